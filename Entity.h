@@ -1,13 +1,55 @@
 #ifndef ENTITY_H
 #define ENTITY_H
 
+#include <QLineF>
+#include <QRectF>
+#include <QString>
+#include "block.h"
+#include "polyline.h"
+
 //Enum for drawing modes
 enum class DrawMode{
     Select,
     Line,
     Rectangle,
     Circle,
+    Polyline,
     Resize
 };
 
+//Enum for the shape kinds a drawing can hold
+enum class ShapeType{
+    Line,
+    Rectangle,
+    Circle,
+    Polyline,
+    Block
+};
+constexpr int ShapeTypeCount = 5;
+
+//Plain geometry of one shape, independent of any scene item
+struct ShapeData{
+    ShapeType type = ShapeType::Line;
+    QLineF line;  //used by ShapeType::Line
+    QRectF rect;  //used by ShapeType::Rectangle and ShapeType::Circle, and as the bounds of a polyline or block instance
+    Polyline polyline; //used by ShapeType::Polyline, vertices relative to rect's top-left
+    Block block;       //used by ShapeType::Block, its members' bounds are mapped onto rect
+    quint16 layer = 0; //index into the drawing's layer list
+};
+
+//Named group of shapes that is shown, locked and stacked as a whole
+struct Layer{
+    QString name;
+    bool visible = true;
+    bool locked = false; //still drawn and snapped to, but shapes can't be picked or selected
+    int z = 0;           //layers with a higher z are drawn on top
+};
+constexpr int MaxLayers = 0x10000;
+
+//Stand-in for shapes too small to draw individually at the current zoom
+struct LodCluster{
+    QRectF box;
+    qsizetype count = 0;
+};
+
 #endif // ENTITY_H
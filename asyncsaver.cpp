@@ -0,0 +1,64 @@
+#include "asyncsaver.h"
+#include "settingsmanager.h"
+
+AsyncSaver::AsyncSaver(QObject *parent)
+    : QObject(parent)
+{
+}
+
+AsyncSaver::~AsyncSaver()
+{
+    //let an in-flight write finish so the file is never left half replaced
+    if(thread){
+        thread->wait();
+        delete thread;
+    }
+}
+
+void AsyncSaver::Save(const QString &filePath, const QVector<ShapeData> &snapshot, const QVector<Layer> &layers)
+{
+    if(thread){
+        hasPending = true;
+        pendingPath = filePath;
+        pendingShapes = snapshot;
+        pendingLayers = layers;
+        return;
+    }
+    StartThread(filePath, snapshot, layers);
+}
+
+bool AsyncSaver::IsSaving() const
+{
+    return thread != nullptr;
+}
+
+void AsyncSaver::StartThread(const QString &filePath, const QVector<ShapeData> &snapshot, const QVector<Layer> &layers)
+{
+    emit saveStarted(filePath);
+
+    thread = QThread::create([this, filePath, snapshot, layers]{
+        const bool ok = SettingsManager::SaveToFile(filePath, snapshot, layers);
+        //report back on the thread that owns the saver
+        QMetaObject::invokeMethod(this, [this, filePath, ok]{ OnThreadFinished(filePath, ok); },
+                                  Qt::QueuedConnection);
+    });
+    thread->start();
+}
+
+void AsyncSaver::OnThreadFinished(const QString &filePath, bool ok)
+{
+    thread->wait();
+    delete thread;
+    thread = nullptr;
+
+    emit saveFinished(filePath, ok);
+
+    if(hasPending){
+        hasPending = false;
+        QVector<ShapeData> shapes;
+        QVector<Layer> layers;
+        shapes.swap(pendingShapes);
+        layers.swap(pendingLayers);
+        StartThread(pendingPath, shapes, layers);
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef ASYNCSAVER_H
+#define ASYNCSAVER_H
+
+#include <QObject>
+#include <QThread>
+#include <QString>
+#include <QVector>
+#include "Entity.h"
+
+//Writes a snapshot of the drawing on a background thread.
+//The caller passes an immutable copy of the geometry, so editing can continue
+//while the file is encoded and written. Writes go through SettingsManager, which
+//uses a temp file plus rename, so a crash mid-save never truncates the old file.
+//A save requested while another is running is queued; only the newest one is kept.
+class AsyncSaver : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit AsyncSaver(QObject *parent = nullptr);
+    ~AsyncSaver();
+
+    void Save(const QString &filePath, const QVector<ShapeData> &snapshot, const QVector<Layer> &layers = {});
+    bool IsSaving() const;
+
+signals:
+    void saveStarted(const QString &filePath);
+    void saveFinished(const QString &filePath, bool ok);
+
+private:
+    QThread *thread = nullptr;
+    bool hasPending = false;
+    QString pendingPath;
+    QVector<ShapeData> pendingShapes;
+    QVector<Layer> pendingLayers;
+
+    void StartThread(const QString &filePath, const QVector<ShapeData> &snapshot, const QVector<Layer> &layers);
+    void OnThreadFinished(const QString &filePath, bool ok);
+};
+
+#endif // ASYNCSAVER_H
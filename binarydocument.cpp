@@ -0,0 +1,436 @@
+#include "binarydocument.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QSaveFile>
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr quint16 HeaderSize = 16;
+constexpr quint32 TableEntrySize = 24;
+constexpr quint32 RecordSize = 4 * sizeof(double);
+//polyline records add a u64 vertex data offset, a u32 vertex count, a u8 encoding and padding
+constexpr quint32 PolylineRecordSize = RecordSize + 16;
+//block instance records add a u32 definition index and padding
+constexpr quint32 BlockRecordSize = RecordSize + 8;
+//nested definitions deeper than this are rejected instead of recursing on
+constexpr int MaxBlockDepth = 32;
+
+//section kinds in the low 16 bits of a section id: the shape sections up to polylines
+//match ShapeType, the later ones were added after the vertex section took id 4.
+//Shape sections carry their layer in the high 16 bits, the others are shared.
+enum Section : quint32 {
+    LineSection, RectangleSection, CircleSection, PolylineSection,
+    VertexSection,     // vertices of every polyline, record size 1 and count in bytes
+    BlockSection,
+    DefinitionSection, // block definitions, record size 1 and count in bytes
+    LayerSection,      // the layer table, record size 1 and count in bytes
+    SectionCount
+};
+//layer table entries: u32 name size, u8 flags, 3 bytes reserved, i32 z, u32 reserved, name
+constexpr qint64 LayerEntrySize = 16;
+constexpr quint8 LayerVisible = 0x01;
+constexpr quint8 LayerLocked = 0x02;
+
+quint32 SectionId(quint32 section, quint16 layer) { return (quint32(layer) << 16) | section; }
+quint32 KindOf(quint32 id) { return id & 0xFFFF; }
+quint16 LayerOf(quint32 id) { return quint16(id >> 16); }
+
+quint32 SectionOf(ShapeType type)
+{
+    return type == ShapeType::Block ? BlockSection : quint32(type);
+}
+
+ShapeType TypeOf(quint32 section)
+{
+    return section == BlockSection ? ShapeType::Block : ShapeType(section);
+}
+
+bool IsShapeSection(quint32 section)
+{
+    return section != VertexSection && section != DefinitionSection && section != LayerSection;
+}
+
+quint32 RecordSizeOf(quint32 section)
+{
+    switch(section){
+        case VertexSection:
+        case DefinitionSection:
+        case LayerSection: return 1;
+        case PolylineSection: return PolylineRecordSize;
+        case BlockSection: return BlockRecordSize;
+    }
+    return RecordSize;
+}
+
+qint64 Align8(qint64 value) { return (value + 7) & ~qint64(7); }
+
+void PutDouble(uchar *dst, double value)
+{
+    quint64 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    qToLittleEndian(bits, dst);
+}
+
+double GetDouble(const uchar *src)
+{
+    const quint64 bits = qFromLittleEndian<quint64>(src);
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+//the vertices a polyline record points at, checked against the vertex section
+bool DecodeVertices(const uchar *record, const uchar *vertexData, quint64 vertexSize, Polyline &polyline)
+{
+    const quint64 offset = qFromLittleEndian<quint64>(record + 32);
+    const quint32 count = qFromLittleEndian<quint32>(record + 40);
+    const Polyline::Encoding encoding = Polyline::Encoding(record[44]);
+
+    const quint64 bytes = quint64(Polyline::EncodedSize(count, encoding));
+    if(!vertexData || offset > vertexSize || bytes > vertexSize - offset) return false;
+    polyline = Polyline::Decode(vertexData + offset, count, encoding);
+    return !polyline.IsNull();
+}
+
+} // namespace
+
+bool BinaryDocument::IsBinaryPath(const QString &filePath)
+{
+    return QFileInfo(filePath).suffix().compare(Extension, Qt::CaseInsensitive) == 0;
+}
+
+/*********************** Encode ***********************/
+QByteArray BinaryDocument::Encode(const QVector<ShapeData> &shapes, const QVector<Layer> &layers)
+{
+    //definitions are numbered in order of first use and written once
+    QHash<const void *, quint32> definitionIndex;
+    QVector<QByteArray> definitions;
+
+    //sections ordered by id, so each layer's shape sections sit next to each other
+    //and loading one layer reads one stretch of the file
+    std::map<quint32, quint64> counts;
+    counts[VertexSection] = 0;
+    counts[DefinitionSection] = 0;
+    counts[LayerSection] = 0;
+    for(const ShapeData &shape : shapes){
+        counts[SectionId(SectionOf(shape.type), shape.layer)]++;
+        if(shape.type == ShapeType::Polyline) counts[VertexSection] += quint64(shape.polyline.EncodedSize());
+        if(shape.type == ShapeType::Block && !definitionIndex.contains(shape.block.Key())){
+            definitionIndex.insert(shape.block.Key(), quint32(definitions.size()));
+            definitions.append(EncodeBlock(shape.block));
+            counts[DefinitionSection] += 8 + quint64(Align8(definitions.last().size()));
+        }
+    }
+    QVector<QByteArray> layerNames;
+    for(const Layer &layer : layers){
+        layerNames.append(layer.name.toUtf8());
+        counts[LayerSection] += quint64(LayerEntrySize + Align8(layerNames.last().size()));
+    }
+
+    const quint32 sectionCount = quint32(counts.size());
+    std::map<quint32, qint64> offsets;
+    qint64 cursor = Align8(HeaderSize + sectionCount * TableEntrySize);
+    for(const auto &[id, count] : counts){
+        offsets[id] = cursor;
+        cursor = Align8(cursor + qint64(count) * RecordSizeOf(KindOf(id)));
+    }
+
+    QByteArray bytes(cursor, '\0');
+    uchar *data = reinterpret_cast<uchar *>(bytes.data());
+
+    //header
+    qToLittleEndian<quint32>(Magic, data);
+    qToLittleEndian<quint16>(Version, data + 4);
+    qToLittleEndian<quint16>(HeaderSize, data + 6);
+    qToLittleEndian<quint32>(sectionCount, data + 8);
+
+    //offset table
+    uchar *entry = data + HeaderSize;
+    for(const auto &[id, count] : counts){
+        qToLittleEndian<quint32>(id, entry);
+        qToLittleEndian<quint32>(RecordSizeOf(KindOf(id)), entry + 4);
+        qToLittleEndian<quint64>(count, entry + 8);
+        qToLittleEndian<quint64>(quint64(offsets[id]), entry + 16);
+        entry += TableEntrySize;
+    }
+
+    //layer table, in layer index order
+    uchar *layerEntry = data + offsets[LayerSection];
+    for(qsizetype i = 0; i < layers.size(); ++i){
+        const Layer &layer = layers.at(i);
+        const QByteArray &name = layerNames.at(i);
+        qToLittleEndian<quint32>(quint32(name.size()), layerEntry);
+        layerEntry[4] = (layer.visible ? LayerVisible : 0) | (layer.locked ? LayerLocked : 0);
+        qToLittleEndian<qint32>(qint32(layer.z), layerEntry + 8);
+        std::memcpy(layerEntry + LayerEntrySize, name.constData(), size_t(name.size()));
+        layerEntry += LayerEntrySize + Align8(name.size());
+    }
+
+    //definitions, each a u64 size and the encoded block padded to 8 bytes
+    uchar *definition = data + offsets[DefinitionSection];
+    for(const QByteArray &encoded : definitions){
+        qToLittleEndian<quint64>(quint64(encoded.size()), definition);
+        std::memcpy(definition + 8, encoded.constData(), size_t(encoded.size()));
+        definition += 8 + Align8(encoded.size());
+    }
+
+    //records, appended to their layer and type's section
+    std::map<quint32, qint64> write = offsets;
+    qint64 &vertexWrite = write[VertexSection];
+    const qint64 vertexOffset = offsets[VertexSection];
+    for(const ShapeData &shape : shapes){
+        const quint32 section = SectionOf(shape.type);
+        qint64 &next = write[SectionId(section, shape.layer)];
+        uchar *record = data + next;
+        next += RecordSizeOf(section);
+
+        if(shape.type == ShapeType::Line){
+            PutDouble(record,      shape.line.x1());
+            PutDouble(record + 8,  shape.line.y1());
+            PutDouble(record + 16, shape.line.x2());
+            PutDouble(record + 24, shape.line.y2());
+        } else {
+            PutDouble(record,      shape.rect.x());
+            PutDouble(record + 8,  shape.rect.y());
+            PutDouble(record + 16, shape.rect.width());
+            PutDouble(record + 24, shape.rect.height());
+        }
+        if(shape.type == ShapeType::Block){
+            qToLittleEndian<quint32>(definitionIndex.value(shape.block.Key()), record + 32);
+            continue;
+        }
+        if(shape.type != ShapeType::Polyline) continue;
+
+        //vertices go to the vertex section in their stored encoding
+        const Polyline &polyline = shape.polyline;
+        qToLittleEndian<quint64>(quint64(vertexWrite - vertexOffset), record + 32);
+        qToLittleEndian<quint32>(quint32(polyline.Size()), record + 40);
+        record[44] = quint8(polyline.GetEncoding());
+        polyline.Encode(data + vertexWrite);
+        vertexWrite += polyline.EncodedSize();
+    }
+
+    return bytes;
+}
+
+QByteArray BinaryDocument::EncodeBlock(const Block &block)
+{
+    const QByteArray name = block.Name().toUtf8();
+    const QByteArray members = Encode(block.Shapes());
+    QByteArray bytes(8 + Align8(name.size()), '\0');
+    uchar *data = reinterpret_cast<uchar *>(bytes.data());
+    qToLittleEndian<quint32>(quint32(name.size()), data);
+    std::memcpy(data + 8, name.constData(), size_t(name.size()));
+    return bytes + members;
+}
+
+/*********************** Decode ***********************/
+bool BinaryDocument::Decode(const uchar *data, qint64 size, QVector<ShapeData> &shapes,
+                            QVector<Layer> *layers, const QSet<int> *onlyLayers)
+{
+    return DecodeDocument(data, size, shapes, layers, onlyLayers, 0);
+}
+
+Block BinaryDocument::DecodeBlock(const uchar *data, qint64 size)
+{
+    return DecodeBlockAt(data, size, 0);
+}
+
+Block BinaryDocument::DecodeBlockAt(const uchar *data, qint64 size, int depth)
+{
+    if(depth > MaxBlockDepth || size < 8) return Block();
+    const quint32 nameSize = qFromLittleEndian<quint32>(data);
+    const qint64 membersOffset = 8 + Align8(nameSize);
+    if(membersOffset > size) return Block();
+
+    QVector<ShapeData> members;
+    if(!DecodeDocument(data + membersOffset, size - membersOffset, members, nullptr, nullptr, depth + 1)) return Block();
+    const QString name = QString::fromUtf8(reinterpret_cast<const char *>(data + 8), nameSize);
+    return Block::Define(name, members);
+}
+
+bool BinaryDocument::DecodeLayers(const uchar *data, quint64 size, QVector<Layer> &layers)
+{
+    layers.clear();
+    for(quint64 offset = 0; offset < size;){
+        if(size - offset < quint64(LayerEntrySize)) return false;
+        const uchar *entry = data + offset;
+        const quint32 nameSize = qFromLittleEndian<quint32>(entry);
+        if(nameSize > size - offset - LayerEntrySize || layers.size() >= MaxLayers) return false;
+
+        Layer layer;
+        layer.name = QString::fromUtf8(reinterpret_cast<const char *>(entry + LayerEntrySize), nameSize);
+        layer.visible = entry[4] & LayerVisible;
+        layer.locked = entry[4] & LayerLocked;
+        layer.z = qFromLittleEndian<qint32>(entry + 8);
+        layers.append(layer);
+        offset += quint64(LayerEntrySize + Align8(nameSize));
+    }
+    return true;
+}
+
+bool BinaryDocument::DecodeDocument(const uchar *data, qint64 size, QVector<ShapeData> &shapes,
+                                    QVector<Layer> *layers, const QSet<int> *onlyLayers, int depth)
+{
+    if(size < HeaderSize) return false;
+    if(qFromLittleEndian<quint32>(data) != Magic) return false;
+    if(qFromLittleEndian<quint16>(data + 4) > Version) return false; // written by a newer version
+
+    const quint16 headerSize = qFromLittleEndian<quint16>(data + 6);
+    const quint32 sections = qFromLittleEndian<quint32>(data + 8);
+    if(headerSize < HeaderSize || qint64(headerSize) + qint64(sections) * TableEntrySize > size){
+        return false;
+    }
+
+    //validate the whole table before touching any records; sections of layers that
+    //were not asked for are checked against the file size but never read
+    auto wanted = [onlyLayers](quint16 layer){ return !onlyLayers || onlyLayers->contains(layer); };
+    quint64 total = 0;
+    bool needDefinitions = false;
+    const uchar *vertexData = nullptr;
+    quint64 vertexSize = 0;
+    const uchar *definitionData = nullptr;
+    quint64 definitionSize = 0;
+    const uchar *layerData = nullptr;
+    quint64 layerSize = 0;
+    std::vector<std::pair<quint64, quint64>> ranges; // byte ranges of the non-empty sections
+    ranges.reserve(sections);
+    for(quint32 i = 0; i < sections; ++i){
+        const uchar *entry = data + headerSize + i * TableEntrySize;
+        const quint32 id = qFromLittleEndian<quint32>(entry);
+        const quint32 type = KindOf(id);
+        const quint32 recordSize = qFromLittleEndian<quint32>(entry + 4);
+        const quint64 count = qFromLittleEndian<quint64>(entry + 8);
+        const quint64 offset = qFromLittleEndian<quint64>(entry + 16);
+
+        if(type >= quint32(SectionCount) || recordSize < RecordSizeOf(type)) return false;
+        if(LayerOf(id) != 0 && !IsShapeSection(type)) return false;
+        if(offset > quint64(size) || count > (quint64(size) - offset) / recordSize) return false;
+        if(count > 0) ranges.push_back({ offset, offset + count * recordSize });
+        if(type == VertexSection){
+            vertexData = data + offset;
+            vertexSize = count;
+        }
+        else if(type == DefinitionSection){
+            definitionData = data + offset;
+            definitionSize = count;
+        }
+        else if(type == LayerSection){
+            layerData = data + offset;
+            layerSize = count;
+        }
+        else if(wanted(LayerOf(id))){
+            total += count;
+            needDefinitions |= type == BlockSection && count > 0;
+        }
+    }
+
+    //sections lie after the table and never share bytes, so a crafted table can't
+    //point many entries at the same records and make the total outgrow the file
+    std::sort(ranges.begin(), ranges.end());
+    quint64 end = quint64(headerSize) + quint64(sections) * TableEntrySize;
+    for(const auto &range : ranges){
+        if(range.first < end) return false;
+        end = range.second;
+    }
+
+    if(layers && !DecodeLayers(layerData, layerSize, *layers)) return false;
+
+    //definitions first, block records refer to them by index
+    QVector<Block> definitions;
+    for(quint64 offset = 0; needDefinitions && offset < definitionSize;){
+        if(definitionSize - offset < 8) return false;
+        const quint64 encodedSize = qFromLittleEndian<quint64>(definitionData + offset);
+        if(encodedSize > definitionSize - offset - 8) return false;
+        const Block block = DecodeBlockAt(definitionData + offset + 8, qint64(encodedSize), depth);
+        if(block.IsNull()) return false;
+        definitions.append(block);
+        offset += 8 + quint64(Align8(qint64(encodedSize)));
+    }
+
+    shapes.clear();
+    shapes.reserve(qsizetype(total));
+
+    for(quint32 i = 0; i < sections; ++i){
+        const uchar *entry = data + headerSize + i * TableEntrySize;
+        const quint32 id = qFromLittleEndian<quint32>(entry);
+        const quint32 section = KindOf(id);
+        if(!IsShapeSection(section) || !wanted(LayerOf(id))) continue;
+        const ShapeType type = TypeOf(section);
+        const quint32 recordSize = qFromLittleEndian<quint32>(entry + 4);
+        const quint64 count = qFromLittleEndian<quint64>(entry + 8);
+        const uchar *record = data + qFromLittleEndian<quint64>(entry + 16);
+
+        for(quint64 r = 0; r < count; ++r, record += recordSize){
+            ShapeData shape;
+            shape.type = type;
+            shape.layer = LayerOf(id);
+            const double a = GetDouble(record);
+            const double b = GetDouble(record + 8);
+            const double c = GetDouble(record + 16);
+            const double d = GetDouble(record + 24);
+            if(type == ShapeType::Line) shape.line = QLineF(a, b, c, d);
+            else shape.rect = QRectF(a, b, c, d);
+            if(type == ShapeType::Polyline && !DecodeVertices(record, vertexData, vertexSize, shape.polyline)) return false;
+            if(type == ShapeType::Block){
+                const quint32 index = qFromLittleEndian<quint32>(record + 32);
+                if(index >= quint32(definitions.size())) return false;
+                shape.block = definitions.at(index);
+            }
+            shapes.append(shape);
+        }
+    }
+    return true;
+}
+
+/*********************** File I/O ***********************/
+bool BinaryDocument::Save(const QString &filePath, const QVector<ShapeData> &shapes, const QVector<Layer> &layers)
+{
+    QSaveFile file(filePath);
+    if(!file.open(QIODevice::WriteOnly)){
+        return false;
+    }
+    const QByteArray bytes = Encode(shapes, layers);
+    if(file.write(bytes) != bytes.size()){
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+bool BinaryDocument::Load(const QString &filePath, QVector<ShapeData> &shapes,
+                          QVector<Layer> *layers, const QSet<int> *onlyLayers)
+{
+    QFile file(filePath);
+    if(!file.open(QIODevice::ReadOnly)){
+        return false;
+    }
+
+    //map the file so records are read in place instead of copied into a buffer first;
+    //sections of layers that aren't loaded are never paged in
+    const qint64 size = file.size();
+    if(uchar *mapped = file.map(0, size)){
+        const bool ok = Decode(mapped, size, shapes, layers, onlyLayers);
+        file.unmap(mapped);
+        return ok;
+    }
+
+    //some file systems can't be mapped, fall back to a plain read
+    const QByteArray bytes = file.readAll();
+    return Decode(reinterpret_cast<const uchar *>(bytes.constData()), bytes.size(), shapes, layers, onlyLayers);
+}
+
+bool BinaryDocument::LoadLayers(const QString &filePath, QVector<Layer> &layers)
+{
+    //the layer table alone, through an empty layer filter
+    const QSet<int> none;
+    QVector<ShapeData> shapes;
+    return Load(filePath, shapes, &layers, &none);
+}
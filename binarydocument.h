@@ -0,0 +1,65 @@
+#ifndef BINARYDOCUMENT_H
+#define BINARYDOCUMENT_H
+
+#include <QString>
+#include <QVector>
+#include <QByteArray>
+#include <QSet>
+#include "Entity.h"
+
+//Versioned binary drawing format (*.cadb).
+//
+//Layout (all values little-endian):
+//  Header        magic "CADB", u16 version, u16 header size, u32 section count, u32 reserved
+//  Offset table  one entry per section: u32 section id, u32 record size, u64 record count, u64 offset
+//  Sections      fixed-size records grouped by shape type, each section 8-byte aligned
+//
+//Every record starts with four doubles (x1,y1,x2,y2 for lines; x,y,width,height
+//otherwise), so a section can be read straight out of a memory-mapped file without
+//parsing. Version 2 adds polylines: their records also hold a u64 offset into a
+//vertex section (section 4, record size 1), a u32 vertex count and a u8
+//encoding; the vertices are stored as Polyline keeps them, relative to the record's
+//x,y, as double pairs or as delta-encoded qint32 pairs. Version 3 adds block
+//instances (section 5), whose records hold a u32 index into a definition section
+//(section 6, record size 1): each definition is written once, as a u64 size and
+//EncodeBlock's bytes, whatever its instance count. Version 4 adds layers: shape
+//sections carry their layer index in the high 16 bits of the section id, one set
+//of sections per layer, and the layer table is section 7 (record size 1) with a
+//u32 name size, u8 flags (1 visible, 2 locked), 3 bytes reserved, i32 z, u32
+//reserved and the UTF-8 name padded to 8 bytes per layer. A layer can be loaded
+//without reading the sections of the others.
+class BinaryDocument
+{
+public:
+    static constexpr quint32 Magic = 0x42444143; // "CADB"
+    static constexpr quint16 Version = 4;
+    static constexpr const char *Extension = "cadb";
+
+    static bool IsBinaryPath(const QString &filePath);
+
+    static bool Save(const QString &filePath, const QVector<ShapeData> &shapes, const QVector<Layer> &layers = {});
+    //with onlyLayers set, shapes of other layers are skipped without being read
+    static bool Load(const QString &filePath, QVector<ShapeData> &shapes, QVector<Layer> *layers = nullptr,
+                     const QSet<int> *onlyLayers = nullptr);
+    //just the layer table, empty for files written before layers existed
+    static bool LoadLayers(const QString &filePath, QVector<Layer> &layers);
+
+    //encode/decode against memory, used by Save/Load and by callers that map files themselves
+    static QByteArray Encode(const QVector<ShapeData> &shapes, const QVector<Layer> &layers = {});
+    static bool Decode(const uchar *data, qint64 size, QVector<ShapeData> &shapes, QVector<Layer> *layers = nullptr,
+                       const QSet<int> *onlyLayers = nullptr);
+
+    //one block definition: u32 name size, u32 reserved, the UTF-8 name padded to
+    //8 bytes, then its members as a whole document; also used by the edit journal
+    static QByteArray EncodeBlock(const Block &block);
+    //null on malformed data
+    static Block DecodeBlock(const uchar *data, qint64 size);
+
+private:
+    static bool DecodeDocument(const uchar *data, qint64 size, QVector<ShapeData> &shapes, QVector<Layer> *layers,
+                               const QSet<int> *onlyLayers, int depth);
+    static bool DecodeLayers(const uchar *data, quint64 size, QVector<Layer> &layers);
+    static Block DecodeBlockAt(const uchar *data, qint64 size, int depth);
+};
+
+#endif // BINARYDOCUMENT_H
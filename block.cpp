@@ -0,0 +1,155 @@
+#include "block.h"
+#include "Entity.h"
+#include <algorithm>
+#include <limits>
+
+struct Block::Definition{
+    QString name;
+    QVector<ShapeData> shapes;
+    QRectF bounds;
+    Picture picture;
+    qsizetype shapeCount = 0;
+};
+
+namespace {
+
+QRectF BoundsOf(const ShapeData &shape)
+{
+    return shape.type == ShapeType::Line ? QRectF(shape.line.p1(), shape.line.p2()).normalized()
+                                         : shape.rect.normalized();
+}
+
+//members drawn through transform into one flat list of primitives
+void Flatten(const QVector<ShapeData> &shapes, const QTransform &transform, Block::Picture &picture)
+{
+    for(const ShapeData &shape : shapes){
+        switch(shape.type){
+            case ShapeType::Line:
+                picture.lines.append(transform.map(shape.line));
+                break;
+            case ShapeType::Rectangle:
+                picture.rectangles.append(transform.mapRect(shape.rect.normalized()));
+                break;
+            case ShapeType::Circle:
+                picture.ellipses.append(transform.mapRect(shape.rect.normalized()));
+                break;
+            case ShapeType::Polyline:
+                picture.polylines.append(transform.map(QPolygonF(shape.polyline.Points(shape.rect.topLeft()))));
+                break;
+            case ShapeType::Block:
+                //placements only scale and translate, so rectangles and ellipses stay axis-aligned
+                if(!shape.block.IsNull()) Flatten(shape.block.Shapes(), shape.block.Placement(shape.rect) * transform, picture);
+                break;
+        }
+    }
+}
+
+} // namespace
+
+/*********************** Definition ***********************/
+Block Block::Define(const QString &name, const QVector<ShapeData> &shapes)
+{
+    auto definition = std::make_shared<Definition>();
+    definition->name = name;
+    definition->shapes = shapes;
+    definition->shapes.squeeze();
+
+    double left = std::numeric_limits<double>::max(), top = left;
+    double right = std::numeric_limits<double>::lowest(), bottom = right;
+    for(const ShapeData &shape : shapes){
+        const QRectF box = BoundsOf(shape);
+        left = qMin(left, box.left());
+        top = qMin(top, box.top());
+        right = qMax(right, box.right());
+        bottom = qMax(bottom, box.bottom());
+        definition->shapeCount += shape.type == ShapeType::Block ? shape.block.ShapeCount() : 1;
+    }
+    if(!shapes.isEmpty()) definition->bounds = QRectF(QPointF(left, top), QPointF(right, bottom));
+
+    Flatten(definition->shapes, QTransform(), definition->picture);
+
+    Block block;
+    block.definition = std::move(definition);
+    return block;
+}
+
+QString Block::Name() const
+{
+    return definition ? definition->name : QString();
+}
+
+const QVector<ShapeData> &Block::Shapes() const
+{
+    static const QVector<ShapeData> empty;
+    return definition ? definition->shapes : empty;
+}
+
+QRectF Block::Bounds() const
+{
+    return definition ? definition->bounds : QRectF();
+}
+
+const Block::Picture &Block::GetPicture() const
+{
+    static const Picture empty;
+    return definition ? definition->picture : empty;
+}
+
+qsizetype Block::ShapeCount() const
+{
+    return definition ? definition->shapeCount : 0;
+}
+
+qint64 Block::MemoryBytes() const
+{
+    if(!definition) return 0;
+    const Picture &picture = definition->picture;
+    qint64 bytes = sizeof(Definition) + definition->shapes.capacity() * qint64(sizeof(ShapeData))
+                 + picture.lines.capacity() * qint64(sizeof(QLineF))
+                 + (picture.rectangles.capacity() + picture.ellipses.capacity()) * qint64(sizeof(QRectF));
+    for(const QPolygonF &polygon : picture.polylines) bytes += polygon.capacity() * qint64(sizeof(QPointF));
+    return bytes;
+}
+
+/*********************** Instances ***********************/
+QTransform Block::Placement(const QRectF &rect) const
+{
+    const QRectF bounds = Bounds();
+    const QRectF target = rect.normalized();
+    const qreal sx = bounds.width() > 0 ? target.width() / bounds.width() : 1.0;
+    const qreal sy = bounds.height() > 0 ? target.height() / bounds.height() : 1.0;
+    //scene = (local - bounds.topLeft) * scale + target.topLeft
+    return QTransform(sx, 0, 0, sy, target.left() - bounds.left() * sx, target.top() - bounds.top() * sy);
+}
+
+QVector<ShapeData> Block::Explode(const QRectF &rect) const
+{
+    const QTransform placement = Placement(rect);
+    const bool translateOnly = placement.m11() == 1.0 && placement.m22() == 1.0;
+
+    QVector<ShapeData> placed;
+    placed.reserve(Shapes().size());
+    for(ShapeData shape : Shapes()){
+        switch(shape.type){
+            case ShapeType::Line:
+                shape.line = placement.map(shape.line);
+                break;
+            case ShapeType::Polyline:
+                //a moved polyline keeps sharing its vertices, a scaled one needs its own
+                if(!translateOnly){
+                    QVector<QPointF> points = shape.polyline.Points(shape.rect.topLeft());
+                    for(QPointF &point : points) point = placement.map(point);
+                    shape.polyline = Polyline::FromPoints(points);
+                    shape.rect = shape.polyline.Bounds();
+                    break;
+                }
+                shape.rect = placement.mapRect(shape.rect);
+                break;
+            default:
+                shape.rect = placement.mapRect(shape.rect.normalized());
+                break;
+        }
+        placed.append(shape);
+    }
+    return placed;
+}
@@ -0,0 +1,66 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <QLineF>
+#include <QPolygonF>
+#include <QRectF>
+#include <QString>
+#include <QTransform>
+#include <QVector>
+#include <memory>
+
+struct ShapeData;
+
+//Reusable block definition, immutable and shared by every instance of it.
+//
+//A definition is a named list of member shapes in its own coordinates. An instance
+//is a ShapeType::Block shape holding this handle and a rect: the members' bounds
+//are mapped onto that rect, so moving or resizing an instance only changes four
+//doubles and a duplicate costs a row in the shape store, not a copy of the members.
+//Members may themselves be block instances.
+//
+//The members are flattened once into a Picture (lines, rectangles, ellipses and
+//polylines in definition coordinates, nested instances already placed) that every
+//instance paints through its placement transform. It is built with the definition
+//and never changes, so tile workers can paint shared instances without locking.
+class Block
+{
+public:
+    struct Picture{
+        QVector<QLineF> lines;
+        QVector<QRectF> rectangles;
+        QVector<QRectF> ellipses;
+        QVector<QPolygonF> polylines;
+    };
+
+    Block() = default;
+
+    static Block Define(const QString &name, const QVector<ShapeData> &shapes);
+
+    bool IsNull() const { return !definition; }
+    QString Name() const;
+    const QVector<ShapeData> &Shapes() const;
+    //bounds of the members in definition coordinates
+    QRectF Bounds() const;
+    const Picture &GetPicture() const;
+    //members and nested members, what the block stands in for
+    qsizetype ShapeCount() const;
+    qint64 MemoryBytes() const;
+    //identity of the definition, instances of one definition share it
+    const void *Key() const { return definition.get(); }
+
+    //maps definition coordinates onto an instance rect; a zero-width or zero-height
+    //definition keeps scale 1 along that axis
+    QTransform Placement(const QRectF &rect) const;
+    //the members placed for an instance rect, in scene coordinates
+    QVector<ShapeData> Explode(const QRectF &rect) const;
+
+    bool operator==(const Block &other) const { return definition == other.definition; }
+    bool operator!=(const Block &other) const { return definition != other.definition; }
+
+private:
+    struct Definition;
+    std::shared_ptr<const Definition> definition;
+};
+
+#endif // BLOCK_H
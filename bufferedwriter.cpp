@@ -0,0 +1,57 @@
+#include "bufferedwriter.h"
+#include <charconv>
+#include <cmath>
+
+BufferedWriter::BufferedWriter(const QString &filePath)
+    : file(filePath)
+    , buffer(new char[BufferSize])
+{
+}
+
+bool BufferedWriter::Open()
+{
+    failed = !file.open(QIODevice::WriteOnly);
+    return !failed;
+}
+
+bool BufferedWriter::Commit()
+{
+    Flush();
+    if(failed){
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+void BufferedWriter::Flush()
+{
+    if(used > 0) WriteThrough(buffer.get(), used);
+    used = 0;
+}
+
+void BufferedWriter::WriteThrough(const char *data, qsizetype length)
+{
+    if(!failed && file.write(data, length) != length) failed = true;
+    flushed += length;
+}
+
+void BufferedWriter::WriteNumber(double value)
+{
+    if(used + MaxNumberLength > BufferSize) Flush();
+    //neither SVG nor DXF can express inf/nan, write them as 0 rather than a broken file
+    if(!std::isfinite(value)) value = 0.0;
+    //normalize -0 so exports of the same drawing are byte-identical
+    if(value == 0.0) value = 0.0;
+    char *begin = buffer.get() + used;
+    const auto result = std::to_chars(begin, begin + MaxNumberLength, value);
+    used += result.ptr - begin;
+}
+
+void BufferedWriter::WriteNumber(qint64 value)
+{
+    if(used + MaxNumberLength > BufferSize) Flush();
+    char *begin = buffer.get() + used;
+    const auto result = std::to_chars(begin, begin + MaxNumberLength, value);
+    used += result.ptr - begin;
+}
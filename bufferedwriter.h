@@ -0,0 +1,65 @@
+#ifndef BUFFEREDWRITER_H
+#define BUFFEREDWRITER_H
+
+#include <QSaveFile>
+#include <QString>
+#include <cstring>
+#include <memory>
+
+//Append-only text writer with a fixed buffer in front of a QSaveFile.
+//
+//Callers append small pieces (tags, numbers) straight into the buffer; it goes to
+//the file in BufferSize chunks, so memory stays flat however much is written.
+//Numbers use std::to_chars (shortest round-trip form, no locale, no allocation).
+//The target only appears, atomically, when Commit() succeeds; an abandoned writer
+//leaves the old file in place.
+class BufferedWriter
+{
+public:
+    static constexpr qsizetype BufferSize = 1 << 20;
+
+    explicit BufferedWriter(const QString &filePath);
+
+    bool Open();
+    //flushes and renames over the target, false if any write failed
+    bool Commit();
+
+    void Write(const char *text, qsizetype length)
+    {
+        if(used + length > BufferSize){
+            Flush();
+            if(length > BufferSize){
+                WriteThrough(text, length);
+                return;
+            }
+        }
+        std::memcpy(buffer.get() + used, text, length);
+        used += length;
+    }
+    template<qsizetype N>
+    void Write(const char (&text)[N]) { Write(text, N - 1); }
+    void Write(const QByteArray &text) { Write(text.constData(), text.size()); }
+    void Write(char c)
+    {
+        if(used == BufferSize) Flush();
+        buffer[used++] = c;
+    }
+    void WriteNumber(double value);
+    void WriteNumber(qint64 value);
+
+    qint64 BytesWritten() const { return flushed + used; }
+
+private:
+    static constexpr qsizetype MaxNumberLength = 32;
+
+    QSaveFile file;
+    std::unique_ptr<char[]> buffer;
+    qsizetype used = 0;
+    qint64 flushed = 0;
+    bool failed = false;
+
+    void Flush();
+    void WriteThrough(const char *data, qsizetype length);
+};
+
+#endif // BUFFEREDWRITER_H
@@ -0,0 +1,618 @@
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QProcess>
+#include <QRandomGenerator>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <vector>
+#include "binarydocument.h"
+#include "commands.h"
+#include "drawinganalyzer.h"
+#include "dxfimporter.h"
+#include "pageddocument.h"
+#include "shapeexporter.h"
+#include "shapescene.h"
+#include "snapengine.h"
+#include "shapeserializer.h"
+#include "shapeitem.h"
+#include "slabpool.h"
+#include "spatialindex.h"
+#include "undohistory.h"
+#include "viewportpager.h"
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+//Headless benchmark for the cad-core library.
+//Builds synthetic drawings of increasing size and reports timings plus peak RSS
+//for serialize, deserialize (JSON and binary), SVG/DXF export, DXF import, drawing checks, itemAt, the spatial index, snapping and undo/redo,
+//then the same for one polyline traced through that many vertices and for that many
+//instances of one block definition, and for a paged file viewed through a pager
+//with a small memory budget. Last, loading, editing and clearing with pooled items
+//and commands against the plain heap, each in a process of its own so both get a
+//clean peak RSS.
+//Usage: cad-bench [--min N] [--max N] [--queries N] [--pool on|off]
+//       cad-bench --alloc N [--pool on|off]   (only the allocation run, at N shapes)
+
+/*********************** Helpers ***********************/
+static double PeakRssMB()
+{
+#if defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))){
+        return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+    }
+    return 0.0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(Q_OS_MACOS)
+    return usage.ru_maxrss / (1024.0 * 1024.0); // bytes on macOS
+#else
+    return usage.ru_maxrss / 1024.0; // kilobytes on Linux
+#endif
+#endif
+}
+
+static std::vector<ShapeData> MakeDrawing(qsizetype count, quint32 seed)
+{
+    QRandomGenerator rng(seed);
+    //keep the density roughly constant so larger drawings cover a larger area
+    const double extent = 1000.0 * std::sqrt(count / 10000.0 + 1.0);
+
+    std::vector<ShapeData> shapes;
+    shapes.reserve(count);
+    for(qsizetype i = 0; i < count; ++i){
+        ShapeData shape;
+        const double x = rng.generateDouble() * extent;
+        const double y = rng.generateDouble() * extent;
+        const double w = 2.0 + rng.generateDouble() * 40.0;
+        const double h = 2.0 + rng.generateDouble() * 40.0;
+
+        switch(i % 3){
+            case 0:
+                shape.type = ShapeType::Line;
+                shape.line = QLineF(x, y, x + w, y + h);
+                break;
+            case 1:
+                shape.type = ShapeType::Rectangle;
+                shape.rect = QRectF(x, y, w, h);
+                break;
+            default:
+                shape.type = ShapeType::Circle;
+                shape.rect = QRectF(x, y, w, w);
+                break;
+        }
+        shapes.push_back(shape);
+    }
+    return shapes;
+}
+
+static void Report(const char *stage, qsizetype count, qint64 nsecs, qsizetype ops)
+{
+    const double ms = nsecs / 1e6;
+    const double perOp = ops > 0 ? double(nsecs) / ops : 0.0;
+    std::printf("%-14s %10lld %12.2f ms %12.1f ns/op %10.1f MB peak\n",
+                stage, static_cast<long long>(count), ms, perOp, PeakRssMB());
+    std::fflush(stdout);
+}
+
+/*********************** Benchmark Run ***********************/
+static void RunSize(qsizetype count, int queries)
+{
+    const std::vector<ShapeData> shapes = MakeDrawing(count, 0xCAD0u + quint32(count));
+    QElapsedTimer timer;
+
+    //populate a scene the same way the editor does
+    ShapeScene scene;
+    timer.start();
+    for(const ShapeData &shape : shapes){
+        scene.addItem(ShapeSerializer::CreateItem(shape, scene.Store()));
+    }
+    scene.itemAt(QPointF(0, 0), QTransform()); // force the deferred index build
+    Report("populate", count, timer.nsecsElapsed(), count);
+
+    //same shapes through the bulk-insert path DeserializeCanvas uses
+    {
+        ShapeScene bulkScene;
+        const QVector<ShapeData> shapeList(shapes.begin(), shapes.end());
+        timer.restart();
+        ShapeSerializer::PopulateScene(&bulkScene, shapeList);
+        bulkScene.itemAt(QPointF(0, 0), QTransform()); // force the deferred index build
+        Report("populate-bulk", count, timer.nsecsElapsed(), count);
+    }
+
+    //serialize: scene -> JSON bytes
+    timer.restart();
+    QByteArray json = QJsonDocument(ShapeSerializer::SerializeScene(&scene)).toJson(QJsonDocument::Compact);
+    Report("serialize", count, timer.nsecsElapsed(), count);
+
+    //deserialize: JSON bytes -> scene
+    ShapeScene loaded;
+    timer.restart();
+    ShapeSerializer::DeserializeScene(&loaded, QJsonDocument::fromJson(json).array());
+    Report("deserialize", count, timer.nsecsElapsed(), count);
+    json.clear();
+    json.squeeze();
+
+    //binary format: encode the same shapes and decode them back without text parsing
+    timer.restart();
+    QVector<ShapeData> sceneShapes = ShapeSerializer::SceneShapes(&loaded);
+    QByteArray binary = BinaryDocument::Encode(sceneShapes);
+    Report("bin-encode", count, timer.nsecsElapsed(), count);
+
+    timer.restart();
+    BinaryDocument::Decode(reinterpret_cast<const uchar *>(binary.constData()), binary.size(), sceneShapes);
+    Report("bin-decode", count, timer.nsecsElapsed(), count);
+    sceneShapes = QVector<ShapeData>();
+    binary = QByteArray();
+
+    //streaming exports straight from the shape store
+    {
+        QTemporaryDir dir;
+        for(const char *suffix : { "svg", "dxf" }){
+            const QString filePath = dir.filePath(QString("export.") + suffix);
+            timer.restart();
+            const bool ok = ShapeExporter::Export(filePath, *loaded.Store());
+            const qint64 nsecs = timer.nsecsElapsed();
+            Report(qPrintable(QString("export-") + suffix), count, nsecs, count);
+            const double megabytes = QFileInfo(filePath).size() / (1024.0 * 1024.0);
+            std::printf("%-14s %10s %12.1f MB %12.1f MB/s%s\n", "", "", megabytes,
+                        nsecs > 0 ? megabytes * 1e9 / nsecs : 0.0, ok ? "" : " (failed)");
+        }
+
+        //the DXF just written comes back through the parallel importer
+        QVector<ShapeData> imported;
+        DxfImporter::Stats stats;
+        timer.restart();
+        DxfImporter::Load(dir.filePath("export.dxf"), imported, &stats);
+        const qint64 nsecs = timer.nsecsElapsed();
+        Report("dxf-import", count, nsecs, stats.entities);
+        std::printf("%-14s %10s %12.0f entities/s %8.1f MB/s, %d chunks\n", "", "",
+                    nsecs > 0 ? stats.entities * 1e9 / nsecs : 0.0,
+                    nsecs > 0 ? stats.bytes / (1024.0 * 1024.0) * 1e9 / nsecs : 0.0, stats.chunks);
+    }
+
+    //whole-drawing checks over a snapshot, as Check Drawing runs them
+    {
+        const QVector<ShapeData> shapes = loaded.Store()->Snapshot();
+        timer.restart();
+        const DrawingAnalyzer::Report report = DrawingAnalyzer::Analyze(shapes);
+        Report("analyze", count, timer.nsecsElapsed(), count);
+        std::printf("%-14s %10s %lld crossing, %lld overlapping, %lld duplicate, %lld zero-size%s\n", "", "",
+                    static_cast<long long>(report.crossingLines.size()),
+                    static_cast<long long>(report.overlappingRectangles.size()),
+                    static_cast<long long>(report.duplicates.size()),
+                    static_cast<long long>(report.zeroSize.size()), report.truncated ? " (capped)" : "");
+    }
+
+    //itemAt: random point queries against the loaded scene
+    QRandomGenerator rng(42);
+    const QRectF bounds = loaded.itemsBoundingRect();
+    qsizetype hits = 0;
+    timer.restart();
+    for(int i = 0; i < queries; ++i){
+        QPointF point(bounds.left() + rng.generateDouble() * bounds.width(),
+                      bounds.top() + rng.generateDouble() * bounds.height());
+        if(loaded.itemAt(point, QTransform())) ++hits;
+    }
+    Report("itemAt", count, timer.nsecsElapsed(), queries);
+
+    //spatial index: build once, then the three query kinds the editor uses
+    SpatialIndex index;
+    SnapEngine snap(&index); // fills its hash from the index callbacks during Build
+    timer.restart();
+    index.Build(&loaded);
+    Report("index-build", count, timer.nsecsElapsed(), count);
+
+    rng.seed(42);
+    qsizetype indexHits = 0;
+    timer.restart();
+    for(int i = 0; i < queries; ++i){
+        QPointF point(bounds.left() + rng.generateDouble() * bounds.width(),
+                      bounds.top() + rng.generateDouble() * bounds.height());
+        if(index.Nearest(point, 4.0)) ++indexHits;
+    }
+    Report("index-nearest", count, timer.nsecsElapsed(), queries);
+
+    qsizetype windowItems = 0;
+    timer.restart();
+    for(int i = 0; i < queries; ++i){
+        QPointF corner(bounds.left() + rng.generateDouble() * bounds.width(),
+                       bounds.top() + rng.generateDouble() * bounds.height());
+        windowItems += index.Crossing(QRectF(corner, QSizeF(100, 100))).size();
+    }
+    Report("index-window", count, timer.nsecsElapsed(), queries);
+
+    timer.restart();
+    for(int i = 0; i < queries; ++i){
+        QPointF point(bounds.left() + rng.generateDouble() * bounds.width(),
+                      bounds.top() + rng.generateDouble() * bounds.height());
+        index.KNearest(point, 10);
+    }
+    Report("index-knn10", count, timer.nsecsElapsed(), queries);
+
+    //the same nearest queries with the overflow list as full as edits leave it
+    {
+        const QList<QGraphicsItem *> edited = loaded.items();
+        const qsizetype updates = std::min<qsizetype>(edited.size() / 8, SpatialIndex::MaxPending);
+        for(qsizetype i = 0; i < updates; ++i) index.Update(edited.at(i));
+    }
+    rng.seed(42);
+    timer.restart();
+    for(int i = 0; i < queries; ++i){
+        QPointF point(bounds.left() + rng.generateDouble() * bounds.width(),
+                      bounds.top() + rng.generateDouble() * bounds.height());
+        index.Nearest(point, 4.0);
+    }
+    Report("index-pending", count, timer.nsecsElapsed(), queries);
+
+    //snapping as the canvas does it on every mouse move, 10 px at 1:1 zoom
+    snap.SetModes(SnapEngine::ObjectSnaps);
+    qsizetype snapHits = 0;
+    timer.restart();
+    for(int i = 0; i < queries; ++i){
+        QPointF point(bounds.left() + rng.generateDouble() * bounds.width(),
+                      bounds.top() + rng.generateDouble() * bounds.height());
+        if(snap.Snap(point, 10.0).kind != SnapEngine::Kind::None) ++snapHits;
+    }
+    Report("snap", count, timer.nsecsElapsed(), queries);
+
+    //undo/redo: one move command per item (capped), then unwind and replay
+    UndoHistory history;
+    history.SetMemoryBudget(std::numeric_limits<qint64>::max()); // measure, don't trim
+    const QList<QGraphicsItem *> items = loaded.items();
+    const qsizetype commands = std::min<qsizetype>(items.size(), 100000);
+    for(qsizetype i = 0; i < commands; ++i){
+        QGraphicsItem *item = items.at(i);
+        const QPointF position = ShapeItem::PositionOf(item);
+        history.Push(new MoveShapeCommand(item, position, position + QPointF(5, 5)));
+    }
+    const qint64 singleBytes = history.MemoryUsed();
+    timer.restart();
+    while(history.CanUndo()) history.Undo();
+    while(history.CanRedo()) history.Redo();
+    Report("undo/redo", count, timer.nsecsElapsed(), commands * 2);
+    history.Clear();
+
+    //the same edit as one macro command over a contiguous item array
+    const QVector<QGraphicsItem *> macroItems(items.begin(), items.begin() + commands);
+    history.Push(new MoveShapesCommand(macroItems, QPointF(5, 5)));
+    const qint64 macroBytes = history.MemoryUsed();
+    timer.restart();
+    history.Undo();
+    history.Redo();
+    Report("undo-macro", count, timer.nsecsElapsed(), commands * 2);
+    history.Clear();
+    std::printf("%-14s %10lld undo history %lld KB as single commands, %lld KB as one macro\n", "",
+                static_cast<long long>(commands), static_cast<long long>(singleBytes / 1024),
+                static_cast<long long>(macroBytes / 1024));
+
+    //batched selection edits as CanvasView runs them: one command each, index kept in sync
+    timer.restart();
+    history.Push(new MoveShapesCommand(macroItems, QPointF(5, 5), &index));
+    Report("batch-move", count, timer.nsecsElapsed(), commands);
+
+    QVector<QGraphicsItem *> copies;
+    copies.reserve(commands);
+    timer.restart();
+    for(QGraphicsItem *item : macroItems){
+        ShapeData shape;
+        if(!ShapeSerializer::FromItem(item, shape)) continue;
+        shape.line.translate(10, 10);
+        shape.rect.translate(10, 10);
+        copies.append(ShapeSerializer::CreateItem(shape, loaded.Store()));
+    }
+    history.Push(new AddShapesCommand(&loaded, copies, &index));
+    Report("batch-dup", count, timer.nsecsElapsed(), commands);
+
+    timer.restart();
+    history.Push(new DeleteShapesCommand(&loaded, copies, &index));
+    Report("batch-delete", count, timer.nsecsElapsed(), commands);
+    history.Clear();
+
+    std::printf("%-14s %10lld itemAt %d/%d hit, index %d/%d hit, snap %d/%d hit, %lld shapes in windows\n\n", "",
+                static_cast<long long>(count), int(hits), queries, int(indexHits), queries,
+                int(snapHits), queries, static_cast<long long>(windowItems));
+}
+
+//one traced polyline of count vertices: build, first paint at two zoom levels, hit-testing
+static void RunPolyline(qsizetype count, int queries)
+{
+    QRandomGenerator rng(0xCAD0u + quint32(count));
+    QVector<QPointF> points;
+    points.reserve(count);
+    QPointF position;
+    for(qsizetype i = 0; i < count; ++i){
+        position += QPointF(rng.generateDouble() * 2.0 - 0.8, rng.generateDouble() * 2.0 - 1.0);
+        points.append(position);
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    const Polyline polyline = Polyline::FromPoints(points);
+    Report("poly-build", count, timer.nsecsElapsed(), count);
+    points = QVector<QPointF>(); // only the polyline's own storage counts from here
+
+    timer.restart();
+    const qsizetype overview = polyline.Simplified(1.0 / 1024).points.size();
+    Report("poly-simplify", count, timer.nsecsElapsed(), count);
+    timer.restart();
+    const qsizetype closeUp = polyline.Simplified(1.0).points.size();
+    Report("poly-band", count, timer.nsecsElapsed(), count);
+
+    const QRectF bounds = polyline.Bounds();
+    timer.restart();
+    qsizetype hits = 0;
+    for(int i = 0; i < queries; ++i){
+        const QPointF local(rng.generateDouble() * bounds.width(), rng.generateDouble() * bounds.height());
+        if(polyline.Distance(local) < 4.0) ++hits;
+    }
+    Report("poly-hit", count, timer.nsecsElapsed(), queries);
+
+    std::printf("%-14s %10lld vertices in %lld KB (%s), %lld kept at 1:1024, %lld at 1:1, hit %d/%d\n\n", "",
+                static_cast<long long>(count), static_cast<long long>(polyline.MemoryBytes() / 1024),
+                polyline.GetEncoding() == Polyline::Encoding::Delta ? "delta" : "absolute",
+                static_cast<long long>(overview), static_cast<long long>(closeUp), int(hits), queries);
+}
+
+//count instances of one 100-shape block: placing, saving, loading and the store's share of it
+static void RunBlocks(qsizetype count)
+{
+    const std::vector<ShapeData> members = MakeDrawing(100, 0xB10Cu);
+    const Block block = Block::Define("bench", QVector<ShapeData>(members.cbegin(), members.cend()));
+    QRandomGenerator rng(0xCAD0u + quint32(count));
+    const double extent = 1000.0 * std::sqrt(count / 100.0 + 1.0);
+
+    QElapsedTimer timer;
+    timer.start();
+    ShapeStore store;
+    store.Reserve(ShapeType::Block, count);
+    for(qsizetype i = 0; i < count; ++i){
+        ShapeData shape;
+        shape.type = ShapeType::Block;
+        shape.block = block;
+        shape.rect = block.Bounds().translated(rng.generateDouble() * extent, rng.generateDouble() * extent);
+        store.SetActive(store.Add(shape), true);
+    }
+    Report("block-place", count, timer.nsecsElapsed(), count);
+
+    timer.restart();
+    const QVector<ShapeData> shapes = store.Snapshot();
+    const QByteArray bytes = BinaryDocument::Encode(shapes);
+    Report("block-save", count, timer.nsecsElapsed(), count);
+
+    timer.restart();
+    QVector<ShapeData> loaded;
+    const bool ok = BinaryDocument::Decode(reinterpret_cast<const uchar *>(bytes.constData()), bytes.size(), loaded);
+    Report("block-load", count, timer.nsecsElapsed(), count);
+
+    std::printf("%-14s %10lld instances of %lld shapes, %.1f bytes each on disk, definition %lld KB in memory, %s\n\n", "",
+                static_cast<long long>(count), static_cast<long long>(block.ShapeCount()),
+                double(bytes.size()) / qMax<qsizetype>(count, 1),
+                static_cast<long long>(block.MemoryBytes() / 1024), ok && loaded.size() == count ? "reloaded" : "reload failed");
+}
+
+//count shapes spread over ten layers: region queries with every layer shown and with
+//all but one hidden, and reading one layer's sections of a file against all of them
+static void RunLayers(qsizetype count, int queries)
+{
+    constexpr int LayerCount = 10;
+    std::vector<ShapeData> shapes = MakeDrawing(count, 0x1A7Eu + quint32(count));
+    QVector<Layer> layers(LayerCount);
+    for(int i = 0; i < LayerCount; ++i) layers[i].name = QString::number(i);
+    for(size_t i = 0; i < shapes.size(); ++i) shapes[i].layer = quint16(i % LayerCount);
+
+    ShapeScene scene;
+    ShapeSerializer::PopulateScene(&scene, QVector<ShapeData>(shapes.begin(), shapes.end()));
+    SpatialIndex index;
+    index.SetLayers(layers);
+    index.Build(&scene);
+
+    const QRectF extent = scene.itemsBoundingRect();
+    QRandomGenerator rng(0x1A7Eu);
+    auto runQueries = [&](const char *stage){
+        qsizetype found = 0;
+        QElapsedTimer timer;
+        timer.start();
+        for(int i = 0; i < queries; ++i){
+            const QPointF corner(extent.left() + rng.generateDouble() * extent.width(),
+                                 extent.top() + rng.generateDouble() * extent.height());
+            found += index.Crossing(QRectF(corner, QSizeF(100, 100)), SpatialIndex::Scope::Visible).size();
+        }
+        Report(stage, count, timer.nsecsElapsed(), queries);
+        return found;
+    };
+    const qsizetype shown = runQueries("layers-all");
+    for(int i = 1; i < LayerCount; ++i) layers[i].visible = false;
+    index.SetLayers(layers);
+    const qsizetype oneShown = runQueries("layers-one");
+
+    const QByteArray bytes = BinaryDocument::Encode(QVector<ShapeData>(shapes.begin(), shapes.end()), layers);
+    QElapsedTimer timer;
+    timer.start();
+    QVector<ShapeData> loaded;
+    BinaryDocument::Decode(reinterpret_cast<const uchar *>(bytes.constData()), bytes.size(), loaded);
+    Report("layers-load", count, timer.nsecsElapsed(), count);
+    const QSet<int> first{ 0 };
+    timer.restart();
+    QVector<ShapeData> partial;
+    BinaryDocument::Decode(reinterpret_cast<const uchar *>(bytes.constData()), bytes.size(), partial, nullptr, &first);
+    Report("layers-load-1", count, timer.nsecsElapsed(), partial.size());
+
+    std::printf("%-14s %10lld shapes on %d layers, %lld found with all shown, %lld with one, %lld of %lld read for one layer\n\n", "",
+                static_cast<long long>(count), LayerCount, static_cast<long long>(shown), static_cast<long long>(oneShown),
+                static_cast<long long>(partial.size()), static_cast<long long>(loaded.size()));
+}
+
+//count shapes written as a paged file, then a viewport panned across it with a
+//budget of a few pages: time per view until its pages are in, and what stays loaded
+static void RunPaged(qsizetype count, int queries)
+{
+    const std::vector<ShapeData> shapes = MakeDrawing(count, 0xCADFu + quint32(count));
+    QTemporaryDir dir;
+    const QString path = dir.filePath("bench.cadp");
+
+    QElapsedTimer timer;
+    timer.start();
+    PagedDocumentWriter writer(path, 500.0);
+    bool ok = writer.Open();
+    for(const ShapeData &shape : shapes) writer.Add(shape);
+    ok = writer.Finish() && ok;
+    Report("paged-write", count, timer.nsecsElapsed(), count);
+
+    ShapeScene scene;
+    SpatialIndex index;
+    ViewportPager pager(&scene, &index);
+    pager.SetMemoryBudget(32ll * 1024 * 1024);
+    timer.restart();
+    ok = pager.Open(path) && ok;
+    Report("paged-open", count, timer.nsecsElapsed(), 1);
+
+    //a diagonal pan, one view width per step
+    const QRectF extent = pager.Document().Extent();
+    const int views = qMax(1, queries / 100);
+    int maxLoaded = 0;
+    timer.restart();
+    for(int i = 0; i < views; ++i){
+        const qreal t = views > 1 ? qreal(i) / (views - 1) : 0.5;
+        const QPointF centre(extent.left() + t * extent.width(), extent.top() + t * extent.height());
+        pager.SetViewport(QRectF(centre - QPointF(400, 300), QSizeF(800, 600)));
+        while(pager.PendingPages() > 0) QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+        maxLoaded = qMax(maxLoaded, pager.LoadedPages());
+    }
+    Report("paged-view", count, timer.nsecsElapsed(), views);
+
+    std::printf("%-14s %10lld shapes on %lld pages, at most %d loaded (%lld shapes in the index at the end), %s\n\n", "",
+                static_cast<long long>(count), static_cast<long long>(pager.Document().Pages().size()), maxLoaded,
+                static_cast<long long>(index.Size()), ok ? "ok" : "write or open failed");
+    pager.Close();
+}
+
+//load count shapes, push an add command per shape, clear both and load again: the
+//allocation pattern of opening, editing and replacing a drawing
+static void RunAllocation(qsizetype count)
+{
+    const std::vector<ShapeData> shapes = MakeDrawing(count, 0xCAE0u + quint32(count));
+    const QVector<ShapeData> shapeList(shapes.begin(), shapes.end());
+    const QString mode = SlabPool::IsEnabled() ? "pool" : "heap";
+    QElapsedTimer timer;
+
+    ShapeScene scene;
+    timer.start();
+    ShapeSerializer::PopulateScene(&scene, shapeList);
+    Report(qPrintable(mode + "-load"), count, timer.nsecsElapsed(), count);
+
+    {
+        UndoHistory history;
+        history.SetMemoryBudget(std::numeric_limits<qint64>::max());
+        ShapeStore *store = scene.Store();
+        timer.restart();
+        for(const ShapeData &shape : shapes){
+            history.Push(new AddShapeCommand(&scene, ShapeSerializer::CreateItem(shape, store)));
+        }
+        Report(qPrintable(mode + "-edits"), count, timer.nsecsElapsed(), count);
+
+        timer.restart();
+        history.Clear();
+        ShapeScene::ClearShapes(&scene);
+        Report(qPrintable(mode + "-clear"), count, timer.nsecsElapsed(), count * 2);
+    }
+
+    timer.restart();
+    ShapeSerializer::PopulateScene(&scene, shapeList);
+    Report(qPrintable(mode + "-reload"), count, timer.nsecsElapsed(), count);
+}
+
+//RunAllocation with and without pools, each in a child process
+static void RunPooling(qsizetype count)
+{
+    double loadMs[2] = {};
+    double peakMB[2] = {};
+    for(int pooled = 1; pooled >= 0; --pooled){
+        QProcess child;
+        child.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+        child.start(QCoreApplication::applicationFilePath(),
+                    { "--alloc", QString::number(count), "--pool", pooled ? "on" : "off" });
+        if(!child.waitForFinished(-1) || child.exitCode() != 0){
+            std::printf("%-14s %10lld allocation run failed\n\n", "", static_cast<long long>(count));
+            return;
+        }
+
+        //stage count ms "ms" ns/op "ns/op" MB "MB" "peak"
+        const QList<QByteArray> lines = child.readAllStandardOutput().split('\n');
+        for(const QByteArray &line : lines){
+            if(line.isEmpty()) continue;
+            std::printf("%s\n", line.constData());
+            const QList<QByteArray> fields = line.simplified().split(' ');
+            if(fields.size() < 7) continue;
+            if(fields.at(0).endsWith("-load")) loadMs[pooled] = fields.at(2).toDouble();
+            peakMB[pooled] = fields.at(6).toDouble();
+        }
+    }
+    std::fflush(stdout);
+
+    std::printf("%-14s %10lld shapes: pools load %.2fx as fast, %.1f MB less peak RSS\n\n", "",
+                static_cast<long long>(count), loadMs[1] > 0 ? loadMs[0] / loadMs[1] : 0.0, peakMB[0] - peakMB[1]);
+}
+
+int main(int argc, char *argv[])
+{
+    //no display is needed, the scene is never shown
+    if(qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")){
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication app(argc, argv);
+
+    qsizetype minCount = 10000;
+    qsizetype maxCount = 10000000;
+    int queries = 10000;
+    qsizetype allocCount = 0;
+
+    const QStringList args = app.arguments();
+    for(int i = 1; i + 1 < args.size(); i += 2){
+        if(args[i] == "--min") minCount = args[i + 1].toLongLong();
+        else if(args[i] == "--max") maxCount = args[i + 1].toLongLong();
+        else if(args[i] == "--queries") queries = args[i + 1].toInt();
+        else if(args[i] == "--alloc") allocCount = args[i + 1].toLongLong();
+        else if(args[i] == "--pool" && !SlabPool::SetEnabled(args[i + 1] != "off")){
+            std::fprintf(stderr, "--pool has to come before anything is allocated\n");
+            return 1;
+        }
+    }
+    if(allocCount > 0){
+        RunAllocation(allocCount);
+        return 0;
+    }
+
+    std::printf("%-14s %10s %15s %17s %18s\n", "stage", "shapes", "time", "per op", "rss");
+    for(qsizetype count = minCount; count <= maxCount; count *= 10){
+        RunSize(count, queries);
+    }
+    for(qsizetype count = minCount; count <= maxCount; count *= 10){
+        RunPolyline(count, queries);
+    }
+    for(qsizetype count = minCount; count <= maxCount; count *= 10){
+        RunBlocks(count);
+    }
+    for(qsizetype count = minCount; count <= maxCount; count *= 10){
+        RunLayers(count, queries);
+    }
+    for(qsizetype count = minCount; count <= maxCount; count *= 10){
+        RunPaged(count, queries);
+    }
+    for(qsizetype count = minCount; count <= maxCount; count *= 10){
+        RunPooling(count);
+    }
+    return 0;
+}
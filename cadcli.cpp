@@ -0,0 +1,394 @@
+#include <QApplication>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QImage>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPainter>
+#include <QSet>
+#include <QStringList>
+#include <QtMath>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "binarydocument.h"
+#include "pageddocument.h"
+#include "dxfimporter.h"
+#include "settingsmanager.h"
+#include "shapeexporter.h"
+#include "shaperenderer.h"
+#include "shapescene.h"
+#include "shapeserializer.h"
+#include "spatialindex.h"
+#include "workstealingpool.h"
+
+//Headless batch tool for drawing files, built on cad-core.
+//Each file is one task on a WorkStealingPool, so large and small files mix without
+//leaving cores idle. Results are printed in input order once every file is done.
+//
+//Usage: cad-cli <command> [options] <files, directories or globs...>
+//  validate                     load, check geometry and build the scene like DeserializeCanvas
+//  convert [--to json|cadb|cadp|svg|dxf] rewrite in the other drawing format (or the given one)
+//  render --png|--svg [--size N] draw a thumbnail, N is the longest side in pixels (default 512)
+//  stats                        shape counts, extent and index depth
+//Common options: --out DIR (outputs next to the input by default), --jobs N
+
+namespace {
+
+struct Options{
+    QString command;
+    QString outDir;
+    QString convertTo;
+    QString renderFormat;
+    int size = 512;
+    int jobs = 0;
+    QStringList inputs;
+};
+
+struct FileResult{
+    bool ok = false;
+    QString message;
+};
+
+constexpr int RenderMargin = 8;
+
+//QGraphicsScene adds itself to QApplication's scene list when it is constructed and
+//removes itself when it is destroyed, without a lock, so workers build their scenes
+//one at a time; loading and checking the files still runs in parallel
+QMutex sceneMutex;
+
+struct SceneCheck{
+    qsizetype shapes = 0;  // in the store once populated
+    qsizetype indexed = 0;
+    int depth = 0;
+};
+
+/*********************** Input ***********************/
+bool IsDrawingFile(const QString &filePath)
+{
+    const QString suffix = QFileInfo(filePath).suffix().toLower();
+    return suffix == "json" || suffix == BinaryDocument::Extension || suffix == PagedDocument::Extension || suffix == "dxf";
+}
+
+//the shell expands globs on Unix but not on Windows, and quoted globs reach us as-is
+QStringList ExpandInputs(const QStringList &inputs)
+{
+    QStringList files;
+    for(const QString &input : inputs){
+        const QFileInfo info(input);
+        if(info.isDir()){
+            QDirIterator it(input, QDir::Files, QDirIterator::Subdirectories);
+            while(it.hasNext()){
+                const QString filePath = it.next();
+                if(IsDrawingFile(filePath)) files.append(filePath);
+            }
+        }
+        else if(input.contains('*') || input.contains('?') || input.contains('[')){
+            QDir dir(info.path());
+            const QStringList names = dir.entryList(QStringList{ info.fileName() }, QDir::Files, QDir::Name);
+            for(const QString &name : names) files.append(dir.filePath(name));
+        }
+        else{
+            files.append(input);
+        }
+    }
+    return files;
+}
+
+bool ParseOptions(const QStringList &args, Options &options)
+{
+    if(args.size() < 2) return false;
+    options.command = args[1];
+
+    for(int i = 2; i < args.size(); ++i){
+        const QString &arg = args[i];
+        const bool hasValue = i + 1 < args.size();
+        if(arg == "--out" && hasValue) options.outDir = args[++i];
+        else if(arg == "--to" && hasValue) options.convertTo = args[++i].toLower();
+        else if(arg == "--size" && hasValue) options.size = args[++i].toInt();
+        else if(arg == "--jobs" && hasValue) options.jobs = args[++i].toInt();
+        else if(arg == "--png") options.renderFormat = "png";
+        else if(arg == "--svg") options.renderFormat = "svg";
+        else if(arg.startsWith("--")) return false;
+        else options.inputs.append(arg);
+    }
+
+    if(options.command == "render" && options.renderFormat.isEmpty()) return false;
+    const QStringList formats{ "json", BinaryDocument::Extension, PagedDocument::Extension, "svg", "dxf" };
+    if(!options.convertTo.isEmpty() && !formats.contains(options.convertTo)) return false;
+    if(options.size <= 2 * RenderMargin) return false;
+    return !options.inputs.isEmpty();
+}
+
+QString OutputPath(const Options &options, const QString &inputPath, const QString &suffix)
+{
+    const QFileInfo info(inputPath);
+    const QString dir = options.outDir.isEmpty() ? info.path() : options.outDir;
+    return QDir(dir).filePath(info.completeBaseName() + "." + suffix);
+}
+
+//loads like MainWindow does, also reporting JSON entries that FromJson rejected;
+//DXF entities the importer doesn't support are counted as skipped instead
+bool LoadDrawing(const QString &filePath, QVector<ShapeData> &shapes, qsizetype &rejected, qsizetype *skipped = nullptr,
+                 QVector<Layer> *layers = nullptr)
+{
+    rejected = 0;
+    if(skipped) *skipped = 0;
+    if(DxfImporter::IsDxfPath(filePath)){
+        DxfImporter::Stats stats;
+        if(!DxfImporter::Load(filePath, shapes, &stats, 1)) return false; // the pool already runs one file per core
+        if(skipped) *skipped = stats.skipped;
+        return true;
+    }
+    if(BinaryDocument::IsBinaryPath(filePath) || PagedDocument::IsPagedPath(filePath)){
+        return SettingsManager::LoadFromFile(filePath, shapes, layers);
+    }
+
+    QJsonArray shapesArray;
+    if(!SettingsManager::LoadFromFile(filePath, shapesArray)) return false;
+    shapes = ShapeSerializer::FromJsonArray(shapesArray);
+    //layer entries aren't shapes but aren't malformed either
+    qsizetype layerEntries = 0;
+    for(const QJsonValue &value : std::as_const(shapesArray)){
+        if(value.toObject()["type"].toString() == "layer") ++layerEntries;
+    }
+    rejected = shapesArray.size() - shapes.size() - layerEntries;
+    if(layers) *layers = ShapeSerializer::LayersFromJson(shapesArray);
+    return true;
+}
+
+QRectF ShapeBounds(const ShapeData &shape)
+{
+    return shape.type == ShapeType::Line
+        ? QRectF(shape.line.p1(), shape.line.p2()).normalized()
+        : shape.rect.normalized();
+}
+
+QRectF DrawingExtent(const QVector<ShapeData> &shapes)
+{
+    QRectF extent;
+    for(const ShapeData &shape : shapes) extent |= ShapeBounds(shape);
+    return extent;
+}
+
+//the same scene building the canvas does on load, minus the view
+SceneCheck BuildScene(const QVector<ShapeData> &shapes)
+{
+    QMutexLocker locker(&sceneMutex);
+    ShapeScene scene;
+    ShapeSerializer::PopulateScene(&scene, shapes);
+    SpatialIndex index;
+    index.Build(&scene);
+    return { scene.Store()->ActiveCount(), index.Size(), index.Depth() };
+}
+
+/*********************** Commands ***********************/
+FileResult Validate(const QString &filePath)
+{
+    QVector<ShapeData> shapes;
+    qsizetype rejected = 0;
+    qsizetype skipped = 0;
+    if(!LoadDrawing(filePath, shapes, rejected, &skipped)) return { false, "cannot be read" };
+
+    qsizetype nonFinite = 0;
+    qsizetype degenerate = 0;
+    for(const ShapeData &shape : shapes){
+        const QRectF box = ShapeBounds(shape);
+        if(!std::isfinite(box.x()) || !std::isfinite(box.y()) || !std::isfinite(box.width()) || !std::isfinite(box.height())){
+            ++nonFinite;
+        }
+        else if(shape.type == ShapeType::Line ? shape.line.p1() == shape.line.p2()
+                : shape.type == ShapeType::Polyline ? shape.polyline.Size() < 2 || (box.width() == 0 && box.height() == 0)
+                : shape.type == ShapeType::Block ? shape.block.ShapeCount() == 0 || (box.width() == 0 && box.height() == 0)
+                : box.isEmpty()){
+            ++degenerate;
+        }
+    }
+
+    const SceneCheck check = BuildScene(shapes);
+    const bool built = check.shapes == shapes.size() && check.indexed == shapes.size();
+
+    const bool ok = rejected == 0 && nonFinite == 0 && built;
+    QString message = QString("%1 shapes").arg(shapes.size());
+    if(rejected) message += QString(", %1 malformed entries").arg(rejected);
+    if(nonFinite) message += QString(", %1 non-finite").arg(nonFinite);
+    if(degenerate) message += QString(", %1 zero-size (warning)").arg(degenerate);
+    if(skipped) message += QString(", %1 unsupported DXF entities (warning)").arg(skipped);
+    if(!built) message += ", scene does not match the file";
+    return { ok, message };
+}
+
+FileResult Convert(const Options &options, const QString &filePath)
+{
+    QVector<ShapeData> shapes;
+    QVector<Layer> layers;
+    qsizetype rejected = 0;
+    if(!LoadDrawing(filePath, shapes, rejected, nullptr, &layers)) return { false, "cannot be read" };
+
+    QString suffix = options.convertTo;
+    //DXF comes in as the compact binary format, the usual reason to convert it
+    if(suffix.isEmpty()) suffix = BinaryDocument::IsBinaryPath(filePath) ? "json" : BinaryDocument::Extension;
+    const QString outPath = OutputPath(options, filePath, suffix);
+    if(QFileInfo(outPath).absoluteFilePath() == QFileInfo(filePath).absoluteFilePath()){
+        return { false, "output would overwrite the input" };
+    }
+    const bool saved = ShapeExporter::IsExportPath(outPath) ? ShapeExporter::Export(outPath, shapes)
+                                                            : SettingsManager::SaveToFile(outPath, shapes, layers);
+    if(!saved) return { false, "cannot write " + outPath };
+
+    QString message = QString("%1 shapes -> %2").arg(shapes.size()).arg(outPath);
+    if(rejected) message += QString(" (%1 malformed entries dropped)").arg(rejected);
+    return { true, message };
+}
+
+//maps the drawing extent into a size x size box, keeping the aspect ratio
+QTransform FitTransform(const QRectF &extent, int size, QSize &imageSize)
+{
+    const qreal span = qMax(extent.width(), extent.height());
+    const qreal scale = span > 0 ? (size - 2 * RenderMargin) / span : 1.0;
+    imageSize = QSize(qMax(1, qCeil(extent.width() * scale) + 2 * RenderMargin),
+                      qMax(1, qCeil(extent.height() * scale) + 2 * RenderMargin));
+
+    QTransform transform;
+    transform.translate(RenderMargin, RenderMargin);
+    transform.scale(scale, scale);
+    transform.translate(-extent.left(), -extent.top());
+    return transform;
+}
+
+FileResult Render(const Options &options, const QString &filePath)
+{
+    QVector<ShapeData> shapes;
+    qsizetype rejected = 0;
+    if(!LoadDrawing(filePath, shapes, rejected)) return { false, "cannot be read" };
+
+    QSize imageSize;
+    const QTransform transform = FitTransform(DrawingExtent(shapes), options.size, imageSize);
+    const QString outPath = OutputPath(options, filePath, options.renderFormat);
+
+    if(options.renderFormat == "svg"){
+        ShapeExporter::Options exportOptions;
+        exportOptions.pixelSize = options.size;
+        if(!ShapeExporter::Export(outPath, shapes, exportOptions)) return { false, "cannot write " + outPath };
+    }
+    else{
+        QImage image(imageSize, QImage::Format_ARGB32_Premultiplied);
+        image.fill(Qt::white);
+        QPainter painter(&image);
+        painter.setRenderHint(QPainter::Antialiasing);
+        painter.setTransform(transform);
+        ShapeRenderer::PaintAll(&painter, shapes);
+        painter.end();
+        if(!image.save(outPath, "PNG")) return { false, "cannot write " + outPath };
+    }
+    return { true, QString("%1x%2 -> %3").arg(imageSize.width()).arg(imageSize.height()).arg(outPath) };
+}
+
+FileResult Stats(const QString &filePath)
+{
+    QElapsedTimer timer;
+    timer.start();
+    QVector<ShapeData> shapes;
+    QVector<Layer> layers;
+    qsizetype rejected = 0;
+    if(!LoadDrawing(filePath, shapes, rejected, nullptr, &layers)) return { false, "cannot be read" };
+    const qint64 loadMs = timer.elapsed();
+
+    qsizetype counts[ShapeTypeCount] = {};
+    QSet<quint16> usedLayers;
+    for(const ShapeData &shape : shapes){
+        ++counts[int(shape.type)];
+        usedLayers.insert(shape.layer);
+    }
+    qsizetype hiddenLayers = 0;
+    for(const Layer &layer : std::as_const(layers)) hiddenLayers += layer.visible ? 0 : 1;
+
+    const SceneCheck check = BuildScene(shapes);
+    const QRectF extent = DrawingExtent(shapes);
+    return { true, QString("%1 bytes, %2 shapes (%3 lines, %4 rectangles, %5 circles, %6 polylines, %7 block instances), extent %8x%9 at (%10, %11), %12 layers (%13 used, %14 hidden), index depth %15, loaded in %16 ms")
+                       .arg(QFileInfo(filePath).size()).arg(shapes.size())
+                       .arg(counts[int(ShapeType::Line)]).arg(counts[int(ShapeType::Rectangle)]).arg(counts[int(ShapeType::Circle)])
+                       .arg(counts[int(ShapeType::Polyline)]).arg(counts[int(ShapeType::Block)])
+                       .arg(extent.width()).arg(extent.height()).arg(extent.left()).arg(extent.top())
+                       .arg(qMax(layers.size(), qsizetype(1))).arg(usedLayers.size()).arg(hiddenLayers)
+                       .arg(check.depth).arg(loadMs) };
+}
+
+FileResult Process(const Options &options, const QString &filePath)
+{
+    if(options.command == "validate") return Validate(filePath);
+    if(options.command == "convert") return Convert(options, filePath);
+    if(options.command == "render") return Render(options, filePath);
+    return Stats(filePath);
+}
+
+void PrintUsage()
+{
+    std::fprintf(stderr,
+                 "usage: cad-cli validate|convert|render|stats [options] <files, dirs or globs...>\n"
+                 "  convert  [--to json|cadb|cadp|svg|dxf]\n"
+                 "  render   --png|--svg [--size N]\n"
+                 "  options  --out DIR  --jobs N\n");
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    //no display is needed, scenes are built but never shown
+    if(qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")){
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication app(argc, argv);
+
+    Options options;
+    const QStringList commands{ "validate", "convert", "render", "stats" };
+    if(!ParseOptions(app.arguments(), options) || !commands.contains(options.command)){
+        PrintUsage();
+        return 2;
+    }
+    if(!options.outDir.isEmpty() && !QDir().mkpath(options.outDir)){
+        std::fprintf(stderr, "cannot create %s\n", qPrintable(options.outDir));
+        return 1;
+    }
+
+    const QStringList files = ExpandInputs(options.inputs);
+    if(files.isEmpty()){
+        std::fprintf(stderr, "no input files\n");
+        return 1;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    std::vector<FileResult> results(files.size());
+    {
+        WorkStealingPool pool(options.jobs);
+        //one file per task, the largest first so they don't end up as the tail
+        std::vector<qsizetype> order(files.size());
+        std::vector<qint64> sizes(files.size());
+        for(qsizetype i = 0; i < files.size(); ++i){
+            order[i] = i;
+            sizes[i] = QFileInfo(files[i]).size();
+        }
+        std::sort(order.begin(), order.end(), [&sizes](qsizetype a, qsizetype b){ return sizes[a] > sizes[b]; });
+        pool.ParallelFor(files.size(), 1, [&](qsizetype i){
+            const qsizetype file = order[i];
+            results[file] = Process(options, files[file]);
+        });
+    }
+    const qint64 elapsed = timer.elapsed();
+
+    int failed = 0;
+    for(qsizetype i = 0; i < files.size(); ++i){
+        const FileResult &result = results[i];
+        if(!result.ok) ++failed;
+        std::printf("%s %s: %s\n", result.ok ? "ok  " : "FAIL", qPrintable(files[i]), qPrintable(result.message));
+    }
+    std::printf("%lld files, %d failed, %lld ms (%.1f files/s)\n",
+                static_cast<long long>(files.size()), failed, static_cast<long long>(elapsed),
+                elapsed > 0 ? files.size() * 1000.0 / elapsed : 0.0);
+    return failed ? 1 : 0;
+}
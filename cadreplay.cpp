@@ -0,0 +1,471 @@
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QKeyEvent>
+#include <QMap>
+#include <QMouseEvent>
+#include <QStringList>
+#include <QTimer>
+#include <QWheelEvent>
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include "binarydocument.h"
+#include "canvasview.h"
+#include "inputrecording.h"
+#include "profiler.h"
+
+//Headless replayer for input recorded by InputRecorder (*.cadr).
+//Every session is fed into a fresh CanvasView under the offscreen platform, starting
+//from the drawing, view and modes it was recorded with. Each event is timed from
+//being sent to the view until the repaint it asked for is done, and grouped into
+//per-type latency histograms; the moves the frame timer applies between events and
+//the paints show up through their profiler scopes. The drawing's checksum at the
+//end is compared with the one the recorder stored. Right-button presses are skipped:
+//the context menu they open is modal and would wait for a click that never comes.
+//
+//With --baseline the results are compared with an earlier --report: a session fails
+//when its checksum differs or the p99 of an event type grew by more than the
+//tolerance (and by more than --min-regression ms, below that it is noise).
+//
+//Usage: cad-replay [--speed F] [--report FILE] [--baseline FILE] [--tolerance F]
+//                  [--min-regression MS] <sessions...>
+//  --speed 1 replays at the recorded pace (default), 2 twice as fast, 0 without waiting
+
+namespace {
+
+struct Options{
+    double speed = 1.0;
+    QString reportPath;
+    QString baselinePath;
+    double tolerance = 0.2;
+    double minRegressionMs = 0.5;
+    QStringList sessions;
+};
+
+//histogram buckets are powers of two of microseconds, the last one open-ended
+constexpr int HistogramBuckets = 24;
+//scopes timed by the profiler that are reported next to the events
+const char *const WorkScopes[] = { "ApplyMove", "StartPreview", "Paint", "Snap" };
+//time left for deferred moves and paints once the last event is in
+constexpr int SettleMs = 100;
+
+struct Latencies{
+    std::vector<qint64> samples; // ns
+    double p50 = 0, p90 = 0, p99 = 0, max = 0; // ms
+    std::vector<qint64> histogram;
+};
+
+struct SessionResult{
+    QString file;
+    bool ok = false;
+    QString message;
+    qint64 events = 0;
+    qint64 skipped = 0;
+    quint64 checksum = 0;
+    bool hasRecordedChecksum = false;
+    quint64 recordedChecksum = 0;
+    qint64 shapes = 0;
+    QMap<QString, Latencies> latency; // per event type
+    QMap<QString, Latencies> work;    // per profiler scope
+};
+
+/*********************** Options ***********************/
+bool ParseOptions(const QStringList &args, Options &options)
+{
+    for(int i = 1; i < args.size(); ++i){
+        const QString &arg = args[i];
+        const bool hasValue = i + 1 < args.size();
+        if(arg == "--speed" && hasValue) options.speed = args[++i].toDouble();
+        else if(arg == "--report" && hasValue) options.reportPath = args[++i];
+        else if(arg == "--baseline" && hasValue) options.baselinePath = args[++i];
+        else if(arg == "--tolerance" && hasValue) options.tolerance = args[++i].toDouble();
+        else if(arg == "--min-regression" && hasValue) options.minRegressionMs = args[++i].toDouble();
+        else if(arg.startsWith("--")) return false;
+        else options.sessions.append(arg);
+    }
+    return options.speed >= 0 && options.tolerance >= 0 && !options.sessions.isEmpty();
+}
+
+void PrintUsage()
+{
+    std::fprintf(stderr,
+                 "usage: cad-replay [options] <sessions.cadr...>\n"
+                 "  --speed F           1 recorded pace (default), 0 as fast as possible\n"
+                 "  --report FILE       write the results as JSON\n"
+                 "  --baseline FILE     fail on checksum changes and p99 regressions against a report\n"
+                 "  --tolerance F       allowed p99 growth, 0.2 is 20%% (default)\n"
+                 "  --min-regression MS p99 growth always allowed (default 0.5)\n");
+}
+
+/*********************** Statistics ***********************/
+void Summarize(Latencies &latencies)
+{
+    std::vector<qint64> &samples = latencies.samples;
+    latencies.histogram.assign(HistogramBuckets, 0);
+    if(samples.empty()) return;
+    std::sort(samples.begin(), samples.end());
+
+    auto percentile = [&samples](double fraction){
+        const size_t rank = std::min(samples.size() - 1, size_t(fraction * (samples.size() - 1) + 0.5));
+        return samples[rank] / 1e6;
+    };
+    latencies.p50 = percentile(0.5);
+    latencies.p90 = percentile(0.9);
+    latencies.p99 = percentile(0.99);
+    latencies.max = samples.back() / 1e6;
+
+    for(qint64 ns : samples){
+        int bucket = 0;
+        for(qint64 us = ns / 1000; us > 1 && bucket < HistogramBuckets - 1; us >>= 1) ++bucket;
+        ++latencies.histogram[bucket];
+    }
+}
+
+QString Hex(quint64 value)
+{
+    return QString::number(value, 16).rightJustified(16, '0');
+}
+
+/*********************** Replay ***********************/
+//resizes the window so the canvas gets the size it had when recorded; the frame
+//and the scroll bars take their share, and scroll bars can come and go on a resize
+void FitViewport(CanvasView &view, const QSize &size)
+{
+    if(size.isEmpty()) return;
+    for(int i = 0; i < 3 && view.viewport()->size() != size; ++i){
+        view.resize(view.size() + size - view.viewport()->size());
+        QCoreApplication::sendPostedEvents();
+    }
+}
+
+//runs the event loop until the clock reaches dueNs, so the frame timer and whatever
+//else the view scheduled run between events as they did in the session
+void WaitUntil(const QElapsedTimer &clock, qint64 dueNs)
+{
+    for(qint64 left = dueNs - clock.nsecsElapsed(); left > 0; left = dueNs - clock.nsecsElapsed()){
+        if(left >= 1000000){
+            QEventLoop loop;
+            QTimer::singleShot(int(left / 1000000), Qt::PreciseTimer, &loop, &QEventLoop::quit);
+            loop.exec();
+        }
+        else{
+            QCoreApplication::processEvents();
+        }
+    }
+}
+
+const char *NameOf(InputRecording::EventType type)
+{
+    using Type = InputRecording::EventType;
+    switch(type){
+        case Type::MousePress: return "MousePress";
+        case Type::MouseRelease: return "MouseRelease";
+        case Type::MouseMove: return "MouseMove";
+        case Type::MouseDoubleClick: return "MouseDoubleClick";
+        case Type::Wheel: return "Wheel";
+        case Type::KeyPress: return "KeyPress";
+        case Type::Resize: return "Resize";
+        case Type::Mode: return "Mode";
+        case Type::SnapModes: return "SnapModes";
+        case Type::Layer: return "Layer";
+        case Type::Undo: return "Undo";
+        case Type::Redo: return "Redo";
+        case Type::End: return "End";
+    }
+    return "Unknown";
+}
+
+void Dispatch(CanvasView &view, const InputRecording::Event &event)
+{
+    using Type = InputRecording::EventType;
+    QWidget *viewport = view.viewport();
+    const QPointF global = viewport->mapToGlobal(event.pos);
+    switch(event.type){
+        case Type::MousePress:
+        case Type::MouseRelease:
+        case Type::MouseMove:
+        case Type::MouseDoubleClick:{
+            const QEvent::Type type = event.type == Type::MousePress ? QEvent::MouseButtonPress
+                                    : event.type == Type::MouseRelease ? QEvent::MouseButtonRelease
+                                    : event.type == Type::MouseMove ? QEvent::MouseMove : QEvent::MouseButtonDblClick;
+            QMouseEvent mouse(type, event.pos, global, event.button, event.buttons, event.modifiers);
+            QCoreApplication::sendEvent(viewport, &mouse);
+            break;
+        }
+        case Type::Wheel:{
+            QWheelEvent wheel(event.pos, global, QPoint(), QPoint(event.a, event.b), event.buttons, event.modifiers,
+                              Qt::NoScrollPhase, false);
+            QCoreApplication::sendEvent(viewport, &wheel);
+            break;
+        }
+        case Type::KeyPress:{
+            QKeyEvent key(QEvent::KeyPress, event.a, event.modifiers);
+            QCoreApplication::sendEvent(&view, &key);
+            break;
+        }
+        case Type::Resize:
+            FitViewport(view, QSize(qRound(event.pos.x()), qRound(event.pos.y())));
+            break;
+        case Type::Mode:
+            if(event.a >= 0 && event.a <= int(DrawMode::Polyline)) view.SetDrawMode(DrawMode(event.a));
+            break;
+        case Type::SnapModes:
+            view.SetSnapModes(event.a);
+            break;
+        case Type::Layer:
+            view.SetCurrentLayer(event.a);
+            break;
+        case Type::Undo:
+            view.Undo();
+            break;
+        case Type::Redo:
+            view.Redo();
+            break;
+        case Type::End:
+            break;
+    }
+}
+
+bool LoadStart(CanvasView &view, const InputRecording::Header &header)
+{
+    switch(header.documentKind){
+        case InputRecording::DocumentKind::None:
+            break;
+        case InputRecording::DocumentKind::Embedded:{
+            QVector<ShapeData> shapes;
+            QVector<Layer> layers;
+            if(!BinaryDocument::Decode(reinterpret_cast<const uchar *>(header.document.constData()), header.document.size(),
+                                       shapes, &layers)){
+                return false;
+            }
+            view.LoadShapes(shapes, layers);
+            break;
+        }
+        case InputRecording::DocumentKind::PagedPath:
+            if(!view.OpenPaged(QString::fromUtf8(header.document))) return false;
+            break;
+    }
+    view.SetDrawMode(header.mode);
+    view.SetSnapModes(header.snapModes);
+    view.SetCurrentLayer(header.layer);
+    view.setTransform(QTransform::fromScale(header.scale, header.scale));
+    view.centerOn(header.centre);
+    return true;
+}
+
+SessionResult Replay(const Options &options, const QString &filePath)
+{
+    SessionResult result;
+    result.file = QFileInfo(filePath).fileName();
+
+    InputRecording::Header header;
+    QVector<InputRecording::Event> events;
+    if(!InputRecording::Load(filePath, header, events)){
+        result.message = "not a readable recording";
+        return result;
+    }
+
+    CanvasView view;
+    view.show();
+    FitViewport(view, header.viewportSize);
+    if(!LoadStart(view, header)){
+        result.message = "the drawing it started from can't be loaded";
+        return result;
+    }
+    QCoreApplication::processEvents(); // first paint, and the pages around the view
+
+    Profiler &profiler = Profiler::Instance();
+    profiler.Reset();
+    profiler.SetEnabled(true);
+
+    QElapsedTimer clock;
+    clock.start();
+    for(const InputRecording::Event &event : std::as_const(events)){
+        if(options.speed > 0) WaitUntil(clock, qint64(event.timeUs * 1000 / options.speed));
+        else QCoreApplication::processEvents();
+
+        if(event.type == InputRecording::EventType::End){
+            result.hasRecordedChecksum = true;
+            result.recordedChecksum = event.checksum;
+            continue;
+        }
+        if(event.type == InputRecording::EventType::MousePress && event.button == Qt::RightButton){
+            ++result.skipped;
+            continue;
+        }
+
+        //widget updates are posted, sending them paints what the event invalidated
+        const qint64 start = clock.nsecsElapsed();
+        Dispatch(view, event);
+        QCoreApplication::sendPostedEvents();
+        result.latency[NameOf(event.type)].samples.push_back(clock.nsecsElapsed() - start);
+        ++result.events;
+    }
+    WaitUntil(clock, clock.nsecsElapsed() + SettleMs * 1000000ll);
+    profiler.SetEnabled(false);
+
+    for(const Profiler::Event &event : profiler.Events()){
+        for(const char *scope : WorkScopes){
+            if(qstrcmp(event.name, scope) == 0) result.work[scope].samples.push_back(event.durationNs);
+        }
+    }
+    for(Latencies &latencies : result.latency) Summarize(latencies);
+    for(Latencies &latencies : result.work) Summarize(latencies);
+
+    const QVector<ShapeData> shapes = view.CanvasShapes();
+    result.shapes = shapes.size();
+    result.checksum = InputRecording::Checksum(shapes, view.Layers());
+    result.ok = !result.hasRecordedChecksum || result.checksum == result.recordedChecksum;
+    if(!result.ok) result.message = "the drawing differs from the recorded one";
+    return result;
+}
+
+/*********************** Report ***********************/
+QJsonObject ToJson(const QMap<QString, Latencies> &groups)
+{
+    QJsonObject object;
+    for(auto it = groups.cbegin(); it != groups.cend(); ++it){
+        const Latencies &latencies = it.value();
+        QJsonArray histogram;
+        for(qint64 count : latencies.histogram) histogram.append(count);
+        object.insert(it.key(), QJsonObject{
+            { "count", qint64(latencies.samples.size()) },
+            { "p50", latencies.p50 },
+            { "p90", latencies.p90 },
+            { "p99", latencies.p99 },
+            { "max", latencies.max },
+            { "histogram", histogram },
+        });
+    }
+    return object;
+}
+
+bool WriteReport(const QString &filePath, const std::vector<SessionResult> &results)
+{
+    QJsonArray sessions;
+    for(const SessionResult &result : results){
+        QJsonObject session{
+            { "file", result.file },
+            { "ok", result.ok },
+            { "events", result.events },
+            { "skipped", result.skipped },
+            { "shapes", result.shapes },
+            { "checksum", Hex(result.checksum) },
+            { "latency", ToJson(result.latency) },
+            { "work", ToJson(result.work) },
+        };
+        if(result.hasRecordedChecksum) session.insert("recordedChecksum", Hex(result.recordedChecksum));
+        if(!result.message.isEmpty()) session.insert("message", result.message);
+        sessions.append(session);
+    }
+    QFile file(filePath);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+    const QByteArray bytes = QJsonDocument(QJsonObject{ { "sessions", sessions } }).toJson();
+    return file.write(bytes) == bytes.size();
+}
+
+void PrintLatencies(const QMap<QString, Latencies> &groups)
+{
+    for(auto it = groups.cbegin(); it != groups.cend(); ++it){
+        const Latencies &latencies = it.value();
+        std::printf("  %-18s n=%-7lld p50 %8.3f  p90 %8.3f  p99 %8.3f  max %8.3f ms\n", qPrintable(it.key()),
+                    static_cast<long long>(latencies.samples.size()), latencies.p50, latencies.p90, latencies.p99,
+                    latencies.max);
+        //one line per occupied bucket, the bar scaled to the fullest one
+        const qint64 fullest = *std::max_element(latencies.histogram.begin(), latencies.histogram.end());
+        for(int bucket = 0; bucket < HistogramBuckets && fullest > 0; ++bucket){
+            const qint64 count = latencies.histogram[bucket];
+            if(count == 0) continue;
+            const QString range = bucket == HistogramBuckets - 1 ? QString(">=%1 us").arg(1ll << bucket)
+                                                                 : QString("<%1 us").arg(2ll << bucket);
+            std::printf("      %-12s %7lld %s\n", qPrintable(range), static_cast<long long>(count),
+                        qPrintable(QString(int(40 * count / fullest) + 1, '#')));
+        }
+    }
+}
+
+//the failures against an earlier report, empty when there are none
+QStringList CompareWithBaseline(const Options &options, const SessionResult &result, const QJsonObject &baseline)
+{
+    QStringList failures;
+    if(baseline.value("checksum").toString() != Hex(result.checksum)){
+        failures.append(QString("checksum %1, baseline %2").arg(Hex(result.checksum), baseline.value("checksum").toString()));
+    }
+    const QJsonObject latency = baseline.value("latency").toObject();
+    for(auto it = result.latency.cbegin(); it != result.latency.cend(); ++it){
+        if(!latency.contains(it.key())) continue;
+        const double before = latency.value(it.key()).toObject().value("p99").toDouble();
+        const double now = it.value().p99;
+        if(now > before * (1 + options.tolerance) && now - before > options.minRegressionMs){
+            failures.append(QString("%1 p99 %2 ms, baseline %3 ms").arg(it.key()).arg(now, 0, 'f', 3).arg(before, 0, 'f', 3));
+        }
+    }
+    return failures;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    //the view is never on screen, but it is shown and painted like on one
+    if(qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")){
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication app(argc, argv);
+
+    Options options;
+    if(!ParseOptions(app.arguments(), options)){
+        PrintUsage();
+        return 2;
+    }
+
+    QHash<QString, QJsonObject> baseline;
+    if(!options.baselinePath.isEmpty()){
+        QFile file(options.baselinePath);
+        if(!file.open(QIODevice::ReadOnly)){
+            std::fprintf(stderr, "cannot read %s\n", qPrintable(options.baselinePath));
+            return 1;
+        }
+        const QJsonArray sessions = QJsonDocument::fromJson(file.readAll()).object().value("sessions").toArray();
+        for(const QJsonValue &session : sessions){
+            baseline.insert(session.toObject().value("file").toString(), session.toObject());
+        }
+    }
+
+    //one at a time, parallel sessions would time each other
+    std::vector<SessionResult> results;
+    int failed = 0;
+    for(const QString &session : std::as_const(options.sessions)){
+        results.push_back(Replay(options, session));
+        SessionResult &result = results.back();
+        QStringList failures;
+        if(!result.message.isEmpty()) failures.append(result.message);
+        const auto it = baseline.constFind(result.file);
+        if(result.ok && it != baseline.constEnd()) failures.append(CompareWithBaseline(options, result, it.value()));
+        if(!failures.isEmpty()) ++failed;
+
+        std::printf("%s %s: %lld events, %lld skipped, %lld shapes, checksum %s\n", failures.isEmpty() ? "ok  " : "FAIL",
+                    qPrintable(session), static_cast<long long>(result.events), static_cast<long long>(result.skipped),
+                    static_cast<long long>(result.shapes), qPrintable(Hex(result.checksum)));
+        for(const QString &failure : std::as_const(failures)) std::printf("  %s\n", qPrintable(failure));
+        PrintLatencies(result.latency);
+        if(!result.work.isEmpty()){
+            std::printf("  work between and within events:\n");
+            PrintLatencies(result.work);
+        }
+    }
+
+    if(!options.reportPath.isEmpty() && !WriteReport(options.reportPath, results)){
+        std::fprintf(stderr, "cannot write %s\n", qPrintable(options.reportPath));
+        return 1;
+    }
+    std::printf("%lld sessions, %d failed\n", static_cast<long long>(results.size()), failed);
+    return failed ? 1 : 0;
+}
@@ -1,182 +1,1032 @@
-#include <QGraphicsLineItem>
-#include <QGraphicsRectItem>
-#include <QGraphicsEllipseItem>
 #include <QMenu>
-#include <QJsonObject>
+#include <algorithm>
 #include <QJsonArray>
 #include <QScrollBar>
+#include <QScreen>
+#include <QPainter>
+#include <QPaintEvent>
+#include <QResizeEvent>
+#include <QStyleOptionGraphicsItem>
 #include "canvasview.h"
+#include "shapeserializer.h"
+#include "shaperenderer.h"
+#include "shapeitem.h"
+#include "shapeexporter.h"
+
+namespace {
+
+//rect covering both, unlike united() it keeps a zero-size one, a line along an axis
+QRectF Cover(const QRectF &a, const QRectF &b)
+{
+    return QRectF(QPointF(qMin(a.left(), b.left()), qMin(a.top(), b.top())),
+                  QPointF(qMax(a.right(), b.right()), qMax(a.bottom(), b.bottom())));
+}
+
+//overlap including the edges, so zero-size rects can touch
+bool Touches(const QRectF &a, const QRectF &b)
+{
+    return a.left() <= b.right() && b.left() <= a.right() && a.top() <= b.bottom() && b.top() <= a.bottom();
+}
+
+} // namespace
 
 CanvasView::CanvasView(QWidget *parent)
     : QGraphicsView(parent)
-    , scene(new QGraphicsScene(this))
+    , scene(new ShapeScene(this))
     , currentMode(DrawMode::Select)
-    , currentItem(nullptr)
-    , selectedItem(nullptr)
-    , undoStack(new QUndoStack(this))
+    , frameTimer(new QTimer(this))
+    , rubberBand(new QRubberBand(QRubberBand::Rectangle, viewport()))
+    , tileCache(new TileCache(&spatialIndex, this))
+    , pager(new ViewportPager(scene, &spatialIndex, this))
 {
-    undoStack->setUndoLimit(20); //limit the commands
+    undoHistory.SetMemoryBudget(UndoHistory::DefaultMemoryBudget); //limit history by bytes, not by command count
     setScene(scene);
     setRenderHint(QPainter::Antialiasing);
-    setSceneRect(0, 0, 1000, 1000);
+    setSceneRect(0, 0, 1000, 1000); // starting area, it grows with the view (GrowSceneRect)
     setDragMode(QGraphicsView::NoDrag); // Default to no drag
+    setMouseTracking(true); // snap markers follow the cursor before a button is pressed
+
+    //moves arriving faster than the display refreshes wait for the next frame
+    frameTimer->setSingleShot(true);
+    frameTimer->setTimerType(Qt::PreciseTimer);
+    connect(frameTimer, &QTimer::timeout, this, [this]{
+        if(!pendingMove) return;
+        FlushMove();
+        frameTimer->start();
+    });
+
+    //edits only invalidate the tiles they touch
+    spatialIndex.SetChangeCallback([this](const QRectF &rect){ tileCache->Invalidate(rect); });
+    connect(tileCache, &TileCache::tilesUpdated, viewport(), QOverload<>::of(&QWidget::update));
 
+    //pages under commands or a drag stay loaded, evicted shapes leave the selection
+    undoHistory.SetPushCallback([this](const QVector<QGraphicsItem *> &items){ pager->Pin(items); });
+    connect(pager, &ViewportPager::itemsEvicting, this, [this](const QVector<QGraphicsItem *> &items){
+        for(QGraphicsItem *item : items) selection.remove(item);
+    });
+    connect(pager, &ViewportPager::pagesLoaded, this, [this]{
+        PickRenderingPath();
+        viewport()->update();
+    });
+    //closing clears the scene, nothing may point into it afterwards
+    connect(pager, &ViewportPager::closing, this, [this]{
+        undoHistory.Clear();
+        selection.clear();
+        DropInteraction();
+        tileCache->Clear();
+        tiledRendering = false;
+    });
 }
 
 /***********************Saving & Loading Canvas**********************/
 QJsonArray CanvasView::SerializeCanvas() const
 {
-    QJsonArray shapesArray;
+    CAD_PROFILE_SCOPE("SerializeCanvas");
+    return ShapeSerializer::SerializeScene(scene);
+}
 
-    for(QGraphicsItem *item : scene->items()){
-        QJsonObject shapeObj;
+void CanvasView::DeserializeCanvas(const QJsonArray &shapesArray) {
+    CAD_PROFILE_SCOPE("DeserializeCanvas");
+    undoHistory.Clear(); // commands refer to the items about to be replaced
+    selection.clear();
+    pager->Close();
+    ShapeSerializer::DeserializeScene(scene, shapesArray);
+    currentLayer = 0;
+    SetLayers(scene->Layers());
+    CoverLayers(CanvasShapes());
+    layersEdited = false;
+    RebuildIndex();
+    FitSceneRect();
+}
 
-        if(auto *line = dynamic_cast<QGraphicsLineItem *>(item)){
-            shapeObj["type"] = "line";
-            shapeObj["x1"] = line->line().p1().x();
-            shapeObj["y1"] = line->line().p1().y();
-            shapeObj["x2"] = line->line().p2().x();
-            shapeObj["y2"] = line->line().p2().y();
-        }
-        else if (auto *rect = dynamic_cast<QGraphicsRectItem *>(item)) {
-            shapeObj["type"] = "rectangle";
-            shapeObj["x"] = rect->rect().x();
-            shapeObj["y"] = rect->rect().y();
-            shapeObj["width"] = rect->rect().width();
-            shapeObj["height"] = rect->rect().height();
-        }
-        else if (auto *ellipse = dynamic_cast<QGraphicsEllipseItem *>(item)) {
-            shapeObj["type"] = "circle";
-            shapeObj["x"] = ellipse->rect().x();
-            shapeObj["y"] = ellipse->rect().y();
-            shapeObj["width"] = ellipse->rect().width();
-            shapeObj["height"] = ellipse->rect().height();
-        }
+void CanvasView::LoadShapes(const QVector<ShapeData> &shapes, const QVector<Layer> &layers)
+{
+    undoHistory.Clear(); // commands refer to the items about to be replaced
+    selection.clear();
+    pager->Close();
+    currentLayer = 0;
+    SetLayers(layers);
+    ShapeSerializer::PopulateScene(scene, shapes);
+    CoverLayers(shapes);
+    layersEdited = false;
+    RebuildIndex();
+    FitSceneRect();
+}
 
-        if (!shapeObj.isEmpty()) {
-            shapesArray.append(shapeObj);
+//Adds shapes without clearing, used by progressive loading
+void CanvasView::AppendShapes(const QVector<ShapeData> &shapes)
+{
+    CoverLayers(shapes);
+    if(bulkInsert){
+        for(const ShapeData &shape : shapes){
+            bulkInsert->Add(ShapeSerializer::CreateItem(shape, scene->Store()));
         }
+        return;
     }
 
-    return shapesArray;
+    SceneBulkInsert bulk(scene);
+    for(const ShapeData &shape : shapes){
+        QGraphicsItem *item = ShapeSerializer::CreateItem(shape, scene->Store());
+        bulk.Add(item);
+        spatialIndex.Insert(item);
+    }
 }
 
-void CanvasView::DeserializeCanvas(const QJsonArray &shapesArray) {
-    scene->clear(); // Clear existing shapes
+//Keeps the scene unindexed across many AppendShapes calls; the index is built once in EndBulkLoad
+void CanvasView::BeginBulkLoad()
+{
+    if(!bulkInsert) bulkInsert = std::make_unique<SceneBulkInsert>(scene);
+}
 
-    for (const QJsonValue &value : shapesArray) {
-        QJsonObject obj = value.toObject();
-        QString type = obj["type"].toString();
+void CanvasView::EndBulkLoad()
+{
+    bulkInsert.reset();
+    RebuildIndex();
+    FitSceneRect();
+}
 
-        if (type == "line") {
-            int x1 = obj["x1"].toInt();
-            int y1 = obj["y1"].toInt();
-            int x2 = obj["x2"].toInt();
-            int y2 = obj["y2"].toInt();
+//Hit-test through the spatial index, with a tolerance that stays constant on screen
+QGraphicsItem *CanvasView::ItemAt(const QPointF &scenePos) const
+{
+    CAD_COUNT("hit-tests", 1);
+    return spatialIndex.Nearest(scenePos, PickTolerancePx / transform().m11());
+}
 
-            QGraphicsLineItem* line = new QGraphicsLineItem(x1, y1, x2, y2);
-            scene->addItem(line);
-        }
-        else if (type == "circle") {
-            int x = obj["x"].toInt();
-            int y = obj["y"].toInt();
-            int width = obj["width"].toInt();
-            int height = obj["height"].toInt();
-
-            QGraphicsEllipseItem* circle = new QGraphicsEllipseItem(x, y, width, height);
-            scene->addItem(circle);
-        }
-        else if (type == "rectangle") {
-            int x = obj["x"].toInt();
-            int y = obj["y"].toInt();
-            int width = obj["width"].toInt();
-            int height = obj["height"].toInt();
-
-            QGraphicsRectItem* rectangle = new QGraphicsRectItem(x, y, width, height);
-            scene->addItem(rectangle);
+//Rebuilds the spatial index from the scene and picks the rendering path for its size
+void CanvasView::RebuildIndex()
+{
+    spatialIndex.SetLayers(scene->Layers());
+    spatialIndex.Build(scene);
+    tileCache->Clear();
+    tiledRendering = spatialIndex.Size() >= TiledRenderingThreshold;
+    viewport()->update();
+}
+
+//Grows the scrollable area so loaded shapes outside the default canvas are reachable,
+//as long as the whole drawing fits the scroll range
+void CanvasView::FitSceneRect()
+{
+    const QRectF rect = sceneRect().united(DrawingExtent());
+    if(qMax(rect.width(), rect.height()) * transform().m11() < MaxScrollPx) setSceneRect(rect);
+    GrowSceneRect();
+}
+
+//Keeps the scrollable area SceneReach viewports beyond the visible one on every
+//side, so panning never runs into an edge. The area takes in the whole drawing
+//while that fits the scroll bars' int range at the current zoom, past that it
+//slides along with the view; scene coordinates are doubles either way.
+void CanvasView::GrowSceneRect()
+{
+    if(growingSceneRect) return;
+    const QRectF visible = mapToScene(viewport()->rect()).boundingRect();
+    if(visible.isEmpty()) return;
+
+    const qreal zoom = transform().m11();
+    auto fits = [zoom](const QRectF &rect){ return qMax(rect.width(), rect.height()) * zoom < MaxScrollPx; };
+    const QRectF margin = visible.adjusted(-visible.width(), -visible.height(), visible.width(), visible.height());
+    if(sceneRect().contains(margin) && fits(sceneRect())) return;
+
+    const qreal reachX = visible.width() * SceneReach;
+    const qreal reachY = visible.height() * SceneReach;
+    const QRectF reach = visible.adjusted(-reachX, -reachY, reachX, reachY);
+    QRectF rect = sceneRect().united(reach);
+    if(!fits(rect)){
+        rect = reach.united(DrawingExtent());
+        if(!fits(rect)) rect = reach;
+    }
+
+    //a new rect moves the scroll bars, which comes back here through scrollContentsBy
+    growingSceneRect = true;
+    setSceneRect(rect);
+    centerOn(visible.center());
+    growingSceneRect = false;
+}
+
+QRectF CanvasView::DrawingExtent() const
+{
+    const QRectF loaded = scene->sceneRect();
+    return pager->IsOpen() ? loaded.united(pager->Document().Extent()) : loaded;
+}
+
+//Follows the view with the scrollable area and, for a paged drawing, the loaded pages
+void CanvasView::UpdateViewport()
+{
+    GrowSceneRect();
+    if(!pager->IsOpen()) return;
+    pager->SetViewport(mapToScene(viewport()->rect()).boundingRect());
+    PickRenderingPath();
+}
+
+//Paging changes the shape count; drags leave the index alone, so the path can switch any time
+void CanvasView::PickRenderingPath()
+{
+    tiledRendering = spatialIndex.Size() >= TiledRenderingThreshold;
+}
+
+void CanvasView::scrollContentsBy(int dx, int dy)
+{
+    QGraphicsView::scrollContentsBy(dx, dy);
+    UpdateViewport();
+}
+
+void CanvasView::resizeEvent(QResizeEvent *event)
+{
+    QGraphicsView::resizeEvent(event);
+    UpdateViewport();
+}
+
+/***********************Paged Drawings**********************/
+bool CanvasView::OpenPaged(const QString &filePath)
+{
+    CAD_PROFILE_SCOPE("OpenPaged");
+    ClearCanvas();
+    if(!pager->Open(filePath)) return false;
+    SetLayers(pager->Document().Layers());
+    layersEdited = false;
+
+    //the view starts on the middle of the drawing, pages load as it settles there
+    FitSceneRect();
+    centerOn(pager->Document().Extent().center());
+    UpdateViewport();
+    return true;
+}
+
+bool CanvasView::SavePaged(const QString &filePath)
+{
+    FinishPolyline();
+    const QPointF centre = mapToScene(viewport()->rect().center());
+    if(!pager->Save(filePath, scene->Layers())) return false;
+    layersEdited = false;
+
+    centerOn(centre);
+    UpdateViewport();
+    return true;
+}
+
+//a paged drawing is mostly on disk, its shapes come from the pager
+QVector<ShapeData> CanvasView::CanvasShapes() const
+{
+    if(pager->IsOpen()) return pager->Shapes();
+    return ShapeSerializer::SceneShapes(scene);
+}
+
+bool CanvasView::ExportDrawing(const QString &filePath) const
+{
+    CAD_PROFILE_SCOPE("ExportDrawing");
+    if(pager->IsOpen()) return ShapeExporter::Export(filePath, pager->Shapes());
+    return ShapeExporter::Export(filePath, *scene->Store());
+}
+
+bool CanvasView::IsEmpty() const
+{
+    return scene->Store()->ActiveCount() == 0 && (!pager->IsOpen() || pager->Document().ShapeCount() == 0);
+}
+
+void CanvasView::SetJournal(EditJournal *journal)
+{
+    this->journal = journal;
+    undoHistory.SetJournal(journal);
+}
+
+/***********************Painting**********************/
+void CanvasView::paintEvent(QPaintEvent *event)
+{
+    {
+        CAD_PROFILE_SCOPE("Paint");
+        PaintCanvas(event);
+    }
+
+    if(pager->IsOpen()){
+        QPainter painter(viewport());
+        PaintPendingPages(&painter, mapToScene(event->rect()).boundingRect());
+    }
+
+    if(snapResult.kind != SnapEngine::Kind::None){
+        QPainter painter(viewport());
+        PaintSnapMarker(&painter);
+    }
+
+    if(performanceOverlay){
+        Profiler::Instance().FrameMark();
+        QPainter painter(viewport());
+        PaintPerformanceOverlay(&painter, mapToScene(viewport()->rect()).boundingRect());
+    }
+}
+
+void CanvasView::PaintCanvas(QPaintEvent *event)
+{
+    if(!tiledRendering){
+        QGraphicsView::paintEvent(event);
+        return;
+    }
+
+    //committed shapes come from the tile cache instead of item-by-item painting
+    QPainter painter(viewport());
+    painter.setRenderHints(renderHints());
+    tileCache->Paint(&painter, viewportTransform(), event->rect());
+
+    //tiles are drawn with the default pen, selected shapes get their highlight on top
+    //unless a drag preview stands in for them
+    const QRectF visible = mapToScene(event->rect()).boundingRect();
+    for(QGraphicsItem *item : std::as_const(selection)){
+        if(previewedItems.contains(item)) continue;
+        if(item->sceneBoundingRect().intersects(visible)) PaintItemDirect(&painter, item);
+    }
+
+    //the shape being drawn and the drag preview go over the tiles
+    painter.setTransform(viewportTransform());
+    PaintPreview(&painter, visible);
+}
+
+//QGraphicsView's own paint path, scene coordinates
+void CanvasView::drawForeground(QPainter *painter, const QRectF &rect)
+{
+    PaintPreview(painter, rect);
+}
+
+//Pages still on their way are shaded, so an empty spot reads as not loaded yet
+void CanvasView::PaintPendingPages(QPainter *painter, const QRectF &visible)
+{
+    const QVector<QRectF> pages = pager->UnloadedIn(visible, MaxPageOutlines);
+    if(pages.isEmpty()) return;
+
+    painter->setTransform(viewportTransform());
+    painter->setRenderHint(QPainter::Antialiasing, false);
+    painter->setPen(QPen(QColor(0, 0, 0, 40), 0)); // cosmetic, one pixel at any zoom
+    painter->setBrush(QColor(0, 0, 0, 12));
+    for(const QRectF &page : pages) painter->drawRect(page);
+}
+
+void CanvasView::PaintItemDirect(QPainter *painter, QGraphicsItem *item)
+{
+    QStyleOptionGraphicsItem option;
+    option.exposedRect = item->boundingRect();
+
+    painter->save();
+    painter->setTransform(item->sceneTransform() * viewportTransform());
+    item->paint(painter, &option, viewport());
+    painter->restore();
+}
+
+//Drawn in view coordinates on top of whichever rendering path painted the frame
+void CanvasView::PaintPerformanceOverlay(QPainter *painter, const QRectF &visible)
+{
+    //counted again only when the view moved or the index changed, not every frame
+    if(visible != overlayArea || spatialIndex.Revision() != overlayRevision){
+        overlayVisible = spatialIndex.Crossing(visible, SpatialIndex::Scope::Visible).size();
+        overlayArea = visible;
+        overlayRevision = spatialIndex.Revision();
+    }
+
+    const Profiler &profiler = Profiler::Instance();
+    QStringList lines{
+        QString("FPS %1").arg(profiler.Fps(), 0, 'f', 1),
+        QString("Input p50 %1 ms  p99 %2 ms").arg(profiler.LatencyPercentile(0.5), 0, 'f', 2)
+                                              .arg(profiler.LatencyPercentile(0.99), 0, 'f', 2),
+        QString("Visible %1 / %2 shapes").arg(overlayVisible).arg(spatialIndex.Size()),
+        QString("Index depth %1%2").arg(spatialIndex.Depth()).arg(tiledRendering ? ", tiled" : ""),
+    };
+    if(pager->IsOpen()){
+        lines << QString("Pages %1 / %2, %3 pending, %4 MB").arg(pager->LoadedPages()).arg(pager->Document().Pages().size())
+                     .arg(pager->PendingPages()).arg(pager->MemoryUsed() / (1024 * 1024));
+    }
+
+    const QFontMetrics metrics(painter->font());
+    int width = 0;
+    for(const QString &line : lines) width = qMax(width, metrics.horizontalAdvance(line));
+    const int lineHeight = metrics.height();
+    const QRect box(8, 8, width + 12, lineHeight * lines.size() + 8);
+
+    painter->resetTransform();
+    painter->setRenderHint(QPainter::Antialiasing, false);
+    painter->fillRect(box, QColor(0, 0, 0, 160));
+    painter->setPen(Qt::white);
+    for(qsizetype i = 0; i < lines.size(); ++i){
+        painter->drawText(box.left() + 6, box.top() + 4 + metrics.ascent() + i * lineHeight, lines.at(i));
+    }
+}
+
+void CanvasView::SetPerformanceOverlay(bool on)
+{
+    performanceOverlay = on;
+    if(on) Profiler::Instance().Reset();
+    Profiler::Instance().SetEnabled(on);
+    viewport()->update();
+}
+
+/***********************Snapping**********************/
+void CanvasView::SetSnapModes(int modes)
+{
+    snapEngine.SetModes(modes);
+    SetSnapResult(SnapEngine::Result());
+}
+
+//Scene position for a cursor position, pulled onto the nearest snap point in reach
+QPointF CanvasView::SnapToScene(const QPoint &viewPos, const QSet<QGraphicsItem *> &exclude)
+{
+    CAD_PROFILE_SCOPE("Snap");
+    const QPointF scenePos = mapToScene(viewPos);
+    const SnapEngine::Result result = snapEngine.Snap(scenePos, SnapTolerancePx / transform().m11(), exclude);
+    SetSnapResult(result);
+    return result.kind == SnapEngine::Kind::None ? scenePos : result.point;
+}
+
+//Moves the marker, repainting only the spots it leaves and enters
+void CanvasView::SetSnapResult(const SnapEngine::Result &result)
+{
+    auto markerRect = [this](const SnapEngine::Result &snap){
+        const QPoint center = mapFromScene(snap.point);
+        const int reach = SnapMarkerSize;
+        return QRect(center - QPoint(reach, reach), QSize(2 * reach, 2 * reach));
+    };
+    if(snapResult.kind == result.kind && snapResult.point == result.point) return;
+    if(snapResult.kind != SnapEngine::Kind::None) viewport()->update(markerRect(snapResult));
+    snapResult = result;
+    if(snapResult.kind != SnapEngine::Kind::None) viewport()->update(markerRect(snapResult));
+}
+
+//Marker shape tells the kind: square endpoint, triangle midpoint, circle centre,
+//cross intersection, small plus for the grid
+void CanvasView::PaintSnapMarker(QPainter *painter)
+{
+    const QPointF center = mapFromScene(snapResult.point);
+    const qreal half = SnapMarkerSize / 2.0;
+    const QRectF box(center - QPointF(half, half), QSizeF(SnapMarkerSize, SnapMarkerSize));
+
+    painter->resetTransform();
+    painter->setRenderHint(QPainter::Antialiasing);
+    painter->setPen(QPen(QColor(255, 140, 0), 1.5));
+    painter->setBrush(Qt::NoBrush);
+    switch(snapResult.kind){
+        case SnapEngine::Kind::Endpoint:
+            painter->drawRect(box);
+            break;
+        case SnapEngine::Kind::Midpoint:{
+            const QPointF triangle[3] = { QPointF(center.x(), box.top()), box.bottomRight(), box.bottomLeft() };
+            painter->drawPolygon(triangle, 3);
+            break;
         }
+        case SnapEngine::Kind::Center:
+            painter->drawEllipse(box);
+            break;
+        case SnapEngine::Kind::Intersection:
+            painter->drawLine(box.topLeft(), box.bottomRight());
+            painter->drawLine(box.topRight(), box.bottomLeft());
+            break;
+        case SnapEngine::Kind::Grid:
+            painter->drawLine(QPointF(center.x() - half / 2, center.y()), QPointF(center.x() + half / 2, center.y()));
+            painter->drawLine(QPointF(center.x(), center.y() - half / 2), QPointF(center.x(), center.y() + half / 2));
+            break;
+        case SnapEngine::Kind::None:
+            break;
     }
+}
 
-    scene->update(); // Force refresh
+void CanvasView::leaveEvent(QEvent *event)
+{
+    SetSnapResult(SnapEngine::Result());
+    QGraphicsView::leaveEvent(event);
 }
 
 /***********************Undo Redo**********************/
+//A drag or a shape being drawn is given up first: the command may take its items out
+//of the scene, and pushing the drag's command afterwards would drop the redo branch
+//that owns them
 void CanvasView::Undo(){
-    if(undoStack) undoStack->undo();
+    CAD_PROFILE_SCOPE("Undo");
+    EndDrag();
+    DropInteraction();
+    undoHistory.Undo();
+    PruneSelection();
 }
 
 void CanvasView::Redo(){
-    if(undoStack) undoStack->redo();
+    CAD_PROFILE_SCOPE("Redo");
+    EndDrag();
+    DropInteraction();
+    undoHistory.Redo();
+    PruneSelection();
 }
 
 /***********************Actions**********************/
 void CanvasView::SetDrawMode(DrawMode mode)
 {
+    FinishPolyline();
     currentMode = mode;
+    SetSnapResult(SnapEngine::Result());
 }
 
 void CanvasView::ClearCanvas()
 {
-    undoStack->clear();
-    scene->clear();
-    selectedItem = nullptr;
-    currentItem = nullptr;
-    originalRect = QRectF();
+    if(journal) journal->RecordClear();
+    undoHistory.Clear();
+    pager->Close();
+    bulkInsert.reset();
+    spatialIndex.Clear();
+    tileCache->Clear();
+    tiledRendering = false;
+    selection.clear(); // the items go with the scene
+    DropInteraction();
+    ShapeScene::ClearShapes(scene);
+    //a new drawing starts with the default layer table
+    currentLayer = 0;
+    SetLayers({});
+    layersEdited = false;
 }
 
-void CanvasView::DuplicateShape(QGraphicsItem *item){
+void CanvasView::DuplicateSelection()
+{
+    const QVector<QGraphicsItem *> items = SelectedItems();
+    QVector<QGraphicsItem *> copies;
+    copies.reserve(items.size());
+
+    for(QGraphicsItem *item : items){
+        ShapeData shape;
+        if(!ShapeSerializer::FromItem(item, shape)) continue;
+        shape.line.translate(10, 10);
+        shape.rect.translate(10, 10);
+        copies.append(ShapeSerializer::CreateItem(shape, scene->Store()));
+    }
+    if(copies.isEmpty()) return;
+
+    if(copies.size() == 1) undoHistory.Push(new AddShapeCommand(scene, copies.first(), &spatialIndex));
+    else undoHistory.Push(new AddShapesCommand(scene, copies, &spatialIndex));
+
+    //the copies become the selection, so they can be dragged into place
+    ClearSelection();
+    for(QGraphicsItem *copy : copies) SetSelected(copy, true);
+}
+
+void CanvasView::DeleteSelection()
+{
+    const QVector<QGraphicsItem *> items = SelectedItems();
+    if(items.isEmpty()) return;
+
+    ClearSelection();
+    if(items.size() == 1) undoHistory.Push(new DeleteShapeCommand(scene, items.first(), &spatialIndex));
+    else undoHistory.Push(new DeleteShapesCommand(scene, items, &spatialIndex));
+}
+
+/***********************Blocks**********************/
+void CanvasView::MakeBlockFromSelection()
+{
+    const QVector<QGraphicsItem *> items = SelectedItems();
+    QVector<ShapeData> members;
+    members.reserve(items.size());
+    for(QGraphicsItem *item : items){
+        ShapeData shape;
+        if(ShapeSerializer::FromItem(item, shape)) members.append(shape);
+    }
+    if(members.isEmpty()) return;
+
+    //the members keep their scene coordinates, so the first instance sits where they were
+    ShapeData instance;
+    instance.type = ShapeType::Block;
+    instance.block = Block::Define(QString("Block %1").arg(++blocksMade), members);
+    instance.rect = instance.block.Bounds();
+    instance.layer = quint16(currentLayer);
+    QGraphicsItem *item = ShapeSerializer::CreateItem(instance, scene->Store());
+
+    ClearSelection();
+    undoHistory.Push(new ReplaceShapesCommand(scene, items, { item }, &spatialIndex));
+    SetSelected(item, true);
+}
+
+void CanvasView::ExplodeSelection()
+{
+    QVector<QGraphicsItem *> instances;
+    QVector<QGraphicsItem *> members;
+    for(QGraphicsItem *item : SelectedItems()){
+        ShapeData shape;
+        if(!ShapeSerializer::FromItem(item, shape) || shape.type != ShapeType::Block) continue;
+        instances.append(item);
+        for(ShapeData member : shape.block.Explode(shape.rect)){
+            member.layer = shape.layer; // the members land on the instance's layer
+            members.append(ShapeSerializer::CreateItem(member, scene->Store()));
+        }
+    }
+    if(instances.isEmpty()) return;
+
+    ClearSelection();
+    undoHistory.Push(new ReplaceShapesCommand(scene, instances, members, &spatialIndex));
+    for(QGraphicsItem *member : members) SetSelected(member, true);
+}
+
+/***********************Layers**********************/
+//The table lives in the scene; the index keeps its own copy so queries can skip
+//hidden and locked layers without touching the items
+void CanvasView::SetLayers(const QVector<Layer> &layers)
+{
+    scene->SetLayers(layers);
+    spatialIndex.SetLayers(scene->Layers());
+    if(currentLayer >= scene->Layers().size()) currentLayer = 0;
+    PruneSelection();
+    layersEdited = true;
+    viewport()->update();
+    emit layersChanged();
+}
+
+int CanvasView::AddLayer(const QString &name)
+{
+    QVector<Layer> layers = scene->Layers();
+    if(layers.size() >= MaxLayers) return -1;
+    //new layers go on top of the others
+    int z = 0;
+    for(const Layer &layer : std::as_const(layers)) z = qMax(z, layer.z + 1);
+    layers.append(Layer{ name, true, false, z });
+    SetLayers(layers);
+    return int(layers.size()) - 1;
+}
+
+void CanvasView::SetLayerVisible(int index, bool on)
+{
+    if(index < 0 || index >= scene->Layers().size()) return;
+    QVector<Layer> layers = scene->Layers();
+    layers[index].visible = on;
+    SetLayers(layers);
+}
+
+void CanvasView::SetLayerLocked(int index, bool on)
+{
+    if(index < 0 || index >= scene->Layers().size()) return;
+    QVector<Layer> layers = scene->Layers();
+    layers[index].locked = on;
+    SetLayers(layers);
+}
+
+void CanvasView::SetLayerZ(int index, int z)
+{
+    if(index < 0 || index >= scene->Layers().size()) return;
+    QVector<Layer> layers = scene->Layers();
+    layers[index].z = z;
+    SetLayers(layers);
+}
+
+//New shapes go on the current layer, so it is shown if it was hidden
+void CanvasView::SetCurrentLayer(int index)
+{
+    if(index < 0 || index >= scene->Layers().size()) return;
+    currentLayer = index;
+    if(!scene->Layers().at(index).visible) SetLayerVisible(index, true);
+    else emit layersChanged();
+}
+
+void CanvasView::MoveSelectionToLayer(int index)
+{
+    const QVector<QGraphicsItem *> items = SelectedItems();
+    if(items.isEmpty() || index < 0 || index >= scene->Layers().size()) return;
+
+    ClearSelection();
+    undoHistory.Push(new ChangeLayerCommand(items, quint16(index), &spatialIndex));
+    PruneSelection();
+}
+
+//Extends the table so every layer index the shapes use has an entry
+void CanvasView::CoverLayers(const QVector<ShapeData> &shapes)
+{
+    int highest = -1;
+    for(const ShapeData &shape : shapes) highest = qMax(highest, int(shape.layer));
+    if(highest < scene->Layers().size()) return;
+
+    QVector<Layer> layers = scene->Layers();
+    while(layers.size() <= highest) layers.append(Layer{ QString::number(layers.size()) });
+    const bool edited = layersEdited;
+    SetLayers(layers);
+    layersEdited = edited; // the drawing already used them
+}
+
+/***********************Selection**********************/
+QVector<QGraphicsItem *> CanvasView::SelectedItems() const
+{
+    return QVector<QGraphicsItem *>(selection.cbegin(), selection.cend());
+}
+
+void CanvasView::SetSelected(QGraphicsItem *item, bool on)
+{
     if(!item) return;
-    QGraphicsItem *newItem = nullptr;
+    if(on) selection.insert(item);
+    else selection.remove(item);
+
+    if(ShapeItem *shapeItem = ShapeItem::Cast(item)) shapeItem->SetHighlighted(on);
+    if(tiledRendering) viewport()->update();
+}
+
+void CanvasView::SelectOnly(QGraphicsItem *item)
+{
+    if(selection.size() == 1 && selection.contains(item)) return;
+    ClearSelection();
+    SetSelected(item, true);
+}
+
+void CanvasView::ClearSelection()
+{
+    for(QGraphicsItem *item : std::as_const(selection)){
+        if(ShapeItem *shapeItem = ShapeItem::Cast(item)) shapeItem->SetHighlighted(false);
+    }
+    selection.clear();
+    if(tiledRendering) viewport()->update();
+}
+
+//Drops selected shapes that an undo or redo took out of the scene, or whose layer
+//was hidden or locked
+void CanvasView::PruneSelection()
+{
+    const QVector<Layer> &layers = scene->Layers();
+    for(auto it = selection.begin(); it != selection.end();){
+        const quint16 layer = ShapeItem::LayerOf(*it);
+        const bool pickable = layer >= layers.size() || (layers.at(layer).visible && !layers.at(layer).locked);
+        if((*it)->scene() == scene && pickable){
+            ++it;
+            continue;
+        }
+        if(ShapeItem *shapeItem = ShapeItem::Cast(*it)) shapeItem->SetHighlighted(false);
+        it = selection.erase(it);
+    }
+}
+
+//Selects the shapes inside the band (dragged right) or touching it (dragged left)
+void CanvasView::FinishRubberBand(const QPoint &viewPos, bool additive)
+{
+    rubberBand->hide();
+    const QRectF area = mapToScene(QRect(rubberBandOrigin, viewPos).normalized()).boundingRect();
+    const QList<QGraphicsItem *> items = viewPos.x() >= rubberBandOrigin.x() ? spatialIndex.Window(area)
+                                                                            : spatialIndex.Crossing(area);
+    if(!additive) ClearSelection();
+    selection.reserve(selection.size() + items.size());
+    for(QGraphicsItem *item : items) SetSelected(item, true);
+}
+
+/***********************Drawing Check**********************/
+//Runs the whole-drawing checks and selects the shapes involved so they stand out
+DrawingAnalyzer::Report CanvasView::CheckDrawing()
+{
+    CAD_PROFILE_SCOPE("CheckDrawing");
+    const QVector<ShapeData> shapes = CanvasShapes();
+    const DrawingAnalyzer::Report report = DrawingAnalyzer::Analyze(shapes);
+
+    QVector<qint32> problems = report.duplicates + report.zeroSize;
+    for(const auto &pair : report.crossingLines) problems << pair.first << pair.second;
+    for(const auto &pair : report.overlappingRectangles) problems << pair.first << pair.second;
+    std::sort(problems.begin(), problems.end());
+    problems.erase(std::unique(problems.begin(), problems.end()), problems.end());
+    if(problems.size() > MaxCheckHighlights) problems.resize(MaxCheckHighlights);
+
+    //the snapshot holds no items, so each one is found again through a point on the
+    //shape and matched on geometry
+    auto sameShape = [](const ShapeData &a, const ShapeData &b){
+        if(a.type != b.type) return false;
+        return a.type == ShapeType::Line ? a.line == b.line : a.rect == b.rect && a.polyline == b.polyline && a.block == b.block;
+    };
+    ClearSelection();
+    for(const qint32 index : problems){
+        const ShapeData &shape = shapes[index];
+        QPointF probe = shape.type == ShapeType::Line ? shape.line.p1() : shape.rect.topLeft();
+        if(shape.type == ShapeType::Polyline && shape.polyline.Size() > 0) probe = shape.polyline.Point(0, probe);
+        for(QGraphicsItem *item : spatialIndex.Crossing(QRectF(probe, QSizeF(0, 0)))){
+            ShapeData candidate;
+            if(ShapeSerializer::FromItem(item, candidate) && sameShape(candidate, shape)) SetSelected(item, true);
+        }
+    }
+    viewport()->update();
+    return report;
+}
+
+/***********************Dragging**********************/
+//The shapes stay where they are, in the scene, the index and the tiles, until the
+//drag ends; meanwhile a preview of them is painted over the canvas
+void CanvasView::BeginDrag(const QVector<QGraphicsItem *> &items)
+{
+    pager->Pin(items);
+    activeItems = items;
+    dragDelta = QPointF();
+}
+
+//Restores what the preview took over; a drag that changed something has pushed its command by now
+void CanvasView::EndDrag()
+{
+    if(!tiledRendering){
+        for(QGraphicsItem *item : std::as_const(previewedItems)){
+            if(ShapeItem *shapeItem = ShapeItem::Cast(item)) shapeItem->SetHighlighted(selection.contains(item));
+        }
+    }
+    activeItems.clear();
+    originalRects.clear();
+    resizeRects.clear();
+    previewShapes.clear();
+    previewedItems.clear();
+    dragDelta = QPointF();
+    UpdatePreview();
+}
+
+//Forgets the drag and the shape being drawn without applying them, for when the items are going away
+void CanvasView::DropInteraction()
+{
+    frameTimer->stop();
+    pendingMove.reset();
+    tracePoints.clear();
+    activeItems.clear();
+    originalRects.clear();
+    resizeRects.clear();
+    previewShapes.clear();
+    previewedItems.clear();
+    dragDelta = QPointF();
+    polylinePoints.clear();
+    drawing = false;
+    previewViewRect = QRect();
+    viewport()->update();
+}
+
+/***********************Preview**********************/
+//A dragged shape at the drag's geometry: moved by dragDelta, or resized to its resize rect
+ShapeData CanvasView::PreviewShape(qsizetype index) const
+{
+    ShapeData shape = previewShapes.at(index);
+    if(!resizeRects.isEmpty()){
+        if(shape.type != ShapeType::Line && shape.type != ShapeType::Polyline) shape.rect = resizeRects.at(index);
+        return shape;
+    }
+    shape.line.translate(dragDelta);
+    shape.rect.translate(dragDelta);
+    return shape;
+}
+
+//Scene area the preview covers, lines along an axis included
+QRectF CanvasView::PreviewArea() const
+{
+    QRectF area;
+    bool any = false;
+    auto cover = [&area, &any](const QRectF &rect){
+        area = any ? Cover(area, rect) : rect;
+        any = true;
+    };
+    if(drawing) cover(PagedDocument::BoundsOf(drawnShape));
+    if(!previewShapes.isEmpty() && resizeRects.isEmpty()) cover(previewOrigin.translated(dragDelta));
+    for(qsizetype i = 0; i < resizeRects.size(); ++i) cover(PagedDocument::BoundsOf(PreviewShape(i)));
+    return area;
+}
 
-    if(auto *line = dynamic_cast<QGraphicsLineItem *>(item)){
-        QLineF originalLine = line->line();
-        QLineF newLine(originalLine.p1()+QPointF(10, 10), originalLine.p2()+QPointF(10, 10));
-        newItem = scene->addLine(newLine, QPen(Qt::black, 2));
+//Repaints the viewport where the preview was and where it is now, nothing else
+void CanvasView::UpdatePreview()
+{
+    //the first movement of a drag hands the shapes over to their preview
+    if(previewShapes.isEmpty() && !activeItems.isEmpty() && (!dragDelta.isNull() || !resizeRects.isEmpty())){
+        CAD_PROFILE_SCOPE("StartPreview");
+        previewShapes.reserve(activeItems.size());
+        previewedItems.reserve(activeItems.size());
+        for(QGraphicsItem *item : std::as_const(activeItems)){
+            ShapeData shape;
+            if(!ShapeSerializer::FromItem(item, shape)) continue;
+            previewOrigin = previewShapes.isEmpty() ? PagedDocument::BoundsOf(shape) : Cover(previewOrigin, PagedDocument::BoundsOf(shape));
+            previewShapes.append(shape);
+            previewedItems.insert(item);
+            //the originals stay as they were drawn before they were picked
+            if(!tiledRendering){
+                if(ShapeItem *shapeItem = ShapeItem::Cast(item)) shapeItem->SetHighlighted(false);
+            }
+        }
+    }
+
+    const QRectF area = PreviewArea();
+    const QRect viewRect = area.isNull() && !drawing ? QRect()
+                         : mapFromScene(area).boundingRect().adjusted(-PreviewPaddingPx, -PreviewPaddingPx,
+                                                                      PreviewPaddingPx, PreviewPaddingPx);
+    if(!previewViewRect.isEmpty()) viewport()->update(previewViewRect);
+    if(!viewRect.isEmpty()) viewport()->update(viewRect);
+    previewViewRect = viewRect;
+}
+
+//The shape being drawn in the default pen, dragged shapes in the selection pen.
+//painter is in scene coordinates
+void CanvasView::PaintPreview(QPainter *painter, const QRectF &exposed)
+{
+    //a shape is culled by its geometry, its stroke reaches a little past it
+    const qreal pad = PreviewPaddingPx / qMax(transform().m11(), 1e-9);
+    const QRectF paintArea = exposed.adjusted(-pad, -pad, pad, pad);
+    painter->save();
+    painter->setBrush(Qt::NoBrush);
+    if(drawing){
+        painter->setPen(ShapeSerializer::DefaultPen());
+        ShapeRenderer::Paint(painter, drawnShape);
     }
-    else if(auto *rect = dynamic_cast<QGraphicsRectItem *>(item)){
-        QRectF newRect = rect->rect().translated(10,10);
-        newItem = scene->addRect(newRect, QPen(Qt::black, 2));
+
+    if(previewShapes.size() > MaxPreviewShapes){
+        //a huge selection follows the cursor as its outline, so the drag keeps the frame rate
+        QPen outline = ShapeRenderer::SelectionPen();
+        outline.setStyle(Qt::DashLine);
+        outline.setCosmetic(true);
+        painter->setPen(outline);
+        painter->drawRect(PreviewArea());
     }
-    else if(auto ellipse = dynamic_cast<QGraphicsEllipseItem *>(item)){
-        QRectF newellipse = ellipse->rect().translated(10,10);
-        newItem = scene->addEllipse(newellipse, QPen(Qt::black, 2));
+    else if(!previewShapes.isEmpty()){
+        painter->setPen(ShapeRenderer::SelectionPen());
+        for(qsizetype i = 0; i < previewShapes.size(); ++i){
+            const ShapeData shape = PreviewShape(i);
+            if(Touches(PagedDocument::BoundsOf(shape), paintArea)) ShapeRenderer::Paint(painter, shape);
+        }
     }
+    painter->restore();
+}
 
-    if(newItem){
-        undoStack->push(new AddShapeCommand(scene, newItem));
+/***********************Polyline**********************/
+//Rebuilds the drawn polyline from polylinePoints, it stays one shape however long it gets
+void CanvasView::UpdatePolyline()
+{
+    ShapeData shape;
+    if(!drawing || !ShapeSerializer::MakePolyline(polylinePoints, shape)) return;
+    shape.layer = drawnShape.layer;
+    drawnShape = shape;
+    UpdatePreview();
+}
+
+//Drops the vertex following the cursor and adds the polyline if two vertices are left
+void CanvasView::FinishPolyline()
+{
+    if(!drawing || currentMode != DrawMode::Polyline) return;
+    polylinePoints.removeLast();
+    //a double-click's second press lands on the vertex the first one placed
+    while(polylinePoints.size() > 1 && polylinePoints.last() == polylinePoints.at(polylinePoints.size() - 2)){
+        polylinePoints.removeLast();
     }
+    if(polylinePoints.size() < 2){
+        CancelPolyline();
+        return;
+    }
+    UpdatePolyline();
+    undoHistory.Push(new AddShapeCommand(scene, ShapeSerializer::CreateItem(drawnShape, scene->Store()), &spatialIndex));
+    drawing = false;
+    polylinePoints.clear();
+    tracePoints.clear();
+    UpdatePreview();
+}
+
+void CanvasView::CancelPolyline()
+{
+    if(!drawing || currentMode != DrawMode::Polyline) return;
+    drawing = false;
+    polylinePoints.clear();
+    tracePoints.clear();
+    UpdatePreview();
 }
 
-void CanvasView::DeleteShape(QGraphicsItem *item)
+/***********************Keyboard**********************/
+void CanvasView::keyPressEvent(QKeyEvent *event)
 {
-    if(item) undoStack->push(new DeleteShapeCommand(scene, item));
+    if(event->key() == Qt::Key_Delete || event->key() == Qt::Key_Backspace){
+        DeleteSelection();
+    }
+    else if(event->key() == Qt::Key_Escape && drawing && currentMode == DrawMode::Polyline){
+        CancelPolyline();
+    }
+    else if(event->key() == Qt::Key_Escape){
+        ClearSelection();
+    }
+    else if((event->key() == Qt::Key_Return || event->key() == Qt::Key_Enter) && drawing){
+        FinishPolyline();
+    }
+    else{
+        QGraphicsView::keyPressEvent(event);
+    }
 }
 
 /***********************Mouse Events**********************/
 void CanvasView::mousePressEvent(QMouseEvent *event)
 {
+    CAD_PROFILE_INPUT("MousePress");
+    FlushMove(); // the press happens where the last move left things
     //Pan
     if (event->button() == Qt::MiddleButton) {
         lastPanPoint = event->pos();
         setCursor(Qt::ClosedHandCursor);
     }
-
     //Right Click
     if(event->button() == Qt::RightButton && currentMode == DrawMode::Select){
         startPoint = mapToScene(event->position().toPoint());
-        selectedItem = scene->itemAt(startPoint, QTransform());
-        if(selectedItem){
+        QGraphicsItem *item = ItemAt(startPoint);
+        if(item){
+            //the menu acts on the whole selection when clicked inside it
+            if(!selection.contains(item)) SelectOnly(item);
+
             QMenu ContextMenu;
-            QAction *duplicateAction = ContextMenu.addAction("Duplicate");
-            QAction *deleteAction = ContextMenu.addAction("Delete");
+            QAction *duplicateAction = ContextMenu.addAction(selection.size() > 1 ? "Duplicate Selection" : "Duplicate");
+            QAction *deleteAction = ContextMenu.addAction(selection.size() > 1 ? "Delete Selection" : "Delete");
+            ContextMenu.addSeparator();
+            QAction *makeBlockAction = ContextMenu.addAction("Make Block");
+            QAction *explodeAction = ContextMenu.addAction("Explode Block");
+            explodeAction->setEnabled(item->type() == ShapeItem::BlockType || selection.size() > 1);
 
             QAction *selectedAction = ContextMenu.exec(event->globalPosition().toPoint());
 
             if(selectedAction == duplicateAction){
-                DuplicateShape(selectedItem);
+                DuplicateSelection();
             }
             else if(selectedAction == deleteAction){
-                DeleteShape(selectedItem);
+                DeleteSelection();
+            }
+            else if(selectedAction == makeBlockAction){
+                MakeBlockFromSelection();
+            }
+            else if(selectedAction == explodeAction){
+                ExplodeSelection();
             }
         }
     }
@@ -184,125 +1034,271 @@ void CanvasView::mousePressEvent(QMouseEvent *event)
     //Left Click
     if(event->button() == Qt::LeftButton){
         startPoint = mapToScene(event->position().toPoint());
+        lastMousePos = startPoint;
+        const bool shift = event->modifiers() & Qt::ShiftModifier;
 
         setCursor(Qt::CrossCursor);
         if (currentMode == DrawMode::Select) {
-            setCursor(Qt::SizeAllCursor);
-            selectedItem = scene->itemAt(startPoint, QTransform());
-            if (selectedItem) {
-                originalPos = selectedItem->pos(); //stor exact pos for undo
-                lastMousePos = startPoint; // Store initial position
+            QGraphicsItem *item = ItemAt(startPoint);
+            if(item && shift){
+                SetSelected(item, !selection.contains(item));
+            }
+            else if(item){
+                //dragging a selected shape moves the whole selection
+                if(!selection.contains(item)) SelectOnly(item);
+                setCursor(Qt::SizeAllCursor);
+                //the base point snaps to the grabbed geometry, the target away from it
+                lastMousePos = SnapToScene(event->position().toPoint());
+                BeginDrag(SelectedItems());
             }
+            else{
+                if(!shift) ClearSelection();
+                rubberBandOrigin = event->position().toPoint();
+                rubberBand->setGeometry(QRect(rubberBandOrigin, QSize()));
+                rubberBand->show();
+            }
+            return;
         }
-        else if(currentMode == DrawMode::Resize){
-            selectedItem = scene->itemAt(startPoint, QTransform());
+        if(currentMode == DrawMode::Resize){
             setCursor(Qt::SizeBDiagCursor);
-            if(selectedItem){
-                originalRect = selectedItem->boundingRect();
-                lastMousePos = startPoint;
+            QGraphicsItem *item = ItemAt(startPoint);
+            if(item && item->type() != ShapeItem::PolylineType){
+                //resizing a selected shape resizes every selected rectangle and circle
+                QVector<QGraphicsItem *> items;
+                if(selection.contains(item)){
+                    for(QGraphicsItem *selected : std::as_const(selection)){
+                        if(selected->type() != ShapeItem::LineType && selected->type() != ShapeItem::PolylineType){
+                            items.append(selected);
+                        }
+                    }
+                }
+                else{
+                    items.append(item);
+                }
+                BeginDrag(items);
+                originalRects.reserve(activeItems.size());
+                for(QGraphicsItem *active : std::as_const(activeItems)){
+                    originalRects.append(ShapeItem::GeometryRectOf(active));
+                }
             }
-        }
-        else{
-            selectedItem = nullptr;
+            return;
         }
 
+        startPoint = SnapToScene(event->position().toPoint());
+        if(currentMode == DrawMode::Polyline){
+            //each click fixes the vertex under the cursor and starts the next one
+            if(drawing){
+                polylinePoints.last() = startPoint;
+                polylinePoints.append(startPoint);
+                UpdatePolyline();
+                return;
+            }
+            polylinePoints = { startPoint, startPoint };
+        }
+        ShapeData shape;
         switch(currentMode){
             case DrawMode::Line:
-                currentItem = scene->addLine(QLineF(startPoint, startPoint), QPen(Qt::black, 2));
+                shape = ShapeData{ ShapeType::Line, QLineF(startPoint, startPoint), QRectF() };
                 break;
             case DrawMode::Rectangle:
-                currentItem = scene->addRect(QRectF(startPoint, startPoint), QPen(Qt::black, 2));
+                shape = ShapeData{ ShapeType::Rectangle, QLineF(), QRectF(startPoint, startPoint) };
                 break;
             case DrawMode::Circle:
-                currentItem = scene->addEllipse(QRectF(startPoint, startPoint), QPen(Qt::black, 2));
+                shape = ShapeData{ ShapeType::Circle, QLineF(), QRectF(startPoint, startPoint) };
                 break;
-            default:
+            case DrawMode::Polyline:
+                ShapeSerializer::MakePolyline(polylinePoints, shape);
                 break;
+            default:
+                return;
         }
-
+        shape.layer = quint16(currentLayer);
+        //the shape is an overlay until the button is released, or the polyline finished
+        drawnShape = shape;
+        drawing = true;
+        UpdatePreview();
     }
 }
 
 void CanvasView::mouseMoveEvent(QMouseEvent *event)
 {
+    CAD_PROFILE_INPUT("MouseMove");
+    const QPoint pos = event->position().toPoint();
+    //a traced polyline keeps every raw position, everything else only needs the latest
+    if(drawing && currentMode == DrawMode::Polyline && (event->buttons() & Qt::LeftButton)) tracePoints.append(pos);
+    pendingMove = MoveInput{ pos, event->buttons() };
+
+    //the first move of a frame is applied at once, the rest wait for the next frame
+    if(frameTimer->isActive()) return;
+    FlushMove();
+    const qreal refreshRate = screen() ? screen()->refreshRate() : 60.0;
+    frameTimer->start(qMax(1, qRound(1000.0 / qMax<qreal>(refreshRate, 1.0))));
+}
+
+void CanvasView::FlushMove()
+{
+    if(!pendingMove) return;
+    const MoveInput move = *pendingMove;
+    pendingMove.reset();
+    ApplyMove(move);
+}
+
+//One frame's worth of mouse movement. Drags and the shape being drawn only change
+//their preview here, the items are touched once, on release
+void CanvasView::ApplyMove(const MoveInput &move)
+{
+    CAD_PROFILE_SCOPE("ApplyMove");
     //pan
-    if (event->buttons() & Qt::MiddleButton) {
-        QPointF delta = event->pos() - lastPanPoint;
+    if (move.buttons & Qt::MiddleButton) {
+        QPointF delta = move.pos - lastPanPoint;
 
         // Only update if there's actual movement
         if (!delta.isNull()) {
             horizontalScrollBar()->setValue(horizontalScrollBar()->value() - delta.x());
             verticalScrollBar()->setValue(verticalScrollBar()->value() - delta.y());
-            lastPanPoint = event->pos();
+            lastPanPoint = move.pos;
         }
     }
 
-    if(event->buttons() & Qt::LeftButton){
-        QPointF newMousePos = mapToScene(event->position().toPoint());
-
-        if (currentMode == DrawMode::Select && selectedItem) {
-            QPointF delta = newMousePos - lastMousePos; // Movement difference
-            selectedItem->setPos(selectedItem->pos() + delta); // Move selected item
-            lastMousePos = newMousePos; // Update last position
+    const bool drawMode = currentMode == DrawMode::Line || currentMode == DrawMode::Rectangle
+                          || currentMode == DrawMode::Circle || currentMode == DrawMode::Polyline;
+    if(currentMode == DrawMode::Polyline && drawing){
+        //the last vertex follows the cursor; with the button held the path is traced,
+        //a vertex is fixed every TraceSpacingPx on screen. Every raw position since the
+        //last frame counts for the trace, only the latest is snapped
+        const QPointF point = SnapToScene(move.pos);
+        const qreal spacing = TraceSpacingPx / qMax(transform().m11(), 1e-9);
+        if(move.buttons & Qt::LeftButton){
+            for(const QPoint &raw : std::as_const(tracePoints)){
+                const QPointF traced = raw == move.pos ? point : mapToScene(raw);
+                if(QLineF(polylinePoints.at(polylinePoints.size() - 2), traced).length() >= spacing){
+                    polylinePoints.last() = traced;
+                    polylinePoints.append(traced);
+                }
+            }
         }
-        else if (currentMode == DrawMode::Resize && selectedItem) {
-            qreal scaleFactor = 1.0 + (newMousePos.x() - startPoint.x()) / 100.0; // Adjust scale factor
+        tracePoints.clear();
+        polylinePoints.last() = point;
+        UpdatePolyline();
+        return;
+    }
+    if(!(move.buttons & Qt::LeftButton)){
+        //hovering shows where a click would start the shape
+        if(drawMode) SnapToScene(move.pos);
+        return;
+    }
 
-            if (scaleFactor < 0.1) scaleFactor = 0.1; // Prevent too small size
+    QPointF newMousePos = mapToScene(move.pos);
+    if(currentMode == DrawMode::Select && !activeItems.isEmpty() && !rubberBand->isVisible()){
+        newMousePos = SnapToScene(move.pos, selection);
+    }
+    else if(drawMode && drawing){
+        newMousePos = SnapToScene(move.pos);
+    }
+
+    if(rubberBand->isVisible()){
+        rubberBand->setGeometry(QRect(rubberBandOrigin, move.pos).normalized());
+    }
+    else if (currentMode == DrawMode::Select && !activeItems.isEmpty()) {
+        dragDelta += newMousePos - lastMousePos; // Movement difference
+        lastMousePos = newMousePos; // Update last position
+        UpdatePreview();
+    }
+    else if (currentMode == DrawMode::Resize && !activeItems.isEmpty()) {
+        qreal scaleFactor = 1.0 + (newMousePos.x() - startPoint.x()) / 100.0; // Adjust scale factor
 
+        if (scaleFactor < 0.1) scaleFactor = 0.1; // Prevent too small size
+
+        //every shape is scaled about its own centre
+        resizeRects.resize(activeItems.size());
+        for(qsizetype i = 0; i < activeItems.size(); ++i){
+            const QRectF &originalRect = originalRects.at(i);
             QPointF center = originalRect.center();
 
             qreal newWidth = originalRect.width() * scaleFactor;
             qreal newHeight = originalRect.height() * scaleFactor;
 
-            QRectF newRect(center.x() - newWidth / 2, center.y() - newHeight / 2, newWidth, newHeight);
+            resizeRects[i] = QRectF(center.x() - newWidth / 2, center.y() - newHeight / 2, newWidth, newHeight);
+        }
+        UpdatePreview();
+    }
+    else if (drawing) { // Only update if drawing
+        if(drawnShape.type == ShapeType::Line){
+            drawnShape.line = QLineF(startPoint, newMousePos);
+        }
+        else{
+            drawnShape.rect = QRectF(startPoint, newMousePos).normalized();
+        }
+        UpdatePreview();
+    }
+}
 
-            if (auto *rect = dynamic_cast<QGraphicsRectItem *>(selectedItem)) {
-                rect->setRect(newRect);
-            }
-            else if (auto *ellipse = dynamic_cast<QGraphicsEllipseItem *>(selectedItem)) {
-                ellipse->setRect(newRect);
+void CanvasView::mouseReleaseEvent(QMouseEvent *event)
+{
+    CAD_PROFILE_INPUT("MouseRelease");
+    FlushMove(); // the release applies the drag as far as the last move took it
+    frameTimer->stop();
+    if(rubberBand->isVisible()){
+        FinishRubberBand(event->position().toPoint(), event->modifiers() & Qt::ShiftModifier);
+    }
+    else if(drawing && currentMode != DrawMode::Polyline){ // a polyline is finished by double-click or Enter
+        //the command adds the finished shape, so the journal sees it appear
+        undoHistory.Push(new AddShapeCommand(scene, ShapeSerializer::CreateItem(drawnShape, scene->Store()), &spatialIndex));
+        drawing = false;
+    }
+    else if(!activeItems.isEmpty() && (currentMode == DrawMode::Select || currentMode == DrawMode::Resize)){
+        //items that left the scene meanwhile belong to a command now, not to the drag
+        QVector<QGraphicsItem *> items;
+        QVector<QRectF> fromRects, toRects;
+        for(qsizetype i = 0; i < activeItems.size(); ++i){
+            if(!activeItems.at(i)->scene()) continue;
+            items.append(activeItems.at(i));
+            if(!resizeRects.isEmpty()){
+                fromRects.append(originalRects.at(i));
+                toRects.append(resizeRects.at(i));
             }
         }
 
-        else if (currentItem) { // Only update if drawing
-            if(auto *line = dynamic_cast<QGraphicsLineItem *>(currentItem)) {
-                line->setLine(QLineF(startPoint, newMousePos));
+        if(currentMode == DrawMode::Select && !items.isEmpty() && !dragDelta.isNull()){
+            //the drag was a preview, the command applies the actual move
+            if(items.size() == 1){
+                QGraphicsItem *item = items.first();
+                const QPointF oldPos = ShapeItem::PositionOf(item);
+                undoHistory.Push(new MoveShapeCommand(item, oldPos, oldPos + dragDelta, &spatialIndex));
             }
-            else if(auto *rect = dynamic_cast<QGraphicsRectItem *>(currentItem)){
-                rect->setRect(QRectF(startPoint, newMousePos).normalized());
+            else{
+                undoHistory.Push(new MoveShapesCommand(items, dragDelta, &spatialIndex));
             }
-            else if(auto *ellipse = dynamic_cast<QGraphicsEllipseItem *>(currentItem)){
-                ellipse->setRect(QRectF(startPoint, newMousePos).normalized());
+        }
+        else if(currentMode == DrawMode::Resize && !toRects.isEmpty() && toRects != fromRects){
+            //the resize was a preview, the command applies the actual change
+            if(items.size() == 1){
+                undoHistory.Push(new ResizeShapeCommand(items.first(), fromRects.first(), toRects.first(), &spatialIndex));
+            }
+            else{
+                undoHistory.Push(new ResizeShapesCommand(items, fromRects, toRects, &spatialIndex));
             }
         }
     }
+    EndDrag(); // the preview gives way to the items
+    if(currentMode == DrawMode::Select) SetSnapResult(SnapEngine::Result());
+    setCursor(Qt::ArrowCursor);
 }
 
-void CanvasView::mouseReleaseEvent(QMouseEvent *event)
+void CanvasView::mouseDoubleClickEvent(QMouseEvent *event)
 {
-    if(currentItem){
-        undoStack->push(new AddShapeCommand(scene, currentItem));
-        currentItem = nullptr;
+    CAD_PROFILE_INPUT("MouseDoubleClick");
+    FlushMove();
+    if(event->button() == Qt::LeftButton && currentMode == DrawMode::Polyline && drawing){
+        FinishPolyline();
+        return;
     }
-    else if(selectedItem && currentMode == DrawMode::Select){
-        QPointF newPos = selectedItem->pos();
-        if(newPos != originalPos){
-            undoStack->push(new MoveShapeCommand(selectedItem, originalPos, newPos));
-        }
-    }
-    else if(selectedItem && currentMode == DrawMode::Resize){
-        QRectF newRect = selectedItem->boundingRect();
-        if(newRect != originalRect){
-            undoStack->push(new ResizeShapeCommand(selectedItem, originalRect, newRect));
-        }
-    }
-    setCursor(Qt::ArrowCursor);
-    selectedItem = nullptr;
+    QGraphicsView::mouseDoubleClickEvent(event);
 }
 
 void CanvasView::wheelEvent(QWheelEvent *event) //Zoom feature
 {
+    CAD_PROFILE_INPUT("Wheel");
     if(event->modifiers() & Qt::ControlModifier){
         double scaleFactor = 1.1;
         if(event->angleDelta().y() < 0)
@@ -311,7 +1307,10 @@ void CanvasView::wheelEvent(QWheelEvent *event) //Zoom feature
         qreal newScale = transform().m11() * scaleFactor;
         if (newScale < 0.2 || newScale > 5.0) return;
 
+        //thin strokes gain nothing from antialiasing when zoomed far out
+        setRenderHint(QPainter::Antialiasing, newScale >= ShapeRenderer::AntialiasZoomThreshold);
         scale(scaleFactor, scaleFactor);
+        UpdateViewport();
     } else{
         QGraphicsView::wheelEvent(event);
     }
@@ -8,8 +8,24 @@
 #include <QHoverEvent>
 #include <QWheelEvent>
 #include <QJsonArray>
-#include <QUndoStack>
+#include <QKeyEvent>
+#include <QRubberBand>
+#include <QTimer>
+#include <QSet>
+#include <QVector>
+#include <memory>
+#include <optional>
 #include "commands.h"
+#include "drawinganalyzer.h"
+#include "scenebulkinsert.h"
+#include "shapescene.h"
+#include "spatialindex.h"
+#include "snapengine.h"
+#include "tilecache.h"
+#include "undohistory.h"
+#include "viewportpager.h"
+#include "editjournal.h"
+#include "profiler.h"
 #include "Entity.h"
 
 class CanvasView : public QGraphicsView {
@@ -26,28 +42,172 @@ public:
 
     void DeserializeCanvas(const QJsonArray &shapes);
     QJsonArray SerializeCanvas() const;
+    //an empty layer table means the default one
+    void LoadShapes(const QVector<ShapeData> &shapes, const QVector<Layer> &layers = {});
+    void AppendShapes(const QVector<ShapeData> &shapes);
+    void BeginBulkLoad();
+    void EndBulkLoad();
+    QVector<ShapeData> CanvasShapes() const;
+    //streams the drawing to SVG or DXF (picked by extension) without copying it first
+    bool ExportDrawing(const QString &filePath) const;
+    bool IsEmpty() const;
+    //finds crossing lines, overlapping rectangles, duplicates and zero-size shapes
+    //and selects them, up to MaxCheckHighlights shapes
+    DrawingAnalyzer::Report CheckDrawing();
+
+    //edits made through the undo history (and clearing) are also written here
+    void SetJournal(EditJournal *journal);
+
+    //multi-selection, Shift-click toggles and a rubber band on empty space selects
+    QVector<QGraphicsItem *> SelectedItems() const;
+    void ClearSelection();
+
+    //turns the selection into one instance of a new block definition, and block
+    //instances in the selection back into their members
+    void MakeBlockFromSelection();
+    void ExplodeSelection();
+
+    //SnapEngine::Mode flags used while drawing and moving shapes
+    void SetSnapModes(int modes);
+    int SnapModes() const { return snapEngine.Modes(); }
+
+    //layer table; new shapes go on the current layer. Hidden layers are skipped by
+    //painting, picking and snapping, locked ones are drawn and snapped to but can't be picked
+    const QVector<Layer> &Layers() const { return scene->Layers(); }
+    void SetLayers(const QVector<Layer> &layers);
+    //returns the new layer's index, -1 when the table is full
+    int AddLayer(const QString &name);
+    void SetLayerVisible(int index, bool on);
+    void SetLayerLocked(int index, bool on);
+    void SetLayerZ(int index, int z);
+    int CurrentLayer() const { return currentLayer; }
+    void SetCurrentLayer(int index);
+    void MoveSelectionToLayer(int index);
+    //layer table changes aren't journaled, a save after one rewrites the whole file
+    bool LayersEdited() const { return layersEdited; }
+    void MarkLayersSaved() { layersEdited = false; }
+
+    //*.cadp drawings are paged: only the pages around the view are loaded, and the
+    //canvas reaches as far as the drawing does
+    bool OpenPaged(const QString &filePath);
+    bool IsPaged() const { return pager->IsOpen(); }
+    //rewrites the paged drawing to filePath and goes on paging from there; the
+    //undo history starts over, as after opening
+    bool SavePaged(const QString &filePath);
+
+    //FPS, input latency and index figures drawn over the canvas; also turns the profiler on
+    void SetPerformanceOverlay(bool on);
+    bool IsPerformanceOverlayVisible() const { return performanceOverlay; }
+
+signals:
+    void layersChanged();
 
 protected:
     void mousePressEvent(QMouseEvent *event) override;
     void mouseMoveEvent(QMouseEvent *event) override;
     void mouseReleaseEvent(QMouseEvent *event) override;
+    void mouseDoubleClickEvent(QMouseEvent *event) override;
     void wheelEvent(QWheelEvent *event) override;
+    void keyPressEvent(QKeyEvent *event) override;
     void hoverMoveEvent(QHoverEvent *event);
+    void paintEvent(QPaintEvent *event) override;
+    void leaveEvent(QEvent *event) override;
+    void drawForeground(QPainter *painter, const QRectF &rect) override;
+    void scrollContentsBy(int dx, int dy) override;
+    void resizeEvent(QResizeEvent *event) override;
 
 private:
-    QGraphicsScene *scene;
+    //what a mouse move leaves to be applied at the next frame
+    struct MoveInput{
+        QPoint pos;
+        Qt::MouseButtons buttons;
+    };
+
+    ShapeScene *scene;
     DrawMode currentMode;
     QPointF startPoint;
-    QPointF originalPos;
     QPointF lastMousePos;
     QPointF lastPanPoint;
-    QGraphicsItem *currentItem;
-    QGraphicsItem *selectedItem;
-    QRectF originalRect;
-    QUndoStack *undoStack = nullptr;
+    ShapeData drawnShape;                  // shape being drawn, an overlay until it is added
+    bool drawing = false;
+    QSet<QGraphicsItem *> selection;
+    QVector<QGraphicsItem *> activeItems; // shapes being moved or resized by the current drag
+    QVector<QRectF> originalRects;         // their geometry rects when a resize started
+    QVector<QRectF> resizeRects;           // and where the resize has taken them so far
+    QPointF dragDelta;                     // total movement of the current drag
+    QVector<ShapeData> previewShapes;      // activeItems' shapes, painted at the drag's geometry
+    QSet<QGraphicsItem *> previewedItems;  // activeItems, while their preview stands in for them
+    QRectF previewOrigin;                  // scene bounds of previewShapes before the drag
+    QRect previewViewRect;                 // viewport area the preview was last painted in
+    QVector<QPointF> polylinePoints;       // vertices of the polyline being drawn, the last follows the cursor
+    QTimer *frameTimer;                    // paces applied mouse moves to the display
+    std::optional<MoveInput> pendingMove;
+    QVector<QPoint> tracePoints;           // raw positions of a traced polyline since the last applied move
+    QRubberBand *rubberBand;
+    QPoint rubberBandOrigin;
+    UndoHistory undoHistory; // declared as a member so it goes before the scene and its shape store
+    EditJournal *journal = nullptr;
+    std::unique_ptr<SceneBulkInsert> bulkInsert;
+    SpatialIndex spatialIndex;
+    SnapEngine snapEngine{ &spatialIndex }; // follows the index, so it must come after it
+    SnapEngine::Result snapResult;          // shown as a marker until the next mouse move
+    TileCache *tileCache;
+    ViewportPager *pager;
+    bool tiledRendering = false;
+    bool growingSceneRect = false;
+    bool performanceOverlay = false;
+    qsizetype overlayVisible = 0;  // shapes in overlayArea at overlayRevision of the index
+    QRectF overlayArea;
+    quint64 overlayRevision = ~quint64(0);
+    int blocksMade = 0; // numbers the names of new block definitions
+    int currentLayer = 0;
+    bool layersEdited = false;
+
+    static constexpr qreal PickTolerancePx = 4.0; // hit-test slack around thin lines, in screen pixels
+    static constexpr qreal SnapTolerancePx = 10.0; // snap reach around the cursor, in screen pixels
+    static constexpr int SnapMarkerSize = 10;
+    static constexpr qreal TraceSpacingPx = 3.0; // vertex spacing when a polyline is traced with the button held
+    static constexpr qsizetype MaxCheckHighlights = 50000; // selecting more makes the canvas crawl
+    static constexpr qsizetype TiledRenderingThreshold = 20000; // shape count above which the tile cache paints
+    static constexpr qreal SceneReach = 2.0;  // viewports of scrollable area kept around the visible one
+    static constexpr qreal MaxScrollPx = 1e9; // scroll bars hold ints, the scene rect at the current zoom stays below this
+    static constexpr int MaxPageOutlines = 2000;
+    static constexpr qsizetype MaxPreviewShapes = 20000; // larger drags preview as their outline
+    static constexpr int PreviewPaddingPx = 4;           // repaint margin around a preview for its pen
 
-    void DuplicateShape(QGraphicsItem *item);
-    void DeleteShape(QGraphicsItem *item);
+    void FitSceneRect();
+    void GrowSceneRect();
+    QRectF DrawingExtent() const;
+    void UpdateViewport();
+    void PickRenderingPath();
+    void RebuildIndex();
+    void PaintCanvas(QPaintEvent *event);
+    void PaintItemDirect(QPainter *painter, QGraphicsItem *item);
+    void PaintPerformanceOverlay(QPainter *painter, const QRectF &visible);
+    void PaintSnapMarker(QPainter *painter);
+    void PaintPendingPages(QPainter *painter, const QRectF &visible);
+    void PaintPreview(QPainter *painter, const QRectF &exposed);
+    ShapeData PreviewShape(qsizetype index) const;
+    QRectF PreviewArea() const;
+    void UpdatePreview();
+    void FlushMove();
+    void ApplyMove(const MoveInput &move);
+    void DropInteraction();
+    QPointF SnapToScene(const QPoint &viewPos, const QSet<QGraphicsItem *> &exclude = {});
+    void SetSnapResult(const SnapEngine::Result &result);
+    QGraphicsItem *ItemAt(const QPointF &scenePos) const;
+    void SetSelected(QGraphicsItem *item, bool on);
+    void SelectOnly(QGraphicsItem *item);
+    void PruneSelection();
+    void CoverLayers(const QVector<ShapeData> &shapes);
+    void BeginDrag(const QVector<QGraphicsItem *> &items);
+    void EndDrag();
+    void FinishRubberBand(const QPoint &viewPos, bool additive);
+    void DuplicateSelection();
+    void DeleteSelection();
+    void UpdatePolyline();
+    void FinishPolyline();
+    void CancelPolyline();
 };
 
 #endif // CANVASVIEW_H
@@ -1,67 +1,354 @@
 #include "commands.h"
+#include "shapeitem.h"
 
 /*********************** Add Shape Command Implementation ***********************/
-AddShapeCommand::AddShapeCommand(QGraphicsScene *scene, QGraphicsItem *item)
-    : scene(scene), item(item) {
+AddShapeCommand::AddShapeCommand(QGraphicsScene *scene, QGraphicsItem *item, SpatialIndex *index)
+    : scene(scene), item(item), index(index) {
     setText("Add Shape");
 }
 
+AddShapeCommand::~AddShapeCommand(){
+    //undone and dropped: nothing else refers to the item any more
+    if(item && !done) delete item;
+}
+
 void AddShapeCommand::redo(){
     scene->addItem(item);
+    if(index) index->Insert(item);
+    done = true;
 }
 
 void AddShapeCommand::undo(){
     scene->removeItem(item);
+    if(index) index->Remove(item);
+    done = false;
+}
+
+qint64 AddShapeCommand::MemoryCost() const{
+    return CommandOverhead + (done ? 0 : ItemCost);
+}
+
+QVector<QGraphicsItem *> AddShapeCommand::AffectedItems() const{
+    return { item };
 }
 
 /*********************** Delete Shape Command Implementation ***********************/
-DeleteShapeCommand::DeleteShapeCommand(QGraphicsScene *scene, QGraphicsItem *item)
-    :scene(scene), item(item){
+DeleteShapeCommand::DeleteShapeCommand(QGraphicsScene *scene, QGraphicsItem *item, SpatialIndex *index)
+    :scene(scene), item(item), index(index){
     setText("Delete Shape");
 }
 
+DeleteShapeCommand::~DeleteShapeCommand(){
+    //done and dropped: the deleted shape can't come back
+    if(item && done) delete item;
+}
+
 void DeleteShapeCommand::redo(){
     scene->removeItem(item);
+    if(index) index->Remove(item);
+    done = true;
 }
 
 void DeleteShapeCommand::undo(){
     scene->addItem(item);
+    if(index) index->Insert(item);
+    done = false;
+}
+
+qint64 DeleteShapeCommand::MemoryCost() const{
+    return CommandOverhead + ItemCost;
+}
+
+QVector<QGraphicsItem *> DeleteShapeCommand::AffectedItems() const{
+    return { item };
 }
 
 /*********************** Move Shape Command Implementation ***********************/
-MoveShapeCommand::MoveShapeCommand(QGraphicsItem *item, const QPointF &oldPos, const QPointF &newPos)
-    : item(item), oldPos(oldPos), newPos(newPos){
+MoveShapeCommand::MoveShapeCommand(QGraphicsItem *item, const QPointF &oldPos, const QPointF &newPos, SpatialIndex *index)
+    : item(item), oldPos(oldPos), newPos(newPos), index(index){
     setText("Move Shape");
 }
 
 void MoveShapeCommand::redo(){
-    if(item) item->setPos(newPos);
+    if(item) ShapeItem::MoveTo(item, newPos);
+    if(item && index) index->Update(item);
 }
 
 void MoveShapeCommand::undo(){
-    if(item) item->setPos(oldPos);
+    if(item) ShapeItem::MoveTo(item, oldPos);
+    if(item && index) index->Update(item);
+}
+
+bool MoveShapeCommand::mergeWith(const QUndoCommand *other){
+    auto *move = static_cast<const MoveShapeCommand *>(other);
+    if(move->item != item) return false;
+    newPos = move->newPos;
+    return true;
+}
+
+qint64 MoveShapeCommand::MemoryCost() const{
+    return CommandOverhead;
+}
+
+QVector<QGraphicsItem *> MoveShapeCommand::AffectedItems() const{
+    return { item };
 }
 
 /*********************** Resize Shape Command Implementation ***********************/
-ResizeShapeCommand::ResizeShapeCommand(QGraphicsItem *item, const QRectF &oldRect, const QRectF &newRect)
-    : item(item), oldRect(oldRect), newRect(newRect){
+ResizeShapeCommand::ResizeShapeCommand(QGraphicsItem *item, const QRectF &oldRect, const QRectF &newRect, SpatialIndex *index)
+    : item(item), oldRect(oldRect), newRect(newRect), index(index){
     setText("Resize Shape");
 }
 
 void ResizeShapeCommand::redo(){
-    if(auto *rect = dynamic_cast<QGraphicsRectItem*>(item)){
-        rect->setRect(newRect);
+    if(item) ShapeItem::SetGeometryRect(item, newRect);
+    if(item && index) index->Update(item);
+}
+
+void ResizeShapeCommand::undo(){
+    if(item) ShapeItem::SetGeometryRect(item, oldRect);
+    if(item && index) index->Update(item);
+}
+
+bool ResizeShapeCommand::mergeWith(const QUndoCommand *other){
+    auto *resize = static_cast<const ResizeShapeCommand *>(other);
+    if(resize->item != item) return false;
+    newRect = resize->newRect;
+    return true;
+}
+
+qint64 ResizeShapeCommand::MemoryCost() const{
+    return CommandOverhead;
+}
+
+QVector<QGraphicsItem *> ResizeShapeCommand::AffectedItems() const{
+    return { item };
+}
+
+/*********************** Add Shapes Command Implementation ***********************/
+AddShapesCommand::AddShapesCommand(QGraphicsScene *scene, const QVector<QGraphicsItem *> &items, SpatialIndex *index)
+    : scene(scene), items(items), index(index){
+    setText(QString("Add %1 Shapes").arg(items.size()));
+}
+
+AddShapesCommand::~AddShapesCommand(){
+    if(!done) qDeleteAll(items);
+}
+
+void AddShapesCommand::redo(){
+    if(index) index->BeginBatch();
+    for(QGraphicsItem *item : items){
+        scene->addItem(item);
+        if(index) index->Insert(item);
     }
-    else if(auto *ellipse = dynamic_cast<QGraphicsEllipseItem*>(item)){
-        ellipse->setRect(newRect);
+    if(index) index->EndBatch();
+    done = true;
+}
+
+void AddShapesCommand::undo(){
+    if(index) index->BeginBatch();
+    for(QGraphicsItem *item : items){
+        scene->removeItem(item);
+        if(index) index->Remove(item);
     }
+    if(index) index->EndBatch();
+    done = false;
 }
 
-void ResizeShapeCommand::undo(){
-    if(auto *rect = dynamic_cast<QGraphicsRectItem*>(item)){
-        rect->setRect(oldRect);
+qint64 AddShapesCommand::MemoryCost() const{
+    return CommandOverhead + items.capacity() * qint64(sizeof(QGraphicsItem *)) + (done ? 0 : items.size() * ItemCost);
+}
+
+QVector<QGraphicsItem *> AddShapesCommand::AffectedItems() const{
+    return items;
+}
+
+/*********************** Delete Shapes Command Implementation ***********************/
+DeleteShapesCommand::DeleteShapesCommand(QGraphicsScene *scene, const QVector<QGraphicsItem *> &items, SpatialIndex *index)
+    : scene(scene), items(items), index(index){
+    setText(QString("Delete %1 Shapes").arg(items.size()));
+}
+
+DeleteShapesCommand::~DeleteShapesCommand(){
+    if(done) qDeleteAll(items);
+}
+
+void DeleteShapesCommand::redo(){
+    if(index) index->BeginBatch();
+    for(QGraphicsItem *item : items){
+        scene->removeItem(item);
+        if(index) index->Remove(item);
+    }
+    if(index) index->EndBatch();
+    done = true;
+}
+
+void DeleteShapesCommand::undo(){
+    if(index) index->BeginBatch();
+    for(QGraphicsItem *item : items){
+        scene->addItem(item);
+        if(index) index->Insert(item);
+    }
+    if(index) index->EndBatch();
+    done = false;
+}
+
+qint64 DeleteShapesCommand::MemoryCost() const{
+    return CommandOverhead + items.capacity() * qint64(sizeof(QGraphicsItem *)) + items.size() * ItemCost;
+}
+
+QVector<QGraphicsItem *> DeleteShapesCommand::AffectedItems() const{
+    return items;
+}
+
+/*********************** Move Shapes Command Implementation ***********************/
+MoveShapesCommand::MoveShapesCommand(const QVector<QGraphicsItem *> &items, const QPointF &delta, SpatialIndex *index)
+    : items(items), delta(delta), index(index){
+    setText(QString("Move %1 Shapes").arg(items.size()));
+}
+
+void MoveShapesCommand::redo(){
+    Apply(delta);
+}
+
+void MoveShapesCommand::undo(){
+    Apply(-delta);
+}
+
+void MoveShapesCommand::Apply(const QPointF &offset){
+    //store-backed shapes are translated in one pass over the packed arrays
+    ShapeItem::TranslateMany(items, offset);
+
+    if(index){
+        index->BeginBatch();
+        for(QGraphicsItem *item : items) index->Update(item);
+        index->EndBatch();
     }
-    else if(auto *ellipse = dynamic_cast<QGraphicsEllipseItem*>(item)){
-        ellipse->setRect(oldRect);
+}
+
+qint64 MoveShapesCommand::MemoryCost() const{
+    return CommandOverhead + items.capacity() * qint64(sizeof(QGraphicsItem *));
+}
+
+QVector<QGraphicsItem *> MoveShapesCommand::AffectedItems() const{
+    return items;
+}
+
+/*********************** Resize Shapes Command Implementation ***********************/
+ResizeShapesCommand::ResizeShapesCommand(const QVector<QGraphicsItem *> &items, const QVector<QRectF> &oldRects,
+                                         const QVector<QRectF> &newRects, SpatialIndex *index)
+    : items(items), index(index){
+    Q_ASSERT(oldRects.size() == items.size() && newRects.size() == items.size());
+    rects.reserve(items.size() * 2);
+    for(qsizetype i = 0; i < items.size(); ++i){
+        rects.append(oldRects.at(i));
+        rects.append(newRects.at(i));
     }
+    setText(QString("Resize %1 Shapes").arg(items.size()));
+}
+
+void ResizeShapesCommand::redo(){
+    Apply(1);
+}
+
+void ResizeShapesCommand::undo(){
+    Apply(0);
+}
+
+void ResizeShapesCommand::Apply(int which){
+    if(index) index->BeginBatch();
+    for(qsizetype i = 0; i < items.size(); ++i){
+        ShapeItem::SetGeometryRect(items.at(i), rects.at(2 * i + which));
+        if(index) index->Update(items.at(i));
+    }
+    if(index) index->EndBatch();
+}
+
+qint64 ResizeShapesCommand::MemoryCost() const{
+    return CommandOverhead + items.capacity() * qint64(sizeof(QGraphicsItem *))
+           + rects.capacity() * qint64(sizeof(QRectF));
+}
+
+QVector<QGraphicsItem *> ResizeShapesCommand::AffectedItems() const{
+    return items;
+}
+
+/*********************** Replace Shapes Command Implementation ***********************/
+ReplaceShapesCommand::ReplaceShapesCommand(QGraphicsScene *scene, const QVector<QGraphicsItem *> &removed,
+                                           const QVector<QGraphicsItem *> &added, SpatialIndex *index)
+    : scene(scene), removed(removed), added(added), index(index){
+    setText(QString("Replace %1 Shapes").arg(removed.size()));
+}
+
+ReplaceShapesCommand::~ReplaceShapesCommand(){
+    //whichever side is out of the scene is owned here
+    qDeleteAll(done ? removed : added);
+}
+
+void ReplaceShapesCommand::redo(){
+    Swap(removed, added);
+    done = true;
+}
+
+void ReplaceShapesCommand::undo(){
+    Swap(added, removed);
+    done = false;
+}
+
+void ReplaceShapesCommand::Swap(const QVector<QGraphicsItem *> &out, const QVector<QGraphicsItem *> &in){
+    if(index) index->BeginBatch();
+    for(QGraphicsItem *item : out){
+        scene->removeItem(item);
+        if(index) index->Remove(item);
+    }
+    for(QGraphicsItem *item : in){
+        scene->addItem(item);
+        if(index) index->Insert(item);
+    }
+    if(index) index->EndBatch();
+}
+
+qint64 ReplaceShapesCommand::MemoryCost() const{
+    return CommandOverhead + (removed.capacity() + added.capacity()) * qint64(sizeof(QGraphicsItem *))
+           + (removed.size() + added.size()) * ItemCost;
+}
+
+QVector<QGraphicsItem *> ReplaceShapesCommand::AffectedItems() const{
+    return removed + added;
+}
+
+/*********************** Change Layer Command Implementation ***********************/
+ChangeLayerCommand::ChangeLayerCommand(const QVector<QGraphicsItem *> &items, quint16 layer, SpatialIndex *index)
+    : items(items), layer(layer), index(index){
+    oldLayers.reserve(items.size());
+    for(QGraphicsItem *item : items) oldLayers.append(ShapeItem::LayerOf(item));
+    setText(QString("Change Layer of %1 Shapes").arg(items.size()));
+}
+
+void ChangeLayerCommand::redo(){
+    if(index) index->BeginBatch();
+    for(QGraphicsItem *item : items){
+        ShapeItem::SetLayer(item, layer);
+        //moves the entry into the partition of its new layer
+        if(index) index->Update(item);
+    }
+    if(index) index->EndBatch();
+}
+
+void ChangeLayerCommand::undo(){
+    if(index) index->BeginBatch();
+    for(qsizetype i = 0; i < items.size(); ++i){
+        ShapeItem::SetLayer(items.at(i), oldLayers.at(i));
+        if(index) index->Update(items.at(i));
+    }
+    if(index) index->EndBatch();
+}
+
+qint64 ChangeLayerCommand::MemoryCost() const{
+    return CommandOverhead + items.capacity() * qint64(sizeof(QGraphicsItem *))
+           + oldLayers.capacity() * qint64(sizeof(quint16));
+}
+
+QVector<QGraphicsItem *> ChangeLayerCommand::AffectedItems() const{
+    return items;
 }
@@ -4,53 +4,220 @@
 #include <QUndoCommand>
 #include <QGraphicsScene>
 #include <QGraphicsItem>
+#include <QVector>
+#include "slabpool.h"
+#include "spatialindex.h"
+
+//Every command takes an optional SpatialIndex and keeps it in sync with the scene.
+
+/*********************** Command Base ***********************/
+//Reports what a command keeps alive so UndoHistory can budget by bytes.
+//Add and delete commands own their item while it is out of the scene (undone add,
+//done delete) and delete it when they are dropped from the history in that state.
+//Commands come from per-thread pools by size class, so create and delete them on
+//the thread of the history they belong to.
+class CadCommand : public QUndoCommand{
+public:
+    enum Id { MoveShapeId = 1, ResizeShapeId };
+
+    using QUndoCommand::QUndoCommand;
+
+    static void *operator new(size_t size) { return SizeClassPool::Allocate(size); }
+    static void operator delete(void *object, size_t size) { SizeClassPool::Free(object, size); }
+    virtual qint64 MemoryCost() const = 0;
+    //shapes redo() and undo() touch, compared before and after for the edit journal
+    virtual QVector<QGraphicsItem *> AffectedItems() const = 0;
+
+protected:
+    //fixed part of every command: the object, QUndoCommand's private data and text
+    static constexpr qint64 CommandOverhead = 192;
+    //a detached scene item with its private data and geometry
+    static constexpr qint64 ItemCost = 320;
+};
 
 /*********************** Add Shape Command ***********************/
-class AddShapeCommand : public QUndoCommand{
+class AddShapeCommand : public CadCommand{
 public:
-    AddShapeCommand(QGraphicsScene *scene, QGraphicsItem *item);
+    AddShapeCommand(QGraphicsScene *scene, QGraphicsItem *item, SpatialIndex *index = nullptr);
+    ~AddShapeCommand();
     void redo() override;
     void undo() override;
+    qint64 MemoryCost() const override;
+    QVector<QGraphicsItem *> AffectedItems() const override;
 
 private:
     QGraphicsScene *scene;
     QGraphicsItem *item;
+    SpatialIndex *index;
+    bool done = false;
 };
 
 /*********************** Delete Shape Command ***********************/
-class DeleteShapeCommand : public QUndoCommand{
+class DeleteShapeCommand : public CadCommand{
 public:
-    DeleteShapeCommand(QGraphicsScene *scene, QGraphicsItem *item);
+    DeleteShapeCommand(QGraphicsScene *scene, QGraphicsItem *item, SpatialIndex *index = nullptr);
+    ~DeleteShapeCommand();
     void redo() override;
     void undo() override;
+    qint64 MemoryCost() const override;
+    QVector<QGraphicsItem *> AffectedItems() const override;
 
 private:
     QGraphicsScene *scene;
     QGraphicsItem *item;
+    SpatialIndex *index;
+    bool done = false;
 };
 
 /*********************** Move Shape Command ***********************/
-class MoveShapeCommand : public QUndoCommand{
+//Consecutive moves of the same shape merge into one step.
+class MoveShapeCommand : public CadCommand{
 public:
-    MoveShapeCommand(QGraphicsItem *item, const QPointF &oldPos, const QPointF &newPos);
+    MoveShapeCommand(QGraphicsItem *item, const QPointF &oldPos, const QPointF &newPos, SpatialIndex *index = nullptr);
     void redo() override;
     void undo() override;
+    int id() const override { return MoveShapeId; }
+    bool mergeWith(const QUndoCommand *other) override;
+    qint64 MemoryCost() const override;
+    QVector<QGraphicsItem *> AffectedItems() const override;
 
 private:
     QGraphicsItem *item;
     QPointF oldPos, newPos;
+    SpatialIndex *index;
 };
 
 /*********************** Resize Shape Command ***********************/
-class ResizeShapeCommand : public QUndoCommand{
+//Consecutive resizes of the same shape merge into one step.
+class ResizeShapeCommand : public CadCommand{
 public:
-    ResizeShapeCommand(QGraphicsItem *item, const QRectF &oldRect, const QRectF &newRect);
+    ResizeShapeCommand(QGraphicsItem *item, const QRectF &oldRect, const QRectF &newRect, SpatialIndex *index = nullptr);
     void redo() override;
     void undo() override;
+    int id() const override { return ResizeShapeId; }
+    bool mergeWith(const QUndoCommand *other) override;
+    qint64 MemoryCost() const override;
+    QVector<QGraphicsItem *> AffectedItems() const override;
 
 private:
     QGraphicsItem *item;
     QRectF oldRect, newRect;
+    SpatialIndex *index;
+};
+
+/*********************** Add Shapes Command ***********************/
+//Adds N shapes as one undo step, e.g. duplicating a selection.
+class AddShapesCommand : public CadCommand{
+public:
+    AddShapesCommand(QGraphicsScene *scene, const QVector<QGraphicsItem *> &items, SpatialIndex *index = nullptr);
+    ~AddShapesCommand();
+    void redo() override;
+    void undo() override;
+    qint64 MemoryCost() const override;
+    QVector<QGraphicsItem *> AffectedItems() const override;
+
+private:
+    QGraphicsScene *scene;
+    QVector<QGraphicsItem *> items;
+    SpatialIndex *index;
+    bool done = false;
+};
+
+/*********************** Delete Shapes Command ***********************/
+//Deletes N shapes as one undo step.
+class DeleteShapesCommand : public CadCommand{
+public:
+    DeleteShapesCommand(QGraphicsScene *scene, const QVector<QGraphicsItem *> &items, SpatialIndex *index = nullptr);
+    ~DeleteShapesCommand();
+    void redo() override;
+    void undo() override;
+    qint64 MemoryCost() const override;
+    QVector<QGraphicsItem *> AffectedItems() const override;
+
+private:
+    QGraphicsScene *scene;
+    QVector<QGraphicsItem *> items;
+    SpatialIndex *index;
+    bool done = false;
+};
+
+/*********************** Move Shapes Command ***********************/
+//Moves N shapes by one delta. The items sit in one contiguous array instead of
+//N commands each with its own private data.
+class MoveShapesCommand : public CadCommand{
+public:
+    MoveShapesCommand(const QVector<QGraphicsItem *> &items, const QPointF &delta, SpatialIndex *index = nullptr);
+    void redo() override;
+    void undo() override;
+    qint64 MemoryCost() const override;
+    QVector<QGraphicsItem *> AffectedItems() const override;
+
+private:
+    QVector<QGraphicsItem *> items;
+    QPointF delta;
+    SpatialIndex *index;
+
+    void Apply(const QPointF &offset);
+};
+
+/*********************** Resize Shapes Command ***********************/
+//Changes the geometry rect of N shapes. Old and new rects are interleaved in one
+//buffer, rects[2*i] and rects[2*i+1] belong to items[i].
+class ResizeShapesCommand : public CadCommand{
+public:
+    ResizeShapesCommand(const QVector<QGraphicsItem *> &items, const QVector<QRectF> &oldRects,
+                        const QVector<QRectF> &newRects, SpatialIndex *index = nullptr);
+    void redo() override;
+    void undo() override;
+    qint64 MemoryCost() const override;
+    QVector<QGraphicsItem *> AffectedItems() const override;
+
+private:
+    QVector<QGraphicsItem *> items;
+    QVector<QRectF> rects;
+    SpatialIndex *index;
+
+    void Apply(int which);
+};
+
+/*********************** Replace Shapes Command ***********************/
+//Swaps one set of shapes for another as one undo step, e.g. making a block from a
+//selection or exploding instances back into their members.
+class ReplaceShapesCommand : public CadCommand{
+public:
+    ReplaceShapesCommand(QGraphicsScene *scene, const QVector<QGraphicsItem *> &removed,
+                         const QVector<QGraphicsItem *> &added, SpatialIndex *index = nullptr);
+    ~ReplaceShapesCommand();
+    void redo() override;
+    void undo() override;
+    qint64 MemoryCost() const override;
+    QVector<QGraphicsItem *> AffectedItems() const override;
+
+private:
+    QGraphicsScene *scene;
+    QVector<QGraphicsItem *> removed;
+    QVector<QGraphicsItem *> added;
+    SpatialIndex *index;
+    bool done = false;
+
+    void Swap(const QVector<QGraphicsItem *> &out, const QVector<QGraphicsItem *> &in);
+};
+
+/*********************** Change Layer Command ***********************/
+//Moves N shapes onto one layer as one undo step, each goes back to its own layer on undo.
+class ChangeLayerCommand : public CadCommand{
+public:
+    ChangeLayerCommand(const QVector<QGraphicsItem *> &items, quint16 layer, SpatialIndex *index = nullptr);
+    void redo() override;
+    void undo() override;
+    qint64 MemoryCost() const override;
+    QVector<QGraphicsItem *> AffectedItems() const override;
+
+private:
+    QVector<QGraphicsItem *> items;
+    QVector<quint16> oldLayers;
+    quint16 layer;
+    SpatialIndex *index;
 };
 
 #endif // COMMANDS_H
@@ -0,0 +1,324 @@
+#include "drawinganalyzer.h"
+#include "workstealingpool.h"
+#include <QElapsedTimer>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CAD_ANALYZER_SSE2
+#endif
+
+namespace {
+
+constexpr int Lanes = 4;
+constexpr qsizetype SweepBlock = 4096; // sorted boxes per sweep task
+
+//Sorted structure-of-arrays view of the shapes taking part in one sweep
+struct SweepSet{
+    std::vector<double> minX, minY, maxX, maxY;
+    std::vector<double> x1, y1, x2, y2; // segment coordinates, lines only
+    std::vector<qint32> owner;          // index into the input list
+
+    void Resize(size_t count)
+    {
+        for(std::vector<double> *column : { &minX, &minY, &maxX, &maxY, &x1, &y1, &x2, &y2 }) column->resize(count);
+        owner.resize(count);
+    }
+    size_t Size() const { return owner.size(); }
+};
+
+using PairList = std::vector<QPair<qint32, qint32>>;
+
+/*********************** Batched Tests ***********************/
+//bit k set when candidate k's [minY, maxY] meets [lo, hi]; strict excludes touching
+int OverlapMask(const double *minY, const double *maxY, double lo, double hi, bool strict)
+{
+#ifdef CAD_ANALYZER_SSE2
+    const __m128d hiV = _mm_set1_pd(hi);
+    const __m128d loV = _mm_set1_pd(lo);
+    const __m128d minA = _mm_loadu_pd(minY), minB = _mm_loadu_pd(minY + 2);
+    const __m128d maxA = _mm_loadu_pd(maxY), maxB = _mm_loadu_pd(maxY + 2);
+    __m128d a, b;
+    if(strict){
+        a = _mm_and_pd(_mm_cmplt_pd(minA, hiV), _mm_cmpgt_pd(maxA, loV));
+        b = _mm_and_pd(_mm_cmplt_pd(minB, hiV), _mm_cmpgt_pd(maxB, loV));
+    }
+    else{
+        a = _mm_and_pd(_mm_cmple_pd(minA, hiV), _mm_cmpge_pd(maxA, loV));
+        b = _mm_and_pd(_mm_cmple_pd(minB, hiV), _mm_cmpge_pd(maxB, loV));
+    }
+    return _mm_movemask_pd(a) | (_mm_movemask_pd(b) << 2);
+#else
+    int mask = 0;
+    for(int k = 0; k < Lanes; ++k){
+        const bool hit = strict ? (minY[k] < hi && maxY[k] > lo) : (minY[k] <= hi && maxY[k] >= lo);
+        mask |= int(hit) << k;
+    }
+    return mask;
+#endif
+}
+
+//bit k set when segment (ax,ay)-(bx,by) properly crosses candidate segment k;
+//fixed-width branch-free lanes, left to the compiler to vectorize
+int CrossMask(double ax, double ay, double bx, double by,
+              const double *cx, const double *cy, const double *dx, const double *dy)
+{
+    const double ex = bx - ax, ey = by - ay;
+    int mask = 0;
+    for(int k = 0; k < Lanes; ++k){
+        const double fx = dx[k] - cx[k], fy = dy[k] - cy[k];
+        const double d1 = ex * (cy[k] - ay) - ey * (cx[k] - ax);
+        const double d2 = ex * (dy[k] - ay) - ey * (dx[k] - ax);
+        const double d3 = fx * (ay - cy[k]) - fy * (ax - cx[k]);
+        const double d4 = fx * (by - cy[k]) - fy * (bx - cx[k]);
+        mask |= int((d1 * d2 < 0) & (d3 * d4 < 0)) << k;
+    }
+    return mask;
+}
+
+/*********************** Sweep ***********************/
+SweepSet BuildSweepSet(const QVector<ShapeData> &shapes, const std::vector<qint32> &members, bool segments)
+{
+    //sort by left edge, ties by input order so the result doesn't depend on the sort
+    std::vector<double> left(members.size());
+    for(size_t i = 0; i < members.size(); ++i){
+        const ShapeData &shape = shapes[members[i]];
+        left[i] = segments ? qMin(shape.line.x1(), shape.line.x2()) : shape.rect.normalized().left();
+    }
+    std::vector<qint32> order(members.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](qint32 a, qint32 b){
+        return left[a] < left[b] || (left[a] == left[b] && members[a] < members[b]);
+    });
+
+    SweepSet set;
+    set.Resize(members.size());
+    for(size_t i = 0; i < order.size(); ++i){
+        const ShapeData &shape = shapes[members[order[i]]];
+        const QRectF box = segments ? QRectF(shape.line.p1(), shape.line.p2()).normalized() : shape.rect.normalized();
+        set.minX[i] = box.left();
+        set.minY[i] = box.top();
+        set.maxX[i] = box.right();
+        set.maxY[i] = box.bottom();
+        if(segments){
+            set.x1[i] = shape.line.x1();
+            set.y1[i] = shape.line.y1();
+            set.x2[i] = shape.line.x2();
+            set.y2[i] = shape.line.y2();
+        }
+        set.owner[i] = members[order[i]];
+    }
+    return set;
+}
+
+//pairs found by the boxes in [begin, end) of the sorted set; candidates come from
+//the whole set, but only later ones, so each pair is reported once
+void SweepRange(const SweepSet &set, size_t begin, size_t end, bool segments,
+                std::atomic<qsizetype> &found, PairList &pairs)
+{
+    const bool strict = !segments; // rectangles must share interior, lines may just touch boxes
+    for(size_t i = begin; i < end; ++i){
+        //past the cap nothing more is kept, so don't pay for the search
+        if(found.load(std::memory_order_relaxed) >= DrawingAnalyzer::MaxPairs) return;
+        const double right = set.maxX[i];
+        //candidates start before this box ends; the array is sorted on minX
+        const auto stop = strict ? std::lower_bound(set.minX.begin() + i + 1, set.minX.end(), right)
+                                 : std::upper_bound(set.minX.begin() + i + 1, set.minX.end(), right);
+        const size_t last = size_t(stop - set.minX.begin());
+        if(last == i + 1) continue;
+
+        auto report = [&](size_t j){
+            if(found.fetch_add(1, std::memory_order_relaxed) < DrawingAnalyzer::MaxPairs){
+                pairs.emplace_back(set.owner[i], set.owner[j]);
+            }
+        };
+
+        size_t j = i + 1;
+        for(; j + Lanes <= last; j += Lanes){
+            int mask = OverlapMask(&set.minY[j], &set.maxY[j], set.minY[i], set.maxY[i], strict);
+            if(strict){
+                //a box touching on its left edge lies beside, not over, for interiors
+                for(int k = 0; k < Lanes; ++k){
+                    if(set.minX[j + k] == right) mask &= ~(1 << k);
+                }
+            }
+            if(mask && segments){
+                mask &= CrossMask(set.x1[i], set.y1[i], set.x2[i], set.y2[i],
+                                  &set.x1[j], &set.y1[j], &set.x2[j], &set.y2[j]);
+            }
+            for(int k = 0; mask; ++k, mask >>= 1){
+                if(mask & 1) report(j + k);
+            }
+        }
+        //tail: pad to a full batch from a local copy
+        if(j < last){
+            double minY[Lanes], maxY[Lanes], x1[Lanes], y1[Lanes], x2[Lanes], y2[Lanes];
+            const size_t count = last - j;
+            for(size_t k = 0; k < size_t(Lanes); ++k){
+                const size_t at = k < count ? j + k : j;
+                minY[k] = set.minY[at];
+                maxY[k] = set.maxY[at];
+                if(segments){
+                    x1[k] = set.x1[at];
+                    y1[k] = set.y1[at];
+                    x2[k] = set.x2[at];
+                    y2[k] = set.y2[at];
+                }
+            }
+            int mask = OverlapMask(minY, maxY, set.minY[i], set.maxY[i], strict) & ((1 << count) - 1);
+            if(mask && segments) mask &= CrossMask(set.x1[i], set.y1[i], set.x2[i], set.y2[i], x1, y1, x2, y2);
+            for(size_t k = 0; k < count; ++k){
+                if(!(mask & (1 << k))) continue;
+                if(strict && set.minX[j + k] == right) continue;
+                report(j + k);
+            }
+        }
+    }
+}
+
+void Sweep(WorkStealingPool &pool, const SweepSet &set, bool segments, std::vector<PairList> &blocks,
+           std::atomic<qsizetype> &found)
+{
+    const qsizetype blockCount = (qsizetype(set.Size()) + SweepBlock - 1) / SweepBlock;
+    blocks.resize(blockCount);
+    for(qsizetype block = 0; block < blockCount; ++block){
+        pool.Submit([&set, &blocks, &found, segments, block]{
+            const size_t begin = size_t(block * SweepBlock);
+            const size_t end = qMin(set.Size(), begin + size_t(SweepBlock));
+            SweepRange(set, begin, end, segments, found, blocks[block]);
+        });
+    }
+}
+
+/*********************** Per-shape Checks ***********************/
+//geometry as four doubles, lines as endpoints and the rest as x, y, width, height
+void Coordinates(const ShapeData &shape, double (&values)[4])
+{
+    if(shape.type == ShapeType::Line){
+        values[0] = shape.line.x1();
+        values[1] = shape.line.y1();
+        values[2] = shape.line.x2();
+        values[3] = shape.line.y2();
+    }
+    else{
+        values[0] = shape.rect.x();
+        values[1] = shape.rect.y();
+        values[2] = shape.rect.width();
+        values[3] = shape.rect.height();
+    }
+}
+
+QVector<qint32> FindDuplicates(const QVector<ShapeData> &shapes)
+{
+    std::vector<qint32> order(shapes.size());
+    std::iota(order.begin(), order.end(), 0);
+    auto less = [&shapes](qint32 a, qint32 b){
+        if(shapes[a].type != shapes[b].type) return shapes[a].type < shapes[b].type;
+        double va[4], vb[4];
+        Coordinates(shapes[a], va);
+        Coordinates(shapes[b], vb);
+        for(int k = 0; k < 4; ++k){
+            if(va[k] != vb[k]) return va[k] < vb[k];
+        }
+        //polylines over the same box are told apart by their vertices
+        const Polyline &pa = shapes[a].polyline, &pb = shapes[b].polyline;
+        if(pa.Size() != pb.Size()) return pa.Size() < pb.Size();
+        if(pa.Hash() != pb.Hash()) return pa.Hash() < pb.Hash();
+        //block instances by definition
+        const std::less<const void *> before;
+        if(shapes[a].block != shapes[b].block) return before(shapes[a].block.Key(), shapes[b].block.Key());
+        return a < b; // first copy in drawing order stays the original
+    };
+    std::sort(order.begin(), order.end(), less);
+
+    QVector<qint32> duplicates;
+    for(size_t i = 1; i < order.size(); ++i){
+        double va[4], vb[4];
+        Coordinates(shapes[order[i - 1]], va);
+        Coordinates(shapes[order[i]], vb);
+        if(shapes[order[i - 1]].type == shapes[order[i]].type && std::equal(va, va + 4, vb)
+           && shapes[order[i - 1]].polyline == shapes[order[i]].polyline && shapes[order[i - 1]].block == shapes[order[i]].block){
+            duplicates.append(order[i]);
+        }
+    }
+    std::sort(duplicates.begin(), duplicates.end());
+    return duplicates;
+}
+
+}
+
+/*********************** Analysis ***********************/
+DrawingAnalyzer::Report DrawingAnalyzer::Analyze(const QVector<ShapeData> &shapes, int threadCount)
+{
+    QElapsedTimer timer;
+    timer.start();
+    Report report;
+
+    //one pass for the extent, zero-size shapes and the sweep members
+    std::vector<qint32> lines;
+    std::vector<qint32> rectangles;
+    double left = std::numeric_limits<double>::max(), top = left;
+    double right = std::numeric_limits<double>::lowest(), bottom = right;
+    for(qint32 i = 0; i < shapes.size(); ++i){
+        const ShapeData &shape = shapes[i];
+        const QRectF box = shape.type == ShapeType::Line ? QRectF(shape.line.p1(), shape.line.p2()).normalized()
+                                                         : shape.rect.normalized();
+        left = qMin(left, box.left());
+        top = qMin(top, box.top());
+        right = qMax(right, box.right());
+        bottom = qMax(bottom, box.bottom());
+
+        bool zero;
+        if(shape.type == ShapeType::Line) zero = shape.line.p1() == shape.line.p2();
+        //a straight horizontal or vertical trace is still a polyline with length
+        else if(shape.type == ShapeType::Polyline) zero = shape.polyline.Size() < 2 || (box.width() == 0 && box.height() == 0);
+        else if(shape.type == ShapeType::Block) zero = shape.block.ShapeCount() == 0 || (box.width() == 0 && box.height() == 0);
+        else zero = box.width() == 0 || box.height() == 0;
+        if(zero) report.zeroSize.append(i);
+        else if(shape.type == ShapeType::Line) lines.push_back(i);
+        else if(shape.type == ShapeType::Rectangle) rectangles.push_back(i);
+    }
+    if(!shapes.isEmpty()) report.extent = QRectF(QPointF(left, top), QPointF(right, bottom));
+
+    WorkStealingPool pool(threadCount);
+
+    //duplicates are a sort of their own, run beside the sorts for the sweeps
+    QVector<qint32> duplicates;
+    pool.Submit([&]{ duplicates = FindDuplicates(shapes); });
+    SweepSet lineSet, rectangleSet;
+    pool.Submit([&]{ lineSet = BuildSweepSet(shapes, lines, true); });
+    pool.Submit([&]{ rectangleSet = BuildSweepSet(shapes, rectangles, false); });
+    pool.Wait();
+
+    std::atomic<qsizetype> lineFound{ 0 }, rectangleFound{ 0 };
+    std::vector<PairList> lineBlocks, rectangleBlocks;
+    Sweep(pool, lineSet, true, lineBlocks, lineFound);
+    Sweep(pool, rectangleSet, false, rectangleBlocks, rectangleFound);
+    pool.Wait();
+
+    auto collect = [](const std::vector<PairList> &blocks, QVector<QPair<qint32, qint32>> &out){
+        qsizetype total = 0;
+        for(const PairList &block : blocks) total += qsizetype(block.size());
+        out.reserve(qMin(total, MaxPairs));
+        for(const PairList &block : blocks){
+            for(const auto &pair : block){
+                if(out.size() == MaxPairs) return;
+                out.append(pair);
+            }
+        }
+    };
+    collect(lineBlocks, report.crossingLines);
+    collect(rectangleBlocks, report.overlappingRectangles);
+    //the sweep gives up on the remaining boxes once a list is full, so a full list may
+    //be missing pairs even when the count never went past the cap
+    report.truncated = lineFound >= MaxPairs || rectangleFound >= MaxPairs;
+    report.duplicates = duplicates;
+
+    report.elapsedMs = timer.elapsed();
+    return report;
+}
@@ -0,0 +1,49 @@
+#ifndef DRAWINGANALYZER_H
+#define DRAWINGANALYZER_H
+
+#include <QPair>
+#include <QRectF>
+#include <QVector>
+#include "Entity.h"
+
+//Whole-drawing geometry checks: crossing lines, overlapping rectangles, exact
+//duplicates, zero-size shapes and the drawing extent.
+//
+//Shapes are copied once into structure-of-arrays form (bounds and segment
+//coordinates in separate double arrays), so the inner loops read contiguous memory
+//and test several candidates per instruction (SSE2 where available, a plain 4-lane
+//loop the compiler can vectorize elsewhere). Pair finding is sort-and-sweep: boxes
+//sorted by left edge, each box scans forward only while candidates start before
+//its right edge. Every box's scan is independent, so the sweep is split across a
+//WorkStealingPool without any shared state.
+//
+//Polylines and block instances only take part in the extent, duplicate and
+//zero-size checks.
+//
+//Results refer to shapes by their index in the input list.
+class DrawingAnalyzer
+{
+public:
+    //pair lists stop growing here, a badly broken drawing shouldn't exhaust memory
+    static constexpr qsizetype MaxPairs = 1000000;
+
+    struct Report{
+        QRectF extent;
+        QVector<QPair<qint32, qint32>> crossingLines;        // lines that properly cross
+        QVector<QPair<qint32, qint32>> overlappingRectangles; // interiors overlap
+        QVector<qint32> duplicates; // every copy after the first of an identical shape
+        QVector<qint32> zeroSize;   // zero-length lines and polylines, zero-width or -height rectangles and circles
+        bool truncated = false;     // a pair list hit MaxPairs
+        qint64 elapsedMs = 0;
+
+        qsizetype ProblemCount() const
+        {
+            return crossingLines.size() + overlappingRectangles.size() + duplicates.size() + zeroSize.size();
+        }
+    };
+
+    //threadCount <= 0 uses one thread per core
+    static Report Analyze(const QVector<ShapeData> &shapes, int threadCount = 0);
+};
+
+#endif // DRAWINGANALYZER_H
@@ -0,0 +1,331 @@
+#include "dxfimporter.h"
+#include "shapeserializer.h"
+#include "workstealingpool.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <charconv>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+/*********************** Tokenizing ***********************/
+//one line without its line break and surrounding blanks
+std::string_view NextLine(const char *&p, const char *end)
+{
+    const char *lineEnd = static_cast<const char *>(std::memchr(p, '\n', end - p));
+    if(!lineEnd) lineEnd = end;
+    const char *begin = p;
+    p = lineEnd < end ? lineEnd + 1 : end;
+
+    const char *last = lineEnd;
+    while(begin < last && (*begin == ' ' || *begin == '\t')) ++begin;
+    while(last > begin && (last[-1] == '\r' || last[-1] == ' ' || last[-1] == '\t')) --last;
+    return std::string_view(begin, last - begin);
+}
+
+bool ReadPair(const char *&p, const char *end, int &code, std::string_view &value)
+{
+    if(p >= end) return false;
+    const std::string_view codeLine = NextLine(p, end);
+    if(std::from_chars(codeLine.data(), codeLine.data() + codeLine.size(), code).ec != std::errc()) return false;
+    value = NextLine(p, end);
+    return true;
+}
+
+bool ParseDouble(std::string_view text, double &value)
+{
+    return std::from_chars(text.data(), text.data() + text.size(), value).ec == std::errc();
+}
+
+bool StartsWithLetter(std::string_view text)
+{
+    return !text.empty() && ((text[0] >= 'A' && text[0] <= 'Z') || (text[0] >= 'a' && text[0] <= 'z'));
+}
+
+//start of the first top-level entity at or after p; VERTEX and SEQEND belong to the
+//POLYLINE before them and never start a chunk
+const char *AlignToEntity(const char *p, const char *end)
+{
+    while(p < end){
+        const char *lineStart = p;
+        if(NextLine(p, end) != "0") continue;
+        const char *peek = p;
+        const std::string_view name = NextLine(peek, end);
+        if(StartsWithLetter(name) && name != "VERTEX" && name != "SEQEND") return lineStart;
+    }
+    return end;
+}
+
+//first byte after the "2 / ENTITIES" pair, nullptr if the file has no such section
+const char *FindEntities(const char *p, const char *end)
+{
+    int code = 0;
+    std::string_view value;
+    bool sectionStart = false;
+    while(ReadPair(p, end, code, value)){
+        if(code == 0) sectionStart = value == "SECTION";
+        else if(code == 2 && sectionStart && value == "ENTITIES") return p;
+        else sectionStart = false;
+    }
+    return nullptr;
+}
+
+/*********************** Entities ***********************/
+struct ChunkResult{
+    QVector<ShapeData> shapes;
+    DxfImporter::Stats stats;
+    bool sawEnd = false;
+};
+
+class ChunkParser
+{
+public:
+    explicit ChunkParser(ChunkResult &result) : result(result) {}
+
+    void Parse(const char *p, const char *end)
+    {
+        int code = 0;
+        std::string_view value;
+        while(p < end && ReadPair(p, end, code, value)){
+            if(code == 0){
+                if(!Begin(value)){
+                    result.sawEnd = true;
+                    break;
+                }
+                continue;
+            }
+            Field(code, value);
+        }
+        Emit();
+    }
+
+private:
+    enum class Kind { None, Line, Circle, LwPolyline, Polyline, Unsupported };
+
+    ChunkResult &result;
+    Kind kind = Kind::None;
+    bool inVertex = false;   // R12: group codes belong to the current VERTEX
+    bool malformed = false;
+    double x1 = 0, y1 = 0, x2 = 0, y2 = 0, radius = 0;
+    int seen = 0;            // bit per coordinate field read
+    bool closed = false;
+    std::vector<QPointF> vertices;
+
+    //returns false at the end of the section
+    bool Begin(std::string_view name)
+    {
+        if(kind == Kind::Polyline && name == "VERTEX"){
+            vertices.emplace_back();
+            inVertex = true;
+            return true;
+        }
+        if(kind == Kind::Polyline && name == "SEQEND"){
+            Emit();
+            return true;
+        }
+
+        Emit();
+        if(name == "ENDSEC" || name == "EOF") return false;
+
+        ++result.stats.entities;
+        if(name == "LINE") kind = Kind::Line;
+        else if(name == "CIRCLE") kind = Kind::Circle;
+        else if(name == "LWPOLYLINE") kind = Kind::LwPolyline;
+        else if(name == "POLYLINE") kind = Kind::Polyline;
+        else kind = Kind::Unsupported;
+        return true;
+    }
+
+    void Field(int code, std::string_view value)
+    {
+        if(kind == Kind::None || kind == Kind::Unsupported) return;
+
+        if(code == 70 && !inVertex){
+            int flags = 0;
+            std::from_chars(value.data(), value.data() + value.size(), flags);
+            closed = flags & 1;
+            return;
+        }
+        if(code != 10 && code != 20 && code != 11 && code != 21 && code != 40) return;
+
+        double number = 0;
+        if(!ParseDouble(value, number)){
+            malformed = true;
+            return;
+        }
+
+        if(kind == Kind::LwPolyline || kind == Kind::Polyline){
+            //R12 POLYLINE carries a dummy 10/20/30 point of its own, only VERTEX ones count
+            if(kind == Kind::Polyline && !inVertex) return;
+            if(code == 10){
+                if(kind == Kind::LwPolyline) vertices.emplace_back();
+                if(!vertices.empty()) vertices.back().setX(number);
+            }
+            else if(code == 20 && !vertices.empty()){
+                vertices.back().setY(-number);
+            }
+            return;
+        }
+
+        switch(code){
+            case 10: x1 = number; seen |= 1; break;
+            case 20: y1 = -number; seen |= 2; break;
+            case 11: x2 = number; seen |= 4; break;
+            case 21: y2 = -number; seen |= 8; break;
+            case 40: radius = number; seen |= 16; break;
+        }
+    }
+
+    void Emit()
+    {
+        switch(kind){
+            case Kind::None:
+                break;
+            case Kind::Line:
+                if(!malformed && seen == (1 | 2 | 4 | 8)){
+                    ShapeData shape;
+                    shape.type = ShapeType::Line;
+                    shape.line = QLineF(x1, y1, x2, y2);
+                    result.shapes.append(shape);
+                }
+                else ++result.stats.skipped;
+                break;
+            case Kind::Circle:
+                if(!malformed && seen == (1 | 2 | 16) && radius > 0){
+                    ShapeData shape;
+                    shape.type = ShapeType::Circle;
+                    shape.rect = QRectF(x1 - radius, y1 - radius, 2 * radius, 2 * radius);
+                    result.shapes.append(shape);
+                }
+                else ++result.stats.skipped;
+                break;
+            case Kind::LwPolyline:
+            case Kind::Polyline:
+                if(!malformed && vertices.size() >= 2) EmitPolyline();
+                else ++result.stats.skipped;
+                break;
+            case Kind::Unsupported:
+                ++result.stats.skipped;
+                break;
+        }
+
+        kind = Kind::None;
+        inVertex = false;
+        malformed = false;
+        seen = 0;
+        closed = false;
+        vertices.clear();
+    }
+
+    void EmitPolyline()
+    {
+        if(closed && vertices.size() == 4 && IsAxisAlignedBox()){
+            ShapeData shape;
+            shape.type = ShapeType::Rectangle;
+            shape.rect = QRectF(vertices[0], vertices[2]).normalized();
+            result.shapes.append(shape);
+            return;
+        }
+
+        ShapeData shape;
+        if(!closed && vertices.size() == 2){
+            shape.type = ShapeType::Line;
+            shape.line = QLineF(vertices[0], vertices[1]);
+            result.shapes.append(shape);
+            return;
+        }
+
+        //the shape has no closed flag, a closed outline repeats its first vertex
+        QVector<QPointF> points(vertices.begin(), vertices.end());
+        if(closed) points.append(vertices.front());
+        if(ShapeSerializer::MakePolyline(points, shape)) result.shapes.append(shape);
+    }
+
+    bool IsAxisAlignedBox() const
+    {
+        //consecutive edges alternate between horizontal and vertical, starting with either
+        auto horizontal = [this](size_t i){ return vertices[i].y() == vertices[(i + 1) % 4].y(); };
+        auto vertical = [this](size_t i){ return vertices[i].x() == vertices[(i + 1) % 4].x(); };
+        const bool startsHorizontal = horizontal(0) && vertical(1) && horizontal(2) && vertical(3);
+        const bool startsVertical = vertical(0) && horizontal(1) && vertical(2) && horizontal(3);
+        return startsHorizontal || startsVertical;
+    }
+};
+
+}
+
+/*********************** Loading ***********************/
+bool DxfImporter::IsDxfPath(const QString &filePath)
+{
+    return QFileInfo(filePath).suffix().compare("dxf", Qt::CaseInsensitive) == 0;
+}
+
+bool DxfImporter::Load(const QString &filePath, QVector<ShapeData> &shapes, Stats *stats, int threadCount)
+{
+    QFile file(filePath);
+    if(!file.open(QIODevice::ReadOnly)) return false;
+    if(file.size() == 0) return false;
+
+    //the mapping stays valid after close; unmapped when the QFile is destroyed
+    const uchar *data = file.map(0, file.size());
+    if(data) return Decode(reinterpret_cast<const char *>(data), file.size(), shapes, stats, threadCount);
+
+    const QByteArray contents = file.readAll();
+    return Decode(contents.constData(), contents.size(), shapes, stats, threadCount);
+}
+
+bool DxfImporter::Decode(const char *data, qint64 size, QVector<ShapeData> &shapes, Stats *stats, int threadCount)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    const char *end = data + size;
+    const char *section = FindEntities(data, end);
+    if(!section) return false;
+
+    WorkStealingPool pool(threadCount);
+
+    //cut points are rough byte offsets snapped forward to the next entity start; the
+    //section end isn't searched for up front, each chunk stops at ENDSEC on its own
+    const qint64 span = end - section;
+    const int chunkCount = int(qBound<qint64>(1, span / MinChunkSize, pool.ThreadCount() * 8));
+    std::vector<const char *> cuts(chunkCount + 1);
+    cuts[0] = section;
+    cuts[chunkCount] = end;
+    pool.ParallelFor(chunkCount - 1, 1, [&](qsizetype i){
+        cuts[i + 1] = AlignToEntity(section + span * (i + 1) / chunkCount, end);
+    });
+
+    std::vector<ChunkResult> chunks(chunkCount);
+    pool.ParallelFor(chunkCount, 1, [&](qsizetype i){
+        if(cuts[i] >= cuts[i + 1]) return;
+        ChunkParser parser(chunks[i]);
+        parser.Parse(cuts[i], cuts[i + 1]);
+    });
+
+    //chunks after the one that reached ENDSEC hold later sections, not entities
+    Stats total;
+    qsizetype shapeCount = 0;
+    int used = 0;
+    for(const ChunkResult &chunk : chunks){
+        shapeCount += chunk.shapes.size();
+        ++used;
+        if(chunk.sawEnd) break;
+    }
+    shapes.clear();
+    shapes.reserve(shapeCount);
+    for(int i = 0; i < used; ++i){
+        shapes.append(chunks[i].shapes);
+        total.entities += chunks[i].stats.entities;
+        total.skipped += chunks[i].stats.skipped;
+    }
+
+    total.bytes = size;
+    total.chunks = used;
+    total.elapsedMs = timer.elapsed();
+    if(stats) *stats = total;
+    return true;
+}
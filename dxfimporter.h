@@ -0,0 +1,42 @@
+#ifndef DXFIMPORTER_H
+#define DXFIMPORTER_H
+
+#include <QString>
+#include <QVector>
+#include "Entity.h"
+
+//Native reader for the ENTITIES section of ASCII DXF files.
+//
+//The file is memory-mapped and the ENTITIES section cut into chunks at entity
+//boundaries: a group code line "0" is recognised by the line after it starting
+//with a letter, since a value is always followed by a numeric code. Chunks are
+//parsed on a WorkStealingPool and joined in file order, so shape order matches the
+//file whatever the thread count.
+//
+//Supported: LINE, CIRCLE, LWPOLYLINE and R12 POLYLINE/VERTEX/SEQEND (what
+//ShapeExporter writes). Polylines become one polyline shape, except closed
+//axis-aligned four-vertex ones, which become rectangles, and open two-vertex ones,
+//which become lines; arc bulges are read as straight segments. Other entities are counted and skipped. DXF's y axis points
+//up, so y is negated to match the scene.
+class DxfImporter
+{
+public:
+    struct Stats{
+        qsizetype entities = 0;   // entities read, supported or not
+        qsizetype skipped = 0;    // unsupported or malformed entities
+        qint64 bytes = 0;
+        qint64 elapsedMs = 0;
+        int chunks = 0;
+    };
+
+    static constexpr qint64 MinChunkSize = 4 * 1024 * 1024;
+
+    static bool IsDxfPath(const QString &filePath);
+
+    //threadCount <= 0 uses one thread per core
+    static bool Load(const QString &filePath, QVector<ShapeData> &shapes, Stats *stats = nullptr, int threadCount = 0);
+    //parses a whole DXF held in memory, used by Load and by callers that map files themselves
+    static bool Decode(const char *data, qint64 size, QVector<ShapeData> &shapes, Stats *stats = nullptr, int threadCount = 0);
+};
+
+#endif // DXFIMPORTER_H
@@ -0,0 +1,596 @@
+#include "editjournal.h"
+#include "binarydocument.h"
+#include <QFileInfo>
+#include <QHash>
+#include <QSaveFile>
+#include <QtEndian>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+constexpr quint16 HeaderSize = 32;
+constexpr qint64 RecordSize = 72;
+constexpr qsizetype FlushBytes = 64 * 1024;
+constexpr int FlushIntervalMs = 1000;
+//record[3] flags: a vertex or block definition payload follows the record, and
+//(version 5) the key payload with the rest of what identifies the before shape
+constexpr quint8 HasVertices = 0x01;
+constexpr quint8 HasDefinition = 0x02;
+constexpr quint8 HasBeforeKey = 0x04;
+//vertex payload header: u32 vertex count, u8 encoding, u8 reserved, u16 CRC-16 of the vertices, u64 reserved;
+//definition payload header: u64 size, u16 CRC-16 of the definition, 6 bytes reserved
+constexpr qint64 PayloadHeaderSize = 16;
+//key payload: u16 layer, u16 CRC-16 of the other 14 bytes, 4 bytes reserved, u64 content hash
+constexpr qint64 KeySize = 16;
+
+qint64 Align8(qint64 value) { return (value + 7) & ~qint64(7); }
+
+void PutDouble(uchar *dst, double value)
+{
+    quint64 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    qToLittleEndian(bits, dst);
+}
+
+double GetDouble(const uchar *src)
+{
+    const quint64 bits = qFromLittleEndian<quint64>(src);
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void PutShape(uchar *dst, const ShapeData &shape)
+{
+    if(shape.type == ShapeType::Line){
+        PutDouble(dst,      shape.line.x1());
+        PutDouble(dst + 8,  shape.line.y1());
+        PutDouble(dst + 16, shape.line.x2());
+        PutDouble(dst + 24, shape.line.y2());
+    } else {
+        PutDouble(dst,      shape.rect.x());
+        PutDouble(dst + 8,  shape.rect.y());
+        PutDouble(dst + 16, shape.rect.width());
+        PutDouble(dst + 24, shape.rect.height());
+    }
+}
+
+ShapeData GetShape(const uchar *src, quint8 type)
+{
+    ShapeData shape;
+    shape.type = ShapeType(type);
+    const double a = GetDouble(src);
+    const double b = GetDouble(src + 8);
+    const double c = GetDouble(src + 16);
+    const double d = GetDouble(src + 24);
+    if(shape.type == ShapeType::Line) shape.line = QLineF(a, b, c, d);
+    else shape.rect = QRectF(a, b, c, d);
+    return shape;
+}
+
+//the vertex payload after a record, returns its size or -1 when it is torn or corrupt
+qint64 ReadVertices(const uchar *src, qint64 available, Polyline &polyline)
+{
+    if(available < PayloadHeaderSize) return -1;
+    const quint32 count = qFromLittleEndian<quint32>(src);
+    const Polyline::Encoding encoding = Polyline::Encoding(src[4]);
+    const qint64 size = Polyline::EncodedSize(count, encoding);
+    if(PayloadHeaderSize + Align8(size) > available) return -1;
+    if(qFromLittleEndian<quint16>(src + 6) != qChecksum(QByteArrayView(src + PayloadHeaderSize, size))) return -1;
+
+    polyline = Polyline::Decode(src + PayloadHeaderSize, count, encoding);
+    return polyline.IsNull() ? -1 : PayloadHeaderSize + Align8(size);
+}
+
+//the block definition payload after a record, returns its size or -1 when it is torn or corrupt;
+//records of one definition carry identical bytes, so seen maps them back to one shared Block
+qint64 ReadDefinition(const uchar *src, qint64 available, QHash<QByteArray, Block> &seen, Block &block)
+{
+    if(available < PayloadHeaderSize) return -1;
+    const quint64 size = qFromLittleEndian<quint64>(src);
+    if(size > quint64(available - PayloadHeaderSize) || PayloadHeaderSize + Align8(qint64(size)) > available) return -1;
+    const QByteArray bytes(reinterpret_cast<const char *>(src + PayloadHeaderSize), qsizetype(size));
+    if(qFromLittleEndian<quint16>(src + 8) != qChecksum(bytes)) return -1;
+
+    auto it = seen.constFind(bytes);
+    if(it != seen.constEnd()){
+        block = it.value();
+    }
+    else{
+        block = BinaryDocument::DecodeBlock(src + PayloadHeaderSize, qint64(size));
+        if(block.IsNull()) return -1;
+        seen.insert(bytes, block);
+    }
+    return PayloadHeaderSize + Align8(qint64(size));
+}
+
+quint64 Fnv1a(quint64 hash, const void *data, size_t size)
+{
+    const uchar *bytes = static_cast<const uchar *>(data);
+    for(size_t i = 0; i < size; ++i){
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+//what tells apart shapes with the same type and rect: the vertices of a polyline,
+//the definition of a block instance (by its encoded bytes, the same in every
+//session); blocks maps definitions already hashed to their hash
+quint64 ContentHash(const ShapeData &shape, QHash<const void *, std::pair<Block, quint64>> &blocks)
+{
+    if(shape.type == ShapeType::Polyline) return shape.polyline.Hash();
+    if(shape.type != ShapeType::Block || shape.block.IsNull()) return 0;
+
+    auto it = blocks.find(shape.block.Key());
+    if(it == blocks.end()){
+        //the Block is kept so its address can't be reused by another definition
+        const QByteArray encoded = BinaryDocument::EncodeBlock(shape.block);
+        it = blocks.insert(shape.block.Key(), { shape.block, Fnv1a(14695981039346656037ull, encoded.constData(), size_t(encoded.size())) });
+    }
+    return it.value().second;
+}
+
+quint16 KeyChecksum(const uchar *key)
+{
+    uchar copy[KeySize];
+    std::memcpy(copy, key, KeySize);
+    copy[2] = copy[3] = 0;
+    return qChecksum(QByteArrayView(copy, KeySize));
+}
+
+quint16 RecordChecksum(const uchar *record)
+{
+    //everything but the checksum field itself
+    uchar copy[RecordSize];
+    std::memcpy(copy, record, RecordSize);
+    copy[4] = copy[5] = 0;
+    return qChecksum(QByteArrayView(copy, RecordSize));
+}
+
+//exact geometry, layer and content, used to find the shape a record refers to;
+//records from before version 5 know only the geometry and are matched loosely
+struct GeometryKey{
+    ShapeType type;
+    double a, b, c, d;
+    quint16 layer = 0;
+    quint64 content = 0;
+
+    GeometryKey(const ShapeData &shape, quint64 content) : type(shape.type), layer(shape.layer), content(content)
+    {
+        if(shape.type == ShapeType::Line){
+            a = shape.line.x1(); b = shape.line.y1(); c = shape.line.x2(); d = shape.line.y2();
+        } else {
+            a = shape.rect.x(); b = shape.rect.y(); c = shape.rect.width(); d = shape.rect.height();
+        }
+    }
+    GeometryKey Loose() const
+    {
+        GeometryKey key = *this;
+        key.layer = 0;
+        key.content = 0;
+        return key;
+    }
+    bool operator==(const GeometryKey &other) const
+    {
+        return type == other.type && a == other.a && b == other.b && c == other.c && d == other.d
+            && layer == other.layer && content == other.content;
+    }
+};
+
+size_t qHash(const GeometryKey &key, size_t seed)
+{
+    return qHashMulti(seed, int(key.type), key.a, key.b, key.c, key.d, key.layer, key.content);
+}
+
+} // namespace
+
+EditJournal::EditJournal(QObject *parent)
+    : QObject(parent)
+{
+    flushTimer.setSingleShot(true);
+    flushTimer.setInterval(FlushIntervalMs);
+    connect(&flushTimer, &QTimer::timeout, this, [this]{ Flush(); });
+}
+
+EditJournal::~EditJournal()
+{
+    //unsaved edits stay in the file, that is what recovery reads after a crash
+    Flush();
+}
+
+QString EditJournal::JournalPath(const QString &basePath)
+{
+    return basePath + ".journal";
+}
+
+/*********************** Recording ***********************/
+void EditJournal::RecordAdd(const ShapeData &shape)
+{
+    Append(Op::Add, nullptr, &shape);
+}
+
+void EditJournal::RecordRemove(const ShapeData &shape)
+{
+    Append(Op::Remove, &shape, nullptr);
+}
+
+void EditJournal::RecordModify(const ShapeData &before, const ShapeData &after)
+{
+    Append(Op::Modify, &before, &after);
+}
+
+void EditJournal::RecordClear()
+{
+    Append(Op::Clear, nullptr, nullptr);
+}
+
+void EditJournal::Append(Op op, const ShapeData *before, const ShapeData *after)
+{
+    //a drawing that was never saved has nothing to journal against,
+    //its first save writes the whole drawing anyway
+    if(!file.isOpen() && !capturing) return;
+
+    uchar record[RecordSize] = {};
+    record[0] = quint8(op);
+    record[1] = before ? quint8(before->type) : 0;
+    record[2] = after ? quint8(after->type) : 0;
+    if(before) PutShape(record + 8, *before);
+    if(after){
+        PutShape(record + 40, *after);
+        qToLittleEndian<quint16>(after->layer, record + 6);
+    }
+
+    //the before shape's layer and content, so replay can't pick another shape that
+    //only shares its rect
+    QByteArray payload;
+    if(before){
+        record[3] |= HasBeforeKey;
+        uchar key[KeySize] = {};
+        qToLittleEndian<quint16>(before->layer, key);
+        qToLittleEndian<quint64>(ContentHash(*before, definitionHashes), key + 8);
+        qToLittleEndian<quint16>(KeyChecksum(key), key + 2);
+        payload.append(reinterpret_cast<const char *>(key), KeySize);
+    }
+
+    //a moved polyline keeps its vertices, only new vertex lists are written out
+    if(after && after->type == ShapeType::Polyline
+       && (!before || before->type != ShapeType::Polyline || before->polyline != after->polyline)){
+        record[3] |= HasVertices;
+        const qint64 size = after->polyline.EncodedSize();
+        const qsizetype start = payload.size();
+        payload.append(QByteArray(PayloadHeaderSize + Align8(size), '\0'));
+        uchar *header = reinterpret_cast<uchar *>(payload.data()) + start;
+        after->polyline.Encode(header + PayloadHeaderSize);
+        qToLittleEndian<quint32>(quint32(after->polyline.Size()), header);
+        header[4] = quint8(after->polyline.GetEncoding());
+        qToLittleEndian<quint16>(qChecksum(QByteArrayView(header + PayloadHeaderSize, size)), header + 6);
+    }
+    //the same for a block instance's definition; moves and resizes keep the one they had
+    if(after && after->type == ShapeType::Block
+       && (!before || before->type != ShapeType::Block || before->block != after->block)){
+        record[3] |= HasDefinition;
+        const QByteArray definition = BinaryDocument::EncodeBlock(after->block);
+        const qsizetype start = payload.size();
+        payload.append(QByteArray(PayloadHeaderSize + Align8(definition.size()), '\0'));
+        uchar *header = reinterpret_cast<uchar *>(payload.data()) + start;
+        std::memcpy(header + PayloadHeaderSize, definition.constData(), size_t(definition.size()));
+        qToLittleEndian<quint64>(quint64(definition.size()), header);
+        qToLittleEndian<quint16>(qChecksum(definition), header + 8);
+    }
+    qToLittleEndian<quint16>(RecordChecksum(record), record + 4);
+
+    QByteArray bytes(reinterpret_cast<const char *>(record), RecordSize);
+    bytes += payload;
+    if(file.isOpen()){
+        pending.append(bytes);
+        if(op != Op::Commit) ++changes;
+    }
+    if(capturing){
+        captured.append(bytes);
+        if(op == Op::Commit) capturedCommitEnd = captured.size();
+        else ++capturedChanges;
+    }
+
+    if(pending.size() >= FlushBytes) Flush();
+    else if(!pending.isEmpty() && !flushTimer.isActive()) flushTimer.start();
+}
+
+bool EditJournal::Flush()
+{
+    flushTimer.stop();
+    if(pending.isEmpty() || !file.isOpen()) return true;
+
+    const bool ok = file.write(pending) == pending.size() && file.flush();
+    pending.clear();
+    return ok;
+}
+
+/*********************** Attach & Commit ***********************/
+bool EditJournal::Attach(const QString &basePath, bool keepUncommitted)
+{
+    Detach();
+    this->basePath = basePath;
+
+    QVector<Record> records;
+    qint64 validEnd = 0, commitEnd = 0;
+    qsizetype commitIndex = 0;
+    if(Scan(basePath, &records, &validEnd, &commitEnd, &commitIndex)){
+        changes = keepUncommitted ? records.size() : commitIndex;
+        committedSize = commitEnd;
+        return OpenForAppend(keepUncommitted ? validEnd : commitEnd);
+    }
+
+    //no journal for this version of the file, start an empty one
+    QSaveFile out(JournalPath(basePath));
+    if(!out.open(QIODevice::WriteOnly)) return false;
+    out.write(Header(basePath));
+    if(!out.commit()) return false;
+
+    changes = 0;
+    committedSize = HeaderSize;
+    return OpenForAppend(HeaderSize);
+}
+
+bool EditJournal::OpenForAppend(qint64 size)
+{
+    file.setFileName(JournalPath(basePath));
+    if(!file.open(QIODevice::ReadWrite)) return false;
+    //drops a torn record at the end, or work that was not kept
+    file.resize(size);
+    return file.seek(size);
+}
+
+void EditJournal::Detach()
+{
+    definitionHashes.clear();
+    flushTimer.stop();
+    pending.clear();
+    if(file.isOpen()){
+        file.resize(committedSize);
+        file.close();
+    }
+    basePath.clear();
+    changes = 0;
+    committedSize = 0;
+}
+
+bool EditJournal::IsAttachedTo(const QString &basePath) const
+{
+    return file.isOpen() && this->basePath == basePath;
+}
+
+bool EditJournal::Commit()
+{
+    if(!file.isOpen()) return false;
+    Append(Op::Commit, nullptr, nullptr);
+    if(!Flush()) return false;
+    committedSize = file.pos();
+    return true;
+}
+
+/*********************** Compaction ***********************/
+void EditJournal::BeginCompaction()
+{
+    capturing = true;
+    captured.clear();
+    capturedChanges = 0;
+    capturedCommitEnd = 0;
+}
+
+bool EditJournal::FinishCompaction(const QString &basePath, bool ok)
+{
+    if(!capturing) return false;
+    capturing = false;
+    const QByteArray tail = captured;
+    const qsizetype tailChanges = capturedChanges;
+    const qint64 tailCommitEnd = capturedCommitEnd;
+    captured.clear();
+
+    if(!ok) return false; // the old base and its journal are still valid
+
+    //the base now holds everything up to the snapshot; the edits made since
+    //then start the journal for the new version of the file
+    Detach();
+    QSaveFile out(JournalPath(basePath));
+    if(!out.open(QIODevice::WriteOnly)) return false;
+    out.write(Header(basePath));
+    out.write(tail);
+    if(!out.commit()) return false;
+
+    this->basePath = basePath;
+    changes = tailChanges;
+    committedSize = HeaderSize + tailCommitEnd;
+    return OpenForAppend(HeaderSize + tail.size());
+}
+
+/*********************** Reading ***********************/
+QByteArray EditJournal::Header(const QString &basePath)
+{
+    const QFileInfo base(basePath);
+    QByteArray header(HeaderSize, '\0');
+    uchar *data = reinterpret_cast<uchar *>(header.data());
+    qToLittleEndian<quint32>(Magic, data);
+    qToLittleEndian<quint16>(Version, data + 4);
+    qToLittleEndian<quint16>(HeaderSize, data + 6);
+    qToLittleEndian<quint64>(quint64(base.size()), data + 8);
+    qToLittleEndian<qint64>(base.lastModified().toMSecsSinceEpoch(), data + 16);
+    return header;
+}
+
+bool EditJournal::Scan(const QString &basePath, QVector<Record> *records, qint64 *validEnd,
+                       qint64 *commitEnd, qsizetype *commitIndex)
+{
+    QFile in(JournalPath(basePath));
+    if(!QFileInfo::exists(basePath) || !in.open(QIODevice::ReadOnly)) return false;
+
+    const QByteArray bytes = in.readAll();
+    const uchar *data = reinterpret_cast<const uchar *>(bytes.constData());
+    if(bytes.size() < HeaderSize) return false;
+    if(qFromLittleEndian<quint32>(data) != Magic) return false;
+    if(qFromLittleEndian<quint16>(data + 4) > Version) return false;
+
+    //the journal only applies to the exact base file it was started for
+    const quint16 headerSize = qFromLittleEndian<quint16>(data + 6);
+    const QByteArray expected = Header(basePath);
+    if(headerSize < HeaderSize || headerSize > bytes.size()
+       || std::memcmp(data + 8, expected.constData() + 8, 16) != 0){
+        return false;
+    }
+
+    QHash<QByteArray, Block> definitions;
+    *validEnd = *commitEnd = headerSize;
+    *commitIndex = 0;
+    for(qint64 offset = headerSize; offset + RecordSize <= bytes.size();){
+        const uchar *record = data + offset;
+        //a crash can leave a half-written record, everything from there on is dropped
+        if(qFromLittleEndian<quint16>(record + 4) != RecordChecksum(record)) break;
+        const quint8 op = record[0];
+        if(op < quint8(Op::Add) || op > quint8(Op::Commit)) break;
+        if(record[1] >= ShapeTypeCount || record[2] >= ShapeTypeCount) break;
+
+        Record entry;
+        entry.op = Op(op);
+        entry.before = GetShape(record + 8, record[1]);
+        entry.after = GetShape(record + 40, record[2]);
+        entry.after.layer = qFromLittleEndian<quint16>(record + 6);
+        qint64 end = offset + RecordSize;
+        if(record[3] & HasBeforeKey){
+            const uchar *key = data + end;
+            if(end + KeySize > bytes.size() || qFromLittleEndian<quint16>(key + 2) != KeyChecksum(key)) break;
+            entry.before.layer = qFromLittleEndian<quint16>(key);
+            entry.beforeContent = qFromLittleEndian<quint64>(key + 8);
+            entry.beforeKeyed = true;
+            end += KeySize;
+        }
+        if(record[3] & HasVertices){
+            const qint64 size = ReadVertices(data + end, bytes.size() - end, entry.after.polyline);
+            if(size < 0) break;
+            end += size;
+        }
+        else if(record[3] & HasDefinition){
+            const qint64 size = ReadDefinition(data + end, bytes.size() - end, definitions, entry.after.block);
+            if(size < 0) break;
+            end += size;
+        }
+
+        *validEnd = end;
+        offset = end;
+        if(Op(op) == Op::Commit){
+            *commitEnd = *validEnd;
+            *commitIndex = records->size();
+            continue;
+        }
+        records->append(entry);
+    }
+    return true;
+}
+
+bool EditJournal::Read(const QString &basePath, QVector<Record> &committed, QVector<Record> &uncommitted)
+{
+    QVector<Record> records;
+    qint64 validEnd = 0, commitEnd = 0;
+    qsizetype commitIndex = 0;
+    if(!Scan(basePath, &records, &validEnd, &commitEnd, &commitIndex)) return false;
+
+    committed = records.mid(0, commitIndex);
+    uncommitted = records.mid(commitIndex);
+    return true;
+}
+
+qsizetype EditJournal::Apply(QVector<ShapeData> &shapes, const QVector<Record> &records)
+{
+    if(records.isEmpty()) return 0;
+
+    QHash<const void *, std::pair<Block, quint64>> blocks;
+    auto keyOf = [&blocks](const ShapeData &shape){ return GeometryKey(shape, ContentHash(shape, blocks)); };
+
+    //entries go stale when their shape is changed or removed and are checked on lookup;
+    //the loose map is only built once a record without a key turns up
+    QMultiHash<GeometryKey, qsizetype> where;
+    QMultiHash<GeometryKey, qsizetype> loose;
+    bool looseBuilt = false;
+    std::vector<bool> alive(shapes.size(), true);
+    auto add = [&](qsizetype index){
+        const GeometryKey key = keyOf(shapes.at(index));
+        where.insert(key, index);
+        if(looseBuilt) loose.insert(key.Loose(), index);
+    };
+    auto take = [&](QMultiHash<GeometryKey, qsizetype> &map, const GeometryKey &key, bool exact) -> qsizetype {
+        for(auto it = map.find(key); it != map.end() && it.key() == key;){
+            const qsizetype index = it.value();
+            it = map.erase(it);
+            if(!alive[index]) continue;
+            const GeometryKey current = keyOf(shapes.at(index));
+            if(exact ? current == key : current.Loose() == key) return index;
+        }
+        return -1;
+    };
+
+    where.reserve(shapes.size());
+    for(qsizetype i = 0; i < shapes.size(); ++i) add(i);
+    qsizetype unmatched = 0;
+
+    for(const Record &record : records){
+        switch(record.op){
+            case Op::Add:
+                shapes.append(record.after);
+                alive.push_back(true);
+                add(shapes.size() - 1);
+                break;
+            case Op::Remove:
+            case Op::Modify: {
+                qsizetype index;
+                if(record.beforeKeyed){
+                    index = take(where, GeometryKey(record.before, record.beforeContent), true);
+                }
+                else{
+                    if(!looseBuilt){
+                        loose.reserve(shapes.size());
+                        for(qsizetype i = 0; i < shapes.size(); ++i){
+                            if(alive[i]) loose.insert(keyOf(shapes.at(i)).Loose(), i);
+                        }
+                        looseBuilt = true;
+                    }
+                    index = take(loose, GeometryKey(record.before, 0).Loose(), false);
+                }
+                if(index < 0){
+                    ++unmatched;
+                    break;
+                }
+                if(record.op == Op::Remove){
+                    alive[index] = false;
+                }
+                else{
+                    //a moved polyline or block instance's record carries no vertices or
+                    //definition, it keeps the ones it had
+                    const ShapeData previous = shapes.at(index);
+                    shapes[index] = record.after;
+                    if(record.after.type == ShapeType::Polyline && record.after.polyline.IsNull()){
+                        shapes[index].polyline = previous.polyline;
+                    }
+                    if(record.after.type == ShapeType::Block && record.after.block.IsNull()){
+                        shapes[index].block = previous.block;
+                    }
+                    add(index);
+                }
+                break;
+            }
+            case Op::Clear:
+                where.clear();
+                loose.clear();
+                std::fill(alive.begin(), alive.end(), false);
+                break;
+            case Op::Commit:
+                break;
+        }
+    }
+
+    qsizetype out = 0;
+    for(qsizetype i = 0; i < shapes.size(); ++i){
+        if(alive[i]) shapes[out++] = shapes.at(i);
+    }
+    shapes.resize(out);
+    return unmatched;
+}
@@ -0,0 +1,113 @@
+#ifndef EDITJOURNAL_H
+#define EDITJOURNAL_H
+
+#include <QObject>
+#include <QFile>
+#include <QHash>
+#include <QTimer>
+#include <QString>
+#include <QVector>
+#include <utility>
+#include "Entity.h"
+
+//Append-only log of edits made on top of a saved drawing (<file>.journal).
+//
+//Layout (all values little-endian):
+//  Header   magic "CADJ", u16 version, u16 header size, u64 base file size,
+//           i64 base file mtime (ms since epoch), u64 reserved
+//  Records  fixed 72 bytes: u8 op, u8 before type, u8 after type, u8 flags,
+//           u16 CRC-16 of the record, u16 layer of the after shape (version 4, zero
+//           before), 4 doubles before, 4 doubles after
+//  Vertices (flag 0x01, version 2) after a record that adds a polyline or changes its
+//           vertices: u32 count, u8 encoding, u8 reserved, u16 CRC-16, u64 reserved,
+//           then the vertices as BinaryDocument stores them, padded to 8 bytes
+//  Block    (flag 0x02, version 3) after a record that adds a block instance or changes
+//           its definition: u64 size, u16 CRC-16, 6 bytes reserved, then the definition
+//           as BinaryDocument::EncodeBlock writes it, padded to 8 bytes
+//  Key      (flag 0x04, version 5) first after every record with a before shape: u16
+//           layer, u16 CRC-16, 4 bytes reserved, u64 content hash (FNV-1a of the
+//           polyline vertices or of the encoded block definition, 0 otherwise)
+//
+//Shapes are identified by their exact geometry, layer and content, so the journal
+//needs no ids that would have to survive a reload. Records written before version 5
+//carry no key and match on geometry alone. A Commit record marks a save: everything before
+//the last one is part of the saved document, anything after it is work that was
+//never saved and is offered back after a crash. The header pins the journal to one
+//version of the base file; when the base is rewritten (compaction) the journal is
+//restarted, and a journal whose base no longer matches is ignored.
+class EditJournal : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum class Op : quint8 { Add = 1, Remove, Modify, Clear, Commit };
+
+    struct Record{
+        Op op = Op::Commit;
+        ShapeData before; // Remove, Modify
+        ShapeData after;  // Add, Modify
+        quint64 beforeContent = 0; // polyline or block definition hash of before
+        bool beforeKeyed = false;  // before's layer and content are known
+    };
+
+    static constexpr quint32 Magic = 0x4A444143; // "CADJ"
+    static constexpr quint16 Version = 5;
+    //changes after which a save rewrites the base file instead of appending
+    static constexpr qsizetype CompactionThreshold = 20000;
+
+    explicit EditJournal(QObject *parent = nullptr);
+    ~EditJournal();
+
+    static QString JournalPath(const QString &basePath);
+
+    //recording, called by UndoHistory and CanvasView as edits execute
+    void RecordAdd(const ShapeData &shape);
+    void RecordRemove(const ShapeData &shape);
+    void RecordModify(const ShapeData &before, const ShapeData &after);
+    void RecordClear();
+
+    //binds the journal to a saved file, keeping or dropping edits that were never saved
+    bool Attach(const QString &basePath, bool keepUncommitted);
+    //closes the journal and drops edits made since the last save
+    void Detach();
+    bool IsAttachedTo(const QString &basePath) const;
+
+    //incremental save: marks everything recorded so far as saved
+    bool Commit();
+    qsizetype ChangesSinceCompaction() const { return changes; }
+    bool NeedsCompaction() const { return changes >= CompactionThreshold; }
+
+    //a full save of the base file is about to start from the current state; edits
+    //(and commits) made while it runs are kept and become the new journal when it finishes
+    void BeginCompaction();
+    bool FinishCompaction(const QString &basePath, bool ok);
+    bool IsCompacting() const { return capturing; }
+
+    //recovery
+    static bool Read(const QString &basePath, QVector<Record> &committed, QVector<Record> &uncommitted);
+    //applies records to a loaded drawing, returns how many found no matching shape
+    static qsizetype Apply(QVector<ShapeData> &shapes, const QVector<Record> &records);
+
+private:
+    QFile file;
+    QString basePath;
+    QByteArray pending;  // records not written to the file yet
+    QByteArray captured; // records made since BeginCompaction
+    bool capturing = false;
+    qsizetype capturedChanges = 0;
+    qint64 capturedCommitEnd = 0; // bytes of captured up to its last Commit
+    qsizetype changes = 0;
+    qint64 committedSize = 0;     // file size up to the last Commit
+    QTimer flushTimer;
+    QHash<const void *, std::pair<Block, quint64>> definitionHashes; // content hash by block definition
+
+    void Append(Op op, const ShapeData *before, const ShapeData *after);
+    bool Flush();
+    bool OpenForAppend(qint64 size);
+
+    static QByteArray Header(const QString &basePath);
+    static bool Scan(const QString &basePath, QVector<Record> *records, qint64 *validEnd,
+                     qint64 *commitEnd, qsizetype *commitIndex);
+};
+
+#endif // EDITJOURNAL_H
@@ -0,0 +1,360 @@
+#include "inputrecording.h"
+#include <QFileInfo>
+#include <QHash>
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QResizeEvent>
+#include <QWheelEvent>
+#include <QtEndian>
+#include <cstring>
+#include "binarydocument.h"
+
+namespace {
+
+constexpr quint64 FnvOffset = 14695981039346656037ull;
+//modifier flags sit in bits 25-29 of Qt::KeyboardModifiers
+constexpr int ModifierShift = 25;
+constexpr quint32 MaxDeltaUs = 0xFFFFFFFFu;
+
+qint64 Align8(qint64 value) { return (value + 7) & ~qint64(7); }
+
+void PutDouble(uchar *dst, double value)
+{
+    quint64 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    qToLittleEndian(bits, dst);
+}
+
+double GetDouble(const uchar *src)
+{
+    const quint64 bits = qFromLittleEndian<quint64>(src);
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void PutFloat(uchar *dst, float value)
+{
+    quint32 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    qToLittleEndian(bits, dst);
+}
+
+float GetFloat(const uchar *src)
+{
+    const quint32 bits = qFromLittleEndian<quint32>(src);
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+quint64 Fnv1a(quint64 hash, const void *data, size_t size)
+{
+    const uchar *bytes = static_cast<const uchar *>(data);
+    for(size_t i = 0; i < size; ++i){
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+quint64 HashDouble(quint64 hash, double value)
+{
+    if(value == 0) value = 0; // -0.0 and 0.0 are the same coordinate
+    return Fnv1a(hash, &value, sizeof(value));
+}
+
+//every value the shape is saved with, a block by its encoded definition
+quint64 HashShape(const ShapeData &shape, QHash<const void *, quint64> &blocks)
+{
+    quint64 hash = FnvOffset;
+    const quint8 type = quint8(shape.type);
+    hash = Fnv1a(hash, &type, sizeof(type));
+    hash = Fnv1a(hash, &shape.layer, sizeof(shape.layer));
+    if(shape.type == ShapeType::Line){
+        hash = HashDouble(hash, shape.line.x1());
+        hash = HashDouble(hash, shape.line.y1());
+        hash = HashDouble(hash, shape.line.x2());
+        return HashDouble(hash, shape.line.y2());
+    }
+    hash = HashDouble(hash, shape.rect.x());
+    hash = HashDouble(hash, shape.rect.y());
+    hash = HashDouble(hash, shape.rect.width());
+    hash = HashDouble(hash, shape.rect.height());
+    if(shape.type == ShapeType::Polyline){
+        const quint64 vertices = shape.polyline.Hash();
+        hash = Fnv1a(hash, &vertices, sizeof(vertices));
+    }
+    else if(shape.type == ShapeType::Block && !shape.block.IsNull()){
+        auto it = blocks.find(shape.block.Key());
+        if(it == blocks.end()){
+            const QByteArray encoded = BinaryDocument::EncodeBlock(shape.block);
+            it = blocks.insert(shape.block.Key(), Fnv1a(FnvOffset, encoded.constData(), encoded.size()));
+        }
+        hash = Fnv1a(hash, &it.value(), sizeof(quint64));
+    }
+    return hash;
+}
+
+} // namespace
+
+bool InputRecording::IsRecordingPath(const QString &filePath)
+{
+    return QFileInfo(filePath).suffix().compare(Extension, Qt::CaseInsensitive) == 0;
+}
+
+/*********************** Encoding ***********************/
+QByteArray InputRecording::EncodeHeader(const Header &header)
+{
+    QByteArray bytes(HeaderSize + Align8(header.document.size()), '\0');
+    uchar *data = reinterpret_cast<uchar *>(bytes.data());
+    qToLittleEndian<quint32>(Magic, data);
+    qToLittleEndian<quint16>(Version, data + 4);
+    qToLittleEndian<quint16>(HeaderSize, data + 6);
+    qToLittleEndian<qint32>(header.viewportSize.width(), data + 8);
+    qToLittleEndian<qint32>(header.viewportSize.height(), data + 12);
+    PutDouble(data + 16, header.scale);
+    PutDouble(data + 24, header.centre.x());
+    PutDouble(data + 32, header.centre.y());
+    qToLittleEndian<qint32>(qint32(header.mode), data + 40);
+    qToLittleEndian<qint32>(header.snapModes, data + 44);
+    qToLittleEndian<qint32>(header.layer, data + 48);
+    data[52] = quint8(header.documentKind);
+    qToLittleEndian<quint64>(quint64(header.document.size()), data + 56);
+    if(!header.document.isEmpty()) std::memcpy(data + HeaderSize, header.document.constData(), header.document.size());
+    return bytes;
+}
+
+void InputRecording::EncodeEvent(const Event &event, qint64 previousUs, QByteArray &out)
+{
+    const qsizetype at = out.size();
+    out.resize(at + RecordSize);
+    uchar *record = reinterpret_cast<uchar *>(out.data()) + at;
+    std::memset(record, 0, RecordSize);
+    record[0] = quint8(event.type);
+    record[1] = quint8(event.button);
+    record[2] = quint8(int(event.buttons));
+    record[3] = quint8(int(event.modifiers) >> ModifierShift);
+    //a gap too long for the field only delays the replay less than the session did
+    qToLittleEndian<quint32>(quint32(qBound<qint64>(0, event.timeUs - previousUs, MaxDeltaUs)), record + 4);
+    if(event.type == EventType::End){
+        qToLittleEndian<quint64>(event.checksum, record + 8);
+        return;
+    }
+    PutFloat(record + 8, float(event.pos.x()));
+    PutFloat(record + 12, float(event.pos.y()));
+    qToLittleEndian<qint32>(event.a, record + 16);
+    qToLittleEndian<qint32>(event.b, record + 20);
+}
+
+/*********************** Decoding ***********************/
+bool InputRecording::Load(const QString &filePath, Header &header, QVector<Event> &events)
+{
+    QFile file(filePath);
+    if(!file.open(QIODevice::ReadOnly)) return false;
+    const QByteArray bytes = file.readAll();
+    const uchar *data = reinterpret_cast<const uchar *>(bytes.constData());
+    const qint64 size = bytes.size();
+
+    if(size < HeaderSize || qFromLittleEndian<quint32>(data) != Magic) return false;
+    if(qFromLittleEndian<quint16>(data + 4) > Version) return false;
+    const quint16 headerSize = qFromLittleEndian<quint16>(data + 6);
+    if(headerSize < HeaderSize || headerSize > size) return false;
+
+    header.viewportSize = QSize(qFromLittleEndian<qint32>(data + 8), qFromLittleEndian<qint32>(data + 12));
+    header.scale = GetDouble(data + 16);
+    header.centre = QPointF(GetDouble(data + 24), GetDouble(data + 32));
+    const qint32 mode = qFromLittleEndian<qint32>(data + 40);
+    if(mode < 0 || mode > qint32(DrawMode::Polyline)) return false;
+    header.mode = DrawMode(mode);
+    header.snapModes = qFromLittleEndian<qint32>(data + 44);
+    header.layer = qFromLittleEndian<qint32>(data + 48);
+    if(data[52] > quint8(DocumentKind::PagedPath)) return false;
+    header.documentKind = DocumentKind(data[52]);
+    const quint64 documentSize = qFromLittleEndian<quint64>(data + 56);
+    if(documentSize > quint64(size - headerSize)) return false;
+    header.document = bytes.mid(headerSize, qsizetype(documentSize));
+
+    //a trailing partial record is what a crash mid-write leaves, it is dropped
+    const qint64 first = headerSize + Align8(qint64(documentSize));
+    const qint64 count = first <= size ? (size - first) / RecordSize : 0;
+    events.clear();
+    events.reserve(count);
+    qint64 timeUs = 0;
+    for(qint64 i = 0; i < count; ++i){
+        const uchar *record = data + first + i * RecordSize;
+        if(record[0] < quint8(EventType::MousePress) || record[0] > quint8(EventType::End)) return false;
+        Event event;
+        event.type = EventType(record[0]);
+        event.button = Qt::MouseButton(record[1]);
+        event.buttons = Qt::MouseButtons(QFlag(record[2]));
+        event.modifiers = Qt::KeyboardModifiers(QFlag(int(record[3]) << ModifierShift));
+        timeUs += qFromLittleEndian<quint32>(record + 4);
+        event.timeUs = timeUs;
+        if(event.type == EventType::End){
+            event.checksum = qFromLittleEndian<quint64>(record + 8);
+        }
+        else{
+            event.pos = QPointF(GetFloat(record + 8), GetFloat(record + 12));
+            event.a = qFromLittleEndian<qint32>(record + 16);
+            event.b = qFromLittleEndian<qint32>(record + 20);
+        }
+        events.append(event);
+    }
+    return true;
+}
+
+/*********************** Checksum ***********************/
+quint64 InputRecording::Checksum(const QVector<ShapeData> &shapes, const QVector<Layer> &layers)
+{
+    //shapes are summed, so the order they come out of the store doesn't matter
+    QHash<const void *, quint64> blocks;
+    quint64 sum = 0;
+    for(const ShapeData &shape : shapes) sum += HashShape(shape, blocks);
+
+    quint64 hash = Fnv1a(FnvOffset, &sum, sizeof(sum));
+    const quint64 count = quint64(shapes.size());
+    hash = Fnv1a(hash, &count, sizeof(count));
+    for(const Layer &layer : layers){
+        const QByteArray name = layer.name.toUtf8();
+        const quint8 flags = quint8((layer.visible ? 1 : 0) | (layer.locked ? 2 : 0));
+        const qint32 z = layer.z;
+        hash = Fnv1a(hash, name.constData(), name.size() + 1);
+        hash = Fnv1a(hash, &flags, sizeof(flags));
+        hash = Fnv1a(hash, &z, sizeof(z));
+    }
+    return hash;
+}
+
+/*********************** Recorder ***********************/
+InputRecorder::InputRecorder(QObject *parent)
+    : QObject(parent)
+{
+}
+
+InputRecorder::~InputRecorder()
+{
+    //whatever was recorded stays readable, only the End record is missing
+    if(IsRecording()){
+        Flush();
+        file.close();
+    }
+}
+
+bool InputRecorder::Start(const QString &filePath, const InputRecording::Header &header, QWidget *view, QWidget *viewport)
+{
+    if(IsRecording()) return false;
+    file.setFileName(filePath);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+
+    failed = false;
+    eventCount = 0;
+    lastUs = 0;
+    buffer = InputRecording::EncodeHeader(header);
+    Flush();
+    if(failed){
+        file.close();
+        return false;
+    }
+
+    this->view = view;
+    this->viewport = viewport;
+    view->installEventFilter(this);
+    viewport->installEventFilter(this);
+    clock.start();
+    return true;
+}
+
+bool InputRecorder::Stop(quint64 checksum)
+{
+    if(!IsRecording()) return false;
+    if(view) view->removeEventFilter(this);
+    if(viewport) viewport->removeEventFilter(this);
+
+    InputRecording::Event end;
+    end.type = InputRecording::EventType::End;
+    end.checksum = checksum;
+    Append(end);
+    Flush();
+    file.close();
+    return !failed;
+}
+
+void InputRecorder::Record(InputRecording::EventType type, int value)
+{
+    if(!IsRecording()) return;
+    InputRecording::Event event;
+    event.type = type;
+    event.a = value;
+    Append(event);
+}
+
+bool InputRecorder::eventFilter(QObject *watched, QEvent *event)
+{
+    using Type = InputRecording::EventType;
+    InputRecording::Event record;
+    if(watched == viewport){
+        switch(event->type()){
+            case QEvent::MouseButtonPress:
+            case QEvent::MouseButtonRelease:
+            case QEvent::MouseMove:
+            case QEvent::MouseButtonDblClick:{
+                const QMouseEvent *mouse = static_cast<const QMouseEvent *>(event);
+                record.type = event->type() == QEvent::MouseButtonPress ? Type::MousePress
+                            : event->type() == QEvent::MouseButtonRelease ? Type::MouseRelease
+                            : event->type() == QEvent::MouseMove ? Type::MouseMove : Type::MouseDoubleClick;
+                record.pos = mouse->position();
+                record.button = mouse->button();
+                record.buttons = mouse->buttons();
+                record.modifiers = mouse->modifiers();
+                break;
+            }
+            case QEvent::Wheel:{
+                const QWheelEvent *wheel = static_cast<const QWheelEvent *>(event);
+                record.type = Type::Wheel;
+                record.pos = wheel->position();
+                record.buttons = wheel->buttons();
+                record.modifiers = wheel->modifiers();
+                record.a = wheel->angleDelta().x();
+                record.b = wheel->angleDelta().y();
+                break;
+            }
+            case QEvent::Resize:{
+                const QSize size = static_cast<const QResizeEvent *>(event)->size();
+                record.type = Type::Resize;
+                record.pos = QPointF(size.width(), size.height());
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    else if(watched == view && event->type() == QEvent::KeyPress){
+        const QKeyEvent *key = static_cast<const QKeyEvent *>(event);
+        record.type = Type::KeyPress;
+        record.modifiers = key->modifiers();
+        record.a = key->key();
+    }
+    else{
+        return false;
+    }
+    Append(record);
+    return false; // only watching, the view still gets every event
+}
+
+void InputRecorder::Append(InputRecording::Event &event)
+{
+    event.timeUs = clock.nsecsElapsed() / 1000;
+    InputRecording::EncodeEvent(event, lastUs, buffer);
+    lastUs = event.timeUs;
+    ++eventCount;
+    if(buffer.size() >= FlushBytes) Flush();
+}
+
+void InputRecorder::Flush()
+{
+    if(buffer.isEmpty()) return;
+    if(file.write(buffer) != buffer.size()) failed = true;
+    file.flush();
+    buffer.clear();
+}
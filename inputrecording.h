@@ -0,0 +1,137 @@
+#ifndef INPUTRECORDING_H
+#define INPUTRECORDING_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QEvent>
+#include <QFile>
+#include <QObject>
+#include <QPointer>
+#include <QPointF>
+#include <QSize>
+#include <QString>
+#include <QVector>
+#include <QWidget>
+#include "Entity.h"
+
+//Input reaching a CanvasView, recorded for replay (*.cadr).
+//
+//Layout (all values little-endian):
+//  Header    magic "CADR", u16 version, u16 header size, i32 viewport width, i32 viewport
+//            height, double scale, 2 doubles scene point at the viewport centre, i32 draw
+//            mode, i32 snap modes, i32 current layer, u8 document kind, 3 bytes reserved,
+//            u64 document size
+//  Document  the drawing the session started from, padded to 8 bytes: a BinaryDocument
+//            (Embedded) or the UTF-8 path of a paged drawing (PagedPath), or nothing
+//  Events    24-byte records up to the end of the file: u8 type, u8 button, u8 buttons,
+//            u8 modifiers, u32 microseconds since the previous record, then float x,
+//            float y (viewport coordinates), i32 a, i32 b. Wheel records hold the angle
+//            delta in a (x) and b (y), key, mode, snap and layer records their value in
+//            a. The End record holds the u64 checksum of the drawing instead of x and y.
+//
+//Records are written as they come, so a session cut short by a crash still replays
+//up to the last whole record.
+class InputRecording
+{
+public:
+    static constexpr quint32 Magic = 0x52444143; // "CADR"
+    static constexpr quint16 Version = 1;
+    static constexpr const char *Extension = "cadr";
+    static constexpr int HeaderSize = 64;
+    static constexpr int RecordSize = 24;
+
+    enum class EventType : quint8 {
+        MousePress = 1,
+        MouseRelease,
+        MouseMove,
+        MouseDoubleClick,
+        Wheel,
+        KeyPress,
+        Resize,     // pos holds the new viewport size
+        Mode,       // a DrawMode from MainWindow::modeChanged
+        SnapModes,
+        Layer,      // current layer
+        Undo,
+        Redo,
+        End         // carries the checksum of the drawing when recording stopped
+    };
+
+    enum class DocumentKind : quint8 { None, Embedded, PagedPath };
+
+    struct Header{
+        QSize viewportSize;
+        qreal scale = 1.0;
+        QPointF centre;
+        DrawMode mode = DrawMode::Select;
+        int snapModes = 0;
+        int layer = 0;
+        DocumentKind documentKind = DocumentKind::None;
+        QByteArray document;
+    };
+
+    struct Event{
+        EventType type = EventType::MouseMove;
+        qint64 timeUs = 0; // since the recording started
+        QPointF pos;
+        Qt::MouseButton button = Qt::NoButton;
+        Qt::MouseButtons buttons;
+        Qt::KeyboardModifiers modifiers;
+        qint32 a = 0;
+        qint32 b = 0;
+        quint64 checksum = 0;
+    };
+
+    static bool IsRecordingPath(const QString &filePath);
+
+    static QByteArray EncodeHeader(const Header &header);
+    //appends one record, timed against the previous record's time
+    static void EncodeEvent(const Event &event, qint64 previousUs, QByteArray &out);
+    static bool Load(const QString &filePath, Header &header, QVector<Event> &events);
+
+    //order-independent checksum of a drawing, equal for equal shapes and layer tables
+    //however the store happens to order them
+    static quint64 Checksum(const QVector<ShapeData> &shapes, const QVector<Layer> &layers);
+};
+
+//Writes the input a CanvasView receives to an InputRecording.
+//
+//Mouse, wheel and resize events are taken from the view's viewport and key presses
+//from the view by an event filter, before the view handles them. What reaches the
+//canvas through MainWindow instead (mode changes, snap toggles, undo and redo) is
+//passed to Record by whoever makes the change.
+class InputRecorder : public QObject
+{
+    Q_OBJECT
+
+public:
+    static constexpr qsizetype FlushBytes = 64 * 1024;
+
+    explicit InputRecorder(QObject *parent = nullptr);
+    ~InputRecorder();
+
+    bool Start(const QString &filePath, const InputRecording::Header &header, QWidget *view, QWidget *viewport);
+    //writes the End record and closes the file, false if anything failed to write
+    bool Stop(quint64 checksum);
+    bool IsRecording() const { return file.isOpen(); }
+    qint64 EventCount() const { return eventCount; }
+
+    void Record(InputRecording::EventType type, int value = 0);
+
+protected:
+    bool eventFilter(QObject *watched, QEvent *event) override;
+
+private:
+    QFile file;
+    QByteArray buffer;
+    QElapsedTimer clock;
+    QPointer<QWidget> view;
+    QPointer<QWidget> viewport;
+    qint64 lastUs = 0;
+    qint64 eventCount = 0;
+    bool failed = false;
+
+    void Append(InputRecording::Event &event);
+    void Flush();
+};
+
+#endif // INPUTRECORDING_H
@@ -0,0 +1,150 @@
+#include "layerpanel.h"
+#include <QHBoxLayout>
+#include <QVBoxLayout>
+#include <QHeaderView>
+#include <QSignalBlocker>
+#include <algorithm>
+
+namespace{
+
+//layer indexes topmost first, ties keep the later layer on top like the index does
+QVector<int> DrawingOrder(const QVector<Layer> &layers)
+{
+    QVector<int> order(layers.size());
+    for(int i = 0; i < order.size(); ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&layers](int a, int b){ return layers.at(a).z < layers.at(b).z; });
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+}
+
+LayerPanel::LayerPanel(CanvasView *canvasView, QWidget *parent)
+    : QDockWidget("Layers", parent)
+    , canvasView(canvasView)
+    , tree(new QTreeWidget)
+    , raiseButton(new QPushButton("Raise"))
+    , lowerButton(new QPushButton("Lower"))
+    , currentButton(new QPushButton("Make Current"))
+    , moveButton(new QPushButton("Move Selection Here"))
+{
+    setObjectName("LayerPanel");
+
+    tree->setColumnCount(ColumnCount);
+    tree->setHeaderLabels({ "Layer", "Visible", "Locked" });
+    tree->setRootIsDecorated(false);
+    tree->header()->setSectionResizeMode(NameColumn, QHeaderView::Stretch);
+    tree->header()->setSectionResizeMode(VisibleColumn, QHeaderView::ResizeToContents);
+    tree->header()->setSectionResizeMode(LockedColumn, QHeaderView::ResizeToContents);
+
+    auto *newButton = new QPushButton("New");
+    auto *buttons = new QHBoxLayout;
+    buttons->addWidget(newButton);
+    buttons->addWidget(raiseButton);
+    buttons->addWidget(lowerButton);
+
+    auto *content = new QWidget;
+    auto *layout = new QVBoxLayout(content);
+    layout->addWidget(tree);
+    layout->addLayout(buttons);
+    layout->addWidget(currentButton);
+    layout->addWidget(moveButton);
+    setWidget(content);
+
+    connect(newButton, &QPushButton::clicked, this, &LayerPanel::AddLayer);
+    connect(raiseButton, &QPushButton::clicked, this, [this]{ Shift(1); });
+    connect(lowerButton, &QPushButton::clicked, this, [this]{ Shift(-1); });
+    connect(currentButton, &QPushButton::clicked, this, [this]{ this->canvasView->SetCurrentLayer(HighlightedLayer()); });
+    connect(moveButton, &QPushButton::clicked, this, [this]{ this->canvasView->MoveSelectionToLayer(HighlightedLayer()); });
+    connect(tree, &QTreeWidget::itemChanged, this, &LayerPanel::OnItemChanged);
+    connect(tree, &QTreeWidget::currentItemChanged, this, &LayerPanel::UpdateButtons);
+    connect(canvasView, &CanvasView::layersChanged, this, &LayerPanel::Refresh);
+    Refresh();
+}
+
+void LayerPanel::Refresh()
+{
+    //rebuilt without echoing every checkbox back as an edit
+    const QSignalBlocker blocker(tree);
+    const int highlighted = HighlightedLayer();
+    const QVector<Layer> &layers = canvasView->Layers();
+    tree->clear();
+
+    for(int index : DrawingOrder(layers)){
+        const Layer &layer = layers.at(index);
+        auto *item = new QTreeWidgetItem(tree);
+        item->setData(NameColumn, Qt::UserRole, index);
+        item->setText(NameColumn, layer.name);
+        item->setFlags(item->flags() | Qt::ItemIsEditable | Qt::ItemIsUserCheckable);
+        item->setCheckState(VisibleColumn, layer.visible ? Qt::Checked : Qt::Unchecked);
+        item->setCheckState(LockedColumn, layer.locked ? Qt::Checked : Qt::Unchecked);
+        if(index == canvasView->CurrentLayer()){
+            QFont font = item->font(NameColumn);
+            font.setBold(true);
+            item->setFont(NameColumn, font);
+        }
+        if(index == highlighted) tree->setCurrentItem(item);
+    }
+    UpdateButtons();
+}
+
+void LayerPanel::OnItemChanged(QTreeWidgetItem *item, int column)
+{
+    const int index = item->data(NameColumn, Qt::UserRole).toInt();
+    if(index < 0 || index >= canvasView->Layers().size()) return;
+
+    const Layer &layer = canvasView->Layers().at(index);
+    const bool checked = item->checkState(column) == Qt::Checked;
+    if(column == VisibleColumn && checked != layer.visible){
+        canvasView->SetLayerVisible(index, checked);
+    }
+    else if(column == LockedColumn && checked != layer.locked){
+        canvasView->SetLayerLocked(index, checked);
+    }
+    else if(column == NameColumn && item->text(NameColumn) != layer.name){
+        QVector<Layer> layers = canvasView->Layers();
+        layers[index].name = item->text(NameColumn);
+        canvasView->SetLayers(layers);
+    }
+}
+
+void LayerPanel::UpdateButtons()
+{
+    const QTreeWidgetItem *item = tree->currentItem();
+    const int row = item ? tree->indexOfTopLevelItem(const_cast<QTreeWidgetItem *>(item)) : -1;
+    raiseButton->setEnabled(row > 0);
+    lowerButton->setEnabled(row >= 0 && row < tree->topLevelItemCount() - 1);
+    currentButton->setEnabled(row >= 0);
+    moveButton->setEnabled(row >= 0);
+}
+
+int LayerPanel::HighlightedLayer() const
+{
+    const QTreeWidgetItem *item = tree->currentItem();
+    return item ? item->data(NameColumn, Qt::UserRole).toInt() : -1;
+}
+
+void LayerPanel::AddLayer()
+{
+    const int index = canvasView->AddLayer(QString("Layer %1").arg(canvasView->Layers().size()));
+    if(index < 0) return;
+    canvasView->SetCurrentLayer(index);
+}
+
+void LayerPanel::Shift(int direction)
+{
+    QTreeWidgetItem *item = tree->currentItem();
+    if(!item) return;
+    //the list is topmost first, raising moves towards row 0
+    const int row = tree->indexOfTopLevelItem(item);
+    const int neighbourRow = row - direction;
+    if(neighbourRow < 0 || neighbourRow >= tree->topLevelItemCount()) return;
+
+    const int index = HighlightedLayer();
+    const int neighbour = tree->topLevelItem(neighbourRow)->data(NameColumn, Qt::UserRole).toInt();
+    QVector<Layer> layers = canvasView->Layers();
+    //equal z values are ordered by index, step past the neighbour instead of swapping
+    if(layers.at(index).z == layers.at(neighbour).z) layers[index].z += direction;
+    else std::swap(layers[index].z, layers[neighbour].z);
+    canvasView->SetLayers(layers);
+}
@@ -0,0 +1,39 @@
+#ifndef LAYERPANEL_H
+#define LAYERPANEL_H
+
+#include <QDockWidget>
+#include <QTreeWidget>
+#include <QPushButton>
+#include "canvasview.h"
+
+//Dock listing the canvas's layers with their visibility and lock, in drawing order
+//(topmost first). New shapes go on the current layer, shown in bold; the selection
+//can be moved onto the highlighted layer. Everything goes through CanvasView and the
+//list is rebuilt from it whenever the layer table changes.
+class LayerPanel : public QDockWidget
+{
+    Q_OBJECT
+
+public:
+    explicit LayerPanel(CanvasView *canvasView, QWidget *parent = nullptr);
+
+private:
+    enum Column { NameColumn, VisibleColumn, LockedColumn, ColumnCount };
+
+    CanvasView *canvasView;
+    QTreeWidget *tree;
+    QPushButton *raiseButton;
+    QPushButton *lowerButton;
+    QPushButton *currentButton;
+    QPushButton *moveButton;
+
+    void Refresh();
+    void OnItemChanged(QTreeWidgetItem *item, int column);
+    void UpdateButtons();
+    int HighlightedLayer() const;
+    void AddLayer();
+    //swaps the highlighted layer's z with its neighbour above (+1) or below (-1)
+    void Shift(int direction);
+};
+
+#endif // LAYERPANEL_H
@@ -1,15 +1,33 @@
 #include "mainwindow.h"
 #include "ui_MainWindow.h"
 #include "settingsmanager.h"
+#include "binarydocument.h"
+#include "pageddocument.h"
+#include "shapeexporter.h"
+#include "dxfimporter.h"
+#include <QApplication>
 #include <QVBoxLayout>
 #include <QMessageBox>
 #include <QFileDialog>
+#include <QFile>
+#include <QStatusBar>
+
+static const char *CadFileFilter = "CAD Files (*.json *.cadb *.cadp);;JSON Files (*.json);;CAD Binary Files (*.cadb);;"
+                                   "Paged CAD Files (*.cadp)";
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
     , canvasView(new CanvasView(this))
+    , currentMode(DrawMode::Select)
     , currentFilePath("")
+    , loader(new ProgressiveLoader(this))
+    , saver(new AsyncSaver(this))
+    , journal(new EditJournal(this))
+    , loadProgress(new QProgressBar(this))
+    , cancelLoadButton(new QPushButton("Cancel", this))
+    , layerPanel(new LayerPanel(canvasView, this))
+    , recorder(new InputRecorder(this))
 {
     ui->setupUi(this);
     if(!ui->CanvasContainer->layout()){
@@ -29,6 +47,7 @@ MainWindow::MainWindow(QWidget *parent)
     connect(ui->actionLine, &QAction::triggered, this, &MainWindow::SetLineMode);
     connect(ui->actionRectangle, &QAction::triggered, this, &MainWindow::SetRectangleMode);
     connect(ui->actionCircle, &QAction::triggered, this, &MainWindow::SetCircleMode);
+    connect(ui->actionPolyline, &QAction::triggered, this, &MainWindow::SetPolylineMode);
     connect(ui->actionResize, &QAction::triggered, this, &MainWindow::SetResizeMode);
     connect(ui->actionClear_Canvas, &QAction::triggered, this, &MainWindow::OnClearCanvasTriggered);
 
@@ -36,8 +55,58 @@ MainWindow::MainWindow(QWidget *parent)
     connect(ui->actionOpen, &QAction::triggered, this, &MainWindow::OnOpenFileTriggered);
     connect(ui->actionSave, &QAction::triggered, this, &MainWindow::OnSaveTriggered);
     connect(ui->actionSaveAs, &QAction::triggered, this, &MainWindow::OnSaveAsTriggered);
+    connect(ui->actionImportDxf, &QAction::triggered, this, &MainWindow::OnImportDxfTriggered);
+    connect(ui->actionExport, &QAction::triggered, this, &MainWindow::OnExportTriggered);
+
+    connect(ui->actionMakeBlock, &QAction::triggered, canvasView, &CanvasView::MakeBlockFromSelection);
+    connect(ui->actionExplodeBlock, &QAction::triggered, canvasView, &CanvasView::ExplodeSelection);
+    connect(ui->actionCheckDrawing, &QAction::triggered, this, &MainWindow::OnCheckDrawingTriggered);
 
     connect(this, &MainWindow::modeChanged, canvasView, &CanvasView::SetDrawMode);
+
+    //snapping, object snaps on and grid off by default
+    connect(ui->actionObjectSnap, &QAction::toggled, this, &MainWindow::OnSnapToggled);
+    connect(ui->actionGridSnap, &QAction::toggled, this, &MainWindow::OnSnapToggled);
+    OnSnapToggled();
+
+    //layers, hidden ones of a binary file are only read once they are shown
+    addDockWidget(Qt::RightDockWidgetArea, layerPanel);
+    ui->menuView->addSeparator();
+    ui->menuView->addAction(layerPanel->toggleViewAction());
+    connect(canvasView, &CanvasView::layersChanged, this, &MainWindow::OnLayersChanged);
+
+    //instrumentation, recording only runs while the overlay is shown
+    connect(ui->actionPerformanceOverlay, &QAction::toggled, canvasView, &CanvasView::SetPerformanceOverlay);
+    connect(ui->actionExportTrace, &QAction::triggered, this, &MainWindow::OnExportTraceTriggered);
+
+    //input recording; the canvas's own input is filtered by the recorder, what reaches
+    //it from here is passed on as it happens
+    connect(ui->actionRecordInput, &QAction::toggled, this, &MainWindow::OnRecordInputToggled);
+    connect(this, &MainWindow::modeChanged, recorder, [this](DrawMode mode){
+        recorder->Record(InputRecording::EventType::Mode, int(mode));
+    });
+    connect(ui->actionUndo, &QAction::triggered, recorder, [this]{ recorder->Record(InputRecording::EventType::Undo); });
+    connect(ui->actionRedo, &QAction::triggered, recorder, [this]{ recorder->Record(InputRecording::EventType::Redo); });
+
+    //progressive loading, the canvas stays usable while shapes stream in
+    loadProgress->setRange(0, 100);
+    loadProgress->setMaximumWidth(200);
+    loadProgress->hide();
+    cancelLoadButton->hide();
+    statusBar()->addPermanentWidget(loadProgress);
+    statusBar()->addPermanentWidget(cancelLoadButton);
+    connect(cancelLoadButton, &QPushButton::clicked, loader, &ProgressiveLoader::Cancel);
+    connect(loader, &ProgressiveLoader::progressChanged, loadProgress, &QProgressBar::setValue);
+    connect(loader, &ProgressiveLoader::layersRead, canvasView, &CanvasView::SetLayers);
+    connect(loader, &ProgressiveLoader::batchReady, this, &MainWindow::OnLoadBatchReady);
+    connect(loader, &ProgressiveLoader::finished, this, &MainWindow::OnLoadFinished);
+
+    //saves are written in the background
+    connect(saver, &AsyncSaver::saveStarted, this, &MainWindow::OnSaveStarted);
+    connect(saver, &AsyncSaver::saveFinished, this, &MainWindow::OnSaveFinished);
+
+    //edits are journaled next to the saved file, so a save only appends what changed
+    canvasView->SetJournal(journal);
 }
 
 MainWindow::~MainWindow()
@@ -45,6 +114,192 @@ MainWindow::~MainWindow()
     delete ui;
 }
 
+void MainWindow::OnImportDxfTriggered()
+{
+    if(loader->IsRunning()){
+        QMessageBox::warning(this, "Warning", "A file is still loading.");
+        return;
+    }
+    if(journal->IsCompacting()){
+        QMessageBox::warning(this, "Warning", "A file is still being saved.");
+        return;
+    }
+
+    QString filePath = QFileDialog::getOpenFileName(this, "Import DXF", "", "DXF Files (*.dxf)");
+    if(filePath.isEmpty()) return;
+
+    //parsed on all cores, then added through the bulk insert path like any other load
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    QVector<ShapeData> shapes;
+    DxfImporter::Stats stats;
+    const bool ok = DxfImporter::Load(filePath, shapes, &stats);
+    if(ok){
+        journal->Detach();
+        ForgetDeferredLayers();
+        canvasView->LoadShapes(shapes);
+        //the drawing is new, saving it asks for a CAD file path
+        currentFilePath.clear();
+    }
+    QApplication::restoreOverrideCursor();
+
+    if(!ok){
+        QMessageBox::warning(this, "Error", "Failed to import the DXF file.");
+        return;
+    }
+    const double seconds = qMax<qint64>(stats.elapsedMs, 1) / 1000.0;
+    statusBar()->showMessage(QString("Imported %1 shapes from %2 entities (%3 skipped) in %4 ms, %5 entities/s")
+                             .arg(shapes.size()).arg(stats.entities).arg(stats.skipped)
+                             .arg(stats.elapsedMs).arg(qRound64(stats.entities / seconds)), 10000);
+}
+
+void MainWindow::OnExportTriggered()
+{
+    if(canvasView->IsEmpty()){
+        QMessageBox::warning(this, "Warning", "Canvas is empty. Nothing to export.");
+        return;
+    }
+
+    QString filePath = QFileDialog::getSaveFileName(this, "Export", "", "SVG Files (*.svg);;DXF Files (*.dxf)");
+    if(filePath.isEmpty()) return;
+    if(!ShapeExporter::IsExportPath(filePath)){
+        QMessageBox::warning(this, "Error", "Export supports .svg and .dxf files.");
+        return;
+    }
+
+    //streams straight from the shape store, a few seconds even for millions of shapes
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    LoadAllLayers();
+    const bool ok = canvasView->ExportDrawing(filePath);
+    QApplication::restoreOverrideCursor();
+
+    if(ok) statusBar()->showMessage(QString("Exported %1").arg(filePath), 5000);
+    else QMessageBox::warning(this, "Error", "Failed to export the drawing.");
+}
+
+void MainWindow::OnCheckDrawingTriggered()
+{
+    if(canvasView->IsEmpty()){
+        QMessageBox::information(this, "Check Drawing", "Canvas is empty. Nothing to check.");
+        return;
+    }
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    const DrawingAnalyzer::Report report = canvasView->CheckDrawing();
+    QApplication::restoreOverrideCursor();
+
+    if(report.ProblemCount() == 0){
+        statusBar()->showMessage(QString("No problems found (%1 ms)").arg(report.elapsedMs), 5000);
+        return;
+    }
+    const QRectF &extent = report.extent;
+    QString summary = QString("Crossing lines: %1\nOverlapping rectangles: %2\nDuplicate shapes: %3\nZero-size shapes: %4\n\n"
+                              "Extent: (%5, %6) to (%7, %8)\nChecked in %9 ms. The shapes involved are selected.")
+                          .arg(report.crossingLines.size()).arg(report.overlappingRectangles.size())
+                          .arg(report.duplicates.size()).arg(report.zeroSize.size())
+                          .arg(extent.left()).arg(extent.top()).arg(extent.right()).arg(extent.bottom())
+                          .arg(report.elapsedMs);
+    if(report.truncated) summary += QString("\nPair lists stopped at %1 entries.").arg(DrawingAnalyzer::MaxPairs);
+    QMessageBox::information(this, "Check Drawing", summary);
+}
+
+void MainWindow::OnSnapToggled()
+{
+    int modes = 0;
+    if(ui->actionObjectSnap->isChecked()) modes |= SnapEngine::ObjectSnaps;
+    if(ui->actionGridSnap->isChecked()) modes |= SnapEngine::GridSnap;
+    canvasView->SetSnapModes(modes);
+    recorder->Record(InputRecording::EventType::SnapModes, modes);
+}
+
+void MainWindow::OnExportTraceTriggered()
+{
+    if(!Profiler::IsEnabled()){
+        QMessageBox::information(this, "Export Trace", "Turn on View > Performance Overlay and use the canvas to record a trace first.");
+        return;
+    }
+
+    QString filePath = QFileDialog::getSaveFileName(this, "Export Trace", "", "Chrome Trace (*.json)");
+    if(filePath.isEmpty()) return;
+
+    if(Profiler::Instance().ExportChromeTrace(filePath)){
+        statusBar()->showMessage(QString("Trace written to %1").arg(filePath), 5000);
+    }
+    else{
+        QMessageBox::warning(this, "Error", "Could not write the trace file.");
+    }
+}
+
+void MainWindow::OnRecordInputToggled(bool on)
+{
+    if(!on){
+        StopRecording();
+        return;
+    }
+    auto uncheck = [this]{
+        QSignalBlocker blocker(ui->actionRecordInput);
+        ui->actionRecordInput->setChecked(false);
+    };
+    if(loader->IsRunning()){
+        QMessageBox::warning(this, "Warning", "A file is still loading.");
+        uncheck();
+        return;
+    }
+    QString filePath = QFileDialog::getSaveFileName(this, "Record Input", "", "Input Recordings (*.cadr)");
+    if(filePath.isEmpty()){
+        uncheck();
+        return;
+    }
+    if(!InputRecording::IsRecordingPath(filePath)) filePath += QString(".") + InputRecording::Extension;
+
+    //the replay starts from the same drawing and view; a paged drawing is too large
+    //to embed and is opened from its file, so its unsaved edits are not part of it
+    InputRecording::Header header;
+    header.viewportSize = canvasView->viewport()->size();
+    header.scale = canvasView->transform().m11();
+    header.centre = canvasView->mapToScene(canvasView->viewport()->rect().center());
+    header.mode = currentMode;
+    header.snapModes = canvasView->SnapModes();
+    header.layer = canvasView->CurrentLayer();
+    if(canvasView->IsPaged()){
+        header.documentKind = InputRecording::DocumentKind::PagedPath;
+        header.document = currentFilePath.toUtf8();
+    }
+    else{
+        header.documentKind = InputRecording::DocumentKind::Embedded;
+        header.document = BinaryDocument::Encode(canvasView->CanvasShapes(), canvasView->Layers());
+    }
+
+    recordedLayer = header.layer;
+    if(!recorder->Start(filePath, header, canvasView, canvasView->viewport())){
+        QMessageBox::warning(this, "Error", "Could not write the recording.");
+        uncheck();
+        return;
+    }
+    statusBar()->showMessage(QString("Recording input to %1").arg(filePath));
+}
+
+//ends the recording with the drawing's checksum, which a replay has to arrive at
+void MainWindow::StopRecording()
+{
+    if(!recorder->IsRecording()) return;
+    const qint64 events = recorder->EventCount();
+    const bool ok = recorder->Stop(InputRecording::Checksum(canvasView->CanvasShapes(), canvasView->Layers()));
+    {
+        QSignalBlocker blocker(ui->actionRecordInput);
+        ui->actionRecordInput->setChecked(false);
+    }
+    if(ok) statusBar()->showMessage(QString("Recorded %1 input events").arg(events), 5000);
+    else QMessageBox::warning(this, "Error", "The recording could not be written completely.");
+}
+
+void MainWindow::closeEvent(QCloseEvent *event)
+{
+    StopRecording();
+    //closing without saving drops the unsaved edits, only a crash leaves them to recover
+    journal->Detach();
+    QMainWindow::closeEvent(event);
+}
+
 /*********** CLEAR CANVAS ***********/
 void MainWindow::OnClearCanvasTriggered(){
     QMessageBox::StandardButton reply;
@@ -52,18 +307,24 @@ void MainWindow::OnClearCanvasTriggered(){
                                   QMessageBox::Yes | QMessageBox::No);
 
     if(reply == QMessageBox::Yes){
+        loader->Cancel();
+        ForgetDeferredLayers();
         canvasView->ClearCanvas();
     }
 }
 
 /*********** SAVE ***********/
 void MainWindow::OnSaveTriggered() {
-    if(canvasView->SerializeCanvas().isEmpty()){
+    if(loader->IsRunning()){
+        QMessageBox::warning(this, "Warning", "A file is still loading.");
+        return;
+    }
+    if(canvasView->IsEmpty()){
         QMessageBox::warning(this, "Warning", "Canvas is empty. Nothing to save.");
         return;
     }
     if (currentFilePath.isEmpty()) {
-        currentFilePath = QFileDialog::getSaveFileName(this, "Save File", "", "CAD Files (*.json)");
+        currentFilePath = QFileDialog::getSaveFileName(this, "Save File", "", CadFileFilter);
     }
 
     if (!currentFilePath.isEmpty()) {
@@ -73,11 +334,15 @@ void MainWindow::OnSaveTriggered() {
 
 /*********** SAVE AS ***********/
 void MainWindow::OnSaveAsTriggered() {
-    if(canvasView->SerializeCanvas().isEmpty()){
+    if(loader->IsRunning()){
+        QMessageBox::warning(this, "Warning", "A file is still loading.");
+        return;
+    }
+    if(canvasView->IsEmpty()){
         QMessageBox::warning(this, "Warning", "Canvas is empty. Nothing to save.");
         return;
     }
-    QString filePath = QFileDialog::getSaveFileName(this, "Save File As", "", "CAD Files (*.json)");
+    QString filePath = QFileDialog::getSaveFileName(this, "Save File As", "", CadFileFilter);
 
     if (!filePath.isEmpty()) {
         currentFilePath = filePath;
@@ -87,12 +352,65 @@ void MainWindow::OnSaveAsTriggered() {
 
 /*********** SAVE Method ***********/
 void MainWindow::SaveToFile(const QString &filePath){
-    QJsonArray shapesArray = canvasView->SerializeCanvas();
+    //paged files are always written whole and have no journal; a paged drawing is
+    //rewritten page by page from the file it is paged from
+    if(PagedDocument::IsPagedPath(filePath)){
+        if(journal->IsCompacting()){
+            statusBar()->showMessage("The previous save is still being written.", 5000);
+            return;
+        }
+        journal->Detach();
+        if(!canvasView->IsPaged()){
+            LoadAllLayers();
+            saver->Save(filePath, canvasView->CanvasShapes(), canvasView->Layers());
+            canvasView->MarkLayersSaved();
+            return;
+        }
+        QApplication::setOverrideCursor(Qt::WaitCursor);
+        const bool ok = canvasView->SavePaged(filePath);
+        QApplication::restoreOverrideCursor();
+        if(ok) statusBar()->showMessage(QString("Saved %1").arg(filePath), 5000);
+        else QMessageBox::critical(this, "Error", "Failed to save file.");
+        return;
+    }
+
+    //the file is on disk with a journal: saving appends the edits made since the last save.
+    //Layer table changes aren't journaled, they need the whole file rewritten
+    if(journal->IsAttachedTo(filePath) && (journal->IsCompacting() || (!journal->NeedsCompaction() && !canvasView->LayersEdited()))){
+        if(journal->Commit()){
+            statusBar()->showMessage(QString("Saved %1 (%2 changes journaled)").arg(filePath)
+                                     .arg(journal->ChangesSinceCompaction()), 5000);
+        }
+        else{
+            QMessageBox::critical(this, "Error", "Failed to save file.");
+        }
+        return;
+    }
+    if(journal->IsCompacting()){
+        statusBar()->showMessage("The previous save is still being written.", 5000);
+        return;
+    }
+
+    //first save, a new path or a long journal: rewrite the whole file in the background
+    //from a snapshot, edits made meanwhile carry over into the new journal
+    //hidden layers that were never read would be missing from the rewritten file
+    LoadAllLayers();
+    journal->BeginCompaction();
+    saver->Save(filePath, canvasView->CanvasShapes(), canvasView->Layers());
+    canvasView->MarkLayersSaved();
+}
+
+void MainWindow::OnSaveStarted(const QString &filePath){
+    statusBar()->showMessage(QString("Saving %1...").arg(filePath));
+}
 
-    if(SettingsManager::SaveToFile(filePath, shapesArray)){
-        QMessageBox::information(this, "Success", "File saved successfully.");
+void MainWindow::OnSaveFinished(const QString &filePath, bool ok){
+    journal->FinishCompaction(filePath, ok);
+    if(ok){
+        statusBar()->showMessage(QString("Saved %1").arg(filePath), 5000);
     }
     else{
+        statusBar()->clearMessage();
         QMessageBox::critical(this, "Error", "Failed to save file.");
     }
 }
@@ -100,18 +418,173 @@ void MainWindow::SaveToFile(const QString &filePath){
 /*********** Open File ***********/
 void MainWindow::OnOpenFileTriggered()
 {
-    QString filePath = QFileDialog::getOpenFileName(this, "Open File", "", "CAD Files (*.json)");
+    if(loader->IsRunning()){
+        QMessageBox::warning(this, "Warning", "A file is still loading.");
+        return;
+    }
 
-    if (!filePath.isEmpty()) {
-        QJsonArray shapesArray;
-        if(SettingsManager::LoadFromFile(filePath, shapesArray)){
-            canvasView->DeserializeCanvas(shapesArray);
+    if(journal->IsCompacting()){
+        QMessageBox::warning(this, "Warning", "A file is still being saved.");
+        return;
+    }
+
+    QString filePath = QFileDialog::getOpenFileName(this, "Open File", "", CadFileFilter);
+
+    if (filePath.isEmpty()) return;
+
+    //unsaved edits to the current drawing are dropped, as before
+    journal->Detach();
+    ForgetDeferredLayers();
+
+    //paged files stay on disk, the canvas loads the pages around the view
+    if(PagedDocument::IsPagedPath(filePath)){
+        if(canvasView->OpenPaged(filePath)){
+            currentFilePath = filePath;
+            QMessageBox::information(this, "Success", "File loaded successfully.");
+        } else {
+            QMessageBox::critical(this, "Error", "Failed to load file.");
+        }
+        return;
+    }
+
+    //binary files are mapped and decoded directly, they don't need a worker.
+    //Hidden layers are left on disk until they are shown, unless a journal may
+    //refer to their shapes
+    if(BinaryDocument::IsBinaryPath(filePath)){
+        QVector<ShapeData> shapes;
+        QVector<Layer> layers;
+        QSet<int> visibleLayers;
+        if(!QFile::exists(EditJournal::JournalPath(filePath)) && BinaryDocument::LoadLayers(filePath, layers)){
+            for(int i = 0; i < layers.size(); ++i){
+                if(layers.at(i).visible) visibleLayers.insert(i);
+                else deferredLayers.insert(i);
+            }
+        }
+        const bool ok = deferredLayers.isEmpty() ? SettingsManager::LoadFromFile(filePath, shapes, &layers)
+                                                 : BinaryDocument::Load(filePath, shapes, nullptr, &visibleLayers);
+        if(ok){
+            const bool recovered = ReplayJournal(filePath, shapes);
+            canvasView->LoadShapes(shapes, layers);
+            if(!deferredLayers.isEmpty()) deferredPath = filePath;
+            journal->Attach(filePath, recovered);
             currentFilePath = filePath;  // Set only if loading succeeds
             QMessageBox::information(this, "Success", "File loaded successfully.");
         } else {
+            deferredLayers.clear();
             QMessageBox::critical(this, "Error", "Failed to load file.");
         }
+        return;
     }
+
+    //JSON is parsed incrementally on a worker thread. Until it has finished the
+    //drawing belongs to no file, so a save can't overwrite the previous one with
+    //part of this one
+    canvasView->ClearCanvas();
+    canvasView->BeginBulkLoad();
+    currentFilePath.clear();
+    loadingFilePath = filePath;
+    loadProgress->setValue(0);
+    loadProgress->show();
+    cancelLoadButton->show();
+    loader->Start(filePath);
+}
+
+void MainWindow::OnLoadBatchReady(const QVector<ShapeData> &shapes)
+{
+    canvasView->AppendShapes(shapes);
+    loader->BatchConsumed();
+}
+
+void MainWindow::OnLoadFinished(bool ok, bool cancelled)
+{
+    loadProgress->hide();
+    cancelLoadButton->hide();
+    canvasView->EndBulkLoad();
+
+    if(ok){
+        //saved edits and any crash leftovers live in the journal next to the file
+        bool recovered = false;
+        if(QFile::exists(EditJournal::JournalPath(loadingFilePath))){
+            QVector<ShapeData> shapes = canvasView->CanvasShapes();
+            recovered = ReplayJournal(loadingFilePath, shapes);
+            canvasView->LoadShapes(shapes, canvasView->Layers());
+        }
+        canvasView->MarkLayersSaved();
+        journal->Attach(loadingFilePath, recovered);
+        currentFilePath = loadingFilePath;  // Set only if loading succeeds
+        QMessageBox::information(this, "Success", "File loaded successfully.");
+    }
+    else if(cancelled){
+        //a cleared canvas cancels the load too, then nothing was kept
+        if(!canvasView->IsEmpty()) statusBar()->showMessage("Loading cancelled, partial drawing kept.", 5000);
+    }
+    else{
+        QMessageBox::critical(this, "Error", "Failed to load file.");
+    }
+    loadingFilePath.clear();
+}
+
+//Applies the journal next to filePath on top of the loaded base file.
+//Saved edits are always applied; edits that were never saved (a crash) are offered.
+bool MainWindow::ReplayJournal(const QString &filePath, QVector<ShapeData> &shapes)
+{
+    QVector<EditJournal::Record> committed, uncommitted;
+    if(!EditJournal::Read(filePath, committed, uncommitted)) return false;
+
+    EditJournal::Apply(shapes, committed);
+    if(uncommitted.isEmpty()) return false;
+
+    QMessageBox::StandardButton reply;
+    reply = QMessageBox::question(this, "Recover Changes",
+                                  QString("%1 unsaved changes from a previous session were found. Recover them?")
+                                      .arg(uncommitted.size()),
+                                  QMessageBox::Yes | QMessageBox::No);
+    if(reply != QMessageBox::Yes) return false;
+
+    EditJournal::Apply(shapes, uncommitted);
+    return true;
+}
+
+/*********** LAYERS ***********/
+//Reads the hidden layers of the open file that were just shown
+void MainWindow::OnLayersChanged()
+{
+    if(recorder->IsRecording() && canvasView->CurrentLayer() != recordedLayer){
+        recordedLayer = canvasView->CurrentLayer();
+        recorder->Record(InputRecording::EventType::Layer, recordedLayer);
+    }
+    if(deferredLayers.isEmpty()) return;
+    QSet<int> shown;
+    const QVector<Layer> &layers = canvasView->Layers();
+    for(int index : std::as_const(deferredLayers)){
+        if(index < layers.size() && layers.at(index).visible) shown.insert(index);
+    }
+    if(!shown.isEmpty()) LoadDeferredLayers(shown);
+}
+
+void MainWindow::LoadDeferredLayers(const QSet<int> &layers)
+{
+    //the shapes are part of the saved file, adding them is not an edit
+    QVector<ShapeData> shapes;
+    if(!BinaryDocument::Load(deferredPath, shapes, nullptr, &layers)){
+        statusBar()->showMessage(QString("Could not read the layers from %1").arg(deferredPath), 5000);
+        return;
+    }
+    deferredLayers.subtract(layers);
+    if(deferredLayers.isEmpty()) deferredPath.clear();
+    canvasView->AppendShapes(shapes);
+}
+
+void MainWindow::LoadAllLayers()
+{
+    const QSet<int> all = deferredLayers; // LoadDeferredLayers takes them out of the set
+    if(!all.isEmpty()) LoadDeferredLayers(all);
+}
+
+void MainWindow::ForgetDeferredLayers()
+{
+    deferredLayers.clear();
+    deferredPath.clear();
 }
 
 /*********** MODE SELECTION ***********/
@@ -119,4 +592,5 @@ void MainWindow::SetSelectMode() { currentMode = DrawMode::Select; emit modeChan
 void MainWindow::SetLineMode() { currentMode = DrawMode::Line; emit modeChanged(currentMode); }
 void MainWindow::SetRectangleMode() { currentMode = DrawMode::Rectangle; emit modeChanged(currentMode); }
 void MainWindow::SetCircleMode() { currentMode = DrawMode::Circle; emit modeChanged(currentMode); }
+void MainWindow::SetPolylineMode() { currentMode = DrawMode::Polyline; emit modeChanged(currentMode); }
 void MainWindow::SetResizeMode() { currentMode = DrawMode::Resize; emit modeChanged(currentMode); }
@@ -4,7 +4,15 @@
 #include <QMainWindow>
 #include <QString>
 #include <QJsonArray>
+#include <QProgressBar>
+#include <QPushButton>
+#include <QCloseEvent>
 #include "canvasview.h"
+#include "progressiveloader.h"
+#include "asyncsaver.h"
+#include "editjournal.h"
+#include "inputrecording.h"
+#include "layerpanel.h"
 #include "Entity.h"
 
 QT_BEGIN_NAMESPACE
@@ -24,27 +32,63 @@ public:
 signals:
     void modeChanged(DrawMode mode);
 
+protected:
+    void closeEvent(QCloseEvent *event) override;
+
 private slots:
     //mode slots
     void SetSelectMode();
     void SetLineMode();
     void SetRectangleMode();
     void SetCircleMode();
+    void SetPolylineMode();
     void SetResizeMode();
     //I/O slots
     void OnSaveTriggered();
     void OnSaveAsTriggered();
     void OnOpenFileTriggered();
+    void OnImportDxfTriggered();
+    void OnExportTriggered();
 
     void OnClearCanvasTriggered();
+    void OnCheckDrawingTriggered();
+    void OnExportTraceTriggered();
+    void OnRecordInputToggled(bool on);
+    void OnSnapToggled();
+    void OnLayersChanged();
+
+    //progressive loading slots
+    void OnLoadBatchReady(const QVector<ShapeData> &shapes);
+    void OnLoadFinished(bool ok, bool cancelled);
+
+    //background save slots
+    void OnSaveStarted(const QString &filePath);
+    void OnSaveFinished(const QString &filePath, bool ok);
 
 private:
     Ui::MainWindow *ui;
     CanvasView *canvasView;
     DrawMode currentMode;
     QString currentFilePath;
+    QString loadingFilePath;
+    ProgressiveLoader *loader;
+    AsyncSaver *saver;
+    EditJournal *journal;
+    QProgressBar *loadProgress;
+    QPushButton *cancelLoadButton;
+    LayerPanel *layerPanel;
+    InputRecorder *recorder;
+    int recordedLayer = 0; // current layer as the recording last saw it
+    //hidden layers of the open binary file that haven't been read yet
+    QString deferredPath;
+    QSet<int> deferredLayers;
 
     void SaveToFile(const QString &filePath);
+    bool ReplayJournal(const QString &filePath, QVector<ShapeData> &shapes);
+    void LoadDeferredLayers(const QSet<int> &layers);
+    void LoadAllLayers();
+    void ForgetDeferredLayers();
+    void StopRecording();
 
 };
 #endif // MAINWINDOW_H
@@ -0,0 +1,322 @@
+#include "pageddocument.h"
+#include "binarydocument.h"
+#include <QFileInfo>
+#include <QtEndian>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+constexpr quint16 HeaderSize = 56;
+constexpr qint64 ChunkEntrySize = 64;
+
+qint64 Align8(qint64 value) { return (value + 7) & ~qint64(7); }
+
+void PutDouble(uchar *dst, double value)
+{
+    quint64 bits;
+    std::memcpy(&bits, &value, sizeof bits);
+    qToLittleEndian<quint64>(bits, dst);
+}
+
+double GetDouble(const uchar *src)
+{
+    const quint64 bits = qFromLittleEndian<quint64>(src);
+    double value;
+    std::memcpy(&value, &bits, sizeof value);
+    return value;
+}
+
+quint64 PackCell(const QPoint &cell)
+{
+    return (quint64(quint32(cell.x())) << 32) | quint32(cell.y());
+}
+
+//smallest rect covering both, unlike QRectF::united it keeps zero-width and
+//zero-height rects such as those of horizontal lines
+QRectF Cover(const QRectF &a, const QRectF &b)
+{
+    return QRectF(QPointF(qMin(a.left(), b.left()), qMin(a.top(), b.top())),
+                  QPointF(qMax(a.right(), b.right()), qMax(a.bottom(), b.bottom())));
+}
+
+bool Touches(const QRectF &a, const QRectF &b)
+{
+    return a.left() <= b.right() && b.left() <= a.right() && a.top() <= b.bottom() && b.top() <= a.bottom();
+}
+
+//bytes a buffered shape holds, its vertices included
+qint64 BufferedCost(const ShapeData &shape)
+{
+    return qint64(sizeof(ShapeData)) + (shape.type == ShapeType::Polyline ? shape.polyline.MemoryBytes() : 0);
+}
+
+} // namespace
+
+/*********************** Grid ***********************/
+bool PagedDocument::IsPagedPath(const QString &filePath)
+{
+    return QFileInfo(filePath).suffix().compare(Extension, Qt::CaseInsensitive) == 0;
+}
+
+QRectF PagedDocument::BoundsOf(const ShapeData &shape)
+{
+    return shape.type == ShapeType::Line ? QRectF(shape.line.p1(), shape.line.p2()).normalized()
+                                         : shape.rect.normalized();
+}
+
+QPoint PagedDocument::CellOf(const ShapeData &shape, double pageSize)
+{
+    //the grid index is clamped, far-out coordinates keep their double precision in
+    //the shapes and only share an edge page
+    auto cell = [pageSize](double value){
+        const double index = std::floor(value / pageSize);
+        if(!std::isfinite(index)) return 0;
+        return int(qBound(double(std::numeric_limits<int>::min()), index, double(std::numeric_limits<int>::max())));
+    };
+    const QPointF centre = BoundsOf(shape).center();
+    return QPoint(cell(centre.x()), cell(centre.y()));
+}
+
+/*********************** Reading ***********************/
+PagedDocument::~PagedDocument()
+{
+    Close();
+}
+
+bool PagedDocument::Open(const QString &filePath)
+{
+    Close();
+    file.setFileName(filePath);
+    if(!file.open(QIODevice::ReadOnly)) return false;
+
+    //mapped, so only the pages that are read get paged in
+    size = file.size();
+    data = file.map(0, size);
+    if(!data){
+        fallback = file.readAll();
+        data = reinterpret_cast<const uchar *>(fallback.constData());
+        size = fallback.size();
+    }
+    if(!Parse()){
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void PagedDocument::Close()
+{
+    if(data && fallback.isEmpty()) file.unmap(const_cast<uchar *>(data));
+    data = nullptr;
+    size = 0;
+    fallback.clear();
+    file.close();
+    pages.clear();
+    layers.clear();
+    extent = QRectF();
+    shapeCount = 0;
+}
+
+bool PagedDocument::Parse()
+{
+    if(size < HeaderSize) return false;
+    if(qFromLittleEndian<quint32>(data) != Magic) return false;
+    if(qFromLittleEndian<quint16>(data + 4) > Version) return false; // written by a newer version
+    if(qFromLittleEndian<quint16>(data + 6) < HeaderSize) return false;
+
+    pageSize = GetDouble(data + 16);
+    const quint64 tableOffset = qFromLittleEndian<quint64>(data + 24);
+    const quint64 chunkCount = qFromLittleEndian<quint64>(data + 32);
+    const quint64 layerOffset = qFromLittleEndian<quint64>(data + 40);
+    const quint64 layerSize = qFromLittleEndian<quint64>(data + 48);
+    const quint64 total = quint64(size);
+    if(!std::isfinite(pageSize) || pageSize <= 0) return false;
+    if(tableOffset > total || chunkCount > (total - tableOffset) / ChunkEntrySize) return false;
+    if(layerOffset > total || layerSize > total - layerOffset) return false;
+
+    if(layerSize > 0){
+        QVector<ShapeData> none;
+        if(!BinaryDocument::Decode(data + layerOffset, qint64(layerSize), none, &layers)) return false;
+    }
+
+    //chunks of one page are gathered under it, in file order
+    QHash<quint64, int> pageOfCell;
+    for(quint64 i = 0; i < chunkCount; ++i){
+        const uchar *entry = data + tableOffset + i * ChunkEntrySize;
+        const QPoint cell(qFromLittleEndian<qint32>(entry), qFromLittleEndian<qint32>(entry + 4));
+        const QRectF bounds(GetDouble(entry + 8), GetDouble(entry + 16), GetDouble(entry + 24), GetDouble(entry + 32));
+        const quint64 count = qFromLittleEndian<quint64>(entry + 40);
+        const quint64 offset = qFromLittleEndian<quint64>(entry + 48);
+        const quint64 chunkSize = qFromLittleEndian<quint64>(entry + 56);
+        if(offset > total || chunkSize > total - offset || count > chunkSize) return false;
+
+        auto it = pageOfCell.constFind(PackCell(cell));
+        if(it == pageOfCell.constEnd()){
+            it = pageOfCell.insert(PackCell(cell), int(pages.size()));
+            Page page;
+            page.cell = cell;
+            page.bounds = bounds;
+            pages.append(page);
+        }
+        Page &page = pages[it.value()];
+        page.bounds = Cover(page.bounds, bounds);
+        page.shapeCount += qint64(count);
+        page.bytes += qint64(chunkSize);
+        page.chunks.append(Chunk{ qint64(offset), qint64(chunkSize) });
+        shapeCount += qint64(count);
+    }
+    for(qsizetype i = 0; i < pages.size(); ++i){
+        extent = i == 0 ? pages.at(i).bounds : Cover(extent, pages.at(i).bounds);
+    }
+    return true;
+}
+
+QVector<int> PagedDocument::PagesIn(const QRectF &rect) const
+{
+    //a few thousand pages even for site drawings, a linear pass is fine
+    QVector<int> found;
+    for(int i = 0; i < pages.size(); ++i){
+        if(Touches(pages.at(i).bounds, rect)) found.append(i);
+    }
+    return found;
+}
+
+bool PagedDocument::ReadPage(int page, QVector<ShapeData> &shapes) const
+{
+    shapes.clear();
+    if(!data || page < 0 || page >= pages.size()) return false;
+
+    const Page &entry = pages.at(page);
+    shapes.reserve(entry.shapeCount);
+    QVector<ShapeData> chunkShapes;
+    for(const Chunk &chunk : entry.chunks){
+        if(!BinaryDocument::Decode(data + chunk.offset, chunk.size, chunkShapes)) return false;
+        shapes.append(chunkShapes);
+    }
+    return true;
+}
+
+/*********************** Whole Drawing ***********************/
+bool PagedDocument::Save(const QString &filePath, const QVector<ShapeData> &shapes, const QVector<Layer> &layers,
+                         double pageSize)
+{
+    PagedDocumentWriter writer(filePath, pageSize);
+    if(!writer.Open()) return false;
+    for(const ShapeData &shape : shapes) writer.Add(shape);
+    writer.SetLayers(layers);
+    return writer.Finish();
+}
+
+bool PagedDocument::Load(const QString &filePath, QVector<ShapeData> &shapes, QVector<Layer> *layers)
+{
+    PagedDocument document;
+    if(!document.Open(filePath)) return false;
+
+    shapes.clear();
+    shapes.reserve(document.ShapeCount());
+    QVector<ShapeData> page;
+    for(int i = 0; i < document.Pages().size(); ++i){
+        if(!document.ReadPage(i, page)) return false;
+        shapes.append(page);
+    }
+    if(layers) *layers = document.Layers();
+    return true;
+}
+
+/*********************** Writing ***********************/
+PagedDocumentWriter::PagedDocumentWriter(const QString &filePath, double pageSize, qint64 bufferBytes)
+    : file(filePath)
+    , pageSize(std::isfinite(pageSize) && pageSize > 0 ? pageSize : PagedDocument::DefaultPageSize)
+    , bufferBytes(bufferBytes)
+{
+}
+
+bool PagedDocumentWriter::Open()
+{
+    //the header is written last, once the table offsets are known
+    if(!file.open(QIODevice::WriteOnly)) return false;
+    return file.write(QByteArray(HeaderSize, '\0')) == HeaderSize;
+}
+
+void PagedDocumentWriter::Add(const ShapeData &shape)
+{
+    buckets[PackCell(PagedDocument::CellOf(shape, pageSize))].append(shape);
+    buffered += BufferedCost(shape);
+    if(buffered >= bufferBytes) Flush();
+}
+
+bool PagedDocumentWriter::WriteAligned(const QByteArray &bytes)
+{
+    if(file.write(bytes) != bytes.size()) return false;
+    const qint64 padding = Align8(bytes.size()) - bytes.size();
+    return padding == 0 || file.write(QByteArray(padding, '\0')) == padding;
+}
+
+void PagedDocumentWriter::Flush()
+{
+    for(auto it = buckets.cbegin(); it != buckets.cend() && !failed; ++it){
+        const QVector<ShapeData> &shapes = it.value();
+        ChunkEntry chunk;
+        chunk.cell = QPoint(int(qint32(it.key() >> 32)), int(qint32(it.key() & 0xFFFFFFFFu)));
+        chunk.bounds = PagedDocument::BoundsOf(shapes.first());
+        for(const ShapeData &shape : shapes) chunk.bounds = Cover(chunk.bounds, PagedDocument::BoundsOf(shape));
+        chunk.shapeCount = shapes.size();
+        chunk.offset = file.pos();
+
+        const QByteArray bytes = BinaryDocument::Encode(shapes);
+        chunk.size = bytes.size();
+        if(!WriteAligned(bytes)) failed = true;
+        chunks.push_back(chunk);
+    }
+    buckets.clear();
+    buffered = 0;
+}
+
+bool PagedDocumentWriter::Finish()
+{
+    Flush();
+    if(failed){
+        file.cancelWriting();
+        return false;
+    }
+
+    const qint64 layerOffset = file.pos();
+    const QByteArray layerTable = layers.isEmpty() ? QByteArray() : BinaryDocument::Encode({}, layers);
+    if(!WriteAligned(layerTable)) failed = true;
+
+    const qint64 tableOffset = file.pos();
+    QByteArray table(qint64(chunks.size()) * ChunkEntrySize, '\0');
+    uchar *entry = reinterpret_cast<uchar *>(table.data());
+    for(const ChunkEntry &chunk : chunks){
+        qToLittleEndian<qint32>(chunk.cell.x(), entry);
+        qToLittleEndian<qint32>(chunk.cell.y(), entry + 4);
+        PutDouble(entry + 8, chunk.bounds.x());
+        PutDouble(entry + 16, chunk.bounds.y());
+        PutDouble(entry + 24, chunk.bounds.width());
+        PutDouble(entry + 32, chunk.bounds.height());
+        qToLittleEndian<quint64>(quint64(chunk.shapeCount), entry + 40);
+        qToLittleEndian<quint64>(quint64(chunk.offset), entry + 48);
+        qToLittleEndian<quint64>(quint64(chunk.size), entry + 56);
+        entry += ChunkEntrySize;
+    }
+    if(file.write(table) != table.size()) failed = true;
+
+    uchar header[HeaderSize] = {};
+    qToLittleEndian<quint32>(PagedDocument::Magic, header);
+    qToLittleEndian<quint16>(PagedDocument::Version, header + 4);
+    qToLittleEndian<quint16>(HeaderSize, header + 6);
+    PutDouble(header + 16, pageSize);
+    qToLittleEndian<quint64>(quint64(tableOffset), header + 24);
+    qToLittleEndian<quint64>(quint64(chunks.size()), header + 32);
+    qToLittleEndian<quint64>(quint64(layerOffset), header + 40);
+    qToLittleEndian<quint64>(quint64(layerTable.size()), header + 48);
+    if(!file.seek(0) || file.write(reinterpret_cast<const char *>(header), HeaderSize) != HeaderSize) failed = true;
+
+    if(failed){
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
@@ -0,0 +1,134 @@
+#ifndef PAGEDDOCUMENT_H
+#define PAGEDDOCUMENT_H
+
+#include <QFile>
+#include <QSaveFile>
+#include <QHash>
+#include <QPoint>
+#include <QRectF>
+#include <QString>
+#include <QVector>
+#include <vector>
+#include "Entity.h"
+
+//Drawing stored as pages of a square grid (*.cadp), for drawings too large to load.
+//
+//Layout (all values little-endian):
+//  Header       magic "CADP", u16 version, u16 header size, u64 reserved, double page size,
+//               u64 chunk table offset, u64 chunk count, u64 layer table offset, u64 layer table size
+//  Chunks       BinaryDocument documents holding shapes of one page each, 8-byte aligned
+//  Layer table  a BinaryDocument document with no shapes, only the layer table
+//  Chunk table  per chunk: i32 page column, i32 page row, 4 doubles bounds (x, y, width,
+//               height), u64 shape count, u64 offset, u64 size
+//
+//A shape belongs to the page its centre falls in, and a page's bounds cover all of its
+//shapes, so a query against page bounds also finds shapes reaching across a page border.
+//A page can be spread over several chunks: the writer flushes whatever it has buffered
+//when its memory budget is reached, so writing never holds the whole drawing either.
+//The file is mapped, not read, and a page's chunks are only decoded when it is asked for.
+class PagedDocument
+{
+public:
+    static constexpr quint32 Magic = 0x50444143; // "CADP"
+    static constexpr quint16 Version = 1;
+    static constexpr const char *Extension = "cadp";
+    static constexpr double DefaultPageSize = 2000.0;
+
+    struct Chunk{
+        qint64 offset = 0;
+        qint64 size = 0;
+    };
+
+    struct Page{
+        QPoint cell;        // column, row in the page grid
+        QRectF bounds;      // of the shapes on the page, not of the grid cell
+        qint64 shapeCount = 0;
+        qint64 bytes = 0;   // encoded size of its chunks
+        QVector<Chunk> chunks;
+    };
+
+    PagedDocument() = default;
+    ~PagedDocument();
+    PagedDocument(const PagedDocument &) = delete;
+    PagedDocument &operator=(const PagedDocument &) = delete;
+
+    static bool IsPagedPath(const QString &filePath);
+
+    bool Open(const QString &filePath);
+    void Close();
+    bool IsOpen() const { return data != nullptr; }
+    QString FilePath() const { return file.fileName(); }
+
+    double PageSize() const { return pageSize; }
+    const QVector<Page> &Pages() const { return pages; }
+    const QVector<Layer> &Layers() const { return layers; }
+    QRectF Extent() const { return extent; }
+    qint64 ShapeCount() const { return shapeCount; }
+
+    //pages whose bounds touch rect
+    QVector<int> PagesIn(const QRectF &rect) const;
+    //decodes one page; only reads the mapping, so pages can be read from several threads
+    bool ReadPage(int page, QVector<ShapeData> &shapes) const;
+
+    //whole drawing at once, for callers that want it in memory anyway
+    static bool Save(const QString &filePath, const QVector<ShapeData> &shapes, const QVector<Layer> &layers,
+                     double pageSize = DefaultPageSize);
+    static bool Load(const QString &filePath, QVector<ShapeData> &shapes, QVector<Layer> *layers = nullptr);
+
+    //grid cell a shape is filed under
+    static QPoint CellOf(const ShapeData &shape, double pageSize);
+    static QRectF BoundsOf(const ShapeData &shape);
+
+private:
+    QFile file;
+    QByteArray fallback; // file contents when it can't be mapped
+    const uchar *data = nullptr;
+    qint64 size = 0;
+    double pageSize = DefaultPageSize;
+    QVector<Page> pages;
+    QVector<Layer> layers;
+    QRectF extent;
+    qint64 shapeCount = 0;
+
+    bool Parse();
+};
+
+//Writes a PagedDocument from shapes handed over in any order. Shapes are bucketed by
+//page and every bucket is written out as a chunk once bufferBytes of them are held.
+class PagedDocumentWriter
+{
+public:
+    static constexpr qint64 DefaultBufferBytes = 64ll * 1024 * 1024;
+
+    explicit PagedDocumentWriter(const QString &filePath, double pageSize = PagedDocument::DefaultPageSize,
+                                 qint64 bufferBytes = DefaultBufferBytes);
+
+    bool Open();
+    void Add(const ShapeData &shape);
+    void SetLayers(const QVector<Layer> &layers) { this->layers = layers; }
+    //writes the tables and replaces the target file, false if anything failed
+    bool Finish();
+
+private:
+    struct ChunkEntry{
+        QPoint cell;
+        QRectF bounds;
+        qint64 shapeCount = 0;
+        qint64 offset = 0;
+        qint64 size = 0;
+    };
+
+    QSaveFile file;
+    double pageSize;
+    qint64 bufferBytes;
+    qint64 buffered = 0;
+    QHash<quint64, QVector<ShapeData>> buckets; // by packed cell
+    std::vector<ChunkEntry> chunks;
+    QVector<Layer> layers;
+    bool failed = false;
+
+    void Flush();
+    bool WriteAligned(const QByteArray &bytes);
+};
+
+#endif // PAGEDDOCUMENT_H
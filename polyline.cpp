@@ -0,0 +1,364 @@
+#include "polyline.h"
+#include <QtEndian>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+//distance from p to the segment a-b, to a itself when the segment is a point
+qreal SegmentDistance(const QPointF &p, const QPointF &a, const QPointF &b)
+{
+    const QPointF d = b - a;
+    const qreal lengthSquared = QPointF::dotProduct(d, d);
+    qreal t = lengthSquared > 0 ? QPointF::dotProduct(p - a, d) / lengthSquared : 0;
+    t = qBound<qreal>(0, t, 1);
+    const QPointF nearest = a + t * d;
+    return std::hypot(p.x() - nearest.x(), p.y() - nearest.y());
+}
+
+//squared, callers only compare it
+qreal BoxDistanceSquared(const QRectF &box, const QPointF &p)
+{
+    const qreal dx = std::max({ box.left() - p.x(), 0.0, p.x() - box.right() });
+    const qreal dy = std::max({ box.top() - p.y(), 0.0, p.y() - box.bottom() });
+    return dx * dx + dy * dy;
+}
+
+//one box per ChunkSize segments, each including the vertex shared with the next
+std::vector<QRectF> ChunkBoxes(const QPointF *points, qsizetype count)
+{
+    std::vector<QRectF> boxes;
+    if(count == 0) return boxes;
+    for(qsizetype first = 0; first == 0 || first < count - 1; first += Polyline::ChunkSize){
+        const qsizetype last = std::min(first + Polyline::ChunkSize, count - 1);
+        double left = points[first].x(), right = left, top = points[first].y(), bottom = top;
+        for(qsizetype i = first + 1; i <= last; ++i){
+            left = std::min(left, points[i].x());
+            right = std::max(right, points[i].x());
+            top = std::min(top, points[i].y());
+            bottom = std::max(bottom, points[i].y());
+        }
+        boxes.push_back(QRectF(QPointF(left, top), QPointF(right, bottom)));
+    }
+    return boxes;
+}
+
+quint64 Fnv1a(quint64 hash, const void *data, size_t size)
+{
+    const uchar *bytes = static_cast<const uchar *>(data);
+    for(size_t i = 0; i < size; ++i){
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+} // namespace
+
+/*********************** Building ***********************/
+Polyline Polyline::FromPoints(const QVector<QPointF> &points, Encoding encoding)
+{
+    if(points.isEmpty()) return Polyline();
+
+    double left = points.first().x(), right = left, top = points.first().y(), bottom = top;
+    for(const QPointF &point : points){
+        left = std::min(left, point.x());
+        right = std::max(right, point.x());
+        top = std::min(top, point.y());
+        bottom = std::max(bottom, point.y());
+    }
+    const QPointF topLeft(left, top);
+
+    auto buffer = std::make_unique<Buffer>();
+    buffer->bounds = QRectF(topLeft, QPointF(right, bottom));
+
+    if(encoding == Encoding::Auto){
+        encoding = points.size() >= AutoDeltaThreshold ? Encoding::Delta : Encoding::Absolute;
+    }
+    if(encoding == Encoding::Delta){
+        //the extent bounds every step, so one check tells whether they all fit
+        const double limit = std::numeric_limits<qint32>::max() * DeltaQuantum;
+        if(right - left < limit && bottom - top < limit){
+            buffer->steps.reserve(2 * size_t(points.size()));
+            qint64 x = 0, y = 0;
+            for(const QPointF &point : points){
+                const qint64 qx = std::llround((point.x() - left) / DeltaQuantum);
+                const qint64 qy = std::llround((point.y() - top) / DeltaQuantum);
+                buffer->steps.push_back(qint32(qx - x));
+                buffer->steps.push_back(qint32(qy - y));
+                x = qx;
+                y = qy;
+            }
+            buffer->encoding = Encoding::Delta;
+            return Finish(std::move(buffer), false);
+        }
+    }
+
+    buffer->points.reserve(points.size());
+    for(const QPointF &point : points) buffer->points.push_back(point - topLeft);
+    buffer->encoding = Encoding::Absolute;
+    return Finish(std::move(buffer), false);
+}
+
+Polyline Polyline::FromLocal(std::vector<QPointF> local)
+{
+    if(local.empty()) return Polyline();
+    auto buffer = std::make_unique<Buffer>();
+    buffer->points = std::move(local);
+    buffer->encoding = Encoding::Absolute;
+    return Finish(std::move(buffer), true);
+}
+
+Polyline Polyline::FromSteps(std::vector<qint32> steps)
+{
+    if(steps.size() < 2) return Polyline();
+    auto buffer = std::make_unique<Buffer>();
+    steps.resize(steps.size() & ~size_t(1));
+    buffer->steps = std::move(steps);
+    buffer->encoding = Encoding::Delta;
+    return Finish(std::move(buffer), true);
+}
+
+//fills in the count, chunk boxes and hash, and the bounds of the stored points when asked
+Polyline Polyline::Finish(std::unique_ptr<Buffer> buffer, bool localBounds)
+{
+    const bool delta = buffer->encoding == Encoding::Delta;
+    buffer->count = delta ? qsizetype(buffer->steps.size() / 2) : qsizetype(buffer->points.size());
+
+    std::vector<QPointF> decoded;
+    if(delta){
+        decoded.reserve(buffer->count);
+        qint64 x = 0, y = 0;
+        for(qsizetype i = 0; i < buffer->count; ++i){
+            x += buffer->steps[2 * i];
+            y += buffer->steps[2 * i + 1];
+            decoded.push_back(QPointF(x * DeltaQuantum, y * DeltaQuantum));
+            if(i % ChunkSize == 0){
+                Chunk chunk;
+                chunk.x = x;
+                chunk.y = y;
+                buffer->chunks.push_back(chunk);
+            }
+        }
+    }
+    const QPointF *points = delta ? decoded.data() : buffer->points.data();
+    const std::vector<QRectF> boxes = ChunkBoxes(points, buffer->count);
+    buffer->chunks.resize(boxes.size());
+    for(size_t k = 0; k < boxes.size(); ++k) buffer->chunks[k].box = boxes[k];
+
+    if(localBounds){
+        //by hand, united() drops the empty box of a single vertex
+        double left = boxes.front().left(), right = boxes.front().right();
+        double top = boxes.front().top(), bottom = boxes.front().bottom();
+        for(const QRectF &box : boxes){
+            left = std::min(left, box.left());
+            right = std::max(right, box.right());
+            top = std::min(top, box.top());
+            bottom = std::max(bottom, box.bottom());
+        }
+        buffer->bounds = QRectF(QPointF(left, top), QPointF(right, bottom));
+    }
+
+    quint64 hash = 14695981039346656037ull;
+    hash = Fnv1a(hash, &buffer->count, sizeof(buffer->count));
+    hash = delta ? Fnv1a(hash, buffer->steps.data(), buffer->steps.size() * sizeof(qint32))
+                 : Fnv1a(hash, buffer->points.data(), buffer->points.size() * sizeof(QPointF));
+    buffer->hash = hash;
+
+    Polyline polyline;
+    polyline.buffer = std::move(buffer);
+    return polyline;
+}
+
+/*********************** Encoding ***********************/
+qint64 Polyline::EncodedSize(qsizetype count, Encoding encoding)
+{
+    return encoding == Encoding::Delta ? count * 2 * qint64(sizeof(qint32)) : count * 2 * qint64(sizeof(double));
+}
+
+void Polyline::Encode(uchar *dst) const
+{
+    if(!buffer) return;
+    if(buffer->encoding == Encoding::Delta){
+        for(const qint32 step : buffer->steps){
+            qToLittleEndian<qint32>(step, dst);
+            dst += sizeof(qint32);
+        }
+        return;
+    }
+    for(const QPointF &point : buffer->points){
+        for(const double value : { point.x(), point.y() }){
+            quint64 bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            qToLittleEndian<quint64>(bits, dst);
+            dst += sizeof(bits);
+        }
+    }
+}
+
+Polyline Polyline::Decode(const uchar *src, qsizetype count, Encoding encoding)
+{
+    if(encoding == Encoding::Delta){
+        std::vector<qint32> steps(2 * size_t(count));
+        for(qint32 &step : steps){
+            step = qFromLittleEndian<qint32>(src);
+            src += sizeof(qint32);
+        }
+        return FromSteps(std::move(steps));
+    }
+    if(encoding != Encoding::Absolute) return Polyline();
+
+    std::vector<QPointF> points(count);
+    for(QPointF &point : points){
+        double values[2];
+        for(double &value : values){
+            const quint64 bits = qFromLittleEndian<quint64>(src);
+            std::memcpy(&value, &bits, sizeof(value));
+            src += sizeof(bits);
+        }
+        point = QPointF(values[0], values[1]);
+    }
+    return FromLocal(std::move(points));
+}
+
+/*********************** Access ***********************/
+qint64 Polyline::MemoryBytes() const
+{
+    if(!buffer) return 0;
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    qint64 bytes = sizeof(Buffer) + qint64(buffer->points.capacity() * sizeof(QPointF))
+                 + qint64(buffer->steps.capacity() * sizeof(qint32))
+                 + qint64(buffer->chunks.capacity() * sizeof(Chunk))
+                 + qint64(buffer->ranks.capacity() * sizeof(float));
+    for(const auto &band : buffer->bands){
+        bytes += band.second.points.capacity() * qint64(sizeof(QPointF)) + qint64(band.second.chunks.capacity() * sizeof(QRectF));
+    }
+    return bytes;
+}
+
+QVector<QPointF> Polyline::Points(const QPointF &topLeft) const
+{
+    QVector<QPointF> points;
+    points.reserve(Size());
+    ForEachPoint(topLeft, [&points](const QPointF &point){ points.append(point); });
+    return points;
+}
+
+qreal Polyline::Distance(const QPointF &local) const
+{
+    qreal best = std::numeric_limits<qreal>::max();
+    if(!buffer) return best;
+
+    auto scan = [&](size_t k){
+        const qsizetype first = qsizetype(k) * ChunkSize;
+        const qsizetype last = std::min(first + ChunkSize, Size() - 1);
+        bool started = false;
+        QPointF previous;
+        ForEachInRange(first, last, QPointF(), [&](const QPointF &point){
+            best = std::min(best, SegmentDistance(local, started ? previous : point, point));
+            previous = point;
+            started = true;
+        });
+    };
+
+    //the closest chunk first gives a tight bound, then every chunk farther away
+    //than the best segment so far is skipped without decoding it
+    size_t closest = 0;
+    qreal closestDistance = std::numeric_limits<qreal>::max();
+    for(size_t k = 0; k < buffer->chunks.size(); ++k){
+        const qreal distance = BoxDistanceSquared(buffer->chunks[k].box, local);
+        if(distance < closestDistance){
+            closestDistance = distance;
+            closest = k;
+        }
+    }
+    scan(closest);
+    for(size_t k = 0; k < buffer->chunks.size(); ++k){
+        if(k != closest && BoxDistanceSquared(buffer->chunks[k].box, local) < best * best) scan(k);
+    }
+    return best;
+}
+
+bool Polyline::operator==(const Polyline &other) const
+{
+    if(buffer == other.buffer) return true;
+    if(!buffer || !other.buffer) return false;
+    if(buffer->count != other.buffer->count || buffer->encoding != other.buffer->encoding
+       || buffer->hash != other.buffer->hash){
+        return false;
+    }
+    return buffer->points == other.buffer->points && buffer->steps == other.buffer->steps;
+}
+
+/*********************** Simplification ***********************/
+int Polyline::BandOf(qreal scale)
+{
+    if(!(scale > 0)) return 0;
+    return qBound(MinBand, int(std::floor(std::log2(scale))), MaxBand);
+}
+
+//Douglas-Peucker once with no tolerance, recording for each vertex the deviation
+//that kept it; capping a vertex at its parent's rank makes any tolerance's result a
+//plain filter on the ranks. Called with the buffer mutex held.
+void Polyline::Rank() const
+{
+    if(!buffer->ranks.empty()) return;
+
+    std::vector<QPointF> points;
+    points.reserve(Size());
+    ForEachPoint(QPointF(), [&points](const QPointF &point){ points.push_back(point); });
+
+    const float unbounded = std::numeric_limits<float>::max();
+    std::vector<float> ranks(points.size(), 0.0f);
+    ranks.front() = ranks.back() = unbounded;
+
+    struct Span{
+        qsizetype first, last;
+        float limit;
+    };
+    std::vector<Span> pending{ { 0, qsizetype(points.size()) - 1, unbounded } };
+    while(!pending.empty()){
+        const Span span = pending.back();
+        pending.pop_back();
+        if(span.last - span.first < 2) continue;
+
+        qsizetype farthest = span.first + 1;
+        qreal deviation = -1;
+        for(qsizetype i = span.first + 1; i < span.last; ++i){
+            const qreal distance = SegmentDistance(points[i], points[span.first], points[span.last]);
+            if(distance > deviation){
+                deviation = distance;
+                farthest = i;
+            }
+        }
+        const float rank = std::min(float(deviation), span.limit);
+        ranks[farthest] = rank;
+        pending.push_back({ span.first, farthest, rank });
+        pending.push_back({ farthest, span.last, rank });
+    }
+    buffer->ranks = std::move(ranks);
+}
+
+const Polyline::Band &Polyline::Simplified(qreal scale) const
+{
+    static const Band empty;
+    if(!buffer) return empty;
+
+    const int band = BandOf(scale);
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    auto found = buffer->bands.find(band);
+    if(found != buffer->bands.end()) return found->second;
+
+    Rank();
+    //the band's upper scale, so anywhere in the band the error stays under SimplifyPixels
+    const float tolerance = float(SimplifyPixels / std::ldexp(1.0, band + 1));
+    Band &result = buffer->bands[band];
+    qsizetype index = 0;
+    ForEachPoint(QPointF(), [&](const QPointF &point){
+        if(buffer->ranks[index++] > tolerance) result.points.append(point);
+    });
+    result.chunks = ChunkBoxes(result.points.constData(), result.points.size());
+    return result;
+}
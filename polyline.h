@@ -0,0 +1,179 @@
+#ifndef POLYLINE_H
+#define POLYLINE_H
+
+#include <QLineF>
+#include <QPointF>
+#include <QRectF>
+#include <QVector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//Vertex list of a polyline shape, immutable and shared by every copy of the shape.
+//
+//Vertices are kept relative to the top-left corner of their bounds when built; the
+//shape's rect says where that corner is now, so moving a polyline only moves its
+//rect and copies (snapshots, the spatial index, undo records) share one buffer.
+//
+//Absolute encoding stores two doubles per vertex. Delta encoding stores the first
+//vertex and then each step as two qint32 counted in DeltaQuantum units: half the
+//memory, with vertices rounded to that grid. Auto picks delta for long lists whose
+//steps fit, short hand-drawn ones stay exact.
+//
+//For painting, one Douglas-Peucker pass ranks every vertex by the tolerance at
+//which it would be dropped (clamped so coarser results nest inside finer ones).
+//Each zoom band, a power of two of the view scale, then keeps the vertices ranked
+//above what stays under SimplifyPixels at that band. Ranks and bands are built on
+//first use behind a mutex, so tile workers can paint shared copies.
+class Polyline
+{
+public:
+    enum class Encoding : quint8 { Absolute, Delta, Auto };
+
+    static constexpr double DeltaQuantum = 1.0 / 1024; // scene units per delta step
+    static constexpr qsizetype AutoDeltaThreshold = 256; // vertices from which Auto tries delta
+    static constexpr int ChunkSize = 64;                 // vertices per hit-test and culling box
+    static constexpr qreal SimplifyPixels = 0.5;        // simplification error on screen
+    static constexpr int MinBand = -24;
+    static constexpr int MaxBand = 24;
+
+    //vertices of one zoom band with a bounding box per ChunkSize of them; chunk k
+    //covers points [k * ChunkSize, (k + 1) * ChunkSize] so it includes the joining segment
+    struct Band{
+        QVector<QPointF> points;
+        std::vector<QRectF> chunks;
+    };
+
+    Polyline() = default;
+
+    //points in scene coordinates; Bounds() gives the rect a shape should start with
+    static Polyline FromPoints(const QVector<QPointF> &points, Encoding encoding = Encoding::Auto);
+    //points already relative to a rect's top-left, as stored on disk
+    static Polyline FromLocal(std::vector<QPointF> local);
+    static Polyline FromSteps(std::vector<qint32> steps);
+
+    bool IsNull() const { return !buffer; }
+    qsizetype Size() const { return buffer ? buffer->count : 0; }
+    Encoding GetEncoding() const { return buffer ? buffer->encoding : Encoding::Absolute; }
+    //where the points were when built, the shape's rect tracks it from there
+    QRectF Bounds() const { return buffer ? buffer->bounds : QRectF(); }
+    //raw storage, Absolute: Size() local points, Delta: 2 * Size() steps
+    const std::vector<QPointF> &LocalPoints() const { return buffer->points; }
+    const std::vector<qint32> &Steps() const { return buffer->steps; }
+    qint64 MemoryBytes() const;
+
+    //vertices as files store them: the raw storage, little-endian
+    static qint64 EncodedSize(qsizetype count, Encoding encoding);
+    qint64 EncodedSize() const { return EncodedSize(Size(), GetEncoding()); }
+    void Encode(uchar *dst) const;
+    //null when encoding isn't Absolute or Delta
+    static Polyline Decode(const uchar *src, qsizetype count, Encoding encoding);
+    quint64 Hash() const { return buffer ? buffer->hash : 0; }
+
+    //visit(QPointF) for every vertex, offset by topLeft
+    template<typename Visitor>
+    void ForEachPoint(const QPointF &topLeft, Visitor &&visit) const;
+    QVector<QPointF> Points(const QPointF &topLeft) const;
+    //vertex i offset by topLeft, decoding at most one chunk
+    QPointF Point(qsizetype i, const QPointF &topLeft) const;
+    //visit(QLineF) for the segments whose chunk box touches area (scene coordinates)
+    template<typename Visitor>
+    void ForEachSegment(const QPointF &topLeft, const QRectF &area, Visitor &&visit) const;
+
+    //distance from a point to the nearest segment, both relative to topLeft
+    qreal Distance(const QPointF &local) const;
+
+    //band for the given view scale, in local coordinates
+    const Band &Simplified(qreal scale) const;
+    static int BandOf(qreal scale);
+
+    bool operator==(const Polyline &other) const;
+    bool operator!=(const Polyline &other) const { return !(*this == other); }
+
+private:
+    struct Chunk{
+        QRectF box;
+        qint64 x = 0, y = 0; // Delta: quantized position of the chunk's first vertex
+    };
+
+    struct Buffer{
+        Encoding encoding = Encoding::Absolute;
+        qsizetype count = 0;
+        QRectF bounds;
+        std::vector<QPointF> points; // Absolute
+        std::vector<qint32> steps;   // Delta
+        std::vector<Chunk> chunks;
+        quint64 hash = 0;
+
+        mutable std::mutex mutex;
+        mutable std::vector<float> ranks;
+        mutable std::map<int, Band> bands; // nodes never move, handed out by reference
+    };
+
+    std::shared_ptr<const Buffer> buffer;
+
+    static Polyline Finish(std::unique_ptr<Buffer> buffer, bool localBounds);
+    template<typename Visitor>
+    void ForEachInRange(qsizetype first, qsizetype last, const QPointF &topLeft, Visitor &&visit) const;
+    void Rank() const;
+};
+
+template<typename Visitor>
+void Polyline::ForEachInRange(qsizetype first, qsizetype last, const QPointF &topLeft, Visitor &&visit) const
+{
+    //vertices [first, last]; delta decoding starts from the chunk holding first
+    if(buffer->encoding == Encoding::Absolute){
+        for(qsizetype i = first; i <= last; ++i) visit(topLeft + buffer->points[i]);
+        return;
+    }
+    const Chunk &chunk = buffer->chunks[first / ChunkSize];
+    qint64 x = chunk.x, y = chunk.y;
+    for(qsizetype i = first / ChunkSize * ChunkSize + 1; i <= first; ++i){
+        x += buffer->steps[2 * i];
+        y += buffer->steps[2 * i + 1];
+    }
+    for(qsizetype i = first;;){
+        visit(topLeft + QPointF(x * DeltaQuantum, y * DeltaQuantum));
+        if(++i > last) break;
+        x += buffer->steps[2 * i];
+        y += buffer->steps[2 * i + 1];
+    }
+}
+
+template<typename Visitor>
+void Polyline::ForEachPoint(const QPointF &topLeft, Visitor &&visit) const
+{
+    if(Size() > 0) ForEachInRange(0, Size() - 1, topLeft, visit);
+}
+
+inline QPointF Polyline::Point(qsizetype i, const QPointF &topLeft) const
+{
+    QPointF point;
+    ForEachInRange(i, i, topLeft, [&point](const QPointF &p){ point = p; });
+    return point;
+}
+
+template<typename Visitor>
+void Polyline::ForEachSegment(const QPointF &topLeft, const QRectF &area, Visitor &&visit) const
+{
+    if(!buffer) return;
+    const QRectF local = area.normalized().translated(-topLeft);
+    for(size_t k = 0; k < buffer->chunks.size(); ++k){
+        const QRectF &box = buffer->chunks[k].box;
+        if(box.left() > local.right() || box.right() < local.left()
+           || box.top() > local.bottom() || box.bottom() < local.top()) continue;
+
+        const qsizetype first = qsizetype(k) * ChunkSize;
+        const qsizetype last = qMin(first + ChunkSize, Size() - 1);
+        bool started = false;
+        QPointF previous;
+        ForEachInRange(first, last, topLeft, [&](const QPointF &point){
+            if(started) visit(QLineF(previous, point));
+            previous = point;
+            started = true;
+        });
+    }
+}
+
+#endif // POLYLINE_H
@@ -0,0 +1,188 @@
+#include "profiler.h"
+#include <QFile>
+#include <algorithm>
+
+std::atomic<bool> Profiler::enabled{ false };
+
+Profiler::Profiler()
+{
+    clock.start();
+}
+
+Profiler &Profiler::Instance()
+{
+    static Profiler profiler;
+    return profiler;
+}
+
+qint64 Profiler::Now()
+{
+    return Instance().clock.nsecsElapsed();
+}
+
+quint32 Profiler::ThreadId()
+{
+    //small stable numbers read better in trace viewers than raw handles
+    thread_local quint32 id = 0;
+    static std::atomic<quint32> next{ 1 };
+    if(id == 0) id = next.fetch_add(1, std::memory_order_relaxed);
+    return id;
+}
+
+/*********************** Control ***********************/
+void Profiler::SetEnabled(bool on)
+{
+    QMutexLocker locker(&mutex);
+    if(on && events.capacity() == 0){
+        //allocated once, on first use, so a build that never profiles pays nothing
+        events.reserve(MaxEvents);
+        latencies.reserve(LatencyWindow);
+        frames.reserve(FrameWindow);
+    }
+    enabled.store(on, std::memory_order_relaxed);
+}
+
+void Profiler::Reset()
+{
+    QMutexLocker locker(&mutex);
+    events.clear();
+    eventHead = 0;
+    latencies.clear();
+    latencyHead = 0;
+    frames.clear();
+    frameHead = 0;
+    counters.clear();
+}
+
+/*********************** Recording ***********************/
+template<typename T>
+static void PushRing(std::vector<T> &ring, qsizetype &head, qsizetype capacity, const T &value)
+{
+    if(qsizetype(ring.size()) < capacity){
+        ring.push_back(value);
+        return;
+    }
+    ring[head] = value;
+    head = (head + 1) % capacity;
+}
+
+void Profiler::Record(const char *name, qint64 startNs, qint64 durationNs, Kind kind)
+{
+    const Event event{ name, startNs, durationNs, ThreadId() };
+    QMutexLocker locker(&mutex);
+    PushRing(events, eventHead, MaxEvents, event);
+    if(kind == Kind::Input) PushRing(latencies, latencyHead, LatencyWindow, durationNs);
+}
+
+void Profiler::Count(const char *name, qint64 delta)
+{
+    QMutexLocker locker(&mutex);
+    counters[name] += delta;
+}
+
+void Profiler::FrameMark()
+{
+    const qint64 now = Now();
+    QMutexLocker locker(&mutex);
+    PushRing(frames, frameHead, FrameWindow, now);
+}
+
+/*********************** Statistics ***********************/
+double Profiler::Fps() const
+{
+    QMutexLocker locker(&mutex);
+    if(frames.size() < 2) return 0.0;
+
+    //the ring wraps, so the window ends are the extremes rather than the first and last slot
+    const auto [oldest, newest] = std::minmax_element(frames.begin(), frames.end());
+    const qint64 span = *newest - *oldest;
+    return span > 0 ? (frames.size() - 1) * 1e9 / span : 0.0;
+}
+
+double Profiler::LatencyPercentile(double fraction) const
+{
+    std::vector<qint64> samples;
+    {
+        QMutexLocker locker(&mutex);
+        samples = latencies;
+    }
+    if(samples.empty()) return 0.0;
+
+    const size_t rank = std::min(samples.size() - 1, size_t(fraction * (samples.size() - 1) + 0.5));
+    std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+    return samples[rank] / 1e6;
+}
+
+QHash<QString, qint64> Profiler::Counters() const
+{
+    QMutexLocker locker(&mutex);
+    QHash<QString, qint64> result;
+    for(auto it = counters.cbegin(); it != counters.cend(); ++it){
+        result.insert(QString::fromLatin1(it.key()), it.value());
+    }
+    return result;
+}
+
+std::vector<Profiler::Event> Profiler::Events() const
+{
+    QMutexLocker locker(&mutex);
+    std::vector<Event> snapshot;
+    snapshot.reserve(events.size());
+    snapshot.insert(snapshot.end(), events.begin() + eventHead, events.end());
+    snapshot.insert(snapshot.end(), events.begin(), events.begin() + eventHead);
+    return snapshot;
+}
+
+/*********************** Export ***********************/
+bool Profiler::ExportChromeTrace(const QString &filePath) const
+{
+    const std::vector<Event> snapshot = Events();
+    QHash<QString, qint64> counterValues = Counters();
+    qint64 now = Now();
+
+    QFile file(filePath);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+
+    //written by hand, building a QJsonDocument for 200k events costs far more than the data
+    QByteArray out;
+    out.reserve(1 << 20);
+    out += "{\"traceEvents\":[\n";
+    bool first = true;
+    auto flush = [&]{
+        if(out.size() < (1 << 20)) return true;
+        const bool ok = file.write(out) == out.size();
+        out.clear();
+        return ok;
+    };
+
+    for(const Event &event : snapshot){
+        if(!first) out += ",\n";
+        first = false;
+        out += "{\"name\":\"";
+        out += event.name;
+        out += "\",\"cat\":\"cad\",\"ph\":\"X\",\"pid\":1,\"tid\":";
+        out += QByteArray::number(event.thread);
+        out += ",\"ts\":";
+        out += QByteArray::number(event.startNs / 1000.0, 'f', 3);
+        out += ",\"dur\":";
+        out += QByteArray::number(event.durationNs / 1000.0, 'f', 3);
+        out += '}';
+        if(!flush()) return false;
+    }
+
+    //counters as one sample each at export time
+    for(auto it = counterValues.cbegin(); it != counterValues.cend(); ++it){
+        if(!first) out += ",\n";
+        first = false;
+        out += "{\"name\":\"";
+        out += it.key().toLatin1();
+        out += "\",\"ph\":\"C\",\"pid\":1,\"ts\":";
+        out += QByteArray::number(now / 1000.0, 'f', 3);
+        out += ",\"args\":{\"value\":";
+        out += QByteArray::number(it.value());
+        out += "}}";
+    }
+    out += "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+    return file.write(out) == out.size();
+}
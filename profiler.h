@@ -0,0 +1,103 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <atomic>
+#include <vector>
+
+//Process-wide collector for scoped timings and counters.
+//
+//Disabled by default. While disabled a ScopedTimer or CAD_COUNT costs one relaxed
+//atomic load and a branch, so the hooks can stay in hot paths. While enabled every
+//timing is kept in a bounded ring of trace events (exported as Chrome trace-event
+//JSON, load it in chrome://tracing or Perfetto) and input handler timings also feed
+//a rolling window for the p50/p99 latency shown by the canvas overlay.
+class Profiler
+{
+public:
+    static constexpr qsizetype MaxEvents = 200000;
+    static constexpr qsizetype LatencyWindow = 1024;
+    static constexpr qsizetype FrameWindow = 120;
+
+    enum class Kind { Scope, Input };
+
+    struct Event{
+        const char *name;
+        qint64 startNs;
+        qint64 durationNs;
+        quint32 thread;
+    };
+
+    static Profiler &Instance();
+    static bool IsEnabled() { return enabled.load(std::memory_order_relaxed); }
+    static qint64 Now();
+
+    void SetEnabled(bool on);
+    void Reset();
+
+    void Record(const char *name, qint64 startNs, qint64 durationNs, Kind kind);
+    void Count(const char *name, qint64 delta);
+    //one call per painted frame, drives the FPS figure
+    void FrameMark();
+
+    double Fps() const;
+    //input handler latency percentiles over the last LatencyWindow events, in ms
+    double LatencyPercentile(double fraction) const;
+    QHash<QString, qint64> Counters() const;
+    //the recorded timings, oldest first
+    std::vector<Event> Events() const;
+
+    bool ExportChromeTrace(const QString &filePath) const;
+
+private:
+    Profiler();
+
+    static std::atomic<bool> enabled;
+
+    mutable QMutex mutex;
+    QElapsedTimer clock;
+    std::vector<Event> events; // ring buffer, eventHead is the next slot once full
+    qsizetype eventHead = 0;
+    std::vector<qint64> latencies;
+    qsizetype latencyHead = 0;
+    std::vector<qint64> frames;
+    qsizetype frameHead = 0;
+    QHash<const char *, qint64> counters;
+
+    static quint32 ThreadId();
+};
+
+//Times the enclosing scope under a static name (string literal).
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(const char *name, Profiler::Kind kind = Profiler::Kind::Scope)
+        : name(Profiler::IsEnabled() ? name : nullptr), kind(kind)
+    {
+        if(this->name) start = Profiler::Now();
+    }
+    ~ScopedTimer()
+    {
+        if(name) Profiler::Instance().Record(name, start, Profiler::Now() - start, kind);
+    }
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+    const char *name;
+    Profiler::Kind kind;
+    qint64 start = 0;
+};
+
+#define CAD_CONCAT_INNER(a, b) a##b
+#define CAD_CONCAT(a, b) CAD_CONCAT_INNER(a, b)
+#define CAD_PROFILE_SCOPE(name) ScopedTimer CAD_CONCAT(cadProfileScope, __LINE__)(name)
+#define CAD_PROFILE_INPUT(name) ScopedTimer CAD_CONCAT(cadProfileScope, __LINE__)(name, Profiler::Kind::Input)
+#define CAD_COUNT(name, delta) \
+    do { if(Profiler::IsEnabled()) Profiler::Instance().Count(name, delta); } while(0)
+
+#endif // PROFILER_H
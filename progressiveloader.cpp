@@ -0,0 +1,141 @@
+#include "progressiveloader.h"
+#include "shapestreamreader.h"
+#include <QFile>
+
+ProgressiveLoader::ProgressiveLoader(QObject *parent)
+    : QObject(parent)
+{
+    qRegisterMetaType<ShapeData>();
+    qRegisterMetaType<QVector<ShapeData>>();
+    qRegisterMetaType<QVector<Layer>>();
+}
+
+ProgressiveLoader::~ProgressiveLoader()
+{
+    Cancel();
+    if(thread){
+        thread->wait();
+        delete thread;
+    }
+}
+
+/*********************** Control ***********************/
+void ProgressiveLoader::Start(const QString &filePath, int batchSize)
+{
+    Cancel();
+    if(thread){
+        thread->wait();
+        delete thread;
+    }
+
+    cancelRequested = false;
+    freeBatches.acquire(freeBatches.available());
+    freeBatches.release(MaxPendingBatches);
+    const quint64 run = ++generation;
+    running = true;
+
+    thread = QThread::create([this, filePath, batchSize, run]{ Run(filePath, batchSize, run); });
+    thread->start();
+}
+
+void ProgressiveLoader::Cancel()
+{
+    cancelRequested = true;
+}
+
+void ProgressiveLoader::BatchConsumed()
+{
+    freeBatches.release();
+}
+
+bool ProgressiveLoader::IsRunning() const
+{
+    return running;
+}
+
+/*********************** Worker ***********************/
+template<typename Deliver>
+void ProgressiveLoader::Post(quint64 run, bool final, Deliver deliver)
+{
+    QMetaObject::invokeMethod(this, [this, run, final, deliver]{
+        if(run != generation || (!final && cancelRequested)) return;
+        if(final) running = false;
+        deliver();
+    }, Qt::QueuedConnection);
+}
+
+bool ProgressiveLoader::WaitForFreeBatch()
+{
+    //poll so a cancel is noticed even when the GUI stopped consuming
+    while(!freeBatches.tryAcquire(1, 50)){
+        if(cancelRequested) return false;
+    }
+    return !cancelRequested;
+}
+
+void ProgressiveLoader::Run(const QString &filePath, int batchSize, quint64 run)
+{
+    auto finish = [this, run](bool ok, bool cancelled){
+        //a cancel that came after the last batch still counts, its batches were dropped
+        Post(run, true, [this, ok, cancelled]{
+            emit finished(ok && !cancelRequested, cancelled || cancelRequested);
+        });
+    };
+
+    QFile file(filePath);
+    if(!file.open(QIODevice::ReadOnly)){
+        finish(false, false);
+        return;
+    }
+
+    const qint64 total = qMax<qint64>(file.size(), 1);
+    ShapeStreamReader reader(&file);
+    QVector<ShapeData> batch;
+    batch.reserve(batchSize);
+    int lastPercent = -1;
+
+    //layer entries come ahead of the shapes, so they reach the receiver before any batch on their layers
+    qsizetype layersSent = 0;
+    auto sendLayers = [&](){
+        if(reader.Layers().size() == layersSent) return;
+        layersSent = reader.Layers().size();
+        const QVector<Layer> layers = reader.Layers();
+        Post(run, false, [this, layers]{ emit layersRead(layers); });
+    };
+
+    ShapeData shape;
+    while(reader.ReadNext(shape)){
+        batch.append(shape);
+        if(batch.size() < batchSize) continue;
+
+        if(!WaitForFreeBatch()){
+            finish(false, true);
+            return;
+        }
+        sendLayers();
+        Post(run, false, [this, batch]{ emit batchReady(batch); });
+        batch.clear();
+
+        const int percent = int(reader.BytesConsumed() * 100 / total);
+        if(percent != lastPercent){
+            lastPercent = percent;
+            Post(run, false, [this, percent]{ emit progressChanged(percent); });
+        }
+    }
+
+    if(reader.HasError()){
+        finish(false, false);
+        return;
+    }
+
+    sendLayers();
+    if(!batch.isEmpty()){
+        if(!WaitForFreeBatch()){
+            finish(false, true);
+            return;
+        }
+        Post(run, false, [this, batch]{ emit batchReady(batch); });
+    }
+    Post(run, false, [this]{ emit progressChanged(100); });
+    finish(true, false);
+}
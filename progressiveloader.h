@@ -0,0 +1,57 @@
+#ifndef PROGRESSIVELOADER_H
+#define PROGRESSIVELOADER_H
+
+#include <QObject>
+#include <QThread>
+#include <QSemaphore>
+#include <QVector>
+#include <QMetaType>
+#include <atomic>
+#include "Entity.h"
+
+Q_DECLARE_METATYPE(ShapeData)
+Q_DECLARE_METATYPE(Layer)
+
+//Loads a JSON drawing on a worker thread and hands shapes to the GUI thread in batches.
+//At most MaxPendingBatches batches are in flight; the receiver calls BatchConsumed()
+//after adding each one, so memory stays bounded by the batch size.
+//Signals are emitted on the loader's thread and only for the current run: whatever
+//an older run had queued when Start came again is dropped, and after Cancel only
+//the run's finished still arrives. IsRunning stays true until it has.
+class ProgressiveLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    static constexpr int MaxPendingBatches = 4;
+
+    explicit ProgressiveLoader(QObject *parent = nullptr);
+    ~ProgressiveLoader();
+
+    void Start(const QString &filePath, int batchSize = 5000);
+    void Cancel();
+    void BatchConsumed();
+    bool IsRunning() const;
+
+signals:
+    void layersRead(const QVector<Layer> &layers);
+    void batchReady(const QVector<ShapeData> &shapes);
+    void progressChanged(int percent);
+    void finished(bool ok, bool cancelled);
+
+private:
+    QThread *thread = nullptr;
+    std::atomic<bool> cancelRequested{false};
+    QSemaphore freeBatches;
+    quint64 generation = 0; // current run, only touched on the loader's thread
+    bool running = false;
+
+    void Run(const QString &filePath, int batchSize, quint64 run);
+    //queues deliver to the loader's thread, where it runs if run is still current;
+    //finished is delivered even after a cancel, everything else is not
+    template<typename Deliver>
+    void Post(quint64 run, bool final, Deliver deliver);
+    bool WaitForFreeBatch();
+};
+
+#endif // PROGRESSIVELOADER_H
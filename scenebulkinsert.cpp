@@ -0,0 +1,43 @@
+#include "scenebulkinsert.h"
+#include <cmath>
+
+SceneBulkInsert::SceneBulkInsert(QGraphicsScene *scene)
+    : scene(scene)
+    , previousMethod(scene->itemIndexMethod())
+    , previousSignalsBlocked(scene->signalsBlocked())
+    , existing(scene->items().size()) // cheap in the usual clear-then-load case
+{
+    scene->setItemIndexMethod(QGraphicsScene::NoIndex);
+    scene->blockSignals(true);
+}
+
+SceneBulkInsert::~SceneBulkInsert()
+{
+    scene->blockSignals(previousSignalsBlocked);
+
+    if(previousMethod == QGraphicsScene::BspTreeIndex){
+        //size the tree for everything in the scene, not just this batch
+        scene->setBspTreeDepth(BspDepthFor(existing + count));
+        scene->setItemIndexMethod(QGraphicsScene::BspTreeIndex);
+    }
+
+    if(!bounds.isNull()){
+        scene->setSceneRect(existing > 0 ? scene->sceneRect().united(bounds) : bounds);
+    }
+    scene->update(); // one repaint for the whole insert
+}
+
+void SceneBulkInsert::Add(QGraphicsItem *item)
+{
+    if(!item) return;
+    scene->addItem(item);
+    bounds = bounds.united(item->sceneBoundingRect());
+    ++count;
+}
+
+int SceneBulkInsert::BspDepthFor(qsizetype itemCount)
+{
+    if(itemCount <= ItemsPerLeaf) return MinBspDepth;
+    const int depth = int(std::ceil(std::log2(double(itemCount) / ItemsPerLeaf)));
+    return qBound(MinBspDepth, depth, MaxBspDepth);
+}
@@ -0,0 +1,43 @@
+#ifndef SCENEBULKINSERT_H
+#define SCENEBULKINSERT_H
+
+#include <QGraphicsScene>
+#include <QGraphicsItem>
+#include <QRectF>
+
+//Scoped bulk-insert mode for a QGraphicsScene.
+//While alive the scene runs without an item index and with signals blocked,
+//so each addItem skips BSP maintenance and change notifications. On destruction
+//the BSP index is switched back on once, with a depth sized to the number of
+//items that were added, and the scene rect is grown to cover them.
+class SceneBulkInsert
+{
+public:
+    explicit SceneBulkInsert(QGraphicsScene *scene);
+    ~SceneBulkInsert();
+
+    SceneBulkInsert(const SceneBulkInsert &) = delete;
+    SceneBulkInsert &operator=(const SceneBulkInsert &) = delete;
+
+    void Add(QGraphicsItem *item);
+
+    qsizetype Count() const { return count; }
+    QRectF Bounds() const { return bounds; }
+
+    //BSP depth that leaves roughly ItemsPerLeaf items in each leaf
+    static int BspDepthFor(qsizetype itemCount);
+
+private:
+    static constexpr int ItemsPerLeaf = 16;
+    static constexpr int MinBspDepth = 5;
+    static constexpr int MaxBspDepth = 20;
+
+    QGraphicsScene *scene;
+    QGraphicsScene::ItemIndexMethod previousMethod;
+    bool previousSignalsBlocked;
+    qsizetype existing;
+    qsizetype count = 0;
+    QRectF bounds;
+};
+
+#endif // SCENEBULKINSERT_H
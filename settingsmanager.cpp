@@ -1,19 +1,43 @@
 #include "settingsmanager.h"
+#include "binarydocument.h"
+#include "pageddocument.h"
+#include "shapeserializer.h"
 #include <QFile>
+#include <QSaveFile>
 #include <QJsonDocument>
 
 bool SettingsManager::SaveToFile(const QString &filePath, const QJsonArray &shapes){
+    if(BinaryDocument::IsBinaryPath(filePath)){
+        return BinaryDocument::Save(filePath, ShapeSerializer::FromJsonArray(shapes), ShapeSerializer::LayersFromJson(shapes));
+    }
+    if(PagedDocument::IsPagedPath(filePath)){
+        return PagedDocument::Save(filePath, ShapeSerializer::FromJsonArray(shapes), ShapeSerializer::LayersFromJson(shapes));
+    }
+
+    //QSaveFile writes to a temp file and renames it over the target on commit
     QJsonDocument doc(shapes);
-    QFile file(filePath);
+    QSaveFile file(filePath);
     if (file.open(QIODevice::WriteOnly)) {
         file.write(doc.toJson());
-        file.close();
-        return true; // Save successful
+        return file.commit(); // Save successful if the rename went through
     }
     return false; // Save failed
 }
 
 bool SettingsManager::LoadFromFile(const QString &filePath, QJsonArray &shapes){
+    if(BinaryDocument::IsBinaryPath(filePath) || PagedDocument::IsPagedPath(filePath)){
+        QVector<ShapeData> binaryShapes;
+        QVector<Layer> layers;
+        const bool loaded = BinaryDocument::IsBinaryPath(filePath) ? BinaryDocument::Load(filePath, binaryShapes, &layers)
+                                                                   : PagedDocument::Load(filePath, binaryShapes, &layers);
+        if(!loaded){
+            return false;
+        }
+        shapes = ShapeSerializer::LayersToJson(layers);
+        for(const QJsonValue &value : ShapeSerializer::ToJsonArray(binaryShapes)) shapes.append(value);
+        return true;
+    }
+
     QFile file(filePath);
     if(!file.open(QIODevice::ReadOnly)){
         return false;
@@ -30,3 +54,32 @@ bool SettingsManager::LoadFromFile(const QString &filePath, QJsonArray &shapes){
     shapes = doc.array();
     return true;
 }
+
+bool SettingsManager::SaveToFile(const QString &filePath, const QVector<ShapeData> &shapes, const QVector<Layer> &layers){
+    if(BinaryDocument::IsBinaryPath(filePath)){
+        return BinaryDocument::Save(filePath, shapes, layers);
+    }
+    if(PagedDocument::IsPagedPath(filePath)){
+        return PagedDocument::Save(filePath, shapes, layers);
+    }
+    QJsonArray shapesArray = ShapeSerializer::LayersToJson(layers);
+    for(const QJsonValue &value : ShapeSerializer::ToJsonArray(shapes)) shapesArray.append(value);
+    return SaveToFile(filePath, shapesArray);
+}
+
+bool SettingsManager::LoadFromFile(const QString &filePath, QVector<ShapeData> &shapes, QVector<Layer> *layers){
+    if(BinaryDocument::IsBinaryPath(filePath)){
+        return BinaryDocument::Load(filePath, shapes, layers);
+    }
+    if(PagedDocument::IsPagedPath(filePath)){
+        return PagedDocument::Load(filePath, shapes, layers);
+    }
+
+    QJsonArray shapesArray;
+    if(!LoadFromFile(filePath, shapesArray)){
+        return false;
+    }
+    shapes = ShapeSerializer::FromJsonArray(shapesArray);
+    if(layers) *layers = ShapeSerializer::LayersFromJson(shapesArray);
+    return true;
+}
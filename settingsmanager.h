@@ -3,12 +3,21 @@
 
 #include <QString>
 #include <QJsonArray>
+#include <QVector>
+#include "Entity.h"
 
+//Reads and writes drawing files. The format is picked from the file extension:
+//*.cadb uses the binary BinaryDocument format, *.cadp the paged PagedDocument
+//format (read whole here, see ViewportPager for paging), anything else is JSON.
 class SettingsManager
 {
 public:
     static bool SaveToFile(const QString &filePath, const QJsonArray &shapes);
     static bool LoadFromFile(const QString &filePath, QJsonArray &shapes);
+
+    //with the drawing's layer table; JSON documents carry it as "layer" entries
+    static bool SaveToFile(const QString &filePath, const QVector<ShapeData> &shapes, const QVector<Layer> &layers = {});
+    static bool LoadFromFile(const QString &filePath, QVector<ShapeData> &shapes, QVector<Layer> *layers = nullptr);
 };
 
 #endif // SETTINGSMANAGER_H
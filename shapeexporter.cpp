@@ -0,0 +1,289 @@
+#include "shapeexporter.h"
+#include <QFileInfo>
+#include <QTransform>
+#include <QtMath>
+#include <cmath>
+
+/*********************** Driver ***********************/
+std::unique_ptr<ShapeExporter> ShapeExporter::Create(const QString &filePath, const Options &options)
+{
+    const QString suffix = QFileInfo(filePath).suffix().toLower();
+    if(suffix == "svg") return std::make_unique<SvgExporter>(filePath, options);
+    if(suffix == "dxf") return std::make_unique<DxfExporter>(filePath);
+    return nullptr;
+}
+
+bool ShapeExporter::IsExportPath(const QString &filePath)
+{
+    const QString suffix = QFileInfo(filePath).suffix().toLower();
+    return suffix == "svg" || suffix == "dxf";
+}
+
+bool ShapeExporter::Export(const QString &filePath, const ShapeStore &store, const Options &options)
+{
+    std::unique_ptr<ShapeExporter> exporter = Create(filePath, options);
+    if(!exporter || !exporter->Begin(store.Extent())) return false;
+    store.ForEachActive([&exporter](const ShapeData &shape){ exporter->Write(shape); });
+    return exporter->Finish();
+}
+
+bool ShapeExporter::Export(const QString &filePath, const QVector<ShapeData> &shapes, const Options &options)
+{
+    std::unique_ptr<ShapeExporter> exporter = Create(filePath, options);
+    if(!exporter) return false;
+
+    QRectF extent;
+    for(const ShapeData &shape : shapes){
+        extent |= shape.type == ShapeType::Line ? QRectF(shape.line.p1(), shape.line.p2()).normalized()
+                                                : shape.rect.normalized();
+    }
+    if(!exporter->Begin(extent)) return false;
+    for(const ShapeData &shape : shapes) exporter->Write(shape);
+    return exporter->Finish();
+}
+
+bool ShapeExporter::Begin(const QRectF &extent)
+{
+    if(!out.Open()) return false;
+    WriteHeader(extent);
+    return true;
+}
+
+bool ShapeExporter::Finish()
+{
+    WriteFooter();
+    return out.Commit();
+}
+
+/*********************** SVG ***********************/
+SvgExporter::SvgExporter(const QString &filePath, const Options &options)
+    : ShapeExporter(filePath)
+    , options(options)
+{
+}
+
+void SvgExporter::WriteHeader(const QRectF &extent)
+{
+    //a small margin so strokes on the extent edge aren't clipped in half
+    const QRectF box = extent.isNull() ? QRectF(0, 0, 1, 1) : extent.adjusted(-1, -1, 1, 1);
+    double width = box.width();
+    double height = box.height();
+    if(options.pixelSize > 0){
+        const double scale = options.pixelSize / qMax(width, height);
+        width *= scale;
+        height *= scale;
+    }
+
+    out.Write("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+              "<svg xmlns=\"http://www.w3.org/2000/svg\" xmlns:xlink=\"http://www.w3.org/1999/xlink\" version=\"1.1\" width=\"");
+    out.WriteNumber(width);
+    out.Write("\" height=\"");
+    out.WriteNumber(height);
+    out.Write("\" viewBox=\"");
+    out.WriteNumber(box.x());
+    out.Write(' ');
+    out.WriteNumber(box.y());
+    out.Write(' ');
+    out.WriteNumber(box.width());
+    out.Write(' ');
+    out.WriteNumber(box.height());
+    //same look as ShapeSerializer::DefaultPen, kept at 2px whatever the zoom
+    out.Write("\">\n<g fill=\"none\" stroke=\"black\" stroke-width=\"2\" vector-effect=\"non-scaling-stroke\">\n");
+}
+
+void SvgExporter::Write(const ShapeData &shape)
+{
+    switch(shape.type){
+        case ShapeType::Line:
+            out.Write("<line x1=\"");
+            out.WriteNumber(shape.line.x1());
+            out.Write("\" y1=\"");
+            out.WriteNumber(shape.line.y1());
+            out.Write("\" x2=\"");
+            out.WriteNumber(shape.line.x2());
+            out.Write("\" y2=\"");
+            out.WriteNumber(shape.line.y2());
+            out.Write("\"/>\n");
+            break;
+        case ShapeType::Rectangle:{
+            const QRectF rect = shape.rect.normalized();
+            out.Write("<rect x=\"");
+            out.WriteNumber(rect.x());
+            out.Write("\" y=\"");
+            out.WriteNumber(rect.y());
+            out.Write("\" width=\"");
+            out.WriteNumber(rect.width());
+            out.Write("\" height=\"");
+            out.WriteNumber(rect.height());
+            out.Write("\"/>\n");
+            break;
+        }
+        case ShapeType::Circle:{
+            const QRectF rect = shape.rect.normalized();
+            out.Write("<ellipse cx=\"");
+            out.WriteNumber(rect.center().x());
+            out.Write("\" cy=\"");
+            out.WriteNumber(rect.center().y());
+            out.Write("\" rx=\"");
+            out.WriteNumber(rect.width() / 2);
+            out.Write("\" ry=\"");
+            out.WriteNumber(rect.height() / 2);
+            out.Write("\"/>\n");
+            break;
+        }
+        case ShapeType::Polyline:{
+            out.Write("<polyline points=\"");
+            bool first = true;
+            shape.polyline.ForEachPoint(shape.rect.topLeft(), [this, &first](const QPointF &point){
+                if(!first) out.Write(' ');
+                first = false;
+                out.WriteNumber(point.x());
+                out.Write(',');
+                out.WriteNumber(point.y());
+            });
+            out.Write("\"/>\n");
+            break;
+        }
+        case ShapeType::Block:{
+            auto it = definitions.constFind(shape.block.Key());
+            if(it == definitions.constEnd()){
+                //nested definitions end up inside this one, which SVG allows
+                it = definitions.insert(shape.block.Key(), definitions.size());
+                out.Write("<defs><g id=\"b");
+                out.WriteNumber(it.value());
+                out.Write("\">\n");
+                for(const ShapeData &member : shape.block.Shapes()) Write(member);
+                out.Write("</g></defs>\n");
+            }
+            const QTransform placement = shape.block.Placement(shape.rect);
+            out.Write("<use xlink:href=\"#b");
+            out.WriteNumber(it.value());
+            out.Write("\" transform=\"matrix(");
+            out.WriteNumber(placement.m11());
+            out.Write(' ');
+            out.WriteNumber(placement.m12());
+            out.Write(' ');
+            out.WriteNumber(placement.m21());
+            out.Write(' ');
+            out.WriteNumber(placement.m22());
+            out.Write(' ');
+            out.WriteNumber(placement.dx());
+            out.Write(' ');
+            out.WriteNumber(placement.dy());
+            out.Write(")\"/>\n");
+            break;
+        }
+    }
+}
+
+void SvgExporter::WriteFooter()
+{
+    out.Write("</g>\n</svg>\n");
+}
+
+/*********************** DXF ***********************/
+DxfExporter::DxfExporter(const QString &filePath)
+    : ShapeExporter(filePath)
+{
+}
+
+void DxfExporter::WriteGroup(int code, const char *value)
+{
+    out.WriteNumber(qint64(code));
+    out.Write('\n');
+    out.Write(value, qsizetype(std::strlen(value)));
+    out.Write('\n');
+}
+
+void DxfExporter::WriteGroup(int code, double value)
+{
+    out.WriteNumber(qint64(code));
+    out.Write('\n');
+    out.WriteNumber(value);
+    out.Write('\n');
+}
+
+void DxfExporter::WriteHeader(const QRectF &extent)
+{
+    WriteGroup(0, "SECTION");
+    WriteGroup(2, "HEADER");
+    WriteGroup(9, "$ACADVER");
+    WriteGroup(1, "AC1009");
+    WriteGroup(9, "$EXTMIN");
+    WriteGroup(10, extent.left());
+    WriteGroup(20, -extent.bottom());
+    WriteGroup(9, "$EXTMAX");
+    WriteGroup(10, extent.right());
+    WriteGroup(20, -extent.top());
+    WriteGroup(0, "ENDSEC");
+    WriteGroup(0, "SECTION");
+    WriteGroup(2, "ENTITIES");
+}
+
+void DxfExporter::WritePolyline(const QPointF *points, int count)
+{
+    out.Write("0\nPOLYLINE\n8\n0\n66\n1\n70\n1\n");
+    for(int i = 0; i < count; ++i) WriteVertex(points[i]);
+    out.Write("0\nSEQEND\n8\n0\n");
+}
+
+void DxfExporter::WriteVertex(const QPointF &point)
+{
+    out.Write("0\nVERTEX\n8\n0\n");
+    WriteGroup(10, point.x());
+    WriteGroup(20, -point.y());
+}
+
+void DxfExporter::Write(const ShapeData &shape)
+{
+    switch(shape.type){
+        case ShapeType::Line:
+            out.Write("0\nLINE\n8\n0\n");
+            WriteGroup(10, shape.line.x1());
+            WriteGroup(20, -shape.line.y1());
+            WriteGroup(11, shape.line.x2());
+            WriteGroup(21, -shape.line.y2());
+            break;
+        case ShapeType::Rectangle:{
+            const QRectF rect = shape.rect.normalized();
+            const QPointF corners[4] = { rect.topLeft(), rect.topRight(), rect.bottomRight(), rect.bottomLeft() };
+            WritePolyline(corners, 4);
+            break;
+        }
+        case ShapeType::Circle:{
+            const QRectF rect = shape.rect.normalized();
+            const QPointF center = rect.center();
+            if(qFuzzyCompare(rect.width(), rect.height())){
+                out.Write("0\nCIRCLE\n8\n0\n");
+                WriteGroup(10, center.x());
+                WriteGroup(20, -center.y());
+                WriteGroup(40, rect.width() / 2);
+                break;
+            }
+            QPointF points[EllipseSegments];
+            for(int i = 0; i < EllipseSegments; ++i){
+                const double angle = 2 * M_PI * i / EllipseSegments;
+                points[i] = QPointF(center.x() + rect.width() / 2 * std::cos(angle),
+                                    center.y() + rect.height() / 2 * std::sin(angle));
+            }
+            WritePolyline(points, EllipseSegments);
+            break;
+        }
+        case ShapeType::Polyline:
+            //open (flag 0), vertices streamed straight from the shared buffer
+            out.Write("0\nPOLYLINE\n8\n0\n66\n1\n70\n0\n");
+            shape.polyline.ForEachPoint(shape.rect.topLeft(), [this](const QPointF &point){ WriteVertex(point); });
+            out.Write("0\nSEQEND\n8\n0\n");
+            break;
+        case ShapeType::Block:
+            //members placed one level at a time, nested instances recurse
+            for(const ShapeData &member : shape.block.Explode(shape.rect)) Write(member);
+            break;
+    }
+}
+
+void DxfExporter::WriteFooter()
+{
+    WriteGroup(0, "ENDSEC");
+    WriteGroup(0, "EOF");
+}
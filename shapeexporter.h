@@ -0,0 +1,96 @@
+#ifndef SHAPEEXPORTER_H
+#define SHAPEEXPORTER_H
+
+#include <QHash>
+#include <QRectF>
+#include <QString>
+#include <QVector>
+#include <memory>
+#include "bufferedwriter.h"
+#include "shapestore.h"
+#include "Entity.h"
+
+//Streaming export of a drawing to formats for other tools (SVG, DXF).
+//
+//Shapes are written one at a time through a BufferedWriter as they are visited,
+//straight from a ShapeStore or a shape list, with no document tree in between, so
+//memory use does not grow with the drawing. The extent is needed up front (SVG
+//viewBox, DXF header) and is taken from the source before the first shape.
+class ShapeExporter
+{
+public:
+    enum class Format { Svg, Dxf };
+
+    struct Options{
+        //SVG only: longest side of the picture in pixels, 0 keeps scene units
+        int pixelSize = 0;
+    };
+
+    virtual ~ShapeExporter() = default;
+
+    //picks the format from the file extension, nullptr if it is neither .svg nor .dxf
+    static std::unique_ptr<ShapeExporter> Create(const QString &filePath, const Options &options = {});
+    static bool IsExportPath(const QString &filePath);
+
+    static bool Export(const QString &filePath, const ShapeStore &store, const Options &options = {});
+    static bool Export(const QString &filePath, const QVector<ShapeData> &shapes, const Options &options = {});
+
+    bool Begin(const QRectF &extent);
+    virtual void Write(const ShapeData &shape) = 0;
+    bool Finish();
+
+    qint64 BytesWritten() const { return out.BytesWritten(); }
+
+protected:
+    explicit ShapeExporter(const QString &filePath) : out(filePath) {}
+
+    BufferedWriter out;
+
+    virtual void WriteHeader(const QRectF &extent) = 0;
+    virtual void WriteFooter() = 0;
+};
+
+//Plain SVG 1.1: one line/rect/ellipse element per shape inside a single styled group.
+//A block definition is written once as a <defs> group the first time it is used,
+//every instance is a <use> of it with the placement as its transform.
+class SvgExporter : public ShapeExporter
+{
+public:
+    SvgExporter(const QString &filePath, const Options &options);
+    void Write(const ShapeData &shape) override;
+
+protected:
+    void WriteHeader(const QRectF &extent) override;
+    void WriteFooter() override;
+
+private:
+    Options options;
+    QHash<const void *, qint64> definitions; // block key -> id number
+};
+
+//ASCII DXF R12 (AC1009), the revision every CAD reader accepts without tables or
+//handles. Lines become LINE, rectangles closed POLYLINEs, circles CIRCLE; R12 has
+//no ellipse entity, so non-circular ellipses are closed polylines. Block instances
+//are exploded into their members rather than written as BLOCKS/INSERT, which would
+//need the tables section. DXF's y axis points up, scene y points down, so y is negated.
+class DxfExporter : public ShapeExporter
+{
+public:
+    //segments used for an ellipse that is not a circle
+    static constexpr int EllipseSegments = 64;
+
+    explicit DxfExporter(const QString &filePath);
+    void Write(const ShapeData &shape) override;
+
+protected:
+    void WriteHeader(const QRectF &extent) override;
+    void WriteFooter() override;
+
+private:
+    void WriteGroup(int code, const char *value);
+    void WriteGroup(int code, double value);
+    void WritePolyline(const QPointF *points, int count);
+    void WriteVertex(const QPointF &point);
+};
+
+#endif // SHAPEEXPORTER_H
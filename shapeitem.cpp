@@ -0,0 +1,247 @@
+#include "shapeitem.h"
+#include "shapeserializer.h"
+#include "shaperenderer.h"
+#include "shapescene.h"
+#include <QGraphicsScene>
+#include <QGraphicsRectItem>
+#include <QGraphicsEllipseItem>
+#include <QPainter>
+#include <QPainterPathStroker>
+#include <QPolygonF>
+
+namespace {
+
+//half the stroke width of ShapeSerializer::DefaultPen, added around the geometry
+constexpr qreal PenMargin = 1.0;
+
+static_assert(sizeof(ShapeItem) <= ShapeStore::ItemSlotBytes, "ShapeItem outgrew its pool slot");
+
+} // namespace
+
+ShapeItem::ShapeItem(ShapeStore *store, ShapeId id)
+    : store(store), id(id)
+{
+}
+
+ShapeItem::~ShapeItem()
+{
+    store->Remove(id);
+}
+
+/*********************** Allocation ***********************/
+void *ShapeItem::operator new(size_t size, ShapeStore *store)
+{
+    Q_ASSERT(size <= ShapeStore::ItemSlotBytes);
+    Q_UNUSED(size);
+    return store->ItemPool().Allocate();
+}
+
+void ShapeItem::operator delete(void *object, ShapeStore *)
+{
+    SlabPool::Free(object);
+}
+
+void ShapeItem::operator delete(void *object)
+{
+    //the slab knows its pool, the item is gone by the time this runs
+    SlabPool::Free(object);
+}
+
+/*********************** QGraphicsItem ***********************/
+int ShapeItem::type() const
+{
+    switch(store->Type(id)){
+        case ShapeType::Line: return LineType;
+        case ShapeType::Rectangle: return RectangleType;
+        case ShapeType::Circle: return CircleType;
+        case ShapeType::Polyline: return PolylineType;
+        case ShapeType::Block: return BlockType;
+    }
+    return UserType;
+}
+
+QRectF ShapeItem::boundingRect() const
+{
+    return store->Bounds(id).adjusted(-PenMargin, -PenMargin, PenMargin, PenMargin);
+}
+
+QPainterPath ShapeItem::shape() const
+{
+    const ShapeData data = Data();
+    QPainterPath path;
+
+    switch(data.type){
+        case ShapeType::Line: {
+            path.moveTo(data.line.p1());
+            path.lineTo(data.line.p2());
+            QPainterPathStroker stroker(ShapeSerializer::DefaultPen());
+            return stroker.createStroke(path);
+        }
+        case ShapeType::Rectangle:
+            path.addRect(data.rect.normalized());
+            break;
+        case ShapeType::Circle:
+            path.addEllipse(data.rect.normalized());
+            break;
+        case ShapeType::Polyline: {
+            //outline at 1:1 detail, stroking every vertex of a long trace would take seconds
+            const Polyline::Band &band = data.polyline.Simplified(1.0);
+            if(band.points.isEmpty()) break;
+            path.addPolygon(QPolygonF(band.points).translated(data.rect.topLeft()));
+            QPainterPathStroker stroker(ShapeSerializer::DefaultPen());
+            return stroker.createStroke(path);
+        }
+        case ShapeType::Block:
+            //the instance is picked as a whole, like a filled symbol
+            path.addRect(data.rect.normalized());
+            break;
+    }
+    return path;
+}
+
+void ShapeItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    Q_UNUSED(option);
+    Q_UNUSED(widget);
+    painter->setPen(highlighted ? ShapeRenderer::SelectionPen() : ShapeSerializer::DefaultPen());
+    painter->setBrush(Qt::NoBrush);
+    ShapeRenderer::Paint(painter, Data());
+}
+
+QVariant ShapeItem::itemChange(GraphicsItemChange change, const QVariant &value)
+{
+    //only shapes that are in a scene are saved
+    if(change == ItemSceneHasChanged){
+        store->SetActive(id, scene() != nullptr);
+        //hidden layers are hidden on the scene too, for the unindexed paint path
+        if(auto *shapeScene = qobject_cast<ShapeScene *>(scene())) shapeScene->ApplyLayer(this);
+    }
+    return QGraphicsItem::itemChange(change, value);
+}
+
+/*********************** Geometry ***********************/
+ShapeData ShapeItem::Data() const
+{
+    return store->Get(id);
+}
+
+void ShapeItem::SetData(const ShapeData &shape)
+{
+    prepareGeometryChange();
+    store->Set(id, shape);
+}
+
+void ShapeItem::SetHighlighted(bool on)
+{
+    if(highlighted == on) return;
+    highlighted = on;
+    update();
+}
+
+ShapeItem *ShapeItem::Cast(QGraphicsItem *item)
+{
+    const int kind = item ? item->type() : 0;
+    return kind >= LineType && kind <= BlockType ? static_cast<ShapeItem *>(item) : nullptr;
+}
+
+const ShapeItem *ShapeItem::Cast(const QGraphicsItem *item)
+{
+    const int kind = item ? item->type() : 0;
+    return kind >= LineType && kind <= BlockType ? static_cast<const ShapeItem *>(item) : nullptr;
+}
+
+QPointF ShapeItem::PositionOf(const QGraphicsItem *item)
+{
+    const ShapeItem *shapeItem = Cast(item);
+    if(!shapeItem) return item->pos();
+
+    const ShapeData data = shapeItem->Data();
+    return data.type == ShapeType::Line ? data.line.p1() : data.rect.topLeft();
+}
+
+void ShapeItem::MoveTo(QGraphicsItem *item, const QPointF &position)
+{
+    ShapeItem *shapeItem = Cast(item);
+    if(!shapeItem){
+        item->setPos(position);
+        return;
+    }
+
+    const QPointF delta = position - PositionOf(item);
+    if(delta.isNull()) return;
+    shapeItem->prepareGeometryChange();
+    shapeItem->store->Translate(shapeItem->id, delta);
+}
+
+QRectF ShapeItem::GeometryRectOf(const QGraphicsItem *item)
+{
+    const ShapeItem *shapeItem = Cast(item);
+    if(shapeItem){
+        const ShapeType type = shapeItem->store->Type(shapeItem->id);
+        if(type == ShapeType::Rectangle || type == ShapeType::Circle || type == ShapeType::Block) return shapeItem->Data().rect;
+    }
+    return item->boundingRect();
+}
+
+void ShapeItem::SetGeometryRect(QGraphicsItem *item, const QRectF &rect)
+{
+    if(ShapeItem *shapeItem = Cast(item)){
+        ShapeData data = shapeItem->Data();
+        if(data.type == ShapeType::Line || data.type == ShapeType::Polyline) return; // not resized
+        data.rect = rect;
+        shapeItem->SetData(data);
+    }
+    else if(auto *rectItem = qgraphicsitem_cast<QGraphicsRectItem *>(item)){
+        rectItem->setRect(rect);
+    }
+    else if(auto *ellipseItem = qgraphicsitem_cast<QGraphicsEllipseItem *>(item)){
+        ellipseItem->setRect(rect);
+    }
+}
+
+quint16 ShapeItem::LayerOf(const QGraphicsItem *item)
+{
+    const ShapeItem *shapeItem = Cast(item);
+    return shapeItem ? shapeItem->Data().layer : 0;
+}
+
+void ShapeItem::SetLayer(QGraphicsItem *item, quint16 layer)
+{
+    ShapeItem *shapeItem = Cast(item);
+    if(!shapeItem) return;
+    ShapeData data = shapeItem->Data();
+    data.layer = layer;
+    shapeItem->SetData(data);
+    if(auto *shapeScene = qobject_cast<ShapeScene *>(shapeItem->scene())) shapeScene->ApplyLayer(shapeItem);
+}
+
+void ShapeItem::TranslateMany(const QVector<ShapeItem *> &items, const QPointF &delta)
+{
+    if(items.isEmpty() || delta.isNull()) return;
+
+    QVector<ShapeId> ids;
+    ids.reserve(items.size());
+    for(ShapeItem *item : items){
+        item->prepareGeometryChange();
+        ids.append(item->id);
+    }
+    //items of one canvas share one store
+    items.first()->store->Translate(ids, delta);
+}
+
+void ShapeItem::TranslateMany(const QVector<QGraphicsItem *> &items, const QPointF &delta)
+{
+    if(items.isEmpty() || delta.isNull()) return;
+
+    QVector<ShapeItem *> shapeItems;
+    shapeItems.reserve(items.size());
+    for(QGraphicsItem *item : items){
+        if(ShapeItem *shapeItem = Cast(item)){
+            shapeItems.append(shapeItem);
+        }
+        else{
+            MoveTo(item, PositionOf(item) + delta);
+        }
+    }
+    TranslateMany(shapeItems, delta);
+}
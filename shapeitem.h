@@ -0,0 +1,74 @@
+#ifndef SHAPEITEM_H
+#define SHAPEITEM_H
+
+#include <QGraphicsItem>
+#include <QPainterPath>
+#include <QVector>
+#include "shapestore.h"
+
+//Thin scene item that draws one shape out of a ShapeStore.
+//The item holds only the store pointer and the shape id; geometry changes must go
+//through SetData/MoveAnchorTo/SetGeometryRect so the scene index is told first.
+//type() reports one value per ShapeType, so callers dispatch on type() instead of
+//a dynamic_cast chain.
+//Items are allocated from their store's ItemPool: create them with
+//new (store) ShapeItem(store, id). Qt's private item data stays on the heap.
+class ShapeItem : public QGraphicsItem
+{
+public:
+    enum { LineType = UserType + 1, RectangleType, CircleType, PolylineType, BlockType };
+
+    ShapeItem(ShapeStore *store, ShapeId id);
+    ~ShapeItem() override;
+
+    static void *operator new(size_t size, ShapeStore *store);
+    static void operator delete(void *object, ShapeStore *store); // constructor threw
+    static void operator delete(void *object);
+
+    int type() const override;
+    QRectF boundingRect() const override;
+    QPainterPath shape() const override;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override;
+
+    ShapeId Id() const { return id; }
+    ShapeStore *Store() const { return store; }
+    ShapeData Data() const;
+    void SetData(const ShapeData &shape);
+
+    //drawn with ShapeRenderer::SelectionPen, set by the canvas selection
+    void SetHighlighted(bool on);
+    bool IsHighlighted() const { return highlighted; }
+
+    static ShapeItem *Cast(QGraphicsItem *item);
+    static const ShapeItem *Cast(const QGraphicsItem *item);
+
+    //position used by move commands: p1 for lines, top-left for the others (the
+    //bounds for polylines and block instances),
+    //pos() for items that are not ShapeItems
+    static QPointF PositionOf(const QGraphicsItem *item);
+    static void MoveTo(QGraphicsItem *item, const QPointF &position);
+
+    //geometry rect used by resize commands (rectangles, circles and block instances,
+    //which scale their members; lines and polylines are not resized)
+    static QRectF GeometryRectOf(const QGraphicsItem *item);
+    static void SetGeometryRect(QGraphicsItem *item, const QRectF &rect);
+
+    //layer index of a shape, 0 for items that are not ShapeItems (they have no layer)
+    static quint16 LayerOf(const QGraphicsItem *item);
+    static void SetLayer(QGraphicsItem *item, quint16 layer);
+
+    //moves many items with one linear pass over the store
+    static void TranslateMany(const QVector<ShapeItem *> &items, const QPointF &delta);
+    //same for mixed items, stock Qt items are moved one by one
+    static void TranslateMany(const QVector<QGraphicsItem *> &items, const QPointF &delta);
+
+protected:
+    QVariant itemChange(GraphicsItemChange change, const QVariant &value) override;
+
+private:
+    ShapeStore *store;
+    ShapeId id;
+    bool highlighted = false;
+};
+
+#endif // SHAPEITEM_H
@@ -0,0 +1,121 @@
+#include "shaperenderer.h"
+#include "shapeserializer.h"
+#include <cmath>
+
+QPen ShapeRenderer::SelectionPen()
+{
+    return QPen(QColor(0, 120, 215), 2);
+}
+
+void ShapeRenderer::Paint(QPainter *painter, const ShapeData &shape)
+{
+    switch(shape.type){
+        case ShapeType::Line:
+            painter->drawLine(shape.line);
+            break;
+        case ShapeType::Rectangle:
+            painter->drawRect(shape.rect);
+            break;
+        case ShapeType::Circle:
+            painter->drawEllipse(shape.rect);
+            break;
+        case ShapeType::Polyline:
+            PaintPolyline(painter, shape);
+            break;
+        case ShapeType::Block:
+            PaintBlock(painter, shape);
+            break;
+    }
+}
+
+//Plays the definition's shared picture through the instance placement
+void ShapeRenderer::PaintBlock(QPainter *painter, const ShapeData &shape)
+{
+    const Block::Picture &picture = shape.block.GetPicture();
+    const QTransform placement = shape.block.Placement(shape.rect);
+
+    painter->save();
+    painter->setTransform(placement, true);
+    //the stroke keeps its width however the instance is scaled
+    const qreal scale = std::sqrt(std::abs(placement.determinant()));
+    if(scale > 0 && scale != 1.0){
+        QPen pen = painter->pen();
+        pen.setWidthF(pen.widthF() / scale);
+        painter->setPen(pen);
+    }
+    if(!picture.lines.isEmpty()) painter->drawLines(picture.lines);
+    if(!picture.rectangles.isEmpty()) painter->drawRects(picture.rectangles);
+    for(const QRectF &ellipse : picture.ellipses) painter->drawEllipse(ellipse);
+    for(const QPolygonF &polyline : picture.polylines) painter->drawPolyline(polyline);
+    painter->restore();
+}
+
+//Draws the zoom band for the painter's scale, skipping chunks outside the painted area
+void ShapeRenderer::PaintPolyline(QPainter *painter, const ShapeData &shape)
+{
+    const QTransform transform = painter->worldTransform();
+    const Polyline::Band &band = shape.polyline.Simplified(std::sqrt(std::abs(transform.determinant())));
+    if(band.points.size() < 2) return;
+
+    QRectF area = painter->hasClipping() ? painter->clipBoundingRect()
+                                         : transform.inverted().mapRect(QRectF(painter->viewport()));
+    const qreal margin = painter->pen().widthF();
+    area = area.adjusted(-margin, -margin, margin, margin).translated(-shape.rect.topLeft());
+
+    painter->save();
+    painter->translate(shape.rect.topLeft());
+    const qsizetype last = band.points.size() - 1;
+    qsizetype runStart = -1, runEnd = -1;
+    auto flush = [&]{
+        if(runStart >= 0) painter->drawPolyline(band.points.constData() + runStart, int(runEnd - runStart + 1));
+        runStart = -1;
+    };
+    for(size_t k = 0; k < band.chunks.size(); ++k){
+        //inclusive, a straight run has a zero-width or zero-height box
+        const QRectF &box = band.chunks[k];
+        if(box.left() > area.right() || box.right() < area.left() || box.top() > area.bottom() || box.bottom() < area.top()){
+            flush();
+            continue;
+        }
+        const qsizetype first = qsizetype(k) * Polyline::ChunkSize;
+        if(runStart < 0) runStart = first;
+        runEnd = qMin(first + Polyline::ChunkSize, last);
+    }
+    flush();
+    painter->restore();
+}
+
+void ShapeRenderer::PaintAll(QPainter *painter, const QVector<ShapeData> &shapes)
+{
+    painter->setPen(ShapeSerializer::DefaultPen());
+    painter->setBrush(Qt::NoBrush);
+    for(const ShapeData &shape : shapes){
+        Paint(painter, shape);
+    }
+}
+
+void ShapeRenderer::PaintLod(QPainter *painter, const QVector<ShapeData> &shapes,
+                             const QVector<LodCluster> &clusters, qreal scale)
+{
+    painter->save();
+    painter->setRenderHint(QPainter::Antialiasing, scale >= AntialiasZoomThreshold);
+    PaintAll(painter, shapes);
+    PaintClusters(painter, clusters, scale);
+    painter->restore();
+}
+
+void ShapeRenderer::PaintClusters(QPainter *painter, const QVector<LodCluster> &clusters, qreal scale)
+{
+    //each cluster covers at least one device pixel, darker the more shapes it stands for
+    const qreal minSize = 1.0 / scale;
+    painter->save();
+    painter->setPen(Qt::NoPen);
+    for(const LodCluster &cluster : clusters){
+        const int alpha = int(qMin<qsizetype>(255, 64 + cluster.count * 12));
+        QRectF cell = cluster.box;
+        if(cell.width() < minSize) cell.setWidth(minSize);
+        if(cell.height() < minSize) cell.setHeight(minSize);
+        painter->fillRect(cell, QColor(0, 0, 0, alpha));
+    }
+    painter->restore();
+}
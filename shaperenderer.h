@@ -0,0 +1,34 @@
+#ifndef SHAPERENDERER_H
+#define SHAPERENDERER_H
+
+#include <QPainter>
+#include <QVector>
+#include "Entity.h"
+
+//Paints plain ShapeData with the same look as the scene items.
+//Safe to use from worker threads when painting into a QImage.
+class ShapeRenderer
+{
+public:
+    //zoom below which antialiasing is switched off, strokes are too thin to benefit
+    static constexpr qreal AntialiasZoomThreshold = 0.5;
+    //shapes and index nodes smaller than this many pixels are drawn as density cells
+    static constexpr qreal LodPixelThreshold = 3.0;
+
+    //pen for selected shapes, same width as ShapeSerializer::DefaultPen
+    static QPen SelectionPen();
+
+    static void Paint(QPainter *painter, const ShapeData &shape);
+    //the polyline simplified for the painter's scale, only the part inside its clip or window
+    static void PaintPolyline(QPainter *painter, const ShapeData &shape);
+    //a block instance from its definition's shared picture
+    static void PaintBlock(QPainter *painter, const ShapeData &shape);
+    static void PaintAll(QPainter *painter, const QVector<ShapeData> &shapes);
+
+    //level-of-detail paint at the given zoom, clusters come from SpatialIndex::CrossingLod
+    static void PaintLod(QPainter *painter, const QVector<ShapeData> &shapes,
+                         const QVector<LodCluster> &clusters, qreal scale);
+    static void PaintClusters(QPainter *painter, const QVector<LodCluster> &clusters, qreal scale);
+};
+
+#endif // SHAPERENDERER_H
@@ -0,0 +1,87 @@
+#include "shapescene.h"
+#include "shapeitem.h"
+
+ShapeScene::ShapeScene(QObject *parent)
+    : QGraphicsScene(parent)
+{
+}
+
+ShapeScene::~ShapeScene()
+{
+    //items release their store rows on deletion, so delete them while the store is alive
+    ClearShapes(this);
+}
+
+/*********************** Layers ***********************/
+QVector<Layer> ShapeScene::DefaultLayers()
+{
+    Layer layer;
+    layer.name = "0"; // the layer every DXF drawing has
+    return { layer };
+}
+
+void ShapeScene::SetLayers(const QVector<Layer> &layers)
+{
+    const QVector<Layer> old = this->layers;
+    this->layers = layers.isEmpty() ? DefaultLayers() : layers.mid(0, MaxLayers);
+
+    //only a visibility or stacking change has to touch the items
+    bool changed = old.size() != this->layers.size();
+    for(qsizetype i = 0; !changed && i < old.size(); ++i){
+        changed = old.at(i).visible != this->layers.at(i).visible || old.at(i).z != this->layers.at(i).z;
+    }
+    if(!changed) return;
+    for(QGraphicsItem *item : items()) ApplyLayer(item);
+}
+
+void ShapeScene::SetLayer(int index, const Layer &layer)
+{
+    if(index < 0 || index >= layers.size()) return;
+    QVector<Layer> updated = layers;
+    updated[index] = layer;
+    SetLayers(updated);
+}
+
+void ShapeScene::ApplyLayer(QGraphicsItem *item) const
+{
+    if(!ShapeItem::Cast(item)) return;
+    const quint16 index = ShapeItem::LayerOf(item);
+    const Layer layer = index < layers.size() ? layers.at(index) : Layer();
+    item->setVisible(layer.visible);
+    item->setZValue(layer.z);
+}
+
+int ShapeScene::AddLayer(const Layer &layer)
+{
+    if(layers.size() >= MaxLayers) return -1;
+    layers.append(layer);
+    return int(layers.size()) - 1;
+}
+
+QVector<Layer> ShapeScene::LayersOf(const QGraphicsScene *scene)
+{
+    auto *shapeScene = qobject_cast<const ShapeScene *>(scene);
+    return shapeScene ? shapeScene->Layers() : DefaultLayers();
+}
+
+/*********************** Lookup ***********************/
+ShapeStore *ShapeScene::StoreOf(QGraphicsScene *scene)
+{
+    auto *shapeScene = qobject_cast<ShapeScene *>(scene);
+    return shapeScene ? shapeScene->Store() : nullptr;
+}
+
+const ShapeStore *ShapeScene::StoreOf(const QGraphicsScene *scene)
+{
+    auto *shapeScene = qobject_cast<const ShapeScene *>(scene);
+    return shapeScene ? shapeScene->Store() : nullptr;
+}
+
+/*********************** Clearing ***********************/
+void ShapeScene::ClearShapes(QGraphicsScene *scene)
+{
+    ShapeStore *store = StoreOf(scene);
+    if(store) store->BeginRelease();
+    scene->clear();
+    if(store) store->EndRelease();
+}
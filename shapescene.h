@@ -0,0 +1,48 @@
+#ifndef SHAPESCENE_H
+#define SHAPESCENE_H
+
+#include <QGraphicsScene>
+#include <QVector>
+#include "shapestore.h"
+
+//QGraphicsScene that owns the ShapeStore its ShapeItems draw from, and the layer
+//table the shapes' layer indexes refer to. There is always at least layer 0.
+//Items follow their layer's visibility and z, so QGraphicsView's own painting
+//(used below the tiled rendering threshold) skips hidden layers as well.
+class ShapeScene : public QGraphicsScene
+{
+    Q_OBJECT
+
+public:
+    explicit ShapeScene(QObject *parent = nullptr);
+    ~ShapeScene();
+
+    ShapeStore *Store() { return &store; }
+    const ShapeStore *Store() const { return &store; }
+
+    const QVector<Layer> &Layers() const { return layers; }
+    //an empty table resets to the single default layer
+    void SetLayers(const QVector<Layer> &layers);
+    void SetLayer(int index, const Layer &layer);
+    //appends a layer and returns its index, -1 when the table is full
+    int AddLayer(const Layer &layer);
+    static QVector<Layer> DefaultLayers();
+    //shows or hides an item and sets its stacking from its layer
+    void ApplyLayer(QGraphicsItem *item) const;
+
+    //store behind a scene, nullptr for plain QGraphicsScenes
+    static ShapeStore *StoreOf(QGraphicsScene *scene);
+    static const ShapeStore *StoreOf(const QGraphicsScene *scene);
+    //layer table of a scene, the default table for plain QGraphicsScenes
+    static QVector<Layer> LayersOf(const QGraphicsScene *scene);
+
+    //clear() for drawings: a ShapeScene drops its items' store rows in one pass and
+    //their pool slabs go back at once, plain QGraphicsScenes are just cleared
+    static void ClearShapes(QGraphicsScene *scene);
+
+private:
+    ShapeStore store;
+    QVector<Layer> layers = DefaultLayers();
+};
+
+#endif // SHAPESCENE_H
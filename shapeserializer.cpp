@@ -0,0 +1,347 @@
+#include "shapeserializer.h"
+#include "scenebulkinsert.h"
+#include "shapeitem.h"
+#include "shapescene.h"
+#include <QGraphicsLineItem>
+#include <QGraphicsRectItem>
+#include <QGraphicsEllipseItem>
+#include <QGraphicsPathItem>
+#include <QGraphicsItemGroup>
+#include <QPolygonF>
+
+QPen ShapeSerializer::DefaultPen()
+{
+    return QPen(Qt::black, 2);
+}
+
+/*********************** Single Shape ***********************/
+QJsonObject ShapeSerializer::ToJson(const ShapeData &shape, BlockRefs *blocks)
+{
+    QJsonObject shapeObj;
+
+    switch(shape.type){
+        case ShapeType::Line:
+            shapeObj["type"] = "line";
+            shapeObj["x1"] = shape.line.p1().x();
+            shapeObj["y1"] = shape.line.p1().y();
+            shapeObj["x2"] = shape.line.p2().x();
+            shapeObj["y2"] = shape.line.p2().y();
+            break;
+        case ShapeType::Rectangle:
+        case ShapeType::Circle:
+            shapeObj["type"] = shape.type == ShapeType::Rectangle ? "rectangle" : "circle";
+            shapeObj["x"] = shape.rect.x();
+            shapeObj["y"] = shape.rect.y();
+            shapeObj["width"] = shape.rect.width();
+            shapeObj["height"] = shape.rect.height();
+            break;
+        case ShapeType::Polyline: {
+            //scene coordinates, flattened x0, y0, x1, y1, ...
+            QJsonArray points;
+            shape.polyline.ForEachPoint(shape.rect.topLeft(), [&points](const QPointF &point){
+                points.append(point.x());
+                points.append(point.y());
+            });
+            shapeObj["type"] = "polyline";
+            shapeObj["points"] = points;
+            break;
+        }
+        case ShapeType::Block: {
+            //members in definition coordinates, their bounds are mapped onto x, y, width, height
+            shapeObj["type"] = "block";
+            shapeObj["x"] = shape.rect.x();
+            shapeObj["y"] = shape.rect.y();
+            shapeObj["width"] = shape.rect.width();
+            shapeObj["height"] = shape.rect.height();
+            if(blocks){
+                auto it = blocks->written.constFind(shape.block.Key());
+                if(it != blocks->written.constEnd()){
+                    shapeObj["definition"] = it.value();
+                    break;
+                }
+                const int number = int(blocks->written.size());
+                blocks->written.insert(shape.block.Key(), number);
+                shapeObj["definition"] = number;
+            }
+            shapeObj["name"] = shape.block.Name();
+            shapeObj["shapes"] = ToJsonArray(shape.block.Shapes(), blocks);
+            break;
+        }
+    }
+    if(shape.layer != 0) shapeObj["layer"] = shape.layer;
+
+    return shapeObj;
+}
+
+bool ShapeSerializer::FromJson(const QJsonObject &obj, ShapeData &shape, BlockRefs *blocks)
+{
+    QString type = obj["type"].toString();
+    shape.layer = quint16(qBound(0, obj["layer"].toInt(), MaxLayers - 1));
+
+    if (type == "line") {
+        shape.type = ShapeType::Line;
+        shape.line = QLineF(obj["x1"].toDouble(), obj["y1"].toDouble(),
+                            obj["x2"].toDouble(), obj["y2"].toDouble());
+        return true;
+    }
+    if (type == "rectangle" || type == "circle") {
+        shape.type = type == "rectangle" ? ShapeType::Rectangle : ShapeType::Circle;
+        shape.rect = QRectF(obj["x"].toDouble(), obj["y"].toDouble(),
+                            obj["width"].toDouble(), obj["height"].toDouble());
+        return true;
+    }
+    if (type == "polyline") {
+        const QJsonArray coordinates = obj["points"].toArray();
+        QVector<QPointF> points;
+        points.reserve(coordinates.size() / 2);
+        for(qsizetype i = 0; i + 1 < coordinates.size(); i += 2){
+            points.append(QPointF(coordinates.at(i).toDouble(), coordinates.at(i + 1).toDouble()));
+        }
+        return MakePolyline(points, shape);
+    }
+    if (type == "block") {
+        const int number = obj["definition"].toInt(-1);
+        if(obj.contains("shapes")){
+            shape.block = Block::Define(obj["name"].toString(), FromJsonArray(obj["shapes"].toArray(), blocks));
+            if(blocks && number >= 0) blocks->read.insert(number, shape.block);
+        }
+        else{
+            shape.block = blocks ? blocks->read.value(number) : Block();
+        }
+        if(shape.block.IsNull()) return false; // refers to a definition that was never written
+        shape.type = ShapeType::Block;
+        shape.rect = QRectF(obj["x"].toDouble(), obj["y"].toDouble(),
+                            obj["width"].toDouble(), obj["height"].toDouble());
+        return true;
+    }
+    return false; // Unknown shape type
+}
+
+bool ShapeSerializer::MakePolyline(const QVector<QPointF> &points, ShapeData &shape)
+{
+    if(points.size() < 2) return false;
+    shape.type = ShapeType::Polyline;
+    shape.polyline = Polyline::FromPoints(points);
+    shape.rect = shape.polyline.Bounds();
+    return true;
+}
+
+bool ShapeSerializer::FromItem(const QGraphicsItem *item, ShapeData &shape)
+{
+    //geometry is stored in item coordinates, moves are applied through pos()
+    const QPointF offset = item->pos();
+
+    if(auto *shapeItem = ShapeItem::Cast(item)){
+        shape = shapeItem->Data();
+        if(!offset.isNull()){
+            shape.line.translate(offset);
+            shape.rect.translate(offset);
+        }
+        return true;
+    }
+
+    if(auto *line = dynamic_cast<const QGraphicsLineItem *>(item)){
+        shape.type = ShapeType::Line;
+        shape.line = line->line().translated(offset);
+        return true;
+    }
+    if (auto *rect = dynamic_cast<const QGraphicsRectItem *>(item)) {
+        shape.type = ShapeType::Rectangle;
+        shape.rect = rect->rect().translated(offset);
+        return true;
+    }
+    if (auto *ellipse = dynamic_cast<const QGraphicsEllipseItem *>(item)) {
+        shape.type = ShapeType::Circle;
+        shape.rect = ellipse->rect().translated(offset);
+        return true;
+    }
+    if (auto *pathItem = dynamic_cast<const QGraphicsPathItem *>(item)) {
+        const QPainterPath path = pathItem->path();
+        QVector<QPointF> points;
+        points.reserve(path.elementCount());
+        for(int i = 0; i < path.elementCount(); ++i){
+            points.append(QPointF(path.elementAt(i)) + offset);
+        }
+        return MakePolyline(points, shape);
+    }
+    return false;
+}
+
+QGraphicsItem *ShapeSerializer::CreateItem(const ShapeData &shape, ShapeStore *store)
+{
+    if(store){
+        return new (store) ShapeItem(store, store->Add(shape));
+    }
+
+    switch(shape.type){
+        case ShapeType::Line: {
+            auto *line = new QGraphicsLineItem(shape.line);
+            line->setPen(DefaultPen());
+            return line;
+        }
+        case ShapeType::Rectangle: {
+            auto *rectangle = new QGraphicsRectItem(shape.rect);
+            rectangle->setPen(DefaultPen());
+            return rectangle;
+        }
+        case ShapeType::Circle: {
+            auto *circle = new QGraphicsEllipseItem(shape.rect);
+            circle->setPen(DefaultPen());
+            return circle;
+        }
+        case ShapeType::Polyline: {
+            QPainterPath path;
+            path.addPolygon(QPolygonF(shape.polyline.Points(shape.rect.topLeft())));
+            auto *polyline = new QGraphicsPathItem(path);
+            polyline->setPen(DefaultPen());
+            return polyline;
+        }
+        case ShapeType::Block: {
+            //stock items have no shared picture, the instance becomes a group of its members
+            auto *group = new QGraphicsItemGroup;
+            for(const ShapeData &member : shape.block.Explode(shape.rect)){
+                if(QGraphicsItem *item = CreateItem(member)) group->addToGroup(item);
+            }
+            return group;
+        }
+    }
+    return nullptr;
+}
+
+/*********************** Shape Lists ***********************/
+QJsonArray ShapeSerializer::ToJsonArray(const QVector<ShapeData> &shapes, BlockRefs *blocks)
+{
+    //a whole document writes each block definition once
+    BlockRefs document;
+    if(!blocks) blocks = &document;
+
+    QJsonArray shapesArray;
+    for(const ShapeData &shape : shapes){
+        shapesArray.append(ToJson(shape, blocks));
+    }
+    return shapesArray;
+}
+
+QVector<ShapeData> ShapeSerializer::FromJsonArray(const QJsonArray &shapesArray, BlockRefs *blocks)
+{
+    BlockRefs document;
+    if(!blocks) blocks = &document;
+
+    QVector<ShapeData> shapes;
+    shapes.reserve(shapesArray.size());
+    for (const QJsonValue &value : shapesArray) {
+        ShapeData shape;
+        if(FromJson(value.toObject(), shape, blocks)){
+            shapes.append(shape);
+        }
+    }
+    return shapes;
+}
+
+/*********************** Layers ***********************/
+QJsonArray ShapeSerializer::LayersToJson(const QVector<Layer> &layers)
+{
+    QJsonArray layersArray;
+    for(qsizetype i = 0; i < layers.size(); ++i){
+        const Layer &layer = layers.at(i);
+        QJsonObject layerObj;
+        layerObj["type"] = "layer";
+        layerObj["index"] = int(i);
+        layerObj["name"] = layer.name;
+        layerObj["visible"] = layer.visible;
+        layerObj["locked"] = layer.locked;
+        layerObj["z"] = layer.z;
+        layersArray.append(layerObj);
+    }
+    return layersArray;
+}
+
+QVector<Layer> ShapeSerializer::LayersFromJson(const QJsonArray &shapesArray)
+{
+    QVector<Layer> layers;
+    for(const QJsonValue &value : shapesArray){
+        const QJsonObject obj = value.toObject();
+        if(obj["type"].toString() != "layer") continue;
+        const int index = obj["index"].toInt(-1);
+        if(index < 0 || index >= MaxLayers) continue;
+        if(index >= layers.size()) layers.resize(index + 1);
+        Layer &layer = layers[index];
+        layer.name = obj["name"].toString();
+        layer.visible = obj["visible"].toBool(true);
+        layer.locked = obj["locked"].toBool(false);
+        layer.z = obj["z"].toInt();
+    }
+    return layers;
+}
+
+/*********************** Whole Scene ***********************/
+QJsonArray ShapeSerializer::SerializeScene(const QGraphicsScene *scene)
+{
+    //the layer table goes first so a streaming reader knows it before the shapes
+    QJsonArray shapesArray = LayersToJson(ShapeScene::LayersOf(scene));
+
+    if(const ShapeStore *store = ShapeScene::StoreOf(scene)){
+        for(const QJsonValue &value : ToJsonArray(store->Snapshot())) shapesArray.append(value);
+        return shapesArray;
+    }
+
+    BlockRefs blocks;
+
+    for(QGraphicsItem *item : scene->items()){
+        ShapeData shape;
+        if(FromItem(item, shape)){
+            shapesArray.append(ToJson(shape, &blocks));
+        }
+    }
+
+    return shapesArray;
+}
+
+void ShapeSerializer::DeserializeScene(QGraphicsScene *scene, const QJsonArray &shapesArray)
+{
+    ShapeScene::ClearShapes(scene); // Clear existing shapes
+    if(auto *shapeScene = qobject_cast<ShapeScene *>(scene)){
+        shapeScene->SetLayers(LayersFromJson(shapesArray));
+    }
+
+    ShapeStore *store = ShapeScene::StoreOf(scene);
+    SceneBulkInsert bulk(scene); // index rebuilt once when this goes out of scope
+    BlockRefs blocks;
+    for (const QJsonValue &value : shapesArray) {
+        ShapeData shape;
+        if(FromJson(value.toObject(), shape, &blocks)){
+            bulk.Add(CreateItem(shape, store));
+        }
+    }
+}
+
+QVector<ShapeData> ShapeSerializer::SceneShapes(const QGraphicsScene *scene)
+{
+    //a shape store already holds the geometry packed, no item walk needed
+    if(const ShapeStore *store = ShapeScene::StoreOf(scene)){
+        return store->Snapshot();
+    }
+
+    const QList<QGraphicsItem *> items = scene->items();
+    QVector<ShapeData> shapes;
+    shapes.reserve(items.size());
+
+    for(QGraphicsItem *item : items){
+        ShapeData shape;
+        if(FromItem(item, shape)){
+            shapes.append(shape);
+        }
+    }
+    return shapes;
+}
+
+void ShapeSerializer::PopulateScene(QGraphicsScene *scene, const QVector<ShapeData> &shapes)
+{
+    ShapeScene::ClearShapes(scene); // Clear existing shapes
+
+    ShapeStore *store = ShapeScene::StoreOf(scene);
+    SceneBulkInsert bulk(scene); // index rebuilt once when this goes out of scope
+    for(const ShapeData &shape : shapes){
+        bulk.Add(CreateItem(shape, store));
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef SHAPESERIALIZER_H
+#define SHAPESERIALIZER_H
+
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QGraphicsScene>
+#include <QGraphicsItem>
+#include <QHash>
+#include <QPen>
+#include <QVector>
+#include "Entity.h"
+#include "shapestore.h"
+
+//Converts between scene items, plain ShapeData and the JSON document format.
+//Has no dependency on CanvasView so it can be used without a window.
+class ShapeSerializer
+{
+public:
+    static QPen DefaultPen();
+
+    //block definitions of one document: each is written with its first instance and
+    //numbered, later instances only carry the number
+    struct BlockRefs{
+        QHash<const void *, int> written;
+        QHash<int, Block> read;
+    };
+
+    //single shape conversions; without refs a block instance carries its whole definition
+    static QJsonObject ToJson(const ShapeData &shape, BlockRefs *blocks = nullptr);
+    static bool FromJson(const QJsonObject &obj, ShapeData &shape, BlockRefs *blocks = nullptr);
+    static bool FromItem(const QGraphicsItem *item, ShapeData &shape);
+    //with a store the item is a ShapeItem backed by it, otherwise a stock Qt item
+    static QGraphicsItem *CreateItem(const ShapeData &shape, ShapeStore *store = nullptr);
+    //polyline shape through scene-coordinate points, false for fewer than two
+    static bool MakePolyline(const QVector<QPointF> &points, ShapeData &shape);
+
+    //shape list conversions
+    static QJsonArray ToJsonArray(const QVector<ShapeData> &shapes, BlockRefs *blocks = nullptr);
+    static QVector<ShapeData> FromJsonArray(const QJsonArray &shapesArray, BlockRefs *blocks = nullptr);
+
+    //the layer table, written as "layer" entries ahead of the shapes of a document;
+    //readers that predate layers skip them like any unknown type
+    static QJsonArray LayersToJson(const QVector<Layer> &layers);
+    static QVector<Layer> LayersFromJson(const QJsonArray &shapesArray);
+
+    //whole scene conversions
+    static QJsonArray SerializeScene(const QGraphicsScene *scene);
+    static void DeserializeScene(QGraphicsScene *scene, const QJsonArray &shapesArray);
+    static QVector<ShapeData> SceneShapes(const QGraphicsScene *scene);
+    static void PopulateScene(QGraphicsScene *scene, const QVector<ShapeData> &shapes);
+};
+
+#endif // SHAPESERIALIZER_H
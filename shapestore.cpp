@@ -0,0 +1,313 @@
+#include "shapestore.h"
+#include <algorithm>
+
+/*********************** Rows ***********************/
+ShapeData ShapeStore::Row(const Partition &partition, ShapeType type, size_t row)
+{
+    ShapeData shape;
+    shape.type = type;
+    if(type == ShapeType::Line){
+        shape.line = QLineF(partition.a[row], partition.b[row], partition.c[row], partition.d[row]);
+    } else {
+        shape.rect = QRectF(partition.a[row], partition.b[row], partition.c[row], partition.d[row]);
+    }
+    if(type == ShapeType::Polyline) shape.polyline = partition.polylines[row];
+    if(type == ShapeType::Block) shape.block = partition.blocks[row];
+    shape.layer = partition.layers[row];
+    return shape;
+}
+
+void ShapeStore::Append(ShapeId id, const ShapeData &shape)
+{
+    Partition &partition = partitions[int(shape.type)];
+    Slot &slot = idSlots[id];
+    slot.type = shape.type;
+    slot.row = quint32(partition.ids.size());
+    slot.used = true;
+
+    if(shape.type == ShapeType::Line){
+        partition.a.push_back(shape.line.x1());
+        partition.b.push_back(shape.line.y1());
+        partition.c.push_back(shape.line.x2());
+        partition.d.push_back(shape.line.y2());
+    } else {
+        partition.a.push_back(shape.rect.x());
+        partition.b.push_back(shape.rect.y());
+        partition.c.push_back(shape.rect.width());
+        partition.d.push_back(shape.rect.height());
+    }
+    if(shape.type == ShapeType::Polyline) partition.polylines.push_back(shape.polyline);
+    if(shape.type == ShapeType::Block) partition.blocks.push_back(shape.block);
+    partition.layers.push_back(shape.layer);
+    partition.ids.push_back(id);
+    partition.active.push_back(0);
+}
+
+void ShapeStore::Erase(ShapeId id)
+{
+    //swap the last row into the hole so the arrays stay packed
+    Slot &slot = idSlots[id];
+    Partition &partition = partitions[int(slot.type)];
+    const size_t row = slot.row;
+    const size_t last = partition.ids.size() - 1;
+
+    if(row != last){
+        partition.a[row] = partition.a[last];
+        partition.b[row] = partition.b[last];
+        partition.c[row] = partition.c[last];
+        partition.d[row] = partition.d[last];
+        if(!partition.polylines.empty()) partition.polylines[row] = std::move(partition.polylines[last]);
+        if(!partition.blocks.empty()) partition.blocks[row] = std::move(partition.blocks[last]);
+        partition.layers[row] = partition.layers[last];
+        partition.ids[row] = partition.ids[last];
+        partition.active[row] = partition.active[last];
+        idSlots[partition.ids[row]].row = quint32(row);
+    }
+    partition.a.pop_back();
+    partition.b.pop_back();
+    partition.c.pop_back();
+    partition.d.pop_back();
+    if(!partition.polylines.empty()) partition.polylines.pop_back();
+    if(!partition.blocks.empty()) partition.blocks.pop_back();
+    partition.layers.pop_back();
+    partition.ids.pop_back();
+    partition.active.pop_back();
+    slot.used = false;
+}
+
+/*********************** Add & Remove ***********************/
+ShapeId ShapeStore::Add(const ShapeData &shape)
+{
+    ShapeId id;
+    if(!freeIds.empty()){
+        id = freeIds.back();
+        freeIds.pop_back();
+    } else {
+        id = ShapeId(idSlots.size());
+        idSlots.emplace_back();
+    }
+    Append(id, shape);
+    return id;
+}
+
+void ShapeStore::Remove(ShapeId id)
+{
+    if(releasing || !IsValid(id)) return;
+    Erase(id);
+    freeIds.push_back(id);
+}
+
+void ShapeStore::Clear()
+{
+    for(Partition &partition : partitions){
+        partition = Partition();
+    }
+    idSlots.clear();
+    freeIds.clear();
+    releasing = false;
+}
+
+void ShapeStore::EndRelease()
+{
+    releasing = false;
+    bool anyKept = false;
+    for(Partition &partition : partitions){
+        //keep the inactive rows in order, packed to the front
+        size_t kept = 0;
+        for(size_t row = 0; row < partition.ids.size(); ++row){
+            const ShapeId id = partition.ids[row];
+            if(partition.active[row]){
+                idSlots[id].used = false;
+                freeIds.push_back(id);
+                continue;
+            }
+            if(kept != row){
+                partition.a[kept] = partition.a[row];
+                partition.b[kept] = partition.b[row];
+                partition.c[kept] = partition.c[row];
+                partition.d[kept] = partition.d[row];
+                if(!partition.polylines.empty()) partition.polylines[kept] = std::move(partition.polylines[row]);
+                if(!partition.blocks.empty()) partition.blocks[kept] = std::move(partition.blocks[row]);
+                partition.layers[kept] = partition.layers[row];
+                partition.ids[kept] = id;
+                partition.active[kept] = 0;
+                idSlots[id].row = quint32(kept);
+            }
+            ++kept;
+        }
+
+        if(kept == 0){
+            partition = Partition(); // gives the arrays' memory back too
+            continue;
+        }
+        anyKept = true;
+        partition.a.resize(kept);
+        partition.b.resize(kept);
+        partition.c.resize(kept);
+        partition.d.resize(kept);
+        if(!partition.polylines.empty()) partition.polylines.resize(kept);
+        if(!partition.blocks.empty()) partition.blocks.resize(kept);
+        partition.layers.resize(kept);
+        partition.ids.resize(kept);
+        partition.active.resize(kept);
+    }
+    //nothing outlives the scene's items, the common case when a drawing is closed
+    if(!anyKept) Clear();
+}
+
+void ShapeStore::Reserve(ShapeType type, qsizetype count)
+{
+    Partition &partition = partitions[int(type)];
+    partition.a.reserve(count);
+    partition.b.reserve(count);
+    partition.c.reserve(count);
+    partition.d.reserve(count);
+    if(type == ShapeType::Polyline) partition.polylines.reserve(count);
+    if(type == ShapeType::Block) partition.blocks.reserve(count);
+    partition.layers.reserve(count);
+    partition.ids.reserve(count);
+    partition.active.reserve(count);
+}
+
+/*********************** Access ***********************/
+bool ShapeStore::IsValid(ShapeId id) const
+{
+    return id < idSlots.size() && idSlots[id].used;
+}
+
+ShapeType ShapeStore::Type(ShapeId id) const
+{
+    return idSlots[id].type;
+}
+
+ShapeData ShapeStore::Get(ShapeId id) const
+{
+    const Slot &slot = idSlots[id];
+    return Row(partitions[int(slot.type)], slot.type, slot.row);
+}
+
+QRectF ShapeStore::Bounds(ShapeId id) const
+{
+    const Slot &slot = idSlots[id];
+    const Partition &partition = partitions[int(slot.type)];
+    const size_t row = slot.row;
+
+    if(slot.type == ShapeType::Line){
+        return QRectF(QPointF(partition.a[row], partition.b[row]),
+                      QPointF(partition.c[row], partition.d[row])).normalized();
+    }
+    return QRectF(partition.a[row], partition.b[row], partition.c[row], partition.d[row]).normalized();
+}
+
+void ShapeStore::Set(ShapeId id, const ShapeData &shape)
+{
+    Slot &slot = idSlots[id];
+    if(slot.type != shape.type){
+        //moving between partitions keeps the id and the active flag
+        const bool active = IsActive(id);
+        Erase(id);
+        Append(id, shape);
+        SetActive(id, active);
+        return;
+    }
+
+    Partition &partition = partitions[int(slot.type)];
+    const size_t row = slot.row;
+    if(shape.type == ShapeType::Line){
+        partition.a[row] = shape.line.x1();
+        partition.b[row] = shape.line.y1();
+        partition.c[row] = shape.line.x2();
+        partition.d[row] = shape.line.y2();
+    } else {
+        partition.a[row] = shape.rect.x();
+        partition.b[row] = shape.rect.y();
+        partition.c[row] = shape.rect.width();
+        partition.d[row] = shape.rect.height();
+    }
+    if(shape.type == ShapeType::Polyline) partition.polylines[row] = shape.polyline;
+    if(shape.type == ShapeType::Block) partition.blocks[row] = shape.block;
+    partition.layers[row] = shape.layer;
+}
+
+void ShapeStore::SetActive(ShapeId id, bool active)
+{
+    const Slot &slot = idSlots[id];
+    partitions[int(slot.type)].active[slot.row] = active ? 1 : 0;
+}
+
+bool ShapeStore::IsActive(ShapeId id) const
+{
+    const Slot &slot = idSlots[id];
+    return partitions[int(slot.type)].active[slot.row] != 0;
+}
+
+/*********************** Transforms ***********************/
+void ShapeStore::Translate(ShapeId id, const QPointF &delta)
+{
+    const Slot &slot = idSlots[id];
+    Partition &partition = partitions[int(slot.type)];
+    const size_t row = slot.row;
+
+    partition.a[row] += delta.x();
+    partition.b[row] += delta.y();
+    if(slot.type == ShapeType::Line){
+        partition.c[row] += delta.x();
+        partition.d[row] += delta.y();
+    }
+}
+
+void ShapeStore::Translate(const QVector<ShapeId> &ids, const QPointF &delta)
+{
+    for(ShapeId id : ids){
+        if(IsValid(id)) Translate(id, delta);
+    }
+}
+
+/*********************** Whole Drawing ***********************/
+QVector<ShapeData> ShapeStore::Snapshot() const
+{
+    QVector<ShapeData> shapes;
+    shapes.reserve(ActiveCount());
+    ForEachActive([&shapes](const ShapeData &shape){ shapes.append(shape); });
+    return shapes;
+}
+
+QRectF ShapeStore::Extent() const
+{
+    double left = 0, top = 0, right = 0, bottom = 0;
+    bool any = false;
+
+    auto include = [&](double x, double y){
+        if(!any){
+            left = right = x;
+            top = bottom = y;
+            any = true;
+            return;
+        }
+        left = std::min(left, x);
+        right = std::max(right, x);
+        top = std::min(top, y);
+        bottom = std::max(bottom, y);
+    };
+
+    for(int type = 0; type < ShapeTypeCount; ++type){
+        const Partition &partition = partitions[type];
+        const bool isLine = ShapeType(type) == ShapeType::Line;
+        for(size_t row = 0; row < partition.ids.size(); ++row){
+            if(!partition.active[row]) continue;
+            include(partition.a[row], partition.b[row]);
+            if(isLine) include(partition.c[row], partition.d[row]);
+            else include(partition.a[row] + partition.c[row], partition.b[row] + partition.d[row]);
+        }
+    }
+    return any ? QRectF(QPointF(left, top), QPointF(right, bottom)) : QRectF();
+}
+
+qsizetype ShapeStore::ActiveCount() const
+{
+    qsizetype count = 0;
+    for(const Partition &partition : partitions){
+        for(quint8 active : partition.active) count += active;
+    }
+    return count;
+}
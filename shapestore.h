@@ -0,0 +1,105 @@
+#ifndef SHAPESTORE_H
+#define SHAPESTORE_H
+
+#include <QRectF>
+#include <QVector>
+#include <vector>
+#include "Entity.h"
+#include "slabpool.h"
+
+using ShapeId = quint32;
+
+//Central geometry store for a drawing.
+//
+//Shapes are kept in structure-of-arrays form, one partition per ShapeType, with four
+//contiguous coordinate arrays each (x1,y1,x2,y2 for lines, x,y,width,height otherwise).
+//Polylines keep their bounds there too, plus a column of shared vertex buffers, so
+//moving one touches two doubles whatever its vertex count.
+//Block instances likewise keep their rect there and a column of shared definitions.
+//Every partition has a layer column, the layer table itself belongs to the ShapeScene.
+//IDs are stable across removals: a slot table maps each ID to its partition row and
+//rows are swap-removed. Whole-drawing passes (snapshot, extent, bulk translate) are
+//linear scans over packed doubles instead of walks over scene items.
+//
+//A shape is "active" while its item is in a scene; removed-but-undoable shapes keep
+//their geometry but are skipped by Snapshot() and Extent().
+//
+//The store also owns the pool its ShapeItems are allocated from, so a drawing's
+//items go back in slabs when the scene is cleared (see ShapeScene::ClearShapes).
+class ShapeStore
+{
+public:
+    static constexpr ShapeId InvalidId = ~ShapeId(0);
+    //pool slot of one ShapeItem, checked against the class in shapeitem.cpp
+    static constexpr size_t ItemSlotBytes = 32;
+
+    ShapeId Add(const ShapeData &shape);
+    void Remove(ShapeId id);
+    void Clear();
+    void Reserve(ShapeType type, qsizetype count);
+
+    //for a scene deleting all its items at once: Remove does nothing in between and
+    //EndRelease drops every active row in one pass, so the items don't swap-remove
+    //their rows one by one; removed-but-undoable shapes keep theirs
+    void BeginRelease() { releasing = true; }
+    void EndRelease();
+
+    SlabPool &ItemPool() { return itemPool; }
+
+    bool IsValid(ShapeId id) const;
+    ShapeType Type(ShapeId id) const;
+    ShapeData Get(ShapeId id) const;
+    QRectF Bounds(ShapeId id) const;
+    void Set(ShapeId id, const ShapeData &shape);
+
+    void SetActive(ShapeId id, bool active);
+    bool IsActive(ShapeId id) const;
+
+    void Translate(ShapeId id, const QPointF &delta);
+    void Translate(const QVector<ShapeId> &ids, const QPointF &delta);
+
+    QVector<ShapeData> Snapshot() const;
+    //visits active shapes partition by partition without copying the drawing
+    template<typename Visitor>
+    void ForEachActive(Visitor &&visit) const;
+    QRectF Extent() const;
+    qsizetype ActiveCount() const;
+
+private:
+    struct Partition{
+        std::vector<double> a, b, c, d;
+        std::vector<Polyline> polylines; // polyline partition only
+        std::vector<Block> blocks;       // block partition only
+        std::vector<quint16> layers;
+        std::vector<ShapeId> ids;
+        std::vector<quint8> active;
+    };
+    struct Slot{
+        quint32 row = 0;
+        ShapeType type = ShapeType::Line;
+        bool used = false;
+    };
+
+    Partition partitions[ShapeTypeCount];
+    std::vector<Slot> idSlots;
+    std::vector<ShapeId> freeIds;
+    SlabPool itemPool{ ItemSlotBytes };
+    bool releasing = false;
+
+    void Append(ShapeId id, const ShapeData &shape);
+    void Erase(ShapeId id);
+    static ShapeData Row(const Partition &partition, ShapeType type, size_t row);
+};
+
+template<typename Visitor>
+void ShapeStore::ForEachActive(Visitor &&visit) const
+{
+    for(int type = 0; type < ShapeTypeCount; ++type){
+        const Partition &partition = partitions[type];
+        for(size_t row = 0; row < partition.ids.size(); ++row){
+            if(partition.active[row]) visit(Row(partition, ShapeType(type), row));
+        }
+    }
+}
+
+#endif // SHAPESTORE_H
@@ -0,0 +1,299 @@
+#include "shapestreamreader.h"
+#include "shapeserializer.h"
+
+ShapeStreamReader::ShapeStreamReader(QIODevice *device, qint64 bufferSize)
+    : device(device), bufferSize(bufferSize)
+{
+}
+
+/*********************** Buffer ***********************/
+bool ShapeStreamReader::Fill()
+{
+    if(position < buffer.size()) return true;
+
+    buffer = device->read(bufferSize);
+    position = 0;
+    return !buffer.isEmpty();
+}
+
+int ShapeStreamReader::Peek()
+{
+    if(!Fill()) return -1;
+    return static_cast<unsigned char>(buffer.at(position));
+}
+
+int ShapeStreamReader::Get()
+{
+    if(!Fill()) return -1;
+    ++consumed;
+    return static_cast<unsigned char>(buffer.at(position++));
+}
+
+void ShapeStreamReader::SkipWhitespace()
+{
+    for(int c = Peek(); c == ' ' || c == '\n' || c == '\r' || c == '\t'; c = Peek()){
+        Get();
+    }
+}
+
+bool ShapeStreamReader::Expect(char c)
+{
+    SkipWhitespace();
+    if(Get() != c){
+        return Fail(QString("Expected '%1' at byte %2").arg(c).arg(consumed));
+    }
+    return true;
+}
+
+bool ShapeStreamReader::Fail(const QString &message)
+{
+    if(errorString.isEmpty()) errorString = message;
+    finished = true;
+    return false;
+}
+
+/*********************** Tokens ***********************/
+bool ShapeStreamReader::ReadString(QByteArray &out)
+{
+    out.clear();
+    if(!Expect('"')) return false;
+
+    for(int c = Get(); c != '"'; c = Get()){
+        if(c < 0) return Fail("Unterminated string");
+        if(c == '\\'){
+            //shape keys and type names are plain ASCII, keep escapes verbatim
+            c = Get();
+            if(c < 0) return Fail("Unterminated string");
+        }
+        out.append(char(c));
+    }
+    return true;
+}
+
+bool ShapeStreamReader::ReadNumber(double &out)
+{
+    token.clear();
+    for(int c = Peek(); (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E'; c = Peek()){
+        token.append(char(Get()));
+    }
+
+    bool ok = false;
+    out = token.toDouble(&ok); // locale independent
+    return ok ? true : Fail(QString("Invalid number at byte %1").arg(consumed));
+}
+
+bool ShapeStreamReader::SkipValue()
+{
+    SkipWhitespace();
+    int c = Peek();
+
+    if(c == '"') return ReadString(token);
+    if(c == '{' || c == '['){
+        //skip a nested container by tracking depth, strings may contain brackets
+        int depth = 0;
+        do{
+            c = Peek();
+            if(c < 0) return Fail("Unterminated container");
+            if(c == '"'){
+                if(!ReadString(token)) return false;
+                continue;
+            }
+            Get();
+            if(c == '{' || c == '[') ++depth;
+            else if(c == '}' || c == ']') --depth;
+        } while(depth > 0);
+        return true;
+    }
+    if(c == '-' || (c >= '0' && c <= '9')){
+        double ignored;
+        return ReadNumber(ignored);
+    }
+    //true, false, null
+    while((c = Peek()) >= 'a' && c <= 'z') Get();
+    return true;
+}
+
+//flat [x0, y0, x1, y1, ...] array of a polyline, into points
+bool ShapeStreamReader::ReadPoints()
+{
+    if(!Expect('[')) return false;
+    double coordinate[2];
+    int filled = 0;
+    for(;;){
+        SkipWhitespace();
+        const int c = Peek();
+        if(c == ']'){
+            Get();
+            return true;
+        }
+        if(c == ','){
+            Get();
+            continue;
+        }
+        if(!ReadNumber(coordinate[filled])) return false;
+        if(++filled == 2){
+            points.append(QPointF(coordinate[0], coordinate[1]));
+            filled = 0;
+        }
+    }
+}
+
+/*********************** Shapes ***********************/
+//members of a block definition, a nested shape array
+bool ShapeStreamReader::ReadShapes(QVector<ShapeData> &shapes, int depth)
+{
+    if(depth > MaxBlockDepth) return Fail("Blocks nested too deeply");
+    if(!Expect('[')) return false;
+    SkipWhitespace();
+    if(Peek() == ']'){
+        Get();
+        return true;
+    }
+
+    for(;;){
+        ShapeData shape;
+        bool known = false;
+        if(!ReadObject(shape, known, depth)) return false;
+        if(known) shapes.append(shape);
+
+        SkipWhitespace();
+        const int c = Get();
+        if(c == ']') return true;
+        if(c != ',') return Fail(QString("Expected ',' or ']' at byte %1").arg(consumed));
+    }
+}
+
+bool ShapeStreamReader::ReadObject(ShapeData &shape, bool &known, int depth)
+{
+    static const char *FieldNames[FieldCount] = { "x1", "y1", "x2", "y2", "x", "y", "width", "height", "definition",
+                                                    "layer", "index", "z" };
+
+    double fields[FieldCount] = {};
+    fields[Definition] = -1;
+    fields[Index] = -1;
+    QByteArray key;
+    QByteArray type;
+    QByteArray name;
+    QVector<ShapeData> members;
+    bool hasMembers = false;
+    bool visible = true;
+    bool locked = false;
+    points.clear();
+
+    if(!Expect('{')) return false;
+    SkipWhitespace();
+    if(Peek() == '}'){
+        Get();
+        known = false;
+        return true;
+    }
+
+    for(;;){
+        if(!ReadString(key) || !Expect(':')) return false;
+        SkipWhitespace();
+
+        int field = -1;
+        for(int i = 0; i < FieldCount; ++i){
+            if(key == FieldNames[i]){ field = i; break; }
+        }
+
+        int c = Peek();
+        if(key == "type" && c == '"'){
+            if(!ReadString(type)) return false;
+        }
+        else if(field >= 0 && (c == '-' || (c >= '0' && c <= '9'))){
+            if(!ReadNumber(fields[field])) return false;
+        }
+        else if(key == "points" && c == '['){
+            if(!ReadPoints()) return false;
+        }
+        else if(key == "name" && c == '"'){
+            if(!ReadString(name)) return false;
+        }
+        else if((key == "visible" || key == "locked") && (c == 't' || c == 'f')){
+            (key == "visible" ? visible : locked) = c == 't';
+            if(!SkipValue()) return false;
+        }
+        else if(key == "shapes" && c == '['){
+            if(!ReadShapes(members, depth + 1)) return false;
+            hasMembers = true;
+        }
+        else if(!SkipValue()){
+            return false;
+        }
+
+        SkipWhitespace();
+        c = Get();
+        if(c == '}') break;
+        if(c != ',') return Fail(QString("Expected ',' or '}' at byte %1").arg(consumed));
+    }
+
+    known = true;
+    shape.layer = quint16(qBound(0.0, fields[LayerIndex], double(MaxLayers - 1)));
+    if(type == "line"){
+        shape.type = ShapeType::Line;
+        shape.line = QLineF(fields[X1], fields[Y1], fields[X2], fields[Y2]);
+    }
+    else if(type == "rectangle" || type == "circle"){
+        shape.type = type == "rectangle" ? ShapeType::Rectangle : ShapeType::Circle;
+        shape.rect = QRectF(fields[X], fields[Y], fields[Width], fields[Height]);
+    }
+    else if(type == "polyline"){
+        known = ShapeSerializer::MakePolyline(points, shape);
+    }
+    else if(type == "block"){
+        //the first instance carries the definition, later ones only its number
+        const int number = int(fields[Definition]);
+        if(hasMembers){
+            shape.block = Block::Define(QString::fromUtf8(name), members);
+            if(number >= 0) blocks.insert(number, shape.block);
+        }
+        else{
+            shape.block = blocks.value(number);
+        }
+        shape.type = ShapeType::Block;
+        shape.rect = QRectF(fields[X], fields[Y], fields[Width], fields[Height]);
+        known = !shape.block.IsNull();
+    }
+    else if(type == "layer"){
+        known = false;
+        const double index = fields[Index];
+        if(depth == 0 && index >= 0 && index < MaxLayers){
+            if(index >= layers.size()) layers.resize(qsizetype(index) + 1);
+            layers[qsizetype(index)] = Layer{QString::fromUtf8(name), visible, locked, int(fields[Z])};
+        }
+    }
+    else{
+        known = false; // Unknown shape type, skipped like DeserializeCanvas does
+    }
+    return true;
+}
+
+bool ShapeStreamReader::ReadNext(ShapeData &shape)
+{
+    if(finished) return false;
+
+    if(!started){
+        if(!Expect('[')) return false;
+        started = true;
+        SkipWhitespace();
+        if(Peek() == ']'){
+            Get();
+            finished = true;
+            return false;
+        }
+    }
+
+    for(;;){
+        bool known = false;
+        if(!ReadObject(shape, known)) return false;
+
+        SkipWhitespace();
+        int c = Get();
+        if(c == ']') finished = true;
+        else if(c != ',') return Fail(QString("Expected ',' or ']' at byte %1").arg(consumed));
+
+        if(known) return true;
+        if(finished) return false;
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef SHAPESTREAMREADER_H
+#define SHAPESTREAMREADER_H
+
+#include <QIODevice>
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QVector>
+#include "Entity.h"
+
+//Pull-style reader for the JSON drawing format.
+//Reads the top-level shape array one object at a time from a device through a
+//fixed-size buffer, so memory use doesn't depend on the file size. Block
+//definitions are kept as they are read, later instances refer to them by number.
+//"layer" entries are collected into the layer table rather than returned.
+class ShapeStreamReader
+{
+public:
+    explicit ShapeStreamReader(QIODevice *device, qint64 bufferSize = 64 * 1024);
+
+    //returns false at the end of the array or on a syntax error
+    bool ReadNext(ShapeData &shape);
+
+    bool HasError() const { return !errorString.isEmpty(); }
+    QString ErrorString() const { return errorString; }
+    qint64 BytesConsumed() const { return consumed; }
+    //layer entries read so far; documents write them ahead of their shapes
+    const QVector<Layer> &Layers() const { return layers; }
+
+private:
+    enum Field { X1, Y1, X2, Y2, X, Y, Width, Height, Definition, LayerIndex, Index, Z, FieldCount };
+    static constexpr int MaxBlockDepth = 32;
+
+    QIODevice *device;
+    QByteArray buffer;
+    qint64 bufferSize;
+    qint64 position = 0;
+    qint64 consumed = 0;
+    bool started = false;
+    bool finished = false;
+    QString errorString;
+
+    //scratch space reused for every key and value
+    QByteArray token;
+    QVector<QPointF> points;
+    QHash<int, Block> blocks; // definitions by number
+    QVector<Layer> layers;
+
+    bool Fill();
+    int Peek();
+    int Get();
+    void SkipWhitespace();
+    bool Expect(char c);
+    bool ReadString(QByteArray &out);
+    bool ReadNumber(double &out);
+    bool SkipValue();
+    bool ReadPoints();
+    bool ReadShapes(QVector<ShapeData> &shapes, int depth);
+    bool ReadObject(ShapeData &shape, bool &known, int depth = 0);
+    bool Fail(const QString &message);
+};
+
+#endif // SHAPESTREAMREADER_H
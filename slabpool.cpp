@@ -0,0 +1,155 @@
+#include "slabpool.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <new>
+
+namespace {
+
+std::atomic<bool> poolsEnabled{ true };
+std::atomic<bool> poolsUsed{ false };
+
+} // namespace
+
+SlabPool::SlabPool(size_t size)
+{
+    //every slot has to hold the free-list link and keep the next one aligned
+    const size_t align = alignof(std::max_align_t);
+    size = qMax(size, sizeof(FreeSlot));
+    objectSize = (size + align - 1) / align * align;
+    Q_ASSERT(objectSize <= MaxObjectBytes);
+}
+
+SlabPool::~SlabPool()
+{
+    if(live > 0) return; // still in use somewhere, see the class comment
+    while(slabs){
+        Slab *next = slabs->next;
+        ::operator delete(slabs, std::align_val_t(SlabBytes));
+        slabs = next;
+    }
+}
+
+/*********************** Allocation ***********************/
+void *SlabPool::Allocate()
+{
+    if(!poolsEnabled.load(std::memory_order_relaxed)){
+        poolsUsed.store(true, std::memory_order_relaxed);
+        return ::operator new(objectSize);
+    }
+
+    void *object;
+    if(freeList){
+        object = freeList;
+        freeList = freeList->next;
+    } else {
+        if(bump + objectSize > bumpEnd) Grow();
+        object = bump;
+        bump += objectSize;
+    }
+    ++live;
+    return object;
+}
+
+void SlabPool::Free(void *object)
+{
+    if(!object) return;
+    if(!poolsEnabled.load(std::memory_order_relaxed)){
+        ::operator delete(object);
+        return;
+    }
+
+    //the slab header sits at the slab-aligned address below every object
+    auto *slab = reinterpret_cast<Slab *>(reinterpret_cast<std::uintptr_t>(object) & ~std::uintptr_t(SlabBytes - 1));
+    SlabPool *pool = slab->pool;
+    auto *slot = static_cast<FreeSlot *>(object);
+    slot->next = pool->freeList;
+    pool->freeList = slot;
+    if(--pool->live == 0) pool->Release();
+}
+
+void SlabPool::Grow()
+{
+    poolsUsed.store(true, std::memory_order_relaxed);
+    auto *slab = static_cast<Slab *>(::operator new(SlabBytes, std::align_val_t(SlabBytes)));
+    slab->pool = this;
+    slab->next = slabs;
+    slabs = slab;
+    ++slabCount;
+
+    //left untouched until handed out, so the pages of a fresh slab cost nothing yet
+    bump = reinterpret_cast<char *>(slab) + FirstOffset;
+    bumpEnd = reinterpret_cast<char *>(slab) + SlabBytes;
+}
+
+//Nothing is live any more: every slab goes at once, the newest stays for reuse
+void SlabPool::Release()
+{
+    if(!slabs) return;
+    Slab *kept = slabs;
+    Slab *slab = kept->next;
+    while(slab){
+        Slab *next = slab->next;
+        ::operator delete(slab, std::align_val_t(SlabBytes));
+        slab = next;
+    }
+    kept->next = nullptr;
+    slabs = kept;
+    slabCount = 1;
+    freeList = nullptr;
+    bump = reinterpret_cast<char *>(kept) + FirstOffset;
+    bumpEnd = reinterpret_cast<char *>(kept) + SlabBytes;
+}
+
+/*********************** Switch ***********************/
+bool SlabPool::SetEnabled(bool on)
+{
+    if(poolsUsed.load()) return on == poolsEnabled.load();
+    poolsEnabled.store(on);
+    return true;
+}
+
+bool SlabPool::IsEnabled()
+{
+    return poolsEnabled.load(std::memory_order_relaxed);
+}
+
+/*********************** Size Classes ***********************/
+namespace {
+
+constexpr size_t ClassCount = SizeClassPool::MaxBytes / SizeClassPool::ClassBytes;
+
+//one size class of a thread, created on first use. A pool that still has objects
+//out when its thread ends is left alive along with its slabs: Free reaches the pool
+//through the slab header, so deleting it would leave those objects pointing at
+//freed memory.
+struct ClassPool{
+    std::unique_ptr<SlabPool> pool;
+
+    ~ClassPool()
+    {
+        if(pool && pool->Live() > 0) pool.release();
+    }
+};
+
+thread_local ClassPool classPools[ClassCount];
+
+} // namespace
+
+void *SizeClassPool::Allocate(size_t size)
+{
+    if(size > MaxBytes) return ::operator new(size);
+    const size_t sizeClass = (qMax<size_t>(size, 1) - 1) / ClassBytes;
+    std::unique_ptr<SlabPool> &pool = classPools[sizeClass].pool;
+    if(!pool) pool.reset(new SlabPool((sizeClass + 1) * ClassBytes));
+    return pool->Allocate();
+}
+
+void SizeClassPool::Free(void *object, size_t size)
+{
+    if(size > MaxBytes){
+        ::operator delete(object);
+        return;
+    }
+    SlabPool::Free(object);
+}
@@ -0,0 +1,87 @@
+#ifndef SLABPOOL_H
+#define SLABPOOL_H
+
+#include <QtGlobal>
+#include <cstddef>
+
+//Fixed-size object pool carved out of 64 KB slabs.
+//
+//Objects are bump-allocated from the newest slab and freed ones go on an intrusive
+//free list for reuse, so a drawing's million items cost a few hundred slab
+//allocations instead of a million heap blocks with their headers. Slabs are aligned
+//to their size and start with a pointer to their pool, so Free finds the pool from
+//the object address alone and class-level operator delete needs no extra state.
+//When the last live object is freed the slabs go back in bulk, all but one kept
+//for the next drawing.
+//
+//A pool belongs to one thread at a time: allocate and free from the thread that
+//owns the objects. Destroying a pool with live objects leaks its slabs rather than
+//pulling memory out from under them, but Free still writes to the pool, so whoever
+//owns it must keep the pool object alive too while objects are out.
+class SlabPool
+{
+public:
+    static constexpr size_t SlabBytes = 64 * 1024;
+    //largest object a pool takes, bigger ones belong on the heap
+    static constexpr size_t MaxObjectBytes = SlabBytes / 16;
+
+    explicit SlabPool(size_t size);
+    ~SlabPool();
+    SlabPool(const SlabPool &) = delete;
+    SlabPool &operator=(const SlabPool &) = delete;
+
+    void *Allocate();
+    //returns an object's memory to the pool it came from
+    static void Free(void *object);
+
+    size_t ObjectSize() const { return objectSize; }
+    qsizetype Live() const { return live; }
+    qsizetype SlabCount() const { return slabCount; }
+    qint64 ReservedBytes() const { return qint64(slabCount) * qint64(SlabBytes); }
+
+    //off, every pool hands out plain operator new blocks instead, for comparing the
+    //two in benchmarks; only takes effect before the first allocation of any pool
+    static bool SetEnabled(bool on);
+    static bool IsEnabled();
+
+private:
+    struct Slab{
+        SlabPool *pool;
+        Slab *next;
+    };
+    struct FreeSlot{
+        FreeSlot *next;
+    };
+
+    //objects start past the header, at the alignment operator new guarantees
+    static constexpr size_t FirstOffset =
+        (sizeof(Slab) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+    size_t objectSize;
+    Slab *slabs = nullptr;        // newest first
+    FreeSlot *freeList = nullptr;
+    char *bump = nullptr;         // untouched tail of the newest slab
+    char *bumpEnd = nullptr;
+    qsizetype live = 0;
+    qsizetype slabCount = 0;
+
+    void Grow();
+    void Release();
+};
+
+//SlabPools by size class for a class hierarchy whose objects differ in size, one set
+//per thread. For class-level operator new/delete; sizes above the largest class go
+//to the heap. A thread that ends with objects still out leaves their pool behind,
+//they can then be freed from one other thread.
+class SizeClassPool
+{
+public:
+    static constexpr size_t ClassBytes = 16;
+    static constexpr size_t MaxBytes = 256;
+
+    static void *Allocate(size_t size);
+    //size as passed to a sized operator delete, so it is the dynamic type's
+    static void Free(void *object, size_t size);
+};
+
+#endif // SLABPOOL_H
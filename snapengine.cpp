@@ -0,0 +1,314 @@
+#include "snapengine.h"
+#include "shapeserializer.h"
+#include <QLineF>
+#include <cmath>
+
+namespace {
+
+//cells scanned per axis at most, tolerances beyond this are clamped
+constexpr int MaxCellSpan = 16;
+
+struct Circle{
+    QPointF center;
+    qreal radius;
+};
+
+//segment/segment, proper and touching intersections
+void Intersect(const QLineF &a, const QLineF &b, std::vector<QPointF> &points)
+{
+    QPointF hit;
+    if(a.intersects(b, &hit) != QLineF::BoundedIntersection) return;
+    points.push_back(hit);
+}
+
+void Intersect(const QLineF &segment, const Circle &circle, std::vector<QPointF> &points)
+{
+    const QPointF d = segment.p2() - segment.p1();
+    const QPointF f = segment.p1() - circle.center;
+    const qreal a = QPointF::dotProduct(d, d);
+    if(a == 0) return;
+    const qreal b = 2 * QPointF::dotProduct(f, d);
+    const qreal c = QPointF::dotProduct(f, f) - circle.radius * circle.radius;
+    const qreal discriminant = b * b - 4 * a * c;
+    if(discriminant < 0) return;
+
+    const qreal root = std::sqrt(discriminant);
+    for(const qreal t : { (-b - root) / (2 * a), (-b + root) / (2 * a) }){
+        if(t >= 0 && t <= 1) points.push_back(segment.p1() + t * d);
+    }
+}
+
+void Intersect(const Circle &a, const Circle &b, std::vector<QPointF> &points)
+{
+    const QPointF delta = b.center - a.center;
+    const qreal distance = std::hypot(delta.x(), delta.y());
+    if(distance == 0 || distance > a.radius + b.radius || distance < std::abs(a.radius - b.radius)) return;
+
+    //chord through both intersections, at along from a's centre
+    const qreal along = (a.radius * a.radius - b.radius * b.radius + distance * distance) / (2 * distance);
+    const qreal half = std::sqrt(qMax<qreal>(0, a.radius * a.radius - along * along));
+    const QPointF mid = a.center + delta * (along / distance);
+    const QPointF offset(-delta.y() * half / distance, delta.x() * half / distance);
+    points.push_back(mid + offset);
+    if(half > 0) points.push_back(mid - offset);
+}
+
+//a long trace or a busy block only offers the segments near the cursor, and not too many of those
+constexpr size_t MaxShapeSegments = 256;
+//snap points a block instance offers, taken from its members in order
+constexpr size_t MaxBlockSnapPoints = 256;
+
+//outline pieces of a shape near area; ellipses that aren't circles take no part in intersections
+void Decompose(const ShapeData &shape, const QRectF &area, std::vector<QLineF> &segments, std::vector<Circle> &circles)
+{
+    switch(shape.type){
+        case ShapeType::Line:
+            segments.push_back(shape.line);
+            break;
+        case ShapeType::Rectangle:{
+            const QRectF r = shape.rect.normalized();
+            segments.push_back(QLineF(r.topLeft(), r.topRight()));
+            segments.push_back(QLineF(r.topRight(), r.bottomRight()));
+            segments.push_back(QLineF(r.bottomRight(), r.bottomLeft()));
+            segments.push_back(QLineF(r.bottomLeft(), r.topLeft()));
+            break;
+        }
+        case ShapeType::Circle:{
+            const QRectF r = shape.rect.normalized();
+            if(qFuzzyCompare(r.width(), r.height())) circles.push_back({ r.center(), r.width() / 2 });
+            break;
+        }
+        case ShapeType::Polyline:
+            shape.polyline.ForEachSegment(shape.rect.topLeft(), area, [&segments](const QLineF &segment){
+                if(segments.size() < MaxShapeSegments) segments.push_back(segment);
+            });
+            break;
+        case ShapeType::Block:{
+            //members near the cursor, decomposed in definition coordinates and placed
+            const QTransform placement = shape.block.Placement(shape.rect);
+            const QRectF local = placement.inverted().mapRect(area);
+            std::vector<QLineF> memberSegments;
+            std::vector<Circle> memberCircles;
+            for(const ShapeData &member : shape.block.Shapes()){
+                const QRectF box = member.type == ShapeType::Line ? QRectF(member.line.p1(), member.line.p2()).normalized()
+                                                                  : member.rect.normalized();
+                if(box.left() > local.right() || box.right() < local.left()
+                   || box.top() > local.bottom() || box.bottom() < local.top()) continue;
+                Decompose(member, local, memberSegments, memberCircles);
+                if(memberSegments.size() >= MaxShapeSegments) break;
+            }
+            for(const QLineF &segment : memberSegments) segments.push_back(placement.map(segment));
+            //a circle stays one only under uniform scaling
+            if(qFuzzyCompare(placement.m11(), placement.m22())){
+                for(const Circle &circle : memberCircles){
+                    circles.push_back({ placement.map(circle.center), circle.radius * placement.m11() });
+                }
+            }
+            break;
+        }
+    }
+}
+
+}
+
+SnapEngine::SnapEngine(SpatialIndex *index)
+    : index(index)
+{
+    index->SetShapeCallbacks([this](QGraphicsItem *item, const ShapeData &shape){ Add(item, shape); },
+                             [this](QGraphicsItem *item, const ShapeData &shape){ Remove(item, shape); },
+                             [this]{ Clear(); });
+}
+
+/*********************** Snap Points ***********************/
+quint64 SnapEngine::CellKey(const QPointF &point)
+{
+    const qint32 x = qint32(std::floor(point.x() / CellSize));
+    const qint32 y = qint32(std::floor(point.y() / CellSize));
+    return (quint64(quint32(x)) << 32) | quint32(y);
+}
+
+int SnapEngine::ModeFor(Kind kind)
+{
+    switch(kind){
+        case Kind::Endpoint: return EndpointSnap;
+        case Kind::Midpoint: return MidpointSnap;
+        case Kind::Center: return CenterSnap;
+        case Kind::Intersection: return IntersectionSnap;
+        case Kind::Grid: return GridSnap;
+        case Kind::None: break;
+    }
+    return 0;
+}
+
+template<typename Visitor>
+void SnapEngine::ForEachSnapPoint(const ShapeData &shape, Visitor &&visit)
+{
+    switch(shape.type){
+        case ShapeType::Line:
+            visit(shape.line.p1(), Kind::Endpoint);
+            visit(shape.line.p2(), Kind::Endpoint);
+            visit(shape.line.center(), Kind::Midpoint);
+            break;
+        case ShapeType::Rectangle:{
+            const QRectF r = shape.rect.normalized();
+            visit(r.topLeft(), Kind::Endpoint);
+            visit(r.topRight(), Kind::Endpoint);
+            visit(r.bottomRight(), Kind::Endpoint);
+            visit(r.bottomLeft(), Kind::Endpoint);
+            visit(QPointF(r.center().x(), r.top()), Kind::Midpoint);
+            visit(QPointF(r.right(), r.center().y()), Kind::Midpoint);
+            visit(QPointF(r.center().x(), r.bottom()), Kind::Midpoint);
+            visit(QPointF(r.left(), r.center().y()), Kind::Midpoint);
+            visit(r.center(), Kind::Center);
+            break;
+        }
+        case ShapeType::Circle:
+            visit(shape.rect.normalized().center(), Kind::Center);
+            break;
+        case ShapeType::Polyline:{
+            //every vertex of a traced line would flood the hash, only its ends are offered
+            if(shape.polyline.Size() < 2) break;
+            visit(shape.polyline.Point(0, shape.rect.topLeft()), Kind::Endpoint);
+            visit(shape.polyline.Point(shape.polyline.Size() - 1, shape.rect.topLeft()), Kind::Endpoint);
+            break;
+        }
+        case ShapeType::Block:{
+            std::vector<SnapPoint> points;
+            BlockSnapPoints(shape.block, shape.block.Placement(shape.rect), points);
+            for(const SnapPoint &point : points) visit(point.point, point.kind);
+            break;
+        }
+    }
+}
+
+//members' snap points placed into the scene, nested instances through their own placement
+void SnapEngine::BlockSnapPoints(const Block &block, const QTransform &placement, std::vector<SnapPoint> &points)
+{
+    for(const ShapeData &member : block.Shapes()){
+        if(points.size() >= MaxBlockSnapPoints) return;
+        if(member.type == ShapeType::Block){
+            BlockSnapPoints(member.block, member.block.Placement(member.rect) * placement, points);
+            continue;
+        }
+        ForEachSnapPoint(member, [&points, &placement](const QPointF &point, Kind kind){
+            points.push_back({ placement.map(point), kind, 0, nullptr });
+        });
+    }
+    if(points.size() > MaxBlockSnapPoints) points.resize(MaxBlockSnapPoints);
+}
+
+void SnapEngine::Add(QGraphicsItem *item, const ShapeData &shape)
+{
+    ForEachSnapPoint(shape, [this, item, &shape](const QPointF &point, Kind kind){
+        cells[CellKey(point)].push_back({ point, kind, shape.layer, item });
+        ++pointCount;
+    });
+}
+
+void SnapEngine::Remove(QGraphicsItem *item, const ShapeData &shape)
+{
+    //the shape's own points say which cells to look in; a cell holds a few dozen
+    //points, so a linear pass over it is cheaper than a per-item side table
+    ForEachSnapPoint(shape, [this, item](const QPointF &point, Kind){
+        auto cell = cells.find(CellKey(point));
+        if(cell == cells.end()) return;
+        std::vector<SnapPoint> &points = cell.value();
+        for(size_t i = 0; i < points.size(); ++i){
+            if(points[i].item != item || points[i].point != point) continue;
+            points[i] = points.back();
+            points.pop_back();
+            --pointCount;
+            break;
+        }
+        if(points.empty()) cells.erase(cell);
+    });
+}
+
+void SnapEngine::Clear()
+{
+    cells.clear();
+    pointCount = 0;
+}
+
+/*********************** Queries ***********************/
+SnapEngine::Result SnapEngine::Snap(const QPointF &point, qreal tolerance, const QSet<QGraphicsItem *> &exclude) const
+{
+    Result best{ point, Kind::None };
+    qreal bestDistance = tolerance;
+
+    if(modes & (EndpointSnap | MidpointSnap | CenterSnap)){
+        const qreal reach = qMin(tolerance, CellSize * (MaxCellSpan / 2));
+        const qint64 x0 = qint64(std::floor((point.x() - reach) / CellSize));
+        const qint64 x1 = qint64(std::floor((point.x() + reach) / CellSize));
+        const qint64 y0 = qint64(std::floor((point.y() - reach) / CellSize));
+        const qint64 y1 = qint64(std::floor((point.y() + reach) / CellSize));
+        for(qint64 x = x0; x <= x1; ++x){
+            for(qint64 y = y0; y <= y1; ++y){
+                auto cell = cells.constFind((quint64(quint32(qint32(x))) << 32) | quint32(qint32(y)));
+                if(cell == cells.cend()) continue;
+                for(const SnapPoint &candidate : cell.value()){
+                    if(!(modes & ModeFor(candidate.kind))) continue;
+                    const qreal distance = QLineF(point, candidate.point).length();
+                    //on equal distance the earlier kind (endpoint before midpoint before centre) wins
+                    if(distance > bestDistance || (distance == bestDistance && best.kind != Kind::None && candidate.kind >= best.kind)) continue;
+                    if(exclude.contains(candidate.item) || !index->IsLayerVisible(candidate.layer)) continue;
+                    best = { candidate.point, candidate.kind };
+                    bestDistance = distance;
+                }
+            }
+        }
+    }
+
+    if(modes & IntersectionSnap) NearestIntersection(point, tolerance, exclude, best, bestDistance);
+
+    if(best.kind == Kind::None && (modes & GridSnap) && gridSpacing > 0){
+        best = { QPointF(std::round(point.x() / gridSpacing) * gridSpacing,
+                         std::round(point.y() / gridSpacing) * gridSpacing), Kind::Grid };
+    }
+    return best;
+}
+
+void SnapEngine::NearestIntersection(const QPointF &point, qreal tolerance, const QSet<QGraphicsItem *> &exclude,
+                                     Result &best, qreal &bestDistance) const
+{
+    const QList<QGraphicsItem *> items = index->Crossing(QRectF(point - QPointF(tolerance, tolerance),
+                                                                QSizeF(2 * tolerance, 2 * tolerance)),
+                                                         SpatialIndex::Scope::Visible);
+    if(items.size() < 2) return;
+
+    //each shape keeps its own outline pieces so a rectangle's corners don't count
+    const QRectF area(point - QPointF(tolerance, tolerance), QSizeF(2 * tolerance, 2 * tolerance));
+    std::vector<std::vector<QLineF>> segments;
+    std::vector<std::vector<Circle>> circles;
+    for(QGraphicsItem *item : items){
+        if(int(segments.size()) == MaxIntersectionShapes) break;
+        ShapeData shape;
+        if(exclude.contains(item) || !ShapeSerializer::FromItem(item, shape)) continue;
+        segments.emplace_back();
+        circles.emplace_back();
+        Decompose(shape, area, segments.back(), circles.back());
+    }
+
+    std::vector<QPointF> hits;
+    for(size_t i = 0; i < segments.size(); ++i){
+        for(size_t j = i + 1; j < segments.size(); ++j){
+            for(const QLineF &a : segments[i]){
+                for(const QLineF &b : segments[j]) Intersect(a, b, hits);
+                for(const Circle &c : circles[j]) Intersect(a, c, hits);
+            }
+            for(const Circle &a : circles[i]){
+                for(const QLineF &b : segments[j]) Intersect(b, a, hits);
+                for(const Circle &c : circles[j]) Intersect(a, c, hits);
+            }
+        }
+    }
+
+    for(const QPointF &hit : hits){
+        const qreal distance = QLineF(point, hit).length();
+        //an endpoint on the intersection is the same spot, keep the endpoint
+        if(distance < bestDistance){
+            best = { hit, Kind::Intersection };
+            bestDistance = distance;
+        }
+    }
+}
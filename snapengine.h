@@ -0,0 +1,88 @@
+#ifndef SNAPENGINE_H
+#define SNAPENGINE_H
+
+#include <QGraphicsItem>
+#include <QHash>
+#include <QPointF>
+#include <QSet>
+#include <vector>
+#include "spatialindex.h"
+#include "Entity.h"
+
+//Object snapping for drawing and moving shapes.
+//
+//Endpoints, midpoints and centres of every indexed shape live in a uniform spatial
+//hash of CellSize cells. The hash follows the SpatialIndex through its shape
+//callbacks, so commands that update the index keep the snap points current without
+//knowing about them. Intersections can't be precomputed without a quadratic pass,
+//so they are solved on the fly between the few shapes the R-tree finds under the
+//cursor. A query touches a handful of cells and at most MaxIntersectionShapes
+//shapes, which keeps it in the microsecond range whatever the drawing size.
+//Points of shapes on hidden layers stay in the hash and are skipped by the query;
+//locked layers can still be snapped to.
+class SnapEngine
+{
+public:
+    enum class Kind { None, Endpoint, Midpoint, Center, Intersection, Grid };
+
+    enum Mode{
+        EndpointSnap = 0x01,
+        MidpointSnap = 0x02,
+        CenterSnap = 0x04,
+        IntersectionSnap = 0x08,
+        GridSnap = 0x10,
+        ObjectSnaps = EndpointSnap | MidpointSnap | CenterSnap | IntersectionSnap
+    };
+
+    struct Result{
+        QPointF point;
+        Kind kind = Kind::None;
+    };
+
+    static constexpr qreal CellSize = 64.0;
+    static constexpr int MaxIntersectionShapes = 24;
+
+    explicit SnapEngine(SpatialIndex *index);
+
+    void SetModes(int modes) { this->modes = modes; }
+    int Modes() const { return modes; }
+    void SetGridSpacing(qreal spacing) { gridSpacing = spacing; }
+    qreal GridSpacing() const { return gridSpacing; }
+
+    //best snap within tolerance (scene units) of point, ignoring the excluded items;
+    //kind is None and point unchanged when nothing is close enough
+    Result Snap(const QPointF &point, qreal tolerance, const QSet<QGraphicsItem *> &exclude = {}) const;
+
+    qsizetype PointCount() const { return pointCount; }
+
+private:
+    struct SnapPoint{
+        QPointF point;
+        Kind kind;
+        quint16 layer; // fits in the padding after kind
+        QGraphicsItem *item;
+    };
+
+    SpatialIndex *index;
+    QHash<quint64, std::vector<SnapPoint>> cells;
+    qsizetype pointCount = 0;
+    int modes = ObjectSnaps;
+    qreal gridSpacing = 10.0;
+
+    void Add(QGraphicsItem *item, const ShapeData &shape);
+    void Remove(QGraphicsItem *item, const ShapeData &shape);
+    void Clear();
+
+    void NearestIntersection(const QPointF &point, qreal tolerance, const QSet<QGraphicsItem *> &exclude,
+                             Result &best, qreal &bestDistance) const;
+
+    static quint64 CellKey(const QPointF &point);
+    static int ModeFor(Kind kind);
+    //the fixed snap points of a shape: endpoints, midpoints and centre (a block
+    //instance offers its members')
+    template<typename Visitor>
+    static void ForEachSnapPoint(const ShapeData &shape, Visitor &&visit);
+    static void BlockSnapPoints(const Block &block, const QTransform &placement, std::vector<SnapPoint> &points);
+};
+
+#endif // SNAPENGINE_H
@@ -0,0 +1,597 @@
+#include "spatialindex.h"
+#include "shapeserializer.h"
+#include <algorithm>
+#include <cmath>
+#include <queue>
+
+namespace {
+
+bool Overlaps(const QRectF &a, const QRectF &b)
+{
+    //inclusive test, QRectF::intersects rejects zero-area rects
+    return a.left() <= b.right() && b.left() <= a.right()
+        && a.top() <= b.bottom() && b.top() <= a.bottom();
+}
+
+bool Contains(const QRectF &outer, const QRectF &inner)
+{
+    return outer.left() <= inner.left() && inner.right() <= outer.right()
+        && outer.top() <= inner.top() && inner.bottom() <= outer.bottom();
+}
+
+qreal BoxDistance(const QRectF &box, const QPointF &point)
+{
+    const qreal dx = std::max({ box.left() - point.x(), 0.0, point.x() - box.right() });
+    const qreal dy = std::max({ box.top() - point.y(), 0.0, point.y() - box.bottom() });
+    return std::sqrt(dx * dx + dy * dy);
+}
+
+quint64 HilbertKey(quint32 x, quint32 y)
+{
+    //position along a 2^16 x 2^16 Hilbert curve
+    const quint32 n = 1u << 16;
+    quint64 d = 0;
+    for(quint32 s = n / 2; s > 0; s /= 2){
+        const quint32 rx = (x & s) ? 1 : 0;
+        const quint32 ry = (y & s) ? 1 : 0;
+        d += quint64(s) * s * ((3 * rx) ^ ry);
+        if(ry == 0){
+            if(rx == 1){
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+} // namespace
+
+/*********************** Geometry ***********************/
+qreal SpatialIndex::Distance(const ShapeData &shape, const QPointF &point)
+{
+    switch(shape.type){
+        case ShapeType::Line: {
+            const QPointF a = shape.line.p1();
+            const QPointF ab = shape.line.p2() - a;
+            const qreal length2 = QPointF::dotProduct(ab, ab);
+            qreal t = length2 > 0 ? QPointF::dotProduct(point - a, ab) / length2 : 0.0;
+            t = std::clamp(t, 0.0, 1.0);
+            const QPointF closest = a + ab * t;
+            return std::hypot(point.x() - closest.x(), point.y() - closest.y());
+        }
+        case ShapeType::Rectangle:
+            return BoxDistance(shape.rect.normalized(), point);
+        case ShapeType::Circle: {
+            const QRectF rect = shape.rect.normalized();
+            const qreal a = rect.width() / 2;
+            const qreal b = rect.height() / 2;
+            if(a <= 0 || b <= 0) return BoxDistance(rect, point);
+
+            const QPointF offset = point - rect.center();
+            const qreal u = (offset.x() * offset.x()) / (a * a) + (offset.y() * offset.y()) / (b * b);
+            if(u <= 1.0) return 0.0;
+            //distance along the ray from the centre to the outline
+            return std::hypot(offset.x(), offset.y()) * (1.0 - 1.0 / std::sqrt(u));
+        }
+        case ShapeType::Polyline:
+            return shape.polyline.Distance(point - shape.rect.topLeft());
+        case ShapeType::Block:
+            //instances are picked anywhere inside their rect, like a filled symbol
+            return BoxDistance(shape.rect.normalized(), point);
+    }
+    return 0.0;
+}
+
+/*********************** Building ***********************/
+void SpatialIndex::Clear()
+{
+    //layer states outlive the shapes, the canvas sets them independently
+    for(Partition &partition : partitions){
+        const Layer state = partition.state;
+        partition = Partition();
+        partition.state = state;
+    }
+    itemLayers.clear();
+    nextOrder = 0;
+    ++revision;
+    if(clearedCallback) clearedCallback();
+}
+
+bool SpatialIndex::MakeEntry(QGraphicsItem *item, Entry &entry)
+{
+    if(!ShapeSerializer::FromItem(item, entry.shape)) return false;
+    entry.box = item->sceneBoundingRect();
+    entry.item = item;
+    entry.order = nextOrder++;
+    return true;
+}
+
+void SpatialIndex::Build(const QGraphicsScene *scene)
+{
+    Clear();
+
+    //items() is topmost first, walk it backwards so later entries stack on top
+    const QList<QGraphicsItem *> items = scene->items();
+    std::vector<std::vector<Entry>> entries(partitions.size());
+    for(auto it = items.crbegin(); it != items.crend(); ++it){
+        Entry entry;
+        if(!MakeEntry(*it, entry)) continue;
+        if(addedCallback) addedCallback(entry.item, entry.shape);
+        const quint16 layer = entry.shape.layer;
+        if(layer >= entries.size()) entries.resize(size_t(layer) + 1);
+        itemLayers.insert(entry.item, layer);
+        entries[layer].push_back(entry);
+    }
+    for(size_t layer = 0; layer < entries.size(); ++layer){
+        if(!entries[layer].empty()) Pack(PartitionFor(quint16(layer)), std::move(entries[layer]));
+    }
+}
+
+void SpatialIndex::Pack(Partition &partition, std::vector<Entry> entries)
+{
+    partition.packed.clear();
+    partition.levels.clear();
+    partition.levelCounts.clear();
+    partition.packedSlots.clear();
+    partition.tombstones = 0;
+
+    if(entries.empty()){
+        return;
+    }
+
+    QRectF extent = entries.front().box;
+    for(const Entry &entry : entries) extent = extent.united(entry.box);
+    const qreal sx = extent.width() > 0 ? 65535.0 / extent.width() : 0.0;
+    const qreal sy = extent.height() > 0 ? 65535.0 / extent.height() : 0.0;
+
+    std::vector<std::pair<quint64, qsizetype>> keys(entries.size());
+    for(size_t i = 0; i < entries.size(); ++i){
+        const QPointF c = entries[i].box.center();
+        keys[i] = { HilbertKey(quint32((c.x() - extent.left()) * sx), quint32((c.y() - extent.top()) * sy)),
+                    qsizetype(i) };
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<Entry> &packed = partition.packed;
+    packed.reserve(entries.size());
+    partition.packedSlots.reserve(qsizetype(entries.size()));
+    for(const auto &key : keys){
+        partition.packedSlots.insert(entries[key.second].item, qsizetype(packed.size()));
+        packed.push_back(entries[key.second]);
+    }
+
+    //bottom-up node bounds and entry counts until a single root remains
+    std::vector<QRectF> level;
+    std::vector<qsizetype> counts;
+    for(size_t i = 0; i < packed.size(); i += NodeSize){
+        const size_t last = std::min(packed.size(), i + NodeSize);
+        QRectF box = packed[i].box;
+        for(size_t j = i + 1; j < last; ++j) box = box.united(packed[j].box);
+        level.push_back(box);
+        counts.push_back(qsizetype(last - i));
+    }
+    partition.levels.push_back(std::move(level));
+    partition.levelCounts.push_back(std::move(counts));
+    while(partition.levels.back().size() > 1){
+        const std::vector<QRectF> &below = partition.levels.back();
+        const std::vector<qsizetype> &belowCounts = partition.levelCounts.back();
+        std::vector<QRectF> above;
+        std::vector<qsizetype> aboveCounts;
+        for(size_t i = 0; i < below.size(); i += NodeSize){
+            const size_t last = std::min(below.size(), i + NodeSize);
+            QRectF box = below[i];
+            qsizetype count = belowCounts[i];
+            for(size_t j = i + 1; j < last; ++j){
+                box = box.united(below[j]);
+                count += belowCounts[j];
+            }
+            above.push_back(box);
+            aboveCounts.push_back(count);
+        }
+        partition.levels.push_back(std::move(above));
+        partition.levelCounts.push_back(std::move(aboveCounts));
+    }
+}
+
+void SpatialIndex::MaybeRepack(Partition &partition)
+{
+    if(batchDepth > 0) return; // EndBatch checks once for the whole batch
+
+    const qsizetype live = qsizetype(partition.packed.size()) - partition.tombstones;
+    const qsizetype pendingLimit = std::clamp<qsizetype>(live / 8, 256, MaxPending);
+    if(qsizetype(partition.pending.size()) <= pendingLimit && partition.tombstones <= live / 4){
+        return;
+    }
+
+    std::vector<Entry> entries;
+    entries.reserve(live + partition.pending.size());
+    for(const Entry &entry : partition.packed){
+        if(entry.item) entries.push_back(entry);
+    }
+    entries.insert(entries.end(), partition.pending.begin(), partition.pending.end());
+    partition.pending.clear();
+    partition.pendingSlots.clear();
+    Pack(partition, std::move(entries));
+}
+
+/*********************** Layers ***********************/
+QRectF SpatialIndex::Partition::Bounds() const
+{
+    QRectF bounds = levels.empty() ? QRectF() : levels.back().front();
+    for(const Entry &entry : pending) bounds = bounds.united(entry.box);
+    return bounds;
+}
+
+SpatialIndex::Partition &SpatialIndex::PartitionFor(quint16 layer)
+{
+    if(layer >= partitions.size()){
+        partitions.resize(size_t(layer) + 1);
+        SortLayers();
+    }
+    return partitions[layer];
+}
+
+void SpatialIndex::SortLayers()
+{
+    drawOrder.resize(partitions.size());
+    for(size_t i = 0; i < drawOrder.size(); ++i) drawOrder[i] = quint16(i);
+    std::stable_sort(drawOrder.begin(), drawOrder.end(), [this](quint16 a, quint16 b){
+        return partitions[a].state.z < partitions[b].state.z;
+    });
+}
+
+void SpatialIndex::SetLayers(const QVector<Layer> &layers)
+{
+    if(size_t(layers.size()) > partitions.size()) partitions.resize(size_t(layers.size()));
+
+    QRectF changed;
+    for(size_t i = 0; i < partitions.size(); ++i){
+        Partition &partition = partitions[i];
+        const Layer state = qsizetype(i) < layers.size() ? layers.at(qsizetype(i)) : Layer();
+        //stacking changes what is painted on top too
+        if(state.visible != partition.state.visible || state.z != partition.state.z){
+            changed = changed.united(partition.Bounds());
+        }
+        partition.state = state;
+    }
+    SortLayers();
+    if(!changed.isNull()) NotifyChanged(changed);
+}
+
+bool SpatialIndex::IsLayerVisible(quint16 layer) const
+{
+    return layer >= partitions.size() || partitions[layer].state.visible;
+}
+
+/*********************** Updates ***********************/
+void SpatialIndex::SetChangeCallback(std::function<void(const QRectF &)> callback)
+{
+    changeCallback = std::move(callback);
+}
+
+void SpatialIndex::SetShapeCallbacks(ShapeCallback added, ShapeCallback removed, std::function<void()> cleared)
+{
+    addedCallback = std::move(added);
+    removedCallback = std::move(removed);
+    clearedCallback = std::move(cleared);
+}
+
+void SpatialIndex::NotifyChanged(const QRectF &rect)
+{
+    ++revision;
+    if(batchDepth > 0){
+        batchChanged = batchChanged.united(rect);
+        return;
+    }
+    if(changeCallback) changeCallback(rect);
+}
+
+void SpatialIndex::BeginBatch()
+{
+    ++batchDepth;
+}
+
+void SpatialIndex::EndBatch()
+{
+    if(batchDepth == 0 || --batchDepth > 0) return;
+
+    for(Partition &partition : partitions) MaybeRepack(partition);
+    const QRectF changed = batchChanged;
+    batchChanged = QRectF();
+    if(!changed.isNull() && changeCallback) changeCallback(changed);
+}
+
+void SpatialIndex::Insert(QGraphicsItem *item)
+{
+    if(!item) return;
+    if(itemLayers.contains(item)){
+        Update(item);
+        return;
+    }
+
+    Entry entry;
+    if(!MakeEntry(item, entry)) return;
+    Partition &partition = PartitionFor(entry.shape.layer);
+    itemLayers.insert(item, entry.shape.layer);
+    partition.pendingSlots.insert(item, qsizetype(partition.pending.size()));
+    partition.pending.push_back(entry);
+    if(addedCallback) addedCallback(item, entry.shape);
+    //a shape added to a hidden layer changes nothing on screen
+    if(partition.state.visible) NotifyChanged(entry.box);
+    MaybeRepack(partition);
+}
+
+void SpatialIndex::Remove(QGraphicsItem *item)
+{
+    auto layerIt = itemLayers.find(item);
+    if(layerIt == itemLayers.end()) return;
+    Partition &partition = partitions[layerIt.value()];
+    itemLayers.erase(layerIt);
+
+    auto packedIt = partition.packedSlots.find(item);
+    if(packedIt != partition.packedSlots.end()){
+        Entry &entry = partition.packed[packedIt.value()];
+        if(partition.state.visible) NotifyChanged(entry.box);
+        if(removedCallback) removedCallback(item, entry.shape);
+        entry.item = nullptr;
+        partition.packedSlots.erase(packedIt);
+        ++partition.tombstones;
+        MaybeRepack(partition);
+        return;
+    }
+
+    auto pendingIt = partition.pendingSlots.find(item);
+    if(pendingIt != partition.pendingSlots.end()){
+        //swap-remove, the overflow list is unordered
+        std::vector<Entry> &pending = partition.pending;
+        const qsizetype slot = pendingIt.value();
+        if(partition.state.visible) NotifyChanged(pending[slot].box);
+        if(removedCallback) removedCallback(item, pending[slot].shape);
+        partition.pendingSlots.erase(pendingIt);
+        if(slot != qsizetype(pending.size()) - 1){
+            pending[slot] = pending.back();
+            partition.pendingSlots[pending[slot].item] = slot;
+        }
+        pending.pop_back();
+    }
+}
+
+void SpatialIndex::Update(QGraphicsItem *item)
+{
+    //an item that was already indexed keeps its stacking order, also when it
+    //moves to another layer
+    quint64 order = nextOrder;
+    if(itemLayers.contains(item)){
+        const Partition &old = partitions[itemLayers.value(item)];
+        if(old.packedSlots.contains(item)) order = old.packed[old.packedSlots.value(item)].order;
+        else if(old.pendingSlots.contains(item)) order = old.pending[old.pendingSlots.value(item)].order;
+    }
+
+    Remove(item);
+
+    Entry entry;
+    if(!MakeEntry(item, entry)) return;
+    entry.order = order;
+    Partition &partition = PartitionFor(entry.shape.layer);
+    itemLayers.insert(item, entry.shape.layer);
+    partition.pendingSlots.insert(item, qsizetype(partition.pending.size()));
+    partition.pending.push_back(entry);
+    if(addedCallback) addedCallback(item, entry.shape);
+    if(partition.state.visible) NotifyChanged(entry.box);
+    MaybeRepack(partition);
+}
+
+/*********************** Queries ***********************/
+template<typename Visitor>
+void SpatialIndex::VisitNode(const Partition &partition, int level, qsizetype node, const QRectF &rect, Visitor &visit)
+{
+    const qsizetype first = node * NodeSize;
+    if(level == 0){
+        const qsizetype last = std::min<qsizetype>(first + NodeSize, partition.packed.size());
+        for(qsizetype i = first; i < last; ++i){
+            const Entry &entry = partition.packed[i];
+            if(entry.item && Overlaps(entry.box, rect)) visit(partition, entry);
+        }
+        return;
+    }
+
+    const std::vector<QRectF> &children = partition.levels[level - 1];
+    const qsizetype last = std::min<qsizetype>(first + NodeSize, children.size());
+    for(qsizetype i = first; i < last; ++i){
+        if(Overlaps(children[i], rect)) VisitNode(partition, level - 1, i, rect, visit);
+    }
+}
+
+template<typename Visitor>
+void SpatialIndex::VisitPacked(const QRectF &rect, Scope scope, Visitor &&visit) const
+{
+    for(quint16 layer : drawOrder){
+        const Partition &partition = partitions[layer];
+        if(!partition.state.visible || (scope == Scope::Pickable && partition.state.locked)) continue;
+
+        if(!partition.levels.empty()){
+            const std::vector<QRectF> &roots = partition.levels.back();
+            const int top = int(partition.levels.size()) - 1;
+            for(qsizetype i = 0; i < qsizetype(roots.size()); ++i){
+                if(Overlaps(roots[i], rect)) VisitNode(partition, top, i, rect, visit);
+            }
+        }
+        for(const Entry &entry : partition.pending){
+            if(Overlaps(entry.box, rect)) visit(partition, entry);
+        }
+    }
+}
+
+QGraphicsItem *SpatialIndex::Nearest(const QPointF &point, qreal tolerance) const
+{
+    const QRectF probe(point.x() - tolerance, point.y() - tolerance, 2 * tolerance, 2 * tolerance);
+    const Entry *best = nullptr;
+    int bestZ = 0;
+    qreal bestDistance = tolerance;
+
+    VisitPacked(probe, Scope::Pickable, [&](const Partition &partition, const Entry &entry){
+        const qreal distance = Distance(entry.shape, point);
+        if(distance > tolerance) return;
+        const int z = partition.state.z;
+        if(!best || distance < bestDistance
+           || (distance == bestDistance && (z > bestZ || (z == bestZ && entry.order > best->order)))){
+            best = &entry;
+            bestZ = z;
+            bestDistance = distance;
+        }
+    });
+    return best ? best->item : nullptr;
+}
+
+QList<QGraphicsItem *> SpatialIndex::Window(const QRectF &rect) const
+{
+    const QRectF area = rect.normalized();
+    QList<QGraphicsItem *> result;
+    VisitPacked(area, Scope::Pickable, [&](const Partition &, const Entry &entry){
+        if(Contains(area, entry.box)) result.append(entry.item);
+    });
+    return result;
+}
+
+QList<QGraphicsItem *> SpatialIndex::Crossing(const QRectF &rect, Scope scope) const
+{
+    QList<QGraphicsItem *> result;
+    VisitPacked(rect.normalized(), scope, [&](const Partition &, const Entry &entry){
+        result.append(entry.item);
+    });
+    return result;
+}
+
+QVector<ShapeData> SpatialIndex::CrossingShapes(const QRectF &rect) const
+{
+    QVector<ShapeData> result;
+    VisitPacked(rect.normalized(), Scope::Visible, [&](const Partition &, const Entry &entry){
+        result.append(entry.shape);
+    });
+    return result;
+}
+
+void SpatialIndex::VisitLodNode(const Partition &partition, int level, qsizetype node, const QRectF &rect, qreal minSize,
+                                QVector<ShapeData> &shapes, QVector<LodCluster> &clusters)
+{
+    const qsizetype first = node * NodeSize;
+    auto addEntry = [&](const Entry &entry){
+        if(std::max(entry.box.width(), entry.box.height()) < minSize) clusters.append({ entry.box, 1 });
+        else shapes.append(entry.shape);
+    };
+
+    if(level == 0){
+        const qsizetype last = std::min<qsizetype>(first + NodeSize, partition.packed.size());
+        for(qsizetype i = first; i < last; ++i){
+            const Entry &entry = partition.packed[i];
+            if(entry.item && Overlaps(entry.box, rect)) addEntry(entry);
+        }
+        return;
+    }
+
+    const std::vector<QRectF> &children = partition.levels[level - 1];
+    const qsizetype last = std::min<qsizetype>(first + NodeSize, children.size());
+    for(qsizetype i = first; i < last; ++i){
+        const QRectF &box = children[i];
+        if(!Overlaps(box, rect)) continue;
+        //a node smaller than the detail threshold is drawn as one cluster, the
+        //tree levels act as precomputed simplifications for each zoom band
+        if(std::max(box.width(), box.height()) < minSize) clusters.append({ box, partition.levelCounts[level - 1][i] });
+        else VisitLodNode(partition, level - 1, i, rect, minSize, shapes, clusters);
+    }
+}
+
+void SpatialIndex::CrossingLod(const QRectF &rect, qreal minSize, QVector<ShapeData> &shapes, QVector<LodCluster> &clusters) const
+{
+    const QRectF area = rect.normalized();
+    for(quint16 layer : drawOrder){
+        const Partition &partition = partitions[layer];
+        if(!partition.state.visible) continue;
+
+        if(!partition.levels.empty()){
+            const int top = int(partition.levels.size()) - 1;
+            for(qsizetype i = 0; i < qsizetype(partition.levels[top].size()); ++i){
+                const QRectF &box = partition.levels[top][i];
+                if(!Overlaps(box, area)) continue;
+                if(std::max(box.width(), box.height()) < minSize) clusters.append({ box, partition.levelCounts[top][i] });
+                else VisitLodNode(partition, top, i, area, minSize, shapes, clusters);
+            }
+        }
+        for(const Entry &entry : partition.pending){
+            if(!Overlaps(entry.box, area)) continue;
+            if(std::max(entry.box.width(), entry.box.height()) < minSize) clusters.append({ entry.box, 1 });
+            else shapes.append(entry.shape);
+        }
+    }
+}
+
+QList<QGraphicsItem *> SpatialIndex::KNearest(const QPointF &point, int k) const
+{
+    //best-first search: nodes are ordered by the distance to their bounds,
+    //entries by the distance to their outline, so entries pop in final order
+    struct Candidate{
+        qreal distance;
+        int level;         // -1 for an entry
+        qsizetype index;   // node index, or entry index
+        const Partition *partition;
+        const Entry *entry;
+        bool operator>(const Candidate &other) const { return distance > other.distance; }
+    };
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> queue;
+
+    for(const Partition &partition : partitions){
+        if(!partition.state.visible || partition.state.locked) continue;
+        if(!partition.levels.empty()){
+            const int top = int(partition.levels.size()) - 1;
+            for(qsizetype i = 0; i < qsizetype(partition.levels[top].size()); ++i){
+                queue.push({ BoxDistance(partition.levels[top][i], point), top, i, &partition, nullptr });
+            }
+        }
+        for(const Entry &entry : partition.pending){
+            queue.push({ Distance(entry.shape, point), -1, 0, &partition, &entry });
+        }
+    }
+
+    QList<QGraphicsItem *> result;
+    while(!queue.empty() && result.size() < k){
+        const Candidate candidate = queue.top();
+        queue.pop();
+
+        if(candidate.level < 0){
+            result.append(candidate.entry->item);
+            continue;
+        }
+
+        const Partition &partition = *candidate.partition;
+        const qsizetype first = candidate.index * NodeSize;
+        if(candidate.level == 0){
+            const qsizetype last = std::min<qsizetype>(first + NodeSize, partition.packed.size());
+            for(qsizetype i = first; i < last; ++i){
+                const Entry &entry = partition.packed[i];
+                if(entry.item) queue.push({ Distance(entry.shape, point), -1, i, &partition, &entry });
+            }
+        }
+        else{
+            const std::vector<QRectF> &children = partition.levels[candidate.level - 1];
+            const qsizetype last = std::min<qsizetype>(first + NodeSize, children.size());
+            for(qsizetype i = first; i < last; ++i){
+                queue.push({ BoxDistance(children[i], point), candidate.level - 1, i, &partition, nullptr });
+            }
+        }
+    }
+    return result;
+}
+
+qsizetype SpatialIndex::Size() const
+{
+    return itemLayers.size();
+}
+
+int SpatialIndex::Depth() const
+{
+    size_t depth = 0;
+    for(const Partition &partition : partitions) depth = std::max(depth, partition.levels.size());
+    return int(depth);
+}
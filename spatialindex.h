@@ -0,0 +1,144 @@
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include <QGraphicsScene>
+#include <QGraphicsItem>
+#include <QHash>
+#include <QList>
+#include <QRectF>
+#include <QVector>
+#include <functional>
+#include <vector>
+#include "Entity.h"
+
+//Spatial index over the shapes of a scene, used for hit-testing and region queries.
+//
+//The bulk of the shapes live in a packed Hilbert R-tree: entries sorted by the
+//Hilbert key of their centre and grouped NodeSize at a time, level by level.
+//Shapes added or changed after the last pack go to a small unsorted overflow list
+//and removed ones are tombstoned; once either grows past a fraction of the tree
+//(MaxPending at most for the overflow list) everything is repacked, so updates stay
+//cheap and queries stay logarithmic.
+//
+//Each layer has its own tree and overflow list. Queries walk the layers bottom to
+//top and skip hidden ones with a single check, so a hidden layer costs nothing when
+//painting or hit-testing whatever its size.
+class SpatialIndex
+{
+public:
+    //which layers a query looks at: hidden layers are never visited, locked layers
+    //are drawn and snapped to but can't be picked
+    enum class Scope { Pickable, Visible };
+
+    //most shapes one layer's overflow list holds before it is repacked; every query
+    //scans the list, so it stays short however large the tree is
+    static constexpr qsizetype MaxPending = 4096;
+
+    void Clear();
+    void Build(const QGraphicsScene *scene);
+
+    //kept up to date by the commands in commands.cpp
+    void Insert(QGraphicsItem *item);
+    void Remove(QGraphicsItem *item);
+    void Update(QGraphicsItem *item);
+
+    //visibility, lock and stacking of each layer index; shapes on layers past the end
+    //of the table count as visible and unlocked at z 0. Reports the area of layers
+    //whose visibility changed through the change callback.
+    void SetLayers(const QVector<Layer> &layers);
+    bool IsLayerVisible(quint16 layer) const;
+
+    //closest pickable shape outline within tolerance (scene units), topmost wins ties
+    QGraphicsItem *Nearest(const QPointF &point, qreal tolerance) const;
+    //pickable shapes whose bounds lie entirely inside rect
+    QList<QGraphicsItem *> Window(const QRectF &rect) const;
+    //shapes whose bounds touch rect
+    QList<QGraphicsItem *> Crossing(const QRectF &rect, Scope scope = Scope::Pickable) const;
+    //k closest pickable shapes ordered by distance
+    QList<QGraphicsItem *> KNearest(const QPointF &point, int k) const;
+    //geometry of the visible shapes touching rect, bottom layer first, a thread-safe
+    //copy for background rendering
+    QVector<ShapeData> CrossingShapes(const QRectF &rect) const;
+    //level-of-detail variant: tree nodes and shapes smaller than minSize (scene units)
+    //come back as density clusters instead of being expanded, so the result size is
+    //bounded by the area of rect at that detail rather than by the shape count
+    void CrossingLod(const QRectF &rect, qreal minSize, QVector<ShapeData> &shapes, QVector<LodCluster> &clusters) const;
+
+    //called with the scene area an Insert, Remove or Update touched
+    void SetChangeCallback(std::function<void(const QRectF &)> callback);
+
+    //called for each shape entering or leaving the index, and when it is emptied
+    //(Build reports cleared, then every shape), so derived indexes can follow along
+    using ShapeCallback = std::function<void(QGraphicsItem *, const ShapeData &)>;
+    void SetShapeCallbacks(ShapeCallback added, ShapeCallback removed, std::function<void()> cleared);
+
+    //between BeginBatch and EndBatch changes are collected: the callback fires once
+    //with their union and the repack check runs once at the end (calls nest)
+    void BeginBatch();
+    void EndBatch();
+
+    //all indexed shapes, hidden layers included
+    qsizetype Size() const;
+    //deepest layer tree
+    int Depth() const;
+    //bumped whenever what the visible layers show may have changed, so callers can
+    //cache query results
+    quint64 Revision() const { return revision; }
+
+    //distance from point to the shape outline, 0 inside closed shapes (matches itemAt)
+    static qreal Distance(const ShapeData &shape, const QPointF &point);
+
+private:
+    static constexpr int NodeSize = 16;
+
+    struct Entry{
+        QRectF box;
+        ShapeData shape;
+        QGraphicsItem *item = nullptr; // nullptr marks a tombstone
+        quint64 order = 0;             // insertion order, higher is on top
+    };
+
+    //the tree of one layer
+    struct Partition{
+        std::vector<Entry> packed;
+        std::vector<std::vector<QRectF>> levels; // levels[0] bounds NodeSize packed entries each
+        std::vector<std::vector<qsizetype>> levelCounts; // entries below each node, for LOD clusters
+        QHash<QGraphicsItem *, qsizetype> packedSlots;
+        qsizetype tombstones = 0;
+
+        std::vector<Entry> pending;
+        QHash<QGraphicsItem *, qsizetype> pendingSlots;
+
+        Layer state;
+        QRectF Bounds() const;
+    };
+
+    std::vector<Partition> partitions;         // by layer index, grown as layers are used
+    std::vector<quint16> drawOrder;            // partition indexes bottom to top
+    QHash<QGraphicsItem *, quint16> itemLayers; // which partition holds an item
+    quint64 nextOrder = 0;
+    quint64 revision = 0;
+    std::function<void(const QRectF &)> changeCallback;
+    ShapeCallback addedCallback;
+    ShapeCallback removedCallback;
+    std::function<void()> clearedCallback;
+    int batchDepth = 0;
+    QRectF batchChanged;
+
+    void NotifyChanged(const QRectF &rect);
+    bool MakeEntry(QGraphicsItem *item, Entry &entry);
+    Partition &PartitionFor(quint16 layer);
+    void SortLayers();
+    static void Pack(Partition &partition, std::vector<Entry> entries);
+    void MaybeRepack(Partition &partition);
+
+    //calls visit(partition, entry) for the entries touching rect, layer by layer
+    template<typename Visitor>
+    void VisitPacked(const QRectF &rect, Scope scope, Visitor &&visit) const;
+    template<typename Visitor>
+    static void VisitNode(const Partition &partition, int level, qsizetype node, const QRectF &rect, Visitor &visit);
+    static void VisitLodNode(const Partition &partition, int level, qsizetype node, const QRectF &rect, qreal minSize,
+                             QVector<ShapeData> &shapes, QVector<LodCluster> &clusters);
+};
+
+#endif // SPATIALINDEX_H
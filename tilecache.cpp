@@ -0,0 +1,249 @@
+#include "tilecache.h"
+#include "shaperenderer.h"
+#include "profiler.h"
+#include <QThread>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+//scene-space margin so strokes crossing a tile edge are drawn on both sides
+constexpr qreal StrokePadding = 2.0;
+
+//how far to look for a substitute while a tile is being rendered
+constexpr int CoarserFallbackLevels = 8;
+constexpr int FinerFallbackLevels = 4;
+
+quint64 NextGeneration()
+{
+    static quint64 counter = 0; // GUI thread only
+    return ++counter;
+}
+
+} // namespace
+
+TileCache::TileCache(const SpatialIndex *index, QObject *parent)
+    : QObject(parent)
+    , index(index)
+{
+    //leave a core for the GUI thread
+    pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() - 1));
+}
+
+TileCache::~TileCache()
+{
+    pool.clear();
+    pool.waitForDone();
+}
+
+/*********************** Levels & Tiles ***********************/
+int TileCache::LevelForScale(qreal scale)
+{
+    return qRound(4.0 * std::log2(scale));
+}
+
+qreal TileCache::ScaleForLevel(int level)
+{
+    return std::pow(2.0, level / 4.0);
+}
+
+QRectF TileCache::TileSceneRect(const TileKey &key)
+{
+    const qreal size = TileSize / ScaleForLevel(key.level);
+    return QRectF(key.x * size, key.y * size, size, size);
+}
+
+/*********************** Painting ***********************/
+void TileCache::Paint(QPainter *painter, const QTransform &viewTransform, const QRect &exposed)
+{
+    ++frame;
+    const int level = LevelForScale(viewTransform.m11());
+    const qreal levelScale = ScaleForLevel(level);
+    const QRectF sceneArea = viewTransform.inverted().mapRect(QRectF(exposed));
+
+    const int x0 = int(std::floor(sceneArea.left() * levelScale / TileSize));
+    const int x1 = int(std::floor(sceneArea.right() * levelScale / TileSize));
+    const int y0 = int(std::floor(sceneArea.top() * levelScale / TileSize));
+    const int y1 = int(std::floor(sceneArea.bottom() * levelScale / TileSize));
+
+    painter->save();
+    painter->setClipRect(exposed);
+
+    for(int y = y0; y <= y1; ++y){
+        for(int x = x0; x <= x1; ++x){
+            const TileKey key{ level, x, y };
+            const QRectF tileRect = TileSceneRect(key);
+            const QRectF target = viewTransform.mapRect(tileRect);
+
+            Tile &tile = tiles[key];
+            tile.lastUsed = frame;
+
+            if(!tile.image.isNull() && !tile.dirty){
+                painter->drawImage(target, tile.image);
+                continue;
+            }
+            if(!tile.pending){
+                Request(key, tile);
+            }
+
+            if(tile.dirty){
+                //an edit touched this tile, draw its shapes directly until the new image lands
+                QVector<ShapeData> shapes;
+                QVector<LodCluster> clusters;
+                index->CrossingLod(tileRect.adjusted(-StrokePadding, -StrokePadding, StrokePadding, StrokePadding),
+                                   ShapeRenderer::LodPixelThreshold / viewTransform.m11(), shapes, clusters);
+                painter->save();
+                painter->setTransform(viewTransform);
+                painter->setClipRect(tileRect, Qt::IntersectClip);
+                ShapeRenderer::PaintLod(painter, shapes, clusters, viewTransform.m11());
+                painter->restore();
+            }
+            else{
+                PaintFallback(painter, key, target);
+            }
+        }
+    }
+
+    painter->restore();
+    Evict();
+}
+
+bool TileCache::PaintFallback(QPainter *painter, const TileKey &key, const QRectF &target)
+{
+    const QRectF tileRect = TileSceneRect(key);
+    const qreal viewScale = target.width() / tileRect.width();
+
+    auto tryLevel = [&](int level){
+        const qreal levelScale = ScaleForLevel(level);
+        const int x0 = int(std::floor(tileRect.left() * levelScale / TileSize));
+        const int x1 = int(std::floor((tileRect.right() - 1e-9) * levelScale / TileSize));
+        const int y0 = int(std::floor(tileRect.top() * levelScale / TileSize));
+        const int y1 = int(std::floor((tileRect.bottom() - 1e-9) * levelScale / TileSize));
+
+        //only use a level that covers the whole tile, a patchwork looks worse than a blank
+        for(int y = y0; y <= y1; ++y){
+            for(int x = x0; x <= x1; ++x){
+                auto it = tiles.constFind(TileKey{ level, x, y });
+                if(it == tiles.constEnd() || it->image.isNull() || it->dirty) return false;
+            }
+        }
+
+        painter->save();
+        painter->setClipRect(target, Qt::IntersectClip);
+        painter->setRenderHint(QPainter::SmoothPixmapTransform);
+        for(int y = y0; y <= y1; ++y){
+            for(int x = x0; x <= x1; ++x){
+                const TileKey other{ level, x, y };
+                const QRectF otherRect = TileSceneRect(other);
+                const QRectF otherTarget(target.topLeft() + (otherRect.topLeft() - tileRect.topLeft()) * viewScale,
+                                         otherRect.size() * viewScale);
+                painter->drawImage(otherTarget, tiles.value(other).image);
+            }
+        }
+        painter->restore();
+        return true;
+    };
+
+    for(int step = 1; step <= CoarserFallbackLevels; ++step){
+        if(tryLevel(key.level - step)) return true;
+    }
+    for(int step = 1; step <= FinerFallbackLevels; ++step){
+        if(tryLevel(key.level + step)) return true;
+    }
+    return false;
+}
+
+/*********************** Rendering ***********************/
+void TileCache::Request(const TileKey &key, Tile &tile)
+{
+    tile.pending = true;
+    tile.generation = NextGeneration();
+
+    const quint64 generation = tile.generation;
+    const qreal levelScale = ScaleForLevel(key.level);
+    const QRectF area = TileSceneRect(key).adjusted(-StrokePadding, -StrokePadding, StrokePadding, StrokePadding);
+    //the zoom band decides how far the index is expanded, so a zoomed-out tile
+    //costs about as much as a zoomed-in one
+    QVector<ShapeData> shapes;
+    QVector<LodCluster> clusters;
+    index->CrossingLod(area, ShapeRenderer::LodPixelThreshold / levelScale, shapes, clusters);
+
+    CAD_COUNT("tile-requests", 1);
+    pool.start([this, key, generation, levelScale, shapes, clusters]{
+        CAD_PROFILE_SCOPE("RenderTile");
+        QImage image(TileSize, TileSize, QImage::Format_ARGB32_Premultiplied);
+        image.fill(Qt::transparent);
+
+        QPainter painter(&image);
+        painter.translate(-key.x * TileSize, -key.y * TileSize);
+        painter.scale(levelScale, levelScale);
+        ShapeRenderer::PaintLod(&painter, shapes, clusters, levelScale);
+        painter.end();
+
+        //hand the image back to the thread that owns the cache
+        QMetaObject::invokeMethod(this, [this, key, generation, image]{ Store(key, generation, image); },
+                                  Qt::QueuedConnection);
+    });
+}
+
+void TileCache::Store(const TileKey &key, quint64 generation, const QImage &image)
+{
+    auto it = tiles.find(key);
+    if(it == tiles.end()) return; // evicted or cleared meanwhile
+
+    if(it->generation != generation){
+        return; // invalidated while rendering, a newer request owns the tile
+    }
+    it->image = image;
+    it->dirty = false;
+    it->pending = false;
+    emit tilesUpdated();
+}
+
+/*********************** Invalidation ***********************/
+void TileCache::Invalidate(const QRectF &sceneRect)
+{
+    const QRectF area = sceneRect.adjusted(-StrokePadding, -StrokePadding, StrokePadding, StrokePadding);
+    bool touched = false;
+
+    for(auto it = tiles.begin(); it != tiles.end(); ++it){
+        if(!TileSceneRect(it.key()).intersects(area)) continue;
+        it->dirty = !it->image.isNull();
+        it->pending = false;
+        it->generation = 0; // results of in-flight renders are dropped
+        touched = true;
+    }
+    if(touched) emit tilesUpdated();
+}
+
+void TileCache::Clear()
+{
+    pool.clear(); // drop renders that have not started yet
+    tiles.clear();
+}
+
+void TileCache::SetMemoryBudget(qint64 bytes)
+{
+    memoryBudget = bytes;
+    Evict();
+}
+
+void TileCache::Evict()
+{
+    const qint64 tileBytes = qint64(TileSize) * TileSize * 4;
+    const qint64 maxTiles = qMax<qint64>(16, memoryBudget / tileBytes);
+    if(tiles.size() <= maxTiles) return;
+
+    //least recently painted first, never the tiles of the current frame
+    std::vector<std::pair<quint64, TileKey>> order;
+    order.reserve(tiles.size());
+    for(auto it = tiles.cbegin(); it != tiles.cend(); ++it){
+        if(it->lastUsed != frame) order.push_back({ it->lastUsed, it.key() });
+    }
+    std::sort(order.begin(), order.end(), [](const auto &a, const auto &b){ return a.first < b.first; });
+
+    for(const auto &entry : order){
+        if(tiles.size() <= maxTiles) break;
+        tiles.remove(entry.second);
+    }
+}
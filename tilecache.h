@@ -0,0 +1,76 @@
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+#include <QObject>
+#include <QHash>
+#include <QImage>
+#include <QPainter>
+#include <QThreadPool>
+#include <QTransform>
+#include "spatialindex.h"
+
+//Raster cache for the committed shapes of a drawing.
+//
+//Tiles are TileSize pixels square and keyed by zoom level and tile coordinate.
+//A zoom level is a quarter of an octave (level = round(4 * log2(scale))), so small
+//zoom steps reuse the same tiles scaled slightly. Tiles are rendered into QImages
+//on a thread pool from geometry copied out of the SpatialIndex, so the workers
+//never touch scene items. Edits invalidate only the tiles they touch; until a tile
+//is refreshed its shapes are painted directly, and tiles that were never rendered
+//show a scaled copy from a coarser level while the exact one streams in.
+//Tiles are drawn with ShapeRenderer::PaintLod, so shapes below a few pixels at the
+//tile's zoom band are merged into density cells.
+class TileCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    static constexpr int TileSize = 256;
+
+    explicit TileCache(const SpatialIndex *index, QObject *parent = nullptr);
+    ~TileCache();
+
+    //paints the exposed part of the viewport, requesting any tiles that are missing
+    void Paint(QPainter *painter, const QTransform &viewTransform, const QRect &exposed);
+
+    void Invalidate(const QRectF &sceneRect);
+    void Clear();
+    void SetMemoryBudget(qint64 bytes);
+
+    static int LevelForScale(qreal scale);
+    static qreal ScaleForLevel(int level);
+
+signals:
+    void tilesUpdated();
+
+private:
+    struct TileKey{
+        int level;
+        int x;
+        int y;
+        bool operator==(const TileKey &other) const { return level == other.level && x == other.x && y == other.y; }
+    };
+    friend size_t qHash(const TileKey &key, size_t seed) { return qHashMulti(seed, key.level, key.x, key.y); }
+
+    struct Tile{
+        QImage image;
+        bool dirty = false;   // image is stale, shapes are painted live until it is redone
+        bool pending = false; // a render job is in flight
+        quint64 generation = 0;
+        quint64 lastUsed = 0;
+    };
+
+    const SpatialIndex *index;
+    QHash<TileKey, Tile> tiles;
+    QThreadPool pool;
+    qint64 memoryBudget = 256 * 1024 * 1024;
+    quint64 frame = 0;
+
+    static QRectF TileSceneRect(const TileKey &key);
+    void Request(const TileKey &key, Tile &tile);
+    void Store(const TileKey &key, quint64 generation, const QImage &image);
+    bool PaintFallback(QPainter *painter, const TileKey &key, const QRectF &target);
+    void Evict();
+};
+
+#endif // TILECACHE_H
@@ -0,0 +1,148 @@
+#include "undohistory.h"
+#include "commands.h"
+#include "editjournal.h"
+#include "shapeserializer.h"
+#include <vector>
+
+namespace {
+
+//QUndoCommand's private data and text, charged to commands that don't report a cost
+constexpr qint64 GenericCommandCost = 256;
+
+} // namespace
+
+UndoHistory::~UndoHistory()
+{
+    Clear();
+}
+
+qint64 UndoHistory::CostOf(const QUndoCommand *command)
+{
+    if(auto *cadCommand = dynamic_cast<const CadCommand *>(command)){
+        return cadCommand->MemoryCost();
+    }
+    return GenericCommandCost;
+}
+
+/*********************** Stack ***********************/
+void UndoHistory::Push(QUndoCommand *command)
+{
+    std::unique_ptr<QUndoCommand> owned(command);
+    DropRedoBranch();
+    if(pushCallback){
+        if(auto *cadCommand = dynamic_cast<CadCommand *>(owned.get())) pushCallback(cadCommand->AffectedItems());
+    }
+    Execute(owned.get(), true);
+
+    //same rule as QUndoStack: a mergeable command folds into the one below it
+    if(!commands.empty() && owned->id() != -1){
+        Record &top = commands.back();
+        if(top.command->id() == owned->id() && top.command->mergeWith(owned.get())){
+            Recharge(top);
+            return;
+        }
+    }
+
+    const qint64 cost = CostOf(owned.get());
+    commands.push_back(Record{ std::move(owned), cost });
+    memoryUsed += cost;
+    index = commands.size();
+    Trim();
+}
+
+void UndoHistory::Undo()
+{
+    if(!CanUndo()) return;
+    Record &record = commands[--index];
+    Execute(record.command.get(), false);
+    Recharge(record);
+}
+
+void UndoHistory::Redo()
+{
+    if(!CanRedo()) return;
+    Record &record = commands[index++];
+    Execute(record.command.get(), true);
+    Recharge(record);
+}
+
+void UndoHistory::Clear()
+{
+    //newest first, so commands are destroyed in the reverse order they were made
+    while(!commands.empty()){
+        commands.pop_back();
+    }
+    index = 0;
+    memoryUsed = 0;
+}
+
+/*********************** Journal ***********************/
+void UndoHistory::Execute(QUndoCommand *command, bool redo)
+{
+    auto *cadCommand = journal ? dynamic_cast<CadCommand *>(command) : nullptr;
+    if(!cadCommand){
+        redo ? command->redo() : command->undo();
+        return;
+    }
+
+    //diff the touched shapes around the command, so every command journals the
+    //same way and the records carry the exact geometry on both sides
+    const QVector<QGraphicsItem *> items = cadCommand->AffectedItems();
+    QVector<ShapeData> before(items.size());
+    std::vector<bool> present(items.size());
+    for(qsizetype i = 0; i < items.size(); ++i){
+        present[i] = items.at(i)->scene() && ShapeSerializer::FromItem(items.at(i), before[i]);
+    }
+
+    redo ? command->redo() : command->undo();
+
+    for(qsizetype i = 0; i < items.size(); ++i){
+        ShapeData after;
+        const bool now = items.at(i)->scene() && ShapeSerializer::FromItem(items.at(i), after);
+        if(!present[i] && now){
+            journal->RecordAdd(after);
+        }
+        else if(present[i] && !now){
+            journal->RecordRemove(before.at(i));
+        }
+        else if(present[i] && now && (after.type != before.at(i).type || after.line != before.at(i).line
+                                      || after.rect != before.at(i).rect || after.layer != before.at(i).layer)){
+            journal->RecordModify(before.at(i), after);
+        }
+    }
+}
+
+/*********************** Budget ***********************/
+void UndoHistory::SetMemoryBudget(qint64 bytes)
+{
+    memoryBudget = bytes;
+    Trim();
+}
+
+//add and delete commands own their items in one state only, so a command's cost
+//changes with every undo and redo as well as when it merges
+void UndoHistory::Recharge(Record &record)
+{
+    memoryUsed -= record.cost;
+    record.cost = CostOf(record.command.get());
+    memoryUsed += record.cost;
+    Trim();
+}
+
+void UndoHistory::DropRedoBranch()
+{
+    while(commands.size() > index){
+        memoryUsed -= commands.back().cost;
+        commands.pop_back();
+    }
+}
+
+void UndoHistory::Trim()
+{
+    //the newest command is always kept, even when it alone is over budget
+    while(memoryUsed > memoryBudget && index > 1){
+        memoryUsed -= commands.front().cost;
+        commands.pop_front();
+        --index;
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef UNDOHISTORY_H
+#define UNDOHISTORY_H
+
+#include <QUndoCommand>
+#include <QGraphicsItem>
+#include <QVector>
+#include <deque>
+#include <functional>
+#include <memory>
+
+class EditJournal;
+
+//Undo history bounded by memory instead of by command count.
+//
+//Works like QUndoStack (push runs redo(), commands with the same id() are offered
+//to mergeWith()), but every command is charged its MemoryCost() and the oldest
+//commands are dropped once the total exceeds the budget. A single bulk edit can't
+//pin gigabytes, and many small edits keep a long history.
+class UndoHistory
+{
+public:
+    static constexpr qint64 DefaultMemoryBudget = 64ll * 1024 * 1024;
+
+    UndoHistory() = default;
+    ~UndoHistory();
+    UndoHistory(const UndoHistory &) = delete;
+    UndoHistory &operator=(const UndoHistory &) = delete;
+
+    void Push(QUndoCommand *command);
+    void Undo();
+    void Redo();
+    void Clear();
+
+    bool CanUndo() const { return index > 0; }
+    bool CanRedo() const { return index < commands.size(); }
+    size_t Count() const { return commands.size(); }
+
+    void SetMemoryBudget(qint64 bytes);
+    qint64 MemoryBudget() const { return memoryBudget; }
+    qint64 MemoryUsed() const { return memoryUsed; }
+
+    //every executed redo/undo is also written to the journal as shape-level changes
+    void SetJournal(EditJournal *journal) { this->journal = journal; }
+
+    //told the shapes of every pushed CadCommand, which it refers to from then on;
+    //the viewport pager keeps their pages loaded
+    using PushCallback = std::function<void(const QVector<QGraphicsItem *> &items)>;
+    void SetPushCallback(PushCallback callback) { pushCallback = std::move(callback); }
+
+    //bytes a command holds on to, CadCommand::MemoryCost() or a flat estimate
+    static qint64 CostOf(const QUndoCommand *command);
+
+private:
+    struct Record{
+        std::unique_ptr<QUndoCommand> command;
+        qint64 cost = 0;
+    };
+
+    std::deque<Record> commands;
+    size_t index = 0; // commands below index are done
+    qint64 memoryBudget = DefaultMemoryBudget;
+    qint64 memoryUsed = 0;
+    EditJournal *journal = nullptr;
+    PushCallback pushCallback;
+
+    void Execute(QUndoCommand *command, bool redo);
+    void Recharge(Record &record);
+    void DropRedoBranch();
+    void Trim();
+};
+
+#endif // UNDOHISTORY_H
@@ -0,0 +1,280 @@
+#include "viewportpager.h"
+#include "profiler.h"
+#include "shapeserializer.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+//distance from a point to a rect, 0 inside it
+qreal DistanceTo(const QRectF &rect, const QPointF &point)
+{
+    const qreal dx = qMax<qreal>(0, qMax(rect.left() - point.x(), point.x() - rect.right()));
+    const qreal dy = qMax<qreal>(0, qMax(rect.top() - point.y(), point.y() - rect.bottom()));
+    return std::hypot(dx, dy);
+}
+
+} // namespace
+
+ViewportPager::ViewportPager(ShapeScene *scene, SpatialIndex *index, QObject *parent)
+    : QObject(parent)
+    , scene(scene)
+    , index(index)
+{
+    //decoding is mostly memory bound, two readers keep ahead of a pan
+    pool.setMaxThreadCount(2);
+}
+
+ViewportPager::~ViewportPager()
+{
+    //the items go with the scene, only the readers need stopping
+    pool.clear();
+    pool.waitForDone();
+}
+
+/*********************** Document ***********************/
+bool ViewportPager::Open(const QString &filePath)
+{
+    Close();
+    if(!document.Open(filePath)) return false;
+    pageSlots = QVector<PageSlot>(document.Pages().size());
+    open = true;
+    return true;
+}
+
+void ViewportPager::Close()
+{
+    if(!IsOpen()) return;
+    CancelLoads();
+    emit closing();
+
+    index->Clear();
+    ShapeScene::ClearShapes(scene);
+    document.Close();
+    pageSlots.clear();
+    pageOfItem.clear();
+    open = false;
+    loadedPages = 0;
+    memoryUsed = 0;
+    lastVisible = QRectF();
+}
+
+//Drops the reads that have not started and waits for the others; results already
+//queued are ignored through the generation
+void ViewportPager::CancelLoads()
+{
+    pool.clear();
+    pool.waitForDone();
+    ++generation;
+    for(PageSlot &slot : pageSlots){
+        if(slot.state == PageState::Loading) slot.state = PageState::Unloaded;
+    }
+    queue.clear();
+    inFlight = 0;
+}
+
+void ViewportPager::SetMemoryBudget(qint64 bytes)
+{
+    memoryBudget = bytes;
+    Evict();
+}
+
+qint64 ViewportPager::CostOf(int page) const
+{
+    //the encoded size stands in for what doesn't scale with the shape count,
+    //polyline vertices and block definitions
+    const PagedDocument::Page &entry = document.Pages().at(page);
+    return entry.shapeCount * ShapeCost + entry.bytes;
+}
+
+/*********************** Paging ***********************/
+void ViewportPager::SetViewport(const QRectF &visible)
+{
+    if(!document.IsOpen() || visible.isEmpty() || visible == lastVisible) return;
+    lastVisible = visible;
+    ++tick;
+
+    const qreal marginX = visible.width() * prefetchMargin;
+    const qreal marginY = visible.height() * prefetchMargin;
+    QVector<int> wanted = document.PagesIn(visible.adjusted(-marginX, -marginY, marginX, marginY));
+
+    //nearest first; a zoomed-out view can want more than the budget holds, then
+    //the pages nearest the centre win
+    const QPointF centre = visible.center();
+    std::sort(wanted.begin(), wanted.end(), [this, &centre](int a, int b){
+        return DistanceTo(document.Pages().at(a).bounds, centre) < DistanceTo(document.Pages().at(b).bounds, centre);
+    });
+    qint64 cost = 0;
+    qsizetype kept = 0;
+    for(; kept < wanted.size(); ++kept){
+        cost += CostOf(wanted.at(kept));
+        if(cost > memoryBudget && kept > 0) break;
+    }
+    wanted.resize(kept);
+
+    queue.clear();
+    for(int page : std::as_const(wanted)){
+        PageSlot &slot = pageSlots[page];
+        slot.lastWanted = tick;
+        if(slot.state == PageState::Unloaded) queue.append(page);
+    }
+    Evict();
+    Pump();
+}
+
+void ViewportPager::Pump()
+{
+    while(inFlight < MaxInFlight && !queue.isEmpty()){
+        const int page = queue.takeFirst();
+        PageSlot &slot = pageSlots[page];
+        if(slot.state != PageState::Unloaded) continue;
+        slot.state = PageState::Loading;
+        ++inFlight;
+
+        const quint64 requested = generation;
+        pool.start([this, requested, page]{
+            CAD_PROFILE_SCOPE("ReadPage");
+            //a page that fails to decode is installed empty rather than retried forever
+            QVector<ShapeData> shapes;
+            if(!document.ReadPage(page, shapes)) shapes.clear();
+            QMetaObject::invokeMethod(this, [this, requested, page, shapes]{ Install(requested, page, shapes); },
+                                      Qt::QueuedConnection);
+        });
+    }
+}
+
+void ViewportPager::Install(quint64 requested, int page, const QVector<ShapeData> &shapes)
+{
+    if(requested != generation) return; // cancelled meanwhile
+    CAD_PROFILE_SCOPE("InstallPage");
+    --inFlight;
+
+    PageSlot &slot = pageSlots[page];
+    slot.state = PageState::Loaded;
+    slot.items.reserve(shapes.size());
+    index->BeginBatch();
+    for(const ShapeData &shape : shapes){
+        QGraphicsItem *item = ShapeSerializer::CreateItem(shape, scene->Store());
+        scene->addItem(item);
+        index->Insert(item);
+        slot.items.append(item);
+        pageOfItem.insert(item, page);
+    }
+    index->EndBatch();
+    ++loadedPages;
+    memoryUsed += CostOf(page);
+
+    //a page the view has left meanwhile is kept like any other and aged out by Evict
+    Evict();
+    Pump();
+    emit pagesLoaded();
+}
+
+void ViewportPager::Pin(const QVector<QGraphicsItem *> &items)
+{
+    for(QGraphicsItem *item : items){
+        const auto it = pageOfItem.constFind(item);
+        if(it != pageOfItem.constEnd()) pageSlots[it.value()].pinned = true;
+    }
+}
+
+//Least recently wanted first, never a page the current view wants or a pinned one
+void ViewportPager::Evict()
+{
+    if(memoryUsed <= memoryBudget) return;
+
+    std::vector<std::pair<quint64, int>> order;
+    for(int page = 0; page < pageSlots.size(); ++page){
+        const PageSlot &slot = pageSlots.at(page);
+        if(slot.state == PageState::Loaded && !slot.pinned && slot.lastWanted != tick){
+            order.push_back({ slot.lastWanted, page });
+        }
+    }
+    std::sort(order.begin(), order.end());
+
+    for(const auto &entry : order){
+        if(memoryUsed <= memoryBudget) break;
+        Unload(entry.second);
+    }
+}
+
+void ViewportPager::Unload(int page)
+{
+    CAD_PROFILE_SCOPE("UnloadPage");
+    PageSlot &slot = pageSlots[page];
+    emit itemsEvicting(slot.items);
+
+    index->BeginBatch();
+    for(QGraphicsItem *item : std::as_const(slot.items)) index->Remove(item);
+    index->EndBatch();
+    //only unpinned pages get here, so no command holds these and all are in the scene
+    for(QGraphicsItem *item : std::as_const(slot.items)){
+        pageOfItem.remove(item);
+        delete item;
+    }
+    slot.items = QVector<QGraphicsItem *>();
+    slot.state = PageState::Unloaded;
+    --loadedPages;
+    memoryUsed -= CostOf(page);
+}
+
+QVector<QRectF> ViewportPager::UnloadedIn(const QRectF &rect, int limit) const
+{
+    QVector<QRectF> bounds;
+    if(!IsOpen()) return bounds;
+    for(int page : document.PagesIn(rect)){
+        if(bounds.size() >= limit) break;
+        if(pageSlots.at(page).state != PageState::Loaded) bounds.append(document.Pages().at(page).bounds);
+    }
+    return bounds;
+}
+
+/*********************** Whole Drawing ***********************/
+QVector<ShapeData> ViewportPager::Shapes() const
+{
+    //a loaded page's shapes are in the store, edits included, the others only on disk
+    QVector<ShapeData> shapes;
+    shapes.reserve(document.ShapeCount());
+    QVector<ShapeData> page;
+    for(int i = 0; i < pageSlots.size(); ++i){
+        if(pageSlots.at(i).state == PageState::Loaded || !document.ReadPage(i, page)) continue;
+        shapes.append(page);
+    }
+    scene->Store()->ForEachActive([&shapes](const ShapeData &shape){ shapes.append(shape); });
+    return shapes;
+}
+
+bool ViewportPager::Save(const QString &filePath, const QVector<Layer> &layers, double pageSize)
+{
+    if(!IsOpen()) return false;
+    CAD_PROFILE_SCOPE("SavePaged");
+    CancelLoads(); // the readers share the mapping that is dropped below
+    const QRectF visible = lastVisible;
+    lastVisible = QRectF();
+
+    //written page by page, the drawing is never held in memory as a whole
+    PagedDocumentWriter writer(filePath, pageSize);
+    bool written = writer.Open();
+    QVector<ShapeData> page;
+    for(int i = 0; written && i < pageSlots.size(); ++i){
+        if(pageSlots.at(i).state == PageState::Loaded) continue;
+        written = document.ReadPage(i, page);
+        for(const ShapeData &shape : std::as_const(page)) writer.Add(shape);
+    }
+    scene->Store()->ForEachActive([&writer](const ShapeData &shape){ writer.Add(shape); });
+    writer.SetLayers(layers);
+
+    //a mapped file can't be replaced on Windows, and filePath may be the open one
+    const QString current = document.FilePath();
+    document.Close();
+    if(written && writer.Finish()) return Open(filePath);
+
+    //nothing on disk changed, so the pages line up with the loaded items again
+    if(!document.Open(current)){
+        Close();
+        return false;
+    }
+    SetViewport(visible);
+    return false;
+}
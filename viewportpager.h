@@ -0,0 +1,111 @@
+#ifndef VIEWPORTPAGER_H
+#define VIEWPORTPAGER_H
+
+#include <QObject>
+#include <QGraphicsItem>
+#include <QHash>
+#include <QRectF>
+#include <QThreadPool>
+#include <QVector>
+#include "pageddocument.h"
+#include "shapescene.h"
+#include "spatialindex.h"
+
+//Keeps the part of a PagedDocument around the viewport loaded as scene items.
+//
+//Pages touching the visible rect grown by the prefetch margin are decoded on a
+//thread pool, nearest to the centre of the view first, and handed back to the GUI
+//thread to become items in the scene and the SpatialIndex. Once the loaded pages
+//cost more than the memory budget, the least recently wanted ones are evicted:
+//their items are taken out of the index and deleted. Pages whose items something
+//else refers to (undo commands, a drag) are pinned and stay until the document is
+//closed, so an edited page is never dropped before it is saved. Shapes added while
+//paging belong to no page and always stay loaded.
+class ViewportPager : public QObject
+{
+    Q_OBJECT
+
+public:
+    static constexpr qint64 DefaultMemoryBudget = 256ll * 1024 * 1024;
+    static constexpr qreal DefaultPrefetchMargin = 0.5; // of the viewport size, on every side
+
+    ViewportPager(ShapeScene *scene, SpatialIndex *index, QObject *parent = nullptr);
+    ~ViewportPager();
+
+    //loads nothing until the first SetViewport
+    bool Open(const QString &filePath);
+    //clears the scene and the index, the drawing was the document
+    void Close();
+    bool IsOpen() const { return open; }
+    const PagedDocument &Document() const { return document; }
+
+    void SetMemoryBudget(qint64 bytes);
+    qint64 MemoryBudget() const { return memoryBudget; }
+    qint64 MemoryUsed() const { return memoryUsed; }
+    void SetPrefetchMargin(qreal fraction) { prefetchMargin = qMax<qreal>(0, fraction); }
+
+    //scene rect the view shows, requests the pages around it and evicts over budget
+    void SetViewport(const QRectF &visible);
+    void Pin(const QVector<QGraphicsItem *> &items);
+
+    int LoadedPages() const { return loadedPages; }
+    int PendingPages() const { return inFlight + int(queue.size()); }
+    //bounds of the pages touching rect that are not loaded yet, at most limit of them
+    QVector<QRectF> UnloadedIn(const QRectF &rect, int limit) const;
+
+    //every shape of the drawing: unloaded pages from the file, the rest from the scene
+    QVector<ShapeData> Shapes() const;
+    //writes the drawing to filePath and reopens it from there with nothing loaded,
+    //which closes the current one; on failure the current one stays open as it was
+    bool Save(const QString &filePath, const QVector<Layer> &layers, double pageSize = PagedDocument::DefaultPageSize);
+
+signals:
+    void pagesLoaded();
+    //sent before Close deletes every item, holders of pointers to them (undo
+    //commands among them) must drop them
+    void closing();
+    //sent before the items are deleted, holders of pointers to them must drop them
+    void itemsEvicting(const QVector<QGraphicsItem *> &items);
+
+private:
+    enum class PageState { Unloaded, Loading, Loaded };
+
+    struct PageSlot{
+        PageState state = PageState::Unloaded;
+        QVector<QGraphicsItem *> items;
+        quint64 lastWanted = 0;
+        bool pinned = false;
+    };
+
+    //items, store rows and index entries of a loaded shape, an estimate
+    static constexpr qint64 ShapeCost = 400;
+    //decode requests handed to the pool at once, so a fast pan doesn't queue up
+    //pages it has already left behind
+    static constexpr int MaxInFlight = 4;
+
+    ShapeScene *scene;
+    SpatialIndex *index;
+    PagedDocument document;
+    bool open = false; // stays set while Save has the document's mapping dropped
+    QVector<PageSlot> pageSlots;
+    QHash<QGraphicsItem *, int> pageOfItem;
+    QVector<int> queue;   // wanted pages not requested yet, nearest first
+    QThreadPool pool;
+    quint64 generation = 0; // bumped on close, results for an older one are dropped
+    quint64 tick = 0;
+    QRectF lastVisible;
+    qint64 memoryBudget = DefaultMemoryBudget;
+    qint64 memoryUsed = 0;
+    qreal prefetchMargin = DefaultPrefetchMargin;
+    int inFlight = 0;
+    int loadedPages = 0;
+
+    qint64 CostOf(int page) const;
+    void CancelLoads();
+    void Pump();
+    void Install(quint64 generation, int page, const QVector<ShapeData> &shapes);
+    void Evict();
+    void Unload(int page);
+};
+
+#endif // VIEWPORTPAGER_H
@@ -0,0 +1,121 @@
+#include "workstealingpool.h"
+#include <QThread>
+
+namespace {
+
+//lets Submit() see which worker (if any) of which pool it is running on
+thread_local const WorkStealingPool *currentPool = nullptr;
+thread_local int currentWorker = -1;
+
+}
+
+WorkStealingPool::WorkStealingPool(int threadCount)
+{
+    if(threadCount <= 0) threadCount = qMax(1, QThread::idealThreadCount());
+
+    workers.reserve(threadCount);
+    for(int i = 0; i < threadCount; ++i) workers.push_back(std::make_unique<Worker>());
+    threads.reserve(threadCount);
+    for(int i = 0; i < threadCount; ++i) threads.emplace_back([this, i]{ Run(i); });
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(std::thread &thread : threads) thread.join();
+}
+
+/*********************** Submitting ***********************/
+void WorkStealingPool::Submit(Task task)
+{
+    //a task spawned by a worker stays on that worker, others are dealt round-robin
+    const bool fromWorker = currentPool == this;
+    const int index = fromWorker ? currentWorker
+                                 : int(nextWorker.fetch_add(1, std::memory_order_relaxed) % workers.size());
+    {
+        //subtasks go in front so their spawner picks them up next, outside tasks
+        //queue behind so each worker runs them in submission order
+        Worker &worker = *workers[index];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if(fromWorker) worker.tasks.push_front(std::move(task));
+        else worker.tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        ++queued;
+        ++outstanding;
+    }
+    wake.notify_one();
+}
+
+void WorkStealingPool::Wait()
+{
+    //called from a worker this would wait on itself
+    Q_ASSERT(currentPool != this);
+    std::unique_lock<std::mutex> lock(stateMutex);
+    idle.wait(lock, [this]{ return outstanding == 0; });
+}
+
+void WorkStealingPool::ParallelFor(qsizetype count, qsizetype grain, const std::function<void(qsizetype)> &body)
+{
+    grain = qMax<qsizetype>(1, grain);
+    for(qsizetype begin = 0; begin < count; begin += grain){
+        const qsizetype end = qMin(count, begin + grain);
+        Submit([&body, begin, end]{
+            for(qsizetype i = begin; i < end; ++i) body(i);
+        });
+    }
+    Wait();
+}
+
+/*********************** Workers ***********************/
+//own deque from the front, other deques from the back
+bool WorkStealingPool::TryPop(int index, Task &task)
+{
+    {
+        Worker &own = *workers[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if(!own.tasks.empty()){
+            task = std::move(own.tasks.front());
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+    const int count = int(workers.size());
+    for(int offset = 1; offset < count; ++offset){
+        Worker &victim = *workers[(index + offset) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(!victim.tasks.empty()){
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::Run(int index)
+{
+    currentPool = this;
+    currentWorker = index;
+
+    for(;;){
+        {
+            std::unique_lock<std::mutex> lock(stateMutex);
+            wake.wait(lock, [this]{ return stopping || queued > 0; });
+            if(queued == 0) return; // stopping with nothing left to do
+            --queued; // claims one task, so one is guaranteed to be in some deque
+        }
+
+        Task task;
+        while(!TryPop(index, task)) std::this_thread::yield();
+        task();
+
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if(--outstanding == 0) idle.notify_all();
+    }
+}
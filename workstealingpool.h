@@ -0,0 +1,64 @@
+#ifndef WORKSTEALINGPOOL_H
+#define WORKSTEALINGPOOL_H
+
+#include <QtGlobal>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Fixed set of worker threads, each with its own task deque.
+//
+//A worker takes tasks from the front of its own deque and, when that runs dry,
+//steals from the back of another worker's. Subtasks a worker spawns go to the front
+//of its deque (run next, while their data is still in cache); tasks submitted from
+//outside the pool are dealt round-robin to the back, so submission order is kept. Unlike
+//QThreadPool's single shared queue, uneven task sizes (a 5 MB drawing next to a
+//5 KB one) don't leave threads idle behind one long queue lock.
+class WorkStealingPool
+{
+public:
+    using Task = std::function<void()>;
+
+    //threadCount <= 0 uses one worker per core
+    explicit WorkStealingPool(int threadCount = 0);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    void Submit(Task task);
+    //blocks until every submitted task has finished
+    void Wait();
+
+    //runs body(i) for i in [0, count) in chunks of grain and waits for all of them
+    void ParallelFor(qsizetype count, qsizetype grain, const std::function<void(qsizetype)> &body);
+
+    int ThreadCount() const { return int(workers.size()); }
+
+private:
+    struct Worker{
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::atomic<quint64> nextWorker{ 0 };
+
+    std::mutex stateMutex;
+    std::condition_variable wake;     // workers wait here for tasks
+    std::condition_variable idle;     // Wait() waits here for outstanding == 0
+    qsizetype queued = 0;             // tasks sitting in deques, guarded by stateMutex
+    qsizetype outstanding = 0;        // queued plus running, guarded by stateMutex
+    bool stopping = false;
+
+    void Run(int index);
+    bool TryPop(int index, Task &task);
+};
+
+#endif // WORKSTEALINGPOOL_H